@@ -65,6 +65,10 @@ lively_audio_backend_new (lively_audio_config_t *config) {
 	backend->capture_hw_params = NULL;
 	backend->capture_sw_params = NULL;
 
+	backend->avail_min_capture = 0;
+	backend->avail_min_playback = 0;
+	backend->xruns = 0;
+
 	backend->poll_timeout = 0;
 	backend->poll_fds = NULL;
 	backend->poll_fds_count_capture = 0;
@@ -383,6 +387,7 @@ lively_audio_backend_wait (lively_audio_backend_t *backend) {
 	}
 
 	if (xrun) {
+		backend->xruns++;
 		log_error (backend, "Detected xrun");
 		// TODO: Recover
 	}
@@ -390,11 +395,98 @@ lively_audio_backend_wait (lively_audio_backend_t *backend) {
 	return true;
 }
 
+/**
+* Estimates when the current period became available.
+*
+* The driver timestamps its last hardware pointer update together with the
+* frames available at that moment; stepping back by the frames beyond the
+* wakeup threshold gives the time at which poll() should have returned.
+*/
+bool
+lively_audio_backend_get_period_due (lively_audio_backend_t *backend, double *due) {
+	lively_audio_config_t *config = backend->config;
+	snd_pcm_t *handle;
+	snd_pcm_uframes_t avail_min;
+	snd_pcm_uframes_t avail;
+	snd_htimestamp_t tstamp;
+
+	if (config->stream & AUDIO_CAPTURE) {
+		handle = backend->capture;
+		avail_min = backend->avail_min_capture;
+	} else if (config->stream & AUDIO_PLAYBACK) {
+		handle = backend->playback;
+		avail_min = backend->avail_min_playback;
+	} else {
+		return false;
+	}
+
+	if (snd_pcm_htimestamp (handle, &avail, &tstamp) < 0) {
+		return false;
+	}
+	if (tstamp.tv_sec == 0 && tstamp.tv_nsec == 0) {
+		return false;
+	}
+
+	*due = tstamp.tv_sec + tstamp.tv_nsec * 1e-9;
+	if (avail > avail_min) {
+		*due -= (double) (avail - avail_min) / config->frames_per_second;
+	}
+
+	return true;
+}
+
+unsigned long
+lively_audio_backend_get_xruns (lively_audio_backend_t *backend) {
+	return backend->xruns;
+}
+
 bool
 lively_audio_backend_read (
 	lively_audio_backend_t *backend,
 	lively_audio_block_t *block) {
 
+	audio_mmap_t info;
+
+	if (!(backend->config->stream & AUDIO_CAPTURE)) {
+		return true;
+	}
+
+	unsigned int frames_length = block->frames;
+	unsigned int frames_start = 0;
+
+	while (frames_start < frames_length) {
+
+		unsigned int frames_left = frames_length - frames_start;
+
+		if (!audio_mmap_init (backend, AUDIO_CAPTURE, frames_left, &info)) {
+			return false;
+		}
+
+		for (unsigned int channel = 0; channel < block->num_in; channel++) {
+			const snd_pcm_channel_area_t *area = &(info.areas[channel]);
+			char *data_in = (char *) area->addr + (area->first + info.offset * area->step) / 8;
+			float *data_out = block->in[channel].data + frames_start;
+
+			backend->sample_read (
+				data_out,
+				data_in,
+				info.frames,
+				area->step / 8);
+		}
+
+		if (!audio_mmap_finish (backend, AUDIO_CAPTURE, &info)) {
+			return false;
+		}
+
+		frames_start += info.frames;
+	}
+
+	// Channels have been read, mark all as ready
+	for (unsigned int i = 0; i < block->num_in; i++) {
+		block->in[i].ready = true;
+	}
+	block->avail_in = frames_length;
+
 	return true;
 }
 
@@ -419,16 +511,16 @@ lively_audio_backend_write (
 		for (unsigned int channel = 0; channel < block->num_out; channel++) {
 			const snd_pcm_channel_area_t *area = &(info.areas[channel]);
 			char *data_out = (char *) area->addr + (area->first + info.offset * area->step) / 8;
-			float *data_in = block->out[channel].data;
+			float *data_in = block->out[channel].data + frames_start;
 
 			if (!block->out[channel].ready) {
-				data_in = block->silence;
+				data_in = block->silence + frames_start;
 			}
 
 			backend->sample_write (
 				data_out,
 				data_in,
-				frames_left,
+				info.frames,
 				area->step / 8);
 		}
 
@@ -763,9 +855,11 @@ static bool audio_configure_stream (
 	snd_pcm_uframes_t avail_min;
 	if (stream == AUDIO_CAPTURE) {
 		avail_min = config->frames_per_period;
+		backend->avail_min_capture = avail_min;
 	} else {
 		avail_min = config->frames_per_period * 
 			(*periods_per_buffer - config->periods_per_buffer + 1);
+		backend->avail_min_playback = avail_min;
 	}
 	err = snd_pcm_sw_params_set_avail_min (handle, sw, avail_min);
 	if (err < 0) {
@@ -774,6 +868,19 @@ static bool audio_configure_stream (
 		return false;
 	}
 
+	// Timestamps let us measure how late the audio thread wakes up.
+	err = snd_pcm_sw_params_set_tstamp_mode (handle, sw, SND_PCM_TSTAMP_ENABLE);
+	if (err < 0) {
+		log_warn (backend,
+			"%s stream: Could not enable timestamps", name);
+	}
+	err = snd_pcm_sw_params_set_tstamp_type (handle, sw,
+		SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	if (err < 0) {
+		log_warn (backend,
+			"%s stream: Could not use monotonic timestamps", name);
+	}
+
 	err = snd_pcm_sw_params (handle, sw);
 	if (err < 0) {
 		log_error (backend,
@@ -26,6 +26,10 @@ typedef struct lively_audio_backend {
 	sample_read_func_t sample_read;
 	sample_write_func_t sample_write;
 
+	snd_pcm_uframes_t avail_min_capture;
+	snd_pcm_uframes_t avail_min_playback;
+	unsigned long xruns;
+
 	int poll_timeout;
 	struct pollfd* poll_fds;
 	unsigned int poll_fds_count_playback;
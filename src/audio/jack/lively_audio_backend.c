@@ -1,6 +1,12 @@
 /**
  * @file lively_audio.c
  * Lively Audio: Manages audio interface with driver
+ *
+ * Unsupported: this backend predates #lively_audio_backend_t. It runs the
+ * scene directly at the period of the JACK server rather than through
+ * #lively_audio_quantum, so the scene does not see blocks of
+ * #LIVELY_QUANTUM frames, and it does not build against the current
+ * audio thread.
  */
 
 #include <stdlib.h>
@@ -0,0 +1,195 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "../../lively_audio_backend.h"
+#include "../../lively_audio_config.h"
+#include "../../platform.h"
+
+#include "lively_audio_backend_offline.h"
+
+#define log(backend, type, ...) do { \
+	if (backend->logger) { \
+		backend->logger (backend->logger_data, type, __VA_ARGS__); \
+	} \
+} while (0)
+#define log_error(backend, ...) log(backend, LIVELY_ERROR, __VA_ARGS__)
+#define log_info(backend, ...) log(backend, LIVELY_INFO, __VA_ARGS__)
+
+#define OFFLINE_PI 3.14159265358979323846
+
+/** Default channel count when the configuration leaves it open */
+#define OFFLINE_CHANNELS 2
+
+const char *
+lively_audio_backend_name (lively_audio_backend_t *backend) {
+	return "offline";
+}
+
+lively_audio_backend_t *
+lively_audio_backend_new (lively_audio_config_t *config) {
+	lively_audio_backend_t *backend = malloc (sizeof *backend);
+	if (!backend) {
+		return NULL;
+	}
+
+	backend->config = config;
+
+	backend->period = 0.0;
+	backend->due = 0.0;
+	backend->xruns = 0;
+	backend->frames = 0;
+
+	backend->connected = false;
+
+	backend->logger = NULL;
+	backend->logger_data = NULL;
+
+	return backend;
+}
+
+void
+lively_audio_backend_delete (lively_audio_backend_t **backend_ptr) {
+	if (!backend_ptr)
+		return;
+	if (!*backend_ptr)
+		return;
+
+	lively_audio_backend_disconnect (*backend_ptr);
+
+	free (*backend_ptr);
+	*backend_ptr = NULL;
+}
+
+void
+lively_audio_backend_set_logger (
+	lively_audio_backend_t *backend,
+	lively_audio_backend_logger_callback_t callback,
+	void *data) {
+
+	backend->logger = callback;
+	backend->logger_data = data;
+}
+
+bool
+lively_audio_backend_connect (lively_audio_backend_t *backend) {
+	lively_audio_config_t *config = backend->config;
+
+	if (config->frames_per_second == 0 || config->frames_per_period == 0) {
+		log_error (backend, "Invalid rate or period size");
+		return false;
+	}
+
+	if (config->channels_in == 0) {
+		config->channels_in = OFFLINE_CHANNELS;
+	}
+	if (config->channels_out == 0) {
+		config->channels_out = OFFLINE_CHANNELS;
+	}
+	config->periods_per_buffer_in = config->periods_per_buffer;
+	config->periods_per_buffer_out = config->periods_per_buffer;
+
+	backend->period = (double) config->frames_per_period / config->frames_per_second;
+	backend->connected = true;
+
+	log_info (backend, "Offline: %u Hz, %u frames per period, %u in, %u out",
+		config->frames_per_second, config->frames_per_period,
+		config->channels_in, config->channels_out);
+
+	return true;
+}
+
+bool
+lively_audio_backend_disconnect (lively_audio_backend_t *backend) {
+	if (!backend->connected) {
+		return false;
+	}
+
+	backend->connected = false;
+	return true;
+}
+
+bool
+lively_audio_backend_start (lively_audio_backend_t *backend, lively_audio_block_t *block) {
+	backend->xruns = 0;
+	backend->frames = 0;
+	backend->due = platform_time () + backend->period;
+	return true;
+}
+
+bool
+lively_audio_backend_stop (lively_audio_backend_t *backend) {
+	return true;
+}
+
+/**
+* Sleeps until the next period is due.
+*
+* If we wake up so late that a device would have drained its whole playback
+* buffer, the period is counted as an xrun and the clock is resynchronized.
+*/
+bool
+lively_audio_backend_wait (lively_audio_backend_t *backend) {
+	lively_audio_config_t *config = backend->config;
+	double slack = backend->period * (config->periods_per_buffer - 1);
+
+	platform_sleep_until (backend->due);
+
+	double now = platform_time ();
+	if (now - backend->due > slack) {
+		backend->xruns++;
+		log_error (backend, "Detected xrun");
+		backend->due = now;
+	}
+
+	return true;
+}
+
+bool
+lively_audio_backend_get_period_due (lively_audio_backend_t *backend, double *due) {
+	*due = backend->due;
+	return true;
+}
+
+unsigned long
+lively_audio_backend_get_xruns (lively_audio_backend_t *backend) {
+	return backend->xruns;
+}
+
+bool
+lively_audio_backend_read (
+	lively_audio_backend_t *backend,
+	lively_audio_block_t *block) {
+
+	lively_audio_config_t *config = backend->config;
+
+	// A quiet tone, a semitone apart on each channel.
+	for (unsigned int channel = 0; channel < block->num_in; channel++) {
+		float *data = block->in[channel].data;
+		double frequency = 440.0 * pow (2.0, channel / 12.0);
+		double step = 2.0 * OFFLINE_PI * frequency / config->frames_per_second;
+
+		for (unsigned int i = 0; i < block->frames; i++) {
+			data[i] = 0.1f * (float) sin (step * (backend->frames + i));
+		}
+		block->in[channel].ready = true;
+	}
+
+	backend->frames += block->frames;
+	return true;
+}
+
+bool
+lively_audio_backend_write (
+	lively_audio_backend_t *backend,
+	lively_audio_block_t *block) {
+
+	// Playback is discarded; the next period becomes due.
+	backend->due += backend->period;
+
+	for (unsigned int i = 0; i < block->num_out; i++) {
+		block->out[i].ready = false;
+	}
+
+	return true;
+}
@@ -0,0 +1,28 @@
+#ifndef OFFLINE_AUDIO_H
+#define OFFLINE_AUDIO_H
+
+#include "../../lively_audio_backend.h"
+
+/**
+ * An audio backend without a device.
+ *
+ * Periods are paced by the monotonic clock as if a device with the configured
+ * rate and period size were attached. Capture channels carry a quiet test
+ * tone and playback is discarded. A period is counted as an xrun when the
+ * audio thread wakes up later than the playback buffer could have covered.
+ */
+typedef struct lively_audio_backend {
+	lively_audio_config_t *config;
+
+	double period;
+	double due;
+	unsigned long xruns;
+	unsigned long long frames;
+
+	bool connected;
+
+	lively_audio_backend_logger_callback_t logger;
+	void *logger_data;
+} lively_audio_backend_t;
+
+#endif
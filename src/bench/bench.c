@@ -0,0 +1,29 @@
+/**
+ * @file bench.c
+ * Helpers shared by the benchmarks. They time themselves with
+ * #platform_time.
+ */
+
+#include "bench.h"
+
+/**
+* Returns the next 32 random bits of an xorshift32 generator, whose state
+* must not be 0.
+*/
+uint32_t
+bench_random_bits (uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/**
+* Returns the next random sample, between -1 and 1.
+*/
+float
+bench_random (uint32_t *state) {
+	return (float) bench_random_bits (state) / UINT32_MAX * 2.0f - 1.0f;
+}
@@ -0,0 +1,15 @@
+#ifndef LIVELY_BENCH_H
+#define LIVELY_BENCH_H
+
+#include <stdint.h>
+
+#define BENCH_PI 3.14159265358979323846
+/** Largest error relative to the output which counts as correct */
+#define BENCH_TOLERANCE 1e-5
+
+#define countof(array) (sizeof (array) / sizeof *(array))
+
+uint32_t bench_random_bits (uint32_t *state);
+float bench_random (uint32_t *state);
+
+#endif
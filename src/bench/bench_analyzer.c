@@ -0,0 +1,210 @@
+/**
+ * @file bench_analyzer.c
+ * Benchmarks the analyzer node.
+ *
+ * The node is first checked with a 1 kHz sine of amplitude 0.5, whose
+ * power, summed over the bins, must read 6.02 dB below a full-scale sine,
+ * and with white noise, whose bins are wide enough to sum several
+ * frequencies of the transform and must rise 3 dB per octave. Then the
+ * audio thread's part of the node is timed per block of #LIVELY_QUANTUM
+ * frames, and the analysis thread's part per spectrum, each for many
+ * channels.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+#include "../nodes/lively_node_analyzer.h"
+#include "../platform.h"
+
+#define BENCH_RATE 48000
+#define BENCH_SIZE 4096
+/** Largest error of the level of the sine, in dB */
+#define BENCH_LEVEL_TOLERANCE 0.05
+/** Largest error of the slope of the noise, in dB per octave */
+#define BENCH_SLOPE_TOLERANCE 0.1
+/** Spectra averaged together for the noise */
+#define BENCH_SPECTRA 400
+/** Lowest frequency of the bins fitted for the noise, in Hz */
+#define BENCH_SLOPE_LOW 1000.0
+/** Channels of the timed node */
+#define BENCH_CHANNELS 64
+
+/**
+* Sets up an analyzer node at the bench's rate, making spectra of
+* #BENCH_SIZE frames.
+*/
+static bool
+bench_analyzer_init (lively_node_analyzer_t *analyzer, unsigned int channels, float averaging) {
+	lively_node_t *node = (lively_node_t *) analyzer;
+
+	if (!lively_node_analyzer_init (analyzer, channels)) {
+		return false;
+	}
+	lively_node_set_param (node, LIVELY_ANALYZER_SIZE, (float) BENCH_SIZE);
+	lively_node_set_param (node, LIVELY_ANALYZER_AVERAGING, averaging);
+	node->sample_rate = BENCH_RATE;
+	if (!node->set_buffer_length (node, LIVELY_QUANTUM)) {
+		lively_node_analyzer_destroy (node);
+		return false;
+	}
+	return true;
+}
+
+/**
+* Runs a transform's worth of frames through the first channel of a node,
+* and makes a spectrum of them as the analysis thread would.
+*/
+static const lively_analyzer_spectrum_t *
+bench_spectrum (lively_node_analyzer_t *analyzer, unsigned long *frame, bool noise, uint32_t *seed) {
+	lively_node_t *node = (lively_node_t *) analyzer;
+	float *buffer = node->get_write_buffer (node, LIVELY_CHANNEL (0));
+
+	for (unsigned int block = 0; block < BENCH_SIZE / LIVELY_QUANTUM; block++) {
+		for (unsigned int i = 0; i < LIVELY_QUANTUM; i++, (*frame)++) {
+			// Reduced to a period first, so that the phase stays exact.
+			buffer[i] = noise ? bench_random (seed)
+				: (float) (0.5 * sin (2.0 * BENCH_PI * (*frame * 1000 % BENCH_RATE) / BENCH_RATE));
+		}
+		node->process (node, LIVELY_QUANTUM);
+	}
+	analyzer->task.run (&analyzer->task);
+	return lively_node_analyzer_read (analyzer);
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-t milliseconds]\n"
+		"\n"
+		"  -t milliseconds  Minimum time per measurement (default 200)\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	double min_seconds = 0.200;
+	bool failed = false;
+	uint32_t seed = 1;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	lively_node_analyzer_t analyzer;
+	lively_node_t *node = (lively_node_t *) &analyzer;
+	const lively_analyzer_spectrum_t *spectrum;
+	unsigned long frame = 0;
+
+	if (!bench_analyzer_init (&analyzer, 1, 0.0f)) {
+		fprintf (stderr, "Could not set up an analyzer\n");
+		return 1;
+	}
+	spectrum = bench_spectrum (&analyzer, &frame, false, &seed);
+	double power = 0.0, peak = LIVELY_ANALYZER_FLOOR, peak_frequency = 0.0;
+	for (unsigned int b = 0; b < spectrum->bins; b++) {
+		power += pow (10.0, spectrum->level[b] / 10.0);
+		if (spectrum->level[b] > peak) {
+			peak = spectrum->level[b];
+			peak_frequency = spectrum->frequency[b];
+		}
+	}
+	double level = 10.0 * log10 (power), expected = 20.0 * log10 (0.5);
+	if (fabs (level - expected) > BENCH_LEVEL_TOLERANCE) {
+		failed = true;
+	}
+	printf ("%-24s %9s %9s\n", "check", "expected", "measured");
+	printf ("%-24s %9.2f %9.2f\n", "sine, dB", expected, level);
+	printf ("%-24s %9s %9.2f  (%.0f Hz)\n", "  loudest bin, dB", "", peak, peak_frequency);
+	lively_node_analyzer_destroy (node);
+
+	// A least squares fit of level against octaves, over the bins which sum
+	// whole frequencies of the transform rather than interpolate between them.
+	if (!bench_analyzer_init (&analyzer, 1, 10000.0f)) {
+		fprintf (stderr, "Could not set up an analyzer\n");
+		return 1;
+	}
+	for (unsigned int s = 0; s < BENCH_SPECTRA; s++) {
+		spectrum = bench_spectrum (&analyzer, &frame, true, &seed);
+	}
+	double n = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	for (unsigned int b = 0; b < spectrum->bins; b++) {
+		if (spectrum->frequency[b] < BENCH_SLOPE_LOW) {
+			continue;
+		}
+		double x = log2 (spectrum->frequency[b]), y = spectrum->level[b];
+		n += 1.0;
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+	expected = 10.0 * log10 (2.0);
+	if (fabs (slope - expected) > BENCH_SLOPE_TOLERANCE) {
+		failed = true;
+	}
+	printf ("%-24s %9.2f %9.2f\n", "noise, dB/octave", expected, slope);
+	lively_node_analyzer_destroy (node);
+
+	if (!bench_analyzer_init (&analyzer, BENCH_CHANNELS, 300.0f)) {
+		fprintf (stderr, "Could not set up an analyzer\n");
+		return 1;
+	}
+	for (unsigned int ch = 0; ch < BENCH_CHANNELS; ch++) {
+		float *buffer = node->get_write_buffer (node, LIVELY_CHANNEL (ch));
+		for (unsigned int i = 0; i < LIVELY_QUANTUM; i++) {
+			buffer[i] = bench_random (&seed);
+		}
+	}
+
+	unsigned long long blocks = 0;
+	double start = platform_time (), elapsed;
+	do {
+		for (unsigned int block = 0; block < 64; block++) {
+			node->process (node, LIVELY_QUANTUM);
+		}
+		blocks += 64;
+		elapsed = platform_time () - start;
+	} while (elapsed < min_seconds);
+	double audio = elapsed / blocks;
+
+	// Each spectrum needs frames the last one did not have.
+	unsigned long long spectra = 0;
+	double analysis = 0.0;
+	do {
+		node->process (node, LIVELY_QUANTUM);
+		start = platform_time ();
+		analyzer.task.run (&analyzer.task);
+		analysis += platform_time () - start;
+		spectra++;
+	} while (analysis < min_seconds);
+	lively_node_analyzer_read (&analyzer);
+
+	printf ("\n%8s %5s %15s %12s\n", "channels", "size", "audio us/block", "spectrum ms");
+	printf ("%8u %5u %15.3f %12.3f\n", BENCH_CHANNELS, BENCH_SIZE,
+		audio * 1e6, analysis / spectra * 1e3);
+	lively_node_analyzer_destroy (node);
+
+	if (failed) {
+		printf ("spectra are wrong\n");
+	}
+	return failed ? 1 : 0;
+}
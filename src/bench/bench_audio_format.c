@@ -0,0 +1,388 @@
+/**
+ * @file bench_audio_format.c
+ * Microbenchmarks for the ALSA sample format converters.
+ *
+ * Every sample_read_* and sample_write_* converter is timed the way the ALSA
+ * backend calls it: once per channel per period, with a byte stride that
+ * depends on whether the device area is planar or interleaved. Before timing,
+ * each converter pair is checked for a bit-exact round trip.
+ *
+ * Throughput is reported as GB/s of device and float bytes touched, and cost
+ * as nanoseconds and TSC cycles per sample.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#endif
+
+#include "bench.h"
+
+#include "../audio/alsa/audio_format.h"
+#include "../platform.h"
+
+typedef struct bench_format {
+	const char *name;
+	size_t bytes;
+	sample_read_func_t read;
+	sample_write_func_t write;
+	unsigned int significant_bits;
+} bench_format_t;
+
+typedef enum bench_layout {
+	BENCH_PLANAR,
+	BENCH_INTERLEAVED
+} bench_layout_t;
+
+typedef struct bench_result {
+	double seconds;
+	double cycles;
+	unsigned long long samples;
+	unsigned long long bytes;
+} bench_result_t;
+
+static const bench_format_t formats[] = {
+	{"float_le", 4, sample_read_float_le, sample_write_float_le, 32},
+	{"s32_le", 4, sample_read_s32_le, sample_write_s32_le, 24},
+	{"s16_le", 2, sample_read_s16_le, sample_write_s16_le, 16},
+};
+
+static const char *layout_names[] = {
+	[BENCH_PLANAR] = "planar",
+	[BENCH_INTERLEAVED] = "interleaved",
+};
+
+static const unsigned int channel_counts[] = {2, 4, 8, 16, 32, 64, 128};
+static const unsigned int period_sizes[] = {
+	16, 32, 64, 128, 256, 512, 1024, 2048, 4096
+};
+
+static unsigned long long
+bench_cycles (void) {
+#ifdef BENCH_HAVE_TSC
+	return __rdtsc ();
+#else
+	return 0;
+#endif
+}
+
+/**
+* Returns the address of the first sample of a channel within a device area,
+* and stores the byte stride between its samples.
+*/
+static char *
+bench_channel_area (
+	char *device,
+	const bench_format_t *format,
+	bench_layout_t layout,
+	unsigned int channels,
+	unsigned int frames,
+	unsigned int channel,
+	size_t *skip) {
+
+	if (layout == BENCH_PLANAR) {
+		*skip = format->bytes;
+		return device + (size_t) channel * frames * format->bytes;
+	}
+
+	*skip = format->bytes * channels;
+	return device + (size_t) channel * format->bytes;
+}
+
+/**
+* Fills a device area with random samples which the format can represent
+* exactly as floats.
+*/
+static void
+bench_fill_device (
+	char *device,
+	const bench_format_t *format,
+	size_t samples,
+	uint32_t *seed) {
+
+	for (size_t i = 0; i < samples; i++) {
+		uint32_t bits = bench_random_bits (seed);
+
+		if (format->significant_bits < 32) {
+			// Integer formats: keep only the significant high bits.
+			unsigned int shift = format->bytes * 8 - format->significant_bits;
+			bits >>= 32 - format->bytes * 8;
+			bits = (bits >> shift) << shift;
+		} else {
+			// Float formats: a finite sample within [-1, 1].
+			float sample = (float) bits / UINT32_MAX * 2.0f - 1.0f;
+			memcpy (&bits, &sample, sizeof bits);
+		}
+
+		memcpy (device + i * format->bytes, &bits, format->bytes);
+	}
+}
+
+/**
+* Checks that device -> float -> device is bit-exact for every channel of the
+* given layout, and for float formats also float -> device -> float.
+*
+* @return true if the round trip reproduced every bit
+*/
+static bool
+bench_verify (
+	const bench_format_t *format,
+	bench_layout_t layout,
+	unsigned int channels,
+	unsigned int frames,
+	char *device,
+	char *device_copy,
+	float **buffers) {
+
+	size_t device_bytes = (size_t) channels * frames * format->bytes;
+	uint32_t seed = 0x9e3779b9u ^ (channels * 131 + frames);
+
+	bench_fill_device (device, format, (size_t) channels * frames, &seed);
+	memcpy (device_copy, device, device_bytes);
+
+	for (unsigned int c = 0; c < channels; c++) {
+		size_t skip;
+		char *area = bench_channel_area (
+			device, format, layout, channels, frames, c, &skip);
+		format->read (buffers[c], area, frames, skip);
+	}
+	memset (device, 0, device_bytes);
+	for (unsigned int c = 0; c < channels; c++) {
+		size_t skip;
+		char *area = bench_channel_area (
+			device, format, layout, channels, frames, c, &skip);
+		format->write (area, buffers[c], frames, skip);
+	}
+
+	if (memcmp (device, device_copy, device_bytes) != 0) {
+		return false;
+	}
+
+	if (format->significant_bits < 32) {
+		return true;
+	}
+
+	// Floats must also survive the opposite direction untouched.
+	for (unsigned int c = 0; c < channels; c++) {
+		for (unsigned int i = 0; i < frames; i++) {
+			float sample = bench_random (&seed);
+			buffers[c][i] = sample;
+			buffers[channels + c][i] = sample;
+		}
+	}
+	for (unsigned int c = 0; c < channels; c++) {
+		size_t skip;
+		char *area = bench_channel_area (
+			device, format, layout, channels, frames, c, &skip);
+		format->write (area, buffers[c], frames, skip);
+		format->read (buffers[c], area, frames, skip);
+		if (memcmp (buffers[c], buffers[channels + c], frames * sizeof (float))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+* Times one direction of a converter by calling it for every channel of a
+* period, repeating until at least the minimum duration has elapsed.
+*/
+static bench_result_t
+bench_run (
+	const bench_format_t *format,
+	bench_layout_t layout,
+	unsigned int channels,
+	unsigned int frames,
+	bool write,
+	double min_seconds,
+	char *device,
+	float **buffers) {
+
+	bench_result_t result = {0.0, 0.0, 0, 0};
+	unsigned long long repetitions = 1;
+
+	// Touch everything once so that the first timed pass is not a page fault.
+	for (unsigned int c = 0; c < channels; c++) {
+		size_t skip;
+		char *area = bench_channel_area (
+			device, format, layout, channels, frames, c, &skip);
+		format->write (area, buffers[c], frames, skip);
+	}
+
+	for (;;) {
+		double start = platform_time ();
+		unsigned long long start_cycles = bench_cycles ();
+
+		for (unsigned long long r = 0; r < repetitions; r++) {
+			for (unsigned int c = 0; c < channels; c++) {
+				size_t skip;
+				char *area = bench_channel_area (
+					device, format, layout, channels, frames, c, &skip);
+				if (write) {
+					format->write (area, buffers[c], frames, skip);
+				} else {
+					format->read (buffers[c], area, frames, skip);
+				}
+			}
+		}
+
+		double elapsed = platform_time () - start;
+		unsigned long long cycles = bench_cycles () - start_cycles;
+
+		if (elapsed >= min_seconds || repetitions >= (1ull << 40)) {
+			result.seconds = elapsed;
+			result.cycles = (double) cycles;
+			result.samples = repetitions * channels * frames;
+			result.bytes = result.samples * (format->bytes + sizeof (float));
+			return result;
+		}
+
+		// Aim directly for the minimum duration with some headroom.
+		double scale = elapsed > 0.0 ? 1.2 * min_seconds / elapsed : 16.0;
+		if (scale < 2.0) scale = 2.0;
+		if (scale > 1024.0) scale = 1024.0;
+		repetitions = (unsigned long long) (repetitions * scale);
+	}
+}
+
+static void
+bench_print (
+	const bench_format_t *format,
+	bench_layout_t layout,
+	unsigned int channels,
+	unsigned int frames,
+	const char *direction,
+	bench_result_t *result) {
+
+	double gbps = result->bytes / result->seconds * 1e-9;
+	double ns = result->seconds * 1e9 / result->samples;
+
+	printf ("%-9s %-11s %-5s %4u %5u %8.2f %8.3f",
+		format->name, layout_names[layout], direction, channels, frames,
+		gbps, ns);
+#ifdef BENCH_HAVE_TSC
+	printf (" %8.3f", result->cycles / result->samples);
+#else
+	printf (" %8s", "-");
+#endif
+	putchar ('\n');
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-f format] [-c channels] [-p frames] [-t milliseconds]\n"
+		"\n"
+		"  -f format        Only run the named format (float_le, s32_le, s16_le)\n"
+		"  -c channels      Only run this channel count\n"
+		"  -p frames        Only run this period size\n"
+		"  -t milliseconds  Minimum time per measurement (default 20)\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	const char *only_format = NULL;
+	unsigned int only_channels = 0;
+	unsigned int only_frames = 0;
+	double min_seconds = 0.020;
+	bool failed = false;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "f:c:p:t:h")) != -1) {
+		switch (opt) {
+		case 'f': only_format = optarg; break;
+		case 'c': only_channels = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 'p': only_frames = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	unsigned int max_channels = channel_counts[countof (channel_counts) - 1];
+	unsigned int max_frames = period_sizes[countof (period_sizes) - 1];
+	if (only_channels > max_channels) max_channels = only_channels;
+	if (only_frames > max_frames) max_frames = only_frames;
+
+	size_t device_bytes = (size_t) max_channels * max_frames * sizeof (int32_t);
+	char *device = malloc (device_bytes);
+	char *device_copy = malloc (device_bytes);
+
+	// Two float buffers per channel; the second set is used for verification.
+	float **buffers = malloc (2 * max_channels * sizeof *buffers);
+	if (!device || !device_copy || !buffers) {
+		fprintf (stderr, "Could not allocate memory\n");
+		return 1;
+	}
+	for (unsigned int c = 0; c < 2 * max_channels; c++) {
+		buffers[c] = calloc (max_frames, sizeof (float));
+		if (!buffers[c]) {
+			fprintf (stderr, "Could not allocate memory\n");
+			return 1;
+		}
+	}
+
+	printf ("%-9s %-11s %-5s %4s %5s %8s %8s %8s\n",
+		"format", "layout", "dir", "ch", "frames", "GB/s", "ns/smp", "cyc/smp");
+
+	for (size_t f = 0; f < countof (formats); f++) {
+		const bench_format_t *format = &formats[f];
+		if (only_format && strcmp (only_format, format->name) != 0) {
+			continue;
+		}
+
+		for (int l = BENCH_PLANAR; l <= BENCH_INTERLEAVED; l++) {
+			bench_layout_t layout = (bench_layout_t) l;
+
+			for (size_t c = 0; c < countof (channel_counts); c++) {
+				unsigned int channels = only_channels ? only_channels : channel_counts[c];
+
+				for (size_t p = 0; p < countof (period_sizes); p++) {
+					unsigned int frames = only_frames ? only_frames : period_sizes[p];
+					bench_result_t result;
+
+					if (!bench_verify (format, layout, channels, frames,
+						device, device_copy, buffers)) {
+
+						printf ("%-9s %-11s %4u %5u round trip is NOT bit-exact\n",
+							format->name, layout_names[layout], channels, frames);
+						failed = true;
+						continue;
+					}
+
+					result = bench_run (format, layout, channels, frames,
+						false, min_seconds, device, buffers);
+					bench_print (format, layout, channels, frames, "read", &result);
+
+					result = bench_run (format, layout, channels, frames,
+						true, min_seconds, device, buffers);
+					bench_print (format, layout, channels, frames, "write", &result);
+
+					if (only_frames) break;
+				}
+				if (only_channels) break;
+			}
+		}
+	}
+
+	for (unsigned int c = 0; c < 2 * max_channels; c++) {
+		free (buffers[c]);
+	}
+	free (buffers);
+	free (device_copy);
+	free (device);
+
+	return failed ? 1 : 0;
+}
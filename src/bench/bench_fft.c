@@ -0,0 +1,302 @@
+/**
+ * @file bench_fft.c
+ * Benchmarks the FFT against a naive DFT.
+ *
+ * Every size is first checked against a DFT computed in double precision,
+ * for complex and real transforms in both directions. Then the transforms
+ * are timed, and the DFT too for sizes where it finishes in reasonable
+ * time. Errors are reported relative to the largest output magnitude.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../dsp/lively_fft.h"
+#include "../platform.h"
+
+/** Largest size the naive DFT is timed at */
+#define BENCH_DFT_MAX 4096
+
+static const unsigned int sizes[] = {
+	16, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 65536,
+	48, 96, 480, 960, 1000, 1920, 3000, 6000, 48000
+};
+
+/**
+* The naive DFT, in double precision, which the FFT is checked against.
+*/
+static void
+bench_dft (
+	unsigned int size,
+	const float *input_re,
+	const float *input_im,
+	double *output_re,
+	double *output_im,
+	double sign) {
+
+	for (unsigned int k = 0; k < size; k++) {
+		double sum_re = 0.0, sum_im = 0.0;
+		for (unsigned int n = 0; n < size; n++) {
+			double angle = sign * 2.0 * BENCH_PI * (double) ((unsigned long long) k * n % size) / size;
+			double c = cos (angle), s = sin (angle);
+			double re = input_re ? input_re[n] : 0.0;
+			double im = input_im ? input_im[n] : 0.0;
+			sum_re += re * c - im * s;
+			sum_im += re * s + im * c;
+		}
+		output_re[k] = sum_re;
+		output_im[k] = sum_im;
+	}
+}
+
+/**
+* A naive DFT in single precision with a table, as a fair thing to time.
+*/
+static void
+bench_dft_table (
+	unsigned int size,
+	const float *cosine,
+	const float *sine,
+	const float *input_re,
+	const float *input_im,
+	float *output_re,
+	float *output_im) {
+
+	for (unsigned int k = 0; k < size; k++) {
+		float sum_re = 0.0f, sum_im = 0.0f;
+		unsigned int index = 0;
+		for (unsigned int n = 0; n < size; n++) {
+			sum_re += input_re[n] * cosine[index] + input_im[n] * sine[index];
+			sum_im += input_im[n] * cosine[index] - input_re[n] * sine[index];
+			index += k;
+			if (index >= size) {
+				index -= size;
+			}
+		}
+		output_re[k] = sum_re;
+		output_im[k] = sum_im;
+	}
+}
+
+static double
+bench_error (
+	unsigned int count,
+	const float *re,
+	const float *im,
+	const double *expected_re,
+	const double *expected_im,
+	double scale) {
+
+	double error = 0.0, peak = 0.0;
+	for (unsigned int i = 0; i < count; i++) {
+		double dr = re[i] * scale - expected_re[i];
+		double di = (im ? im[i] * scale : 0.0) - expected_im[i];
+		double magnitude = hypot (expected_re[i], expected_im[i]);
+		error = fmax (error, hypot (dr, di));
+		peak = fmax (peak, magnitude);
+	}
+	return peak > 0.0 ? error / peak : error;
+}
+
+/**
+* Checks the four transforms of a size against the DFT.
+*
+* @return The largest relative error found
+*/
+static double
+bench_verify (unsigned int size, lively_fft_t *complex, lively_fft_t *real, float *buffers, double *expected) {
+	float *in_re = buffers, *in_im = buffers + size;
+	float *out_re = buffers + 2 * size, *out_im = buffers + 3 * size;
+	float *back_re = buffers + 4 * size, *back_im = buffers + 5 * size;
+	float *work = buffers + 6 * size;
+	double *expected_re = expected, *expected_im = expected + size;
+	uint32_t seed = 0x9e3779b9u ^ size;
+	double worst = 0.0;
+
+	for (unsigned int i = 0; i < size; i++) {
+		in_re[i] = bench_random (&seed);
+		in_im[i] = bench_random (&seed);
+	}
+
+	bench_dft (size, in_re, in_im, expected_re, expected_im, -1.0);
+	lively_fft_complex (complex, in_re, in_im, out_re, out_im, work);
+	worst = fmax (worst, bench_error (size, out_re, out_im, expected_re, expected_im, 1.0));
+
+	lively_fft_complex_inverse (complex, out_re, out_im, back_re, back_im, work);
+	for (unsigned int i = 0; i < size; i++) {
+		expected_re[i] = in_re[i];
+		expected_im[i] = in_im[i];
+	}
+	worst = fmax (worst, bench_error (size, back_re, back_im, expected_re, expected_im, 1.0 / size));
+
+	if (real) {
+		unsigned int bins = size / 2 + 1;
+		bench_dft (size, in_re, NULL, expected_re, expected_im, -1.0);
+		lively_fft_real (real, in_re, out_re, out_im, work);
+		worst = fmax (worst, bench_error (bins, out_re, out_im, expected_re, expected_im, 1.0));
+
+		lively_fft_real_inverse (real, out_re, out_im, back_re, work);
+		for (unsigned int i = 0; i < size; i++) {
+			expected_re[i] = in_re[i];
+			expected_im[i] = 0.0;
+		}
+		worst = fmax (worst, bench_error (size, back_re, NULL, expected_re, expected_im, 1.0 / size));
+	}
+
+	return worst;
+}
+
+/**
+* Returns the time of one call of a transform, repeating it until at least
+* the minimum duration has elapsed.
+*/
+static double
+bench_time (
+	int transform,
+	unsigned int size,
+	lively_fft_t *plan,
+	float *buffers,
+	const float *cosine,
+	const float *sine,
+	double min_seconds) {
+
+	float *in_re = buffers, *in_im = buffers + size;
+	float *out_re = buffers + 2 * size, *out_im = buffers + 3 * size;
+	float *work = buffers + 6 * size;
+	unsigned long long repetitions = 1;
+
+	for (;;) {
+		double start = platform_time ();
+		for (unsigned long long r = 0; r < repetitions; r++) {
+			switch (transform) {
+			case 0:
+				lively_fft_complex (plan, in_re, in_im, out_re, out_im, work);
+				break;
+			case 1:
+				lively_fft_real (plan, in_re, out_re, out_im, work);
+				break;
+			default:
+				bench_dft_table (size, cosine, sine, in_re, in_im, out_re, out_im);
+				break;
+			}
+		}
+		double elapsed = platform_time () - start;
+
+		if (elapsed >= min_seconds || repetitions >= (1ull << 40)) {
+			return elapsed / repetitions;
+		}
+
+		double scale = elapsed > 0.0 ? 1.2 * min_seconds / elapsed : 16.0;
+		if (scale < 2.0) scale = 2.0;
+		if (scale > 1024.0) scale = 1024.0;
+		repetitions = (unsigned long long) (repetitions * scale);
+	}
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-n size] [-t milliseconds]\n"
+		"\n"
+		"  -n size          Only run this size\n"
+		"  -t milliseconds  Minimum time per measurement (default 20)\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	unsigned int only_size = 0;
+	double min_seconds = 0.020;
+	bool failed = false;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:t:h")) != -1) {
+		switch (opt) {
+		case 'n': only_size = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	printf ("%6s %-7s %10s %12s %12s %9s\n",
+		"size", "kind", "error", "fft ns", "dft ns", "speedup");
+
+	for (size_t s = 0; s < countof (sizes); s++) {
+		unsigned int size = only_size ? only_size : sizes[s];
+
+		lively_fft_t *complex = lively_fft_acquire (size, LIVELY_FFT_COMPLEX);
+		lively_fft_t *real = size % 2 == 0 ? lively_fft_acquire (size, LIVELY_FFT_REAL) : NULL;
+		if (!complex) {
+			printf ("%6u unsupported size\n", size);
+			failed = true;
+			if (only_size) break;
+			continue;
+		}
+
+		// Six arrays of samples, then the largest work area.
+		float *buffers = malloc ((6 + 3) * (size_t) size * sizeof *buffers);
+		double *expected = malloc (2 * (size_t) size * sizeof *expected);
+		float *cosine = malloc (size * sizeof *cosine);
+		float *sine = malloc (size * sizeof *sine);
+		if (!buffers || !expected || !cosine || !sine) {
+			fprintf (stderr, "Could not allocate memory\n");
+			return 1;
+		}
+		for (unsigned int i = 0; i < size; i++) {
+			cosine[i] = (float) cos (2.0 * BENCH_PI * i / size);
+			sine[i] = (float) sin (2.0 * BENCH_PI * i / size);
+		}
+
+		double error = bench_verify (size, complex, real, buffers, expected);
+		if (error > BENCH_TOLERANCE) {
+			failed = true;
+		}
+
+		double dft = size <= BENCH_DFT_MAX
+			? bench_time (2, size, NULL, buffers, cosine, sine, min_seconds)
+			: 0.0;
+		double fft = bench_time (0, size, complex, buffers, cosine, sine, min_seconds);
+		printf ("%6u %-7s %10.2e %12.1f", size, "complex", error, fft * 1e9);
+		if (dft > 0.0) {
+			printf (" %12.1f %8.1fx\n", dft * 1e9, dft / fft);
+		} else {
+			printf (" %12s %9s\n", "-", "-");
+		}
+
+		if (real) {
+			fft = bench_time (1, size, real, buffers, cosine, sine, min_seconds);
+			printf ("%6u %-7s %10s %12.1f", size, "real", "", fft * 1e9);
+			if (dft > 0.0) {
+				printf (" %12.1f %8.1fx\n", dft * 1e9, dft / fft);
+			} else {
+				printf (" %12s %9s\n", "-", "-");
+			}
+		}
+
+		if (error > BENCH_TOLERANCE) {
+			printf ("%6u error is too large\n", size);
+		}
+
+		free (buffers);
+		free (expected);
+		free (cosine);
+		free (sine);
+		lively_fft_release (real);
+		lively_fft_release (complex);
+
+		if (only_size) break;
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+/**
+ * @file bench_kernels.c
+ * Benchmarks fused chains of kernel nodes.
+ *
+ * A chain of gain and clip nodes runs between an input and an output node,
+ * once as the scene compiles it, fused into a single step, and once with
+ * the same kernels run as ordinary process nodes, each with its own step
+ * and a plug copy into the next. Both must produce the same samples. Each
+ * is then timed per frame.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../lively_app.h"
+#include "../lively_node.h"
+#include "../lively_param.h"
+#include "../lively_scene.h"
+#include "../nodes/lively_node_clip.h"
+#include "../nodes/lively_node_gain.h"
+#include "../platform.h"
+
+/** Most kernel nodes in the chain */
+#define BENCH_CHAIN_MAX 64
+/** Blocks processed before the output is compared */
+#define BENCH_BLOCKS 16
+
+/**
+ * A gain or clip node, and the kernel it was created with, which the
+ * unfused chain runs from its process function instead.
+ */
+typedef struct bench_node {
+	union {
+		lively_node_t node;
+		lively_node_gain_t gain;
+		lively_node_clip_t clip;
+	};
+	void (*kernel)(lively_node_t *, float *samples, unsigned int count);
+} bench_node_t;
+
+static lively_app_t app;
+static lively_node_io_t input, output;
+static bench_node_t chain[BENCH_CHAIN_MAX];
+
+/**
+* The process function of an unfused node: the same as
+* #lively_node_kernel_process, with the kernel hidden from the scene so
+* that it does not fuse the node.
+*/
+static bool
+bench_unfused_process (lively_node_t *node, unsigned int length) {
+	bench_node_t *bench = (bench_node_t *) node;
+	float *buffer = node->get_write_buffer (node, LIVELY_MONO);
+
+	for (unsigned int offset = 0; offset < length; offset += LIVELY_KERNEL_TILE) {
+		unsigned int count = length - offset < LIVELY_KERNEL_TILE
+			? length - offset : LIVELY_KERNEL_TILE;
+		bench->kernel (node, buffer + offset, count);
+	}
+	return true;
+}
+
+/**
+* Builds the chain input, nodes..., output in the scene.
+*/
+static void
+bench_build (lively_scene_t *scene, unsigned int length, bool fused) {
+	lively_scene_begin_edit (scene);
+
+	lively_node_io_init (&input, LIVELY_NODE_PROCESS);
+	lively_node_io_init (&output, LIVELY_NODE_PROCESS);
+	lively_scene_add_node (scene, &input.node);
+	lively_scene_add_node (scene, &output.node);
+
+	lively_node_t *previous = &input.node;
+	for (unsigned int i = 0; i < length; i++) {
+		bench_node_t *bench = &chain[i];
+		if (i % 2 == 0) {
+			lively_node_gain_init (&bench->gain);
+			lively_node_set_param (&bench->node, LIVELY_GAIN_LEVEL, 0.9f);
+		} else {
+			lively_node_clip_init (&bench->clip);
+			lively_node_set_param (&bench->node, LIVELY_CLIP_THRESHOLD, 0.8f);
+		}
+		bench->kernel = bench->node.kernel;
+		if (!fused) {
+			bench->node.kernel = NULL;
+			bench->node.process = bench_unfused_process;
+		}
+
+		lively_scene_add_node (scene, &bench->node);
+		lively_scene_connect (scene, previous, LIVELY_MONO, &bench->node, LIVELY_MONO);
+		previous = &bench->node;
+	}
+	lively_scene_connect (scene, previous, LIVELY_MONO, &output.node, LIVELY_MONO);
+
+	lively_scene_end_edit (scene);
+}
+
+static void
+bench_teardown (lively_scene_t *scene, unsigned int length) {
+	lively_scene_begin_edit (scene);
+	lively_scene_remove_node (scene, &input.node);
+	lively_scene_remove_node (scene, &output.node);
+	for (unsigned int i = 0; i < length; i++) {
+		lively_scene_remove_node (scene, &chain[i].node);
+	}
+	lively_scene_end_edit (scene);
+
+	lively_node_io_destroy (&input.node);
+	lively_node_io_destroy (&output.node);
+	for (unsigned int i = 0; i < length; i++) {
+		lively_node_io_destroy (&chain[i].node);
+	}
+}
+
+/**
+* Processes blocks of noise through the chain, keeping the output of
+* the first #BENCH_BLOCKS blocks, then times it.
+*
+* @return The seconds per frame
+*/
+static double
+bench_run (
+	lively_scene_t *scene,
+	unsigned int length,
+	bool fused,
+	float *kept,
+	unsigned int *steps,
+	double min_seconds) {
+
+	uint32_t seed = 1;
+
+	bench_build (scene, length, fused);
+	*steps = atomic_load (&scene->plan)->steps_count;
+
+	for (unsigned int block = 0; block < BENCH_BLOCKS; block++) {
+		for (unsigned int i = 0; i < LIVELY_QUANTUM; i++) {
+			input.buffer[i] = bench_random (&seed);
+		}
+		lively_scene_process (scene, LIVELY_QUANTUM);
+		memcpy (kept + block * LIVELY_QUANTUM, output.buffer, LIVELY_QUANTUM * sizeof *kept);
+	}
+
+	unsigned long long frames = 0;
+	double start = platform_time (), elapsed;
+	do {
+		for (unsigned int block = 0; block < 256; block++) {
+			lively_scene_process (scene, LIVELY_QUANTUM);
+		}
+		frames += 256 * LIVELY_QUANTUM;
+		elapsed = platform_time () - start;
+	} while (elapsed < min_seconds);
+
+	bench_teardown (scene, length);
+	return elapsed / frames;
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-n nodes] [-t milliseconds]\n"
+		"\n"
+		"  -n nodes         Kernel nodes in the chain, at most %d (default 9)\n"
+		"  -t milliseconds  Minimum time per measurement (default 200)\n",
+		program, BENCH_CHAIN_MAX);
+}
+
+int
+main (int argc, char **argv) {
+	unsigned int only = 0;
+	double min_seconds = 0.200;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:t:h")) != -1) {
+		switch (opt) {
+		case 'n': only = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (only > BENCH_CHAIN_MAX) {
+		usage (argv[0]);
+		return 2;
+	}
+
+	static const unsigned int lengths[] = {1, 2, 3, 5, 9, 17, 33};
+	static float fused_output[BENCH_BLOCKS * LIVELY_QUANTUM];
+	static float unfused_output[BENCH_BLOCKS * LIVELY_QUANTUM];
+	bool failed = false;
+
+	lively_app_init (&app);
+
+	printf ("%5s %6s %8s %12s %12s %8s\n",
+		"nodes", "steps", "unfused", "fused ns", "unfused ns", "speedup");
+
+	for (size_t i = 0; i < sizeof lengths / sizeof *lengths; i++) {
+		unsigned int length = only ? only : lengths[i];
+		unsigned int fused_steps, unfused_steps;
+
+		double fused = bench_run (&app.scene, length, true,
+			fused_output, &fused_steps, min_seconds);
+		double unfused = bench_run (&app.scene, length, false,
+			unfused_output, &unfused_steps, min_seconds);
+
+		if (memcmp (fused_output, unfused_output, sizeof fused_output) != 0) {
+			printf ("%5u: the fused chain does not match\n", length);
+			failed = true;
+		}
+		printf ("%5u %6u %8u %12.3f %12.3f %7.2fx\n", length, fused_steps, unfused_steps,
+			fused * 1e9, unfused * 1e9, unfused / fused);
+
+		if (only) {
+			break;
+		}
+	}
+
+	lively_app_destroy (&app);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file bench_matrix.c
+ * Benchmarks the matrix mixer node.
+ *
+ * Each size is run with every gain at zero, with one gain per output and
+ * with every gain in use. Once the gains have settled, the outputs are
+ * first checked against the same sums computed in double precision. Then
+ * the node is timed per block of #LIVELY_QUANTUM frames.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+#include "../nodes/lively_node_matrix.h"
+#include "../platform.h"
+
+#define BENCH_RATE 48000
+/** Blocks run first, so that every gain has reached its target */
+#define BENCH_SETTLE 256
+
+static const struct {
+	unsigned int inputs;
+	unsigned int outputs;
+} sizes[] = {
+	{2, 2},
+	{8, 8},
+	{16, 4},
+	{64, 16},
+	{64, 64}
+};
+
+typedef enum bench_gains {
+	BENCH_NONE,
+	BENCH_DIAGONAL,
+	BENCH_ALL
+} bench_gains_t;
+
+static const char *gains_names[] = { "none", "one", "all" };
+
+static float
+bench_gain (bench_gains_t gains, unsigned int input, unsigned int output) {
+	switch (gains) {
+	case BENCH_DIAGONAL:
+		return input == output ? 0.5f : 0.0f;
+	case BENCH_ALL:
+		return 0.25f + 0.5f * (float) ((input * 7 + output * 3) % 11) / 11.0f;
+	default:
+		return 0.0f;
+	}
+}
+
+/**
+* Fills every input of the node with the same block of noise, offset by
+* channel.
+*/
+static void
+bench_fill (lively_node_t *node, unsigned int inputs, const float *noise) {
+	for (unsigned int i = 0; i < inputs; i++) {
+		float *buffer = node->get_write_buffer (node, LIVELY_CHANNEL (i));
+		memcpy (buffer, noise + i, LIVELY_QUANTUM * sizeof *buffer);
+	}
+}
+
+/**
+* Checks the outputs of the last block against sums in double precision.
+*
+* @return The largest error relative to the largest output
+*/
+static double
+bench_check (
+	lively_node_t *node,
+	unsigned int inputs,
+	unsigned int outputs,
+	bench_gains_t gains,
+	const float *noise) {
+
+	double peak = 0.0, error = 0.0;
+
+	for (unsigned int o = 0; o < outputs; o++) {
+		const float *output = node->get_read_buffer (node, LIVELY_CHANNEL (o));
+		for (unsigned int n = 0; n < LIVELY_QUANTUM; n++) {
+			double expected = 0.0;
+			for (unsigned int i = 0; i < inputs; i++) {
+				expected += (double) bench_gain (gains, i, o) * noise[i + n];
+			}
+			peak = fmax (peak, fabs (expected));
+			error = fmax (error, fabs (output[n] - expected));
+		}
+	}
+	return peak > 0.0 ? error / peak : error;
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-t milliseconds]\n"
+		"\n"
+		"  -t milliseconds  Minimum time per measurement (default 200)\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	double min_seconds = 0.200;
+	bool failed = false;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	static float noise[LIVELY_QUANTUM + LIVELY_CHANNELS_MAX];
+	uint32_t seed = 1;
+	for (size_t n = 0; n < countof (noise); n++) {
+		noise[n] = bench_random (&seed);
+	}
+
+	printf ("%6s %7s %5s %9s %12s\n", "inputs", "outputs", "gains", "error", "us/block");
+
+	for (size_t s = 0; s < countof (sizes); s++) {
+		for (bench_gains_t gains = BENCH_NONE; gains <= BENCH_ALL; gains++) {
+			unsigned int inputs = sizes[s].inputs, outputs = sizes[s].outputs;
+			lively_node_matrix_t matrix;
+			lively_node_t *node = (lively_node_t *) &matrix;
+
+			if (!lively_node_matrix_init (&matrix, inputs, outputs)) {
+				fprintf (stderr, "Could not set up a %u x %u matrix\n", inputs, outputs);
+				return 1;
+			}
+			node->sample_rate = BENCH_RATE;
+			if (!node->set_buffer_length (node, LIVELY_QUANTUM)) {
+				fprintf (stderr, "Could not allocate memory\n");
+				return 1;
+			}
+			for (unsigned int o = 0; o < outputs; o++) {
+				for (unsigned int i = 0; i < inputs; i++) {
+					lively_node_set_param (node, o * inputs + i, bench_gain (gains, i, o));
+				}
+			}
+
+			for (unsigned int block = 0; block < BENCH_SETTLE; block++) {
+				bench_fill (node, inputs, noise);
+				node->process (node, LIVELY_QUANTUM);
+			}
+			double error = bench_check (node, inputs, outputs, gains, noise);
+			if (error > BENCH_TOLERANCE) {
+				failed = true;
+			}
+
+			unsigned long long blocks = 0;
+			double start = platform_time (), elapsed;
+			do {
+				// The node cleared its inputs, which does not change its cost.
+				for (unsigned int block = 0; block < 256; block++) {
+					node->process (node, LIVELY_QUANTUM);
+				}
+				blocks += 256;
+				elapsed = platform_time () - start;
+			} while (elapsed < min_seconds);
+
+			printf ("%6u %7u %5s %9.1e %12.3f\n", inputs, outputs, gains_names[gains],
+				error, elapsed / blocks * 1e6);
+
+			lively_node_matrix_destroy (node);
+		}
+	}
+
+	if (failed) {
+		printf ("mix is wrong\n");
+	}
+	return failed ? 1 : 0;
+}
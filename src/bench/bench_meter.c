@@ -0,0 +1,225 @@
+/**
+ * @file bench_meter.c
+ * Benchmarks the meter node.
+ *
+ * The node is first checked against cases of EBU Tech 3341: stereo 1 kHz
+ * tones and sequences of them, whose momentary, short-term and integrated
+ * loudness must be within 0.1 LU of the expected value, and a tone between
+ * samples, whose true peak must be within the tolerance the document
+ * gives. Then the node is timed per channel and block of #LIVELY_QUANTUM
+ * frames, with and without the true peak.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+#include "../nodes/lively_node_meter.h"
+#include "../platform.h"
+
+#define BENCH_RATE 48000
+/** Largest error of a loudness, in LU */
+#define BENCH_LOUDNESS_TOLERANCE 0.1
+/** Of the true peak, in dB, as EBU Tech 3341 allows */
+#define BENCH_TRUE_PEAK_OVER 0.2
+#define BENCH_TRUE_PEAK_UNDER 0.4
+/** Channels of the timed node */
+#define BENCH_CHANNELS 64
+
+/** A tone of a case, held for a time */
+typedef struct bench_segment {
+	double level; /**< Peak of the tone, in dBFS */
+	double seconds;
+} bench_segment_t;
+
+static const struct {
+	const char *name;
+	bench_segment_t segments[5];
+	double expected; /**< Loudness, in LUFS */
+	bool steady; /**< Whether the momentary and short-term loudness are checked too */
+} cases[] = {
+	{"1: -23 dBFS", {{-23.0, 20.0}}, -23.0, true},
+	{"2: -33 dBFS", {{-33.0, 20.0}}, -33.0, true},
+	{"3: -36/-23/-36", {{-36.0, 10.0}, {-23.0, 60.0}, {-36.0, 10.0}}, -23.0, false},
+	{"4: -72/-36/-23/-36/-72",
+		{{-72.0, 10.0}, {-36.0, 10.0}, {-23.0, 60.0}, {-36.0, 10.0}, {-72.0, 10.0}},
+		-23.0, false},
+	{"5: -26/-20/-26", {{-26.0, 20.0}, {-20.0, 20.1}, {-26.0, 20.0}}, -23.0, false}
+};
+
+static double
+bench_db (double level) {
+	return 20.0 * log10 (fmax (level, 1e-30));
+}
+
+/**
+* Sets up a meter node at the bench's rate.
+*/
+static bool
+bench_meter_init (lively_node_meter_t *meter, unsigned int channels, bool true_peak) {
+	lively_node_t *node = (lively_node_t *) meter;
+
+	if (!lively_node_meter_init (meter, channels)) {
+		return false;
+	}
+	lively_node_set_param (node, LIVELY_METER_TRUE_PEAK, true_peak ? 1.0f : 0.0f);
+	node->sample_rate = BENCH_RATE;
+	if (!node->set_buffer_length (node, LIVELY_QUANTUM)) {
+		lively_node_meter_destroy (node);
+		return false;
+	}
+	return true;
+}
+
+/**
+* Runs a tone through both channels of a stereo meter, continuing from
+* frame start.
+*
+* @return The frame after the tone
+*/
+static unsigned long
+bench_play (
+	lively_node_meter_t *meter,
+	unsigned long start,
+	double frequency,
+	double amplitude,
+	double phase,
+	unsigned long frames) {
+
+	lively_node_t *node = (lively_node_t *) meter;
+	float *left = node->get_write_buffer (node, LIVELY_LEFT);
+	float *right = node->get_write_buffer (node, LIVELY_RIGHT);
+
+	for (unsigned long frame = start; frame < start + frames; frame += LIVELY_QUANTUM) {
+		for (unsigned int i = 0; i < LIVELY_QUANTUM; i++) {
+			// Reduced to a period first, so that the phase stays exact.
+			unsigned long cycle = (unsigned long) ((frame + i) * (unsigned long) frequency)
+				% BENCH_RATE;
+			left[i] = right[i] = (float) (amplitude
+				* sin (2.0 * BENCH_PI * cycle / BENCH_RATE + phase));
+		}
+		node->process (node, LIVELY_QUANTUM);
+	}
+	return start + (frames + LIVELY_QUANTUM - 1) / LIVELY_QUANTUM * LIVELY_QUANTUM;
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-t milliseconds]\n"
+		"\n"
+		"  -t milliseconds  Minimum time per measurement (default 200)\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	double min_seconds = 0.200;
+	bool failed = false;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	printf ("%-24s %9s %9s %9s %11s\n",
+		"case", "expected", "momentary", "short", "integrated");
+
+	for (size_t c = 0; c < countof (cases); c++) {
+		lively_node_meter_t meter;
+		unsigned long frame = 0;
+
+		if (!bench_meter_init (&meter, 2, false)) {
+			fprintf (stderr, "Could not set up a meter\n");
+			return 1;
+		}
+		for (size_t s = 0; s < countof (cases[c].segments) && cases[c].segments[s].seconds; s++) {
+			frame = bench_play (&meter, frame, 1000.0,
+				pow (10.0, cases[c].segments[s].level / 20.0), 0.0,
+				(unsigned long) (cases[c].segments[s].seconds * BENCH_RATE));
+		}
+
+		const lively_meter_reading_t *reading = lively_node_meter_read (&meter);
+		double expected = cases[c].expected;
+		if (fabs (reading->integrated - expected) > BENCH_LOUDNESS_TOLERANCE
+			|| (cases[c].steady
+				&& (fabs (reading->momentary - expected) > BENCH_LOUDNESS_TOLERANCE
+					|| fabs (reading->short_term - expected) > BENCH_LOUDNESS_TOLERANCE))) {
+			failed = true;
+		}
+		printf ("%-24s %9.2f %9.2f %9.2f %11.2f\n", cases[c].name, expected,
+			reading->momentary, reading->short_term, reading->integrated);
+
+		lively_node_meter_destroy ((lively_node_t *) &meter);
+	}
+
+	// A quarter of the rate, 45 degrees from the samples: every sample is
+	// 3 dB below the peak of the tone.
+	lively_node_meter_t meter;
+	if (!bench_meter_init (&meter, 2, true)) {
+		fprintf (stderr, "Could not set up a meter\n");
+		return 1;
+	}
+	// The peaks of the first reading hold the filters ringing at the onset.
+	unsigned long onset = bench_play (&meter, 0, BENCH_RATE / 4, 0.5, BENCH_PI / 4.0,
+		BENCH_RATE / 10);
+	lively_node_meter_read (&meter);
+	bench_play (&meter, onset, BENCH_RATE / 4, 0.5, BENCH_PI / 4.0, BENCH_RATE);
+	const lively_meter_reading_t *reading = lively_node_meter_read (&meter);
+	double true_peak = bench_db (reading->true_peak[0]);
+	double expected = bench_db (0.5);
+	if (true_peak > expected + BENCH_TRUE_PEAK_OVER || true_peak < expected - BENCH_TRUE_PEAK_UNDER) {
+		failed = true;
+	}
+	printf ("%-24s %9.2f %9s %9.2f %11.2f\n", "true peak, dBTP", expected, "sample",
+		bench_db (reading->peak[0]), true_peak);
+	lively_node_meter_destroy ((lively_node_t *) &meter);
+
+	printf ("\n%8s %9s %14s\n", "channels", "true peak", "us/ch/block");
+	for (int with = 0; with < 2; with++) {
+		lively_node_t *node = (lively_node_t *) &meter;
+		if (!bench_meter_init (&meter, BENCH_CHANNELS, with)) {
+			fprintf (stderr, "Could not set up a meter\n");
+			return 1;
+		}
+		for (unsigned int ch = 0; ch < BENCH_CHANNELS; ch++) {
+			float *buffer = node->get_write_buffer (node, LIVELY_CHANNEL (ch));
+			for (unsigned int i = 0; i < LIVELY_QUANTUM; i++) {
+				buffer[i] = (float) (0.25 * sin (0.05 * (i + ch)));
+			}
+		}
+
+		unsigned long long blocks = 0;
+		double start = platform_time (), elapsed;
+		do {
+			for (unsigned int block = 0; block < 64; block++) {
+				node->process (node, LIVELY_QUANTUM);
+			}
+			blocks += 64;
+			elapsed = platform_time () - start;
+		} while (elapsed < min_seconds);
+
+		printf ("%8u %9s %14.3f\n", BENCH_CHANNELS, with ? "on" : "off",
+			elapsed / blocks / BENCH_CHANNELS * 1e6);
+		lively_node_meter_destroy (node);
+	}
+
+	if (failed) {
+		printf ("readings are wrong\n");
+	}
+	return failed ? 1 : 0;
+}
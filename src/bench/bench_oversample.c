@@ -0,0 +1,311 @@
+/**
+ * @file bench_oversample.c
+ * Benchmarks the half-band oversampling cascades and the oversample node.
+ *
+ * Every factor is first checked at 48 kHz: tones up to 20 kHz must pass a
+ * round trip unchanged, their images above 24 kHz must be rejected when the
+ * rate is raised, and tones which would fold into the band below 20 kHz
+ * must be rejected when it is brought down. Then a 5 kHz tone is clipped
+ * through an oversample node, and the power below 20 kHz which is not at a
+ * harmonic of the tone, which is all aliasing, is measured against the
+ * whole output. Last, a round trip is timed per base frame of one channel.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../lively_node.h"
+#include "../lively_node_class.h"
+#include "../lively_param.h"
+#include "../dsp/lively_fft.h"
+#include "../dsp/lively_halfband.h"
+#include "../nodes/lively_node_clip.h"
+#include "../nodes/lively_node_oversample.h"
+#include "../platform.h"
+
+#define BENCH_RATE 48000
+/** Highest frequency which must pass, in Hz */
+#define BENCH_BAND 20000
+/** Frames run before measuring, so that the filters are full */
+#define BENCH_SETTLE 4096
+/** Amplitude of the test tones */
+#define BENCH_AMPLITUDE 0.5
+/** Largest change of a tone in the band over a round trip, in dB */
+#define BENCH_RIPPLE_MAX 0.01
+/** Least rejection of images and aliases, in dB */
+#define BENCH_REJECTION_MIN 90.0
+/** The clipped tone, its amplitude and the threshold of the clip */
+#define BENCH_CLIP_TONE 5000
+#define BENCH_CLIP_AMPLITUDE 1.0
+#define BENCH_CLIP_THRESHOLD 0.3f
+
+static const unsigned int factors[] = {2, 4, 8};
+
+/** Tones checked in the band, in Hz */
+static const unsigned int tones[] = {20, 100, 1000, 5000, 10000, 15000, 18000, 20000};
+
+static double
+bench_db (double ratio) {
+	return 10.0 * log10 (fmax (ratio, 1e-30));
+}
+
+/**
+* Fills frames of a tone, continuing from frame start.
+*/
+static void
+bench_tone (float *output, unsigned int frames, unsigned long start,
+	double frequency, unsigned int rate, double amplitude) {
+
+	for (unsigned int n = 0; n < frames; n++) {
+		// Reduced to a period first, so that the phase stays exact.
+		unsigned long cycle = (unsigned long) ((start + n) * (unsigned long) frequency) % rate;
+		output[n] = (float) (amplitude * sin (2.0 * BENCH_PI * cycle / rate));
+	}
+}
+
+/**
+* Raises one second of a tone in the band, after the filters have
+* settled, and measures the power of the output above the band's Nyquist
+* frequency against the tone's. Every tone is a whole number of Hz, so the
+* second holds whole periods and needs no window.
+*
+* @return The rejection of the images, in dB
+*/
+static double
+bench_images (lively_halfband_t *halfband, unsigned int factor, unsigned int tone) {
+	unsigned int size = BENCH_RATE * factor;
+	lively_fft_t *fft = lively_fft_acquire (size, LIVELY_FFT_REAL);
+	float *raised = malloc ((size + size / 2 + 1) * 2 * sizeof *raised
+		+ lively_fft_work_size (fft) * sizeof (float));
+	float *re = raised + size, *im = re + size / 2 + 1, *work = im + size / 2 + 1;
+	float input[LIVELY_HALFBAND_BLOCK], scratch[LIVELY_HALFBAND_BLOCK * 8];
+
+	lively_halfband_reset (halfband);
+	for (unsigned long n = 0; n < BENCH_SETTLE + BENCH_RATE; n += LIVELY_HALFBAND_BLOCK) {
+		bench_tone (input, LIVELY_HALFBAND_BLOCK, n, tone, BENCH_RATE, BENCH_AMPLITUDE);
+		lively_halfband_up (halfband, input, scratch, LIVELY_HALFBAND_BLOCK);
+		if (n >= BENCH_SETTLE) {
+			memcpy (raised + (n - BENCH_SETTLE) * factor, scratch,
+				LIVELY_HALFBAND_BLOCK * factor * sizeof *scratch);
+		}
+	}
+	lively_fft_real (fft, raised, re, im, work);
+
+	// Bins are 1 Hz apart.
+	double signal = 0.0, images = 0.0;
+	for (unsigned int k = 0; k <= size / 2; k++) {
+		double power = (double) re[k] * re[k] + (double) im[k] * im[k];
+		if (k == tone) {
+			signal += power;
+		} else if (k > BENCH_RATE / 2) {
+			images += power;
+		}
+	}
+
+	lively_fft_release (fft);
+	free (raised);
+	return -bench_db (images / signal);
+}
+
+/**
+* Brings down a tone at the oversampled rate, and measures what comes out
+* against its power.
+*
+* @return The rejection of the tone, in dB
+*/
+static double
+bench_alias (lively_halfband_t *halfband, unsigned int factor, unsigned int tone) {
+	float input[LIVELY_HALFBAND_BLOCK * 8], output[LIVELY_HALFBAND_BLOCK];
+	double power = 0.0;
+	unsigned long frames = 0;
+
+	lively_halfband_reset (halfband);
+	for (unsigned long n = 0; n < BENCH_SETTLE + BENCH_RATE / 4; n += LIVELY_HALFBAND_BLOCK) {
+		bench_tone (input, LIVELY_HALFBAND_BLOCK * factor, n * factor, tone,
+			BENCH_RATE * factor, BENCH_AMPLITUDE);
+		lively_halfband_down (halfband, input, output, LIVELY_HALFBAND_BLOCK);
+		if (n >= BENCH_SETTLE) {
+			for (unsigned int i = 0; i < LIVELY_HALFBAND_BLOCK; i++) {
+				power += (double) output[i] * output[i];
+			}
+			frames += LIVELY_HALFBAND_BLOCK;
+		}
+	}
+	return -bench_db (power / frames / (BENCH_AMPLITUDE * BENCH_AMPLITUDE / 2.0));
+}
+
+/**
+* Takes a tone in the band there and back, and measures the change of its
+* power.
+*
+* @return The change, in dB
+*/
+static double
+bench_ripple (lively_halfband_t *halfband, unsigned int factor, unsigned int tone) {
+	float input[LIVELY_HALFBAND_BLOCK], scratch[LIVELY_HALFBAND_BLOCK * 8];
+	float output[LIVELY_HALFBAND_BLOCK];
+	double power = 0.0;
+	unsigned long frames = 0;
+
+	lively_halfband_reset (halfband);
+	for (unsigned long n = 0; n < BENCH_SETTLE + BENCH_RATE; n += LIVELY_HALFBAND_BLOCK) {
+		bench_tone (input, LIVELY_HALFBAND_BLOCK, n, tone, BENCH_RATE, BENCH_AMPLITUDE);
+		lively_halfband_up (halfband, input, scratch, LIVELY_HALFBAND_BLOCK);
+		lively_halfband_down (halfband, scratch, output, LIVELY_HALFBAND_BLOCK);
+		if (n >= BENCH_SETTLE) {
+			for (unsigned int i = 0; i < LIVELY_HALFBAND_BLOCK; i++) {
+				power += (double) output[i] * output[i];
+			}
+			frames += LIVELY_HALFBAND_BLOCK;
+		}
+	}
+	return bench_db (power / frames / (BENCH_AMPLITUDE * BENCH_AMPLITUDE / 2.0));
+}
+
+/**
+* Clips one second of a tone through an oversample node, and measures the
+* power below the band's edge that is not at a harmonic of the tone
+* against the power of the whole output.
+*
+* @return The aliasing, in dB, or NAN if the node could not be set up
+*/
+static double
+bench_clip (unsigned int factor) {
+	lively_node_oversample_t oversample;
+	lively_node_t *node = (lively_node_t *) &oversample;
+	lively_fft_t *fft = lively_fft_acquire (BENCH_RATE, LIVELY_FFT_REAL);
+	static float clipped[BENCH_RATE], re[BENCH_RATE / 2 + 1], im[BENCH_RATE / 2 + 1];
+	float *work = malloc (lively_fft_work_size (fft) * sizeof *work);
+
+	if (!work || !lively_node_oversample_init (&oversample, 1, lively_node_class_find ("clip"))) {
+		lively_fft_release (fft);
+		free (work);
+		return NAN;
+	}
+	lively_node_set_param (node, LIVELY_OVERSAMPLE_FACTOR, (float) factor);
+	lively_node_set_param (node, LIVELY_OVERSAMPLE_PARAMS + LIVELY_CLIP_THRESHOLD,
+		BENCH_CLIP_THRESHOLD);
+	node->sample_rate = BENCH_RATE;
+	node->set_buffer_length (node, LIVELY_HALFBAND_BLOCK);
+
+	float *buffer = node->get_write_buffer (node, LIVELY_MONO);
+	for (unsigned long n = 0; n < BENCH_SETTLE + BENCH_RATE; n += LIVELY_HALFBAND_BLOCK) {
+		bench_tone (buffer, LIVELY_HALFBAND_BLOCK, n, BENCH_CLIP_TONE, BENCH_RATE,
+			BENCH_CLIP_AMPLITUDE);
+		node->process (node, LIVELY_HALFBAND_BLOCK);
+		if (n >= BENCH_SETTLE) {
+			memcpy (clipped + n - BENCH_SETTLE, buffer, LIVELY_HALFBAND_BLOCK * sizeof *buffer);
+		}
+	}
+	lively_fft_real (fft, clipped, re, im, work);
+
+	double total = 0.0, aliases = 0.0;
+	for (unsigned int k = 1; k <= BENCH_RATE / 2; k++) {
+		double power = (double) re[k] * re[k] + (double) im[k] * im[k];
+		total += power;
+		if (k <= BENCH_BAND && k % BENCH_CLIP_TONE != 0) {
+			aliases += power;
+		}
+	}
+
+	lively_node_oversample_destroy (node);
+	lively_fft_release (fft);
+	free (work);
+	return bench_db (aliases / total);
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-t milliseconds]\n"
+		"\n"
+		"  -t milliseconds  Minimum time per measurement (default 200)\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	double min_seconds = 0.200;
+	bool failed = false;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	printf ("%6s %7s %10s %10s %10s %10s %10s\n",
+		"factor", "latency", "ripple dB", "images dB", "alias dB", "clip dB", "ns/frame");
+
+	printf ("%6u %7u %10s %10s %10s %10.1f %10s\n", 1, 0, "-", "-", "-", bench_clip (1), "-");
+
+	for (size_t f = 0; f < countof (factors); f++) {
+		unsigned int factor = factors[f];
+		lively_halfband_t halfband;
+
+		if (!lively_halfband_init (&halfband, factor)) {
+			fprintf (stderr, "Could not set up a factor of %u\n", factor);
+			return 1;
+		}
+
+		double ripple = 0.0, images = INFINITY, alias = INFINITY;
+		for (size_t t = 0; t < countof (tones); t++) {
+			double change = bench_ripple (&halfband, factor, tones[t]);
+			ripple = fabs (change) > fabs (ripple) ? change : ripple;
+			images = fmin (images, bench_images (&halfband, factor, tones[t]));
+		}
+		// Every tone above the band's edge which would fold into it.
+		for (unsigned int tone = BENCH_RATE - BENCH_BAND; tone < BENCH_RATE * factor / 2;
+				tone += 500) {
+			unsigned int folded = tone % BENCH_RATE;
+			if (folded > BENCH_RATE / 2) {
+				folded = BENCH_RATE - folded;
+			}
+			if (folded <= BENCH_BAND) {
+				alias = fmin (alias, bench_alias (&halfband, factor, tone));
+			}
+		}
+		if (fabs (ripple) > BENCH_RIPPLE_MAX || images < BENCH_REJECTION_MIN
+			|| alias < BENCH_REJECTION_MIN) {
+			failed = true;
+		}
+
+		double clip = bench_clip (factor);
+
+		float input[LIVELY_HALFBAND_BLOCK] = {0.0f};
+		float scratch[LIVELY_HALFBAND_BLOCK * 8];
+		unsigned long long frames = 0;
+		double start = platform_time (), elapsed;
+		do {
+			for (unsigned int block = 0; block < 256; block++) {
+				lively_halfband_up (&halfband, input, scratch, LIVELY_HALFBAND_BLOCK);
+				lively_halfband_down (&halfband, scratch, input, LIVELY_HALFBAND_BLOCK);
+			}
+			frames += 256 * LIVELY_HALFBAND_BLOCK;
+			elapsed = platform_time () - start;
+		} while (elapsed < min_seconds);
+
+		printf ("%6u %7u %10.4f %10.1f %10.1f %10.1f %10.2f\n", factor,
+			lively_halfband_latency (factor), ripple, images, alias, clip,
+			elapsed / frames * 1e9);
+
+		lively_halfband_destroy (&halfband);
+	}
+
+	if (failed) {
+		printf ("quality is too low\n");
+	}
+	return failed ? 1 : 0;
+}
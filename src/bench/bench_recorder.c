@@ -0,0 +1,246 @@
+/**
+ * @file bench_recorder.c
+ * Benchmarks multitrack recording through the disk service.
+ *
+ * Several recorder nodes, each with many channels, are fed blocks of a
+ * known signal at a multiple of real time, while the disk thread drains
+ * their rings into files. The run fails if any block overflowed a ring, or
+ * if a file, read back through the disk service, differs from the signal
+ * in any sample. The signal is quantized to the resolution of the encoding
+ * so that the comparison can be exact.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../lively_app.h"
+#include "../lively_disk.h"
+#include "../lively_node.h"
+#include "../lively_scene.h"
+#include "../lively_thread.h"
+#include "../nodes/lively_node_recorder.h"
+#include "../platform.h"
+
+/** Most recorder nodes */
+#define BENCH_RECORDERS_MAX 16
+/** Seconds to wait for a read back ring to fill before giving up */
+#define BENCH_READ_TIMEOUT 10.0
+
+static const struct {
+	const char *name;
+	lively_wav_encoding_t encoding;
+	unsigned int bits; /**< Of the signal, so that it survives exactly */
+} encodings[] = {
+	{"s16", LIVELY_WAV_PCM_16, 16},
+	{"s24", LIVELY_WAV_PCM_24, 24},
+	{"s32", LIVELY_WAV_PCM_32, 24},
+	{"float", LIVELY_WAV_FLOAT_32, 24}
+};
+
+static lively_app_t app;
+static lively_node_recorder_t recorders[BENCH_RECORDERS_MAX];
+
+/**
+* The signal of a channel of a recorder at a frame: noise of the given
+* resolution, which differs between channels and recorders.
+*/
+static float
+bench_sample (unsigned int recorder, unsigned int channel, uint64_t frame, unsigned int bits) {
+	uint64_t x = frame * 0x9E3779B97F4A7C15ull ^ ((uint64_t) recorder << 40 | channel);
+	x ^= x >> 31;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 29;
+
+	int32_t level = (int32_t) (x >> (64 - bits)) - (1 << (bits - 1));
+	return (float) level / (float) (1u << (bits - 1));
+}
+
+/**
+* Reads a file back through the disk service, and compares it with the
+* signal.
+*
+* @return The number of frames which matched, or 0 on failure
+*/
+static uint64_t
+bench_check (const char *path, unsigned int recorder, unsigned int channels,
+	unsigned int rate, unsigned int bits, uint64_t frames) {
+
+	lively_disk_stream_t *stream = lively_disk_open_reader (&app.disk, path, rate);
+	if (!stream) {
+		return 0;
+	}
+
+	static float block[LIVELY_CHANNELS_MAX][LIVELY_QUANTUM];
+	float *output[LIVELY_CHANNELS_MAX];
+	for (unsigned int c = 0; c < channels; c++) {
+		output[c] = block[c];
+	}
+
+	uint64_t frame = 0;
+	double deadline = platform_time () + BENCH_READ_TIMEOUT;
+	while (frame < frames && platform_time () < deadline) {
+		unsigned int wanted = frames - frame < LIVELY_QUANTUM ? frames - frame : LIVELY_QUANTUM;
+		unsigned int got = lively_disk_stream_read (stream, output, wanted);
+
+		if (got == 0) {
+			if (lively_disk_stream_is_finished (stream)) {
+				break;
+			}
+			platform_sleep_until (platform_time () + 1e-3);
+			continue;
+		}
+		for (unsigned int c = 0; c < channels; c++) {
+			for (unsigned int i = 0; i < got; i++) {
+				if (block[c][i] != bench_sample (recorder, c, frame + i, bits)) {
+					lively_disk_close (stream);
+					return 0;
+				}
+			}
+		}
+		frame += got;
+		deadline = platform_time () + BENCH_READ_TIMEOUT;
+	}
+
+	lively_disk_close (stream);
+	return frame == frames ? frame : 0;
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-n recorders] [-c channels] [-r rate] [-e encoding] [-l]\n"
+		"          [-s speed] [-d seconds] [-o directory]\n"
+		"\n"
+		"  -n recorders  Recorder nodes, at most %d (default 2)\n"
+		"  -c channels   Channels of each recorder (default 64)\n"
+		"  -r rate       Sample rate (default 96000)\n"
+		"  -e encoding   s16, s24, s32 or float (default s24)\n"
+		"  -l            Write lossless files instead of WAV\n"
+		"  -s speed      Multiple of real time to feed the recorders at (default 4)\n"
+		"  -d seconds    Seconds of audio to record (default 10)\n"
+		"  -o directory  Where the files are written, and removed (default .)\n",
+		program, BENCH_RECORDERS_MAX);
+}
+
+int
+main (int argc, char **argv) {
+	unsigned int count = 2, channels = 64, rate = 96000;
+	size_t encoding = 1;
+	bool lossless = false;
+	double speed = 4.0, seconds = 10.0;
+	const char *directory = ".";
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:c:r:e:ls:d:o:h")) != -1) {
+		switch (opt) {
+		case 'n': count = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 'c': channels = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 'r': rate = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 'e':
+			for (encoding = 0; encoding < countof (encodings); encoding++) {
+				if (strcmp (optarg, encodings[encoding].name) == 0) {
+					break;
+				}
+			}
+			break;
+		case 'l': lossless = true; break;
+		case 's': speed = strtod (optarg, NULL); break;
+		case 'd': seconds = strtod (optarg, NULL); break;
+		case 'o': directory = optarg; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (count == 0 || count > BENCH_RECORDERS_MAX || channels == 0
+		|| channels > LIVELY_CHANNELS_MAX || rate == 0 || encoding == countof (encodings)
+		|| speed <= 0.0 || seconds <= 0.0) {
+		usage (argv[0]);
+		return 2;
+	}
+
+	unsigned int bits = encodings[encoding].bits;
+	char paths[BENCH_RECORDERS_MAX][4096];
+	lively_scene_t *scene = &app.scene;
+
+	lively_app_init (&app);
+	if (!app.disk_ready || !lively_scene_set_sample_rate (scene, rate)
+		|| !lively_thread_init (&app.thread_disk, &app, lively_disk_main)) {
+		fprintf (stderr, "Could not set up the disk service\n");
+		return 1;
+	}
+
+	for (unsigned int r = 0; r < count; r++) {
+		lively_node_t *node = (lively_node_t *) &recorders[r];
+
+		snprintf (paths[r], sizeof paths[r], "%s/bench_recorder_%u.%s", directory, r,
+			lossless ? "lively" : "wav");
+		if (!lively_node_recorder_init (&recorders[r], channels)
+			|| !lively_scene_add_node (scene, node)
+			|| !lively_node_recorder_open (&recorders[r], &app.disk, paths[r],
+				encodings[encoding].encoding, lossless)) {
+			fprintf (stderr, "Could not start recording to '%s'\n", paths[r]);
+			return 1;
+		}
+	}
+
+	// The recorders are processed here rather than by an audio thread,
+	// each block when it falls due at the chosen speed.
+	uint64_t frames = (uint64_t) (seconds * rate) / LIVELY_QUANTUM * LIVELY_QUANTUM;
+	double start = platform_time ();
+	for (uint64_t frame = 0; frame < frames; frame += LIVELY_QUANTUM) {
+		platform_sleep_until (start + frame / (rate * speed));
+		for (unsigned int r = 0; r < count; r++) {
+			lively_node_t *node = (lively_node_t *) &recorders[r];
+			for (unsigned int c = 0; c < channels; c++) {
+				float *buffer = node->get_write_buffer (node, LIVELY_CHANNEL (c));
+				for (unsigned int i = 0; i < LIVELY_QUANTUM; i++) {
+					buffer[i] = bench_sample (r, c, frame + i, bits);
+				}
+			}
+			node->process (node, LIVELY_QUANTUM);
+		}
+	}
+	double elapsed = platform_time () - start;
+
+	unsigned long overflows = 0;
+	bool closed = true;
+	for (unsigned int r = 0; r < count; r++) {
+		overflows += lively_node_recorder_get_overflows (&recorders[r]);
+		closed = lively_node_recorder_close (&recorders[r]) && closed;
+	}
+	double drained = platform_time () - start;
+
+	bool exact = closed;
+	for (unsigned int r = 0; r < count && exact; r++) {
+		exact = bench_check (paths[r], r, channels, rate, bits, frames) == frames;
+	}
+
+	printf ("%u recorders of %u channels at %u Hz, %s%s, fed at %.1fx for %.1f s\n",
+		count, channels, rate, encodings[encoding].name, lossless ? " lossless" : "",
+		speed, (double) frames / rate);
+	printf ("  speed     %.2fx real time, %.2fx until the files were complete\n",
+		(double) frames / rate / elapsed, (double) frames / rate / drained);
+	printf ("  overflows %lu\n", overflows);
+	printf ("  read back %s\n", exact ? "bit-exact" : "DIFFERENT");
+
+	lively_thread_set_state (&app.thread_disk, THREAD_STOP);
+	lively_disk_wake (&app.disk);
+	lively_thread_join (&app.thread_disk);
+	for (unsigned int r = 0; r < count; r++) {
+		lively_scene_remove_node (scene, (lively_node_t *) &recorders[r]);
+		lively_node_recorder_destroy ((lively_node_t *) &recorders[r]);
+		unlink (paths[r]);
+	}
+	lively_app_destroy (&app);
+
+	return overflows == 0 && exact ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file bench_resampler.c
+ * Benchmarks the polyphase resampler.
+ *
+ * Every conversion is first checked on a stereo signal: a tone in the
+ * passband on the left, compared with the same tone computed at the output
+ * rate, and when decimating, a tone above the output Nyquist frequency on
+ * the right, which must not alias back. Then the conversion is timed per
+ * output frame of one channel.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include "../dsp/lively_resampler.h"
+#include "../platform.h"
+
+/** Frequency of the passband tone, in Hz */
+#define BENCH_TONE 997.0
+/** Amplitude of both tones */
+#define BENCH_AMPLITUDE 0.5
+/** Input frames per call, as a device period might deliver them */
+#define BENCH_PERIOD 480
+/** Least signal to error ratio of the passband tone, in dB */
+#define BENCH_SNR_MIN 80.0
+/** Least attenuation of the tone above the output Nyquist frequency, in dB */
+#define BENCH_ALIAS_MIN 80.0
+
+static const struct {
+	unsigned int rate_in;
+	unsigned int rate_out;
+	bool variable;
+} conversions[] = {
+	{44100, 48000, false},
+	{48000, 44100, false},
+	{48000, 96000, false},
+	{96000, 48000, false},
+	{44100, 96000, false},
+	{192000, 44100, false},
+	{44100, 48000, true},
+	{48000, 44100, true},
+	{48000, 48000, true}
+};
+
+/**
+* Runs a whole input through a resampler in periods.
+*
+* @return The number of output frames
+*/
+static unsigned int
+bench_run (
+	lively_resampler_t *resampler,
+	float *const *input,
+	unsigned int input_frames,
+	float *const *output,
+	unsigned int output_room) {
+
+	unsigned int produced = 0;
+
+	for (unsigned int offset = 0; offset < input_frames;) {
+		unsigned int frames = input_frames - offset < BENCH_PERIOD
+			? input_frames - offset : BENCH_PERIOD;
+		const float *in[2] = {input[0] + offset, input[1] + offset};
+		float *out[2] = {output[0] + produced, output[1] + produced};
+
+		produced += lively_resampler_process (resampler, in, &frames, out, output_room - produced);
+		offset += frames;
+		if (frames == 0) {
+			break;
+		}
+	}
+	return produced;
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-t milliseconds]\n"
+		"\n"
+		"  -t milliseconds  Minimum time per measurement (default 200)\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	double min_seconds = 0.200;
+	bool failed = false;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't': min_seconds = strtod (optarg, NULL) / 1000.0; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	printf ("%7s %7s %-8s %5s %9s %9s %10s\n",
+		"in", "out", "kind", "taps", "snr dB", "alias dB", "ns/frame");
+
+	for (size_t i = 0; i < countof (conversions); i++) {
+		unsigned int rate_in = conversions[i].rate_in;
+		unsigned int rate_out = conversions[i].rate_out;
+		lively_resampler_t resampler;
+
+		if (!lively_resampler_init (&resampler, 2, rate_in, rate_out, conversions[i].variable)) {
+			fprintf (stderr, "Could not set up %u to %u\n", rate_in, rate_out);
+			return 1;
+		}
+
+		// One second of input, and room for all of its output.
+		unsigned int input_frames = rate_in;
+		unsigned int output_room = rate_out + 1;
+		float *buffers = malloc (2 * ((size_t) input_frames + output_room) * sizeof *buffers);
+		if (!buffers) {
+			fprintf (stderr, "Could not allocate memory\n");
+			return 1;
+		}
+		float *input[2] = {buffers, buffers + input_frames};
+		float *output[2] = {buffers + 2 * (size_t) input_frames,
+			buffers + 2 * (size_t) input_frames + output_room};
+
+		bool decimating = rate_in > rate_out;
+		double alias_tone = 0.25 * (rate_in + rate_out);
+		for (unsigned int n = 0; n < input_frames; n++) {
+			input[0][n] = (float) (BENCH_AMPLITUDE * sin (2.0 * BENCH_PI * BENCH_TONE * n / rate_in));
+			input[1][n] = decimating
+				? (float) (BENCH_AMPLITUDE * sin (2.0 * BENCH_PI * alias_tone * n / rate_in)) : 0.0f;
+		}
+
+		unsigned int produced = bench_run (&resampler, input, input_frames, output, output_room);
+
+		// Skip the start, where the filter is still filling with input.
+		unsigned int skip = 4 * lively_resampler_latency (&resampler) * rate_out / rate_in + 64;
+		double signal = 0.0, error = 0.0, alias = 0.0;
+		for (unsigned int m = skip; m < produced; m++) {
+			double expected = BENCH_AMPLITUDE * sin (2.0 * BENCH_PI * BENCH_TONE * m / rate_out);
+			signal += expected * expected;
+			error += (output[0][m] - expected) * (output[0][m] - expected);
+			alias += (double) output[1][m] * output[1][m];
+		}
+		double snr = 10.0 * log10 (signal / fmax (error, 1e-30));
+		double rejection = 10.0 * log10 (signal / fmax (alias, 1e-30));
+
+		if (snr < BENCH_SNR_MIN || (decimating && rejection < BENCH_ALIAS_MIN)) {
+			failed = true;
+		}
+
+		unsigned long long frames = 0;
+		double start = platform_time (), elapsed;
+		do {
+			lively_resampler_reset (&resampler);
+			frames += bench_run (&resampler, input, input_frames, output, output_room);
+			elapsed = platform_time () - start;
+		} while (elapsed < min_seconds);
+
+		printf ("%7u %7u %-8s %5u %9.1f", rate_in, rate_out,
+			conversions[i].variable ? "variable" : "exact", resampler.bank->taps, snr);
+		if (decimating) {
+			printf (" %9.1f", rejection);
+		} else {
+			printf (" %9s", "-");
+		}
+		printf (" %10.2f\n", elapsed / frames / 2 * 1e9);
+
+		free (buffers);
+		lively_resampler_destroy (&resampler);
+	}
+
+	if (failed) {
+		printf ("quality is too low\n");
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,338 @@
+/**
+ * @file stress.c
+ * Worst-case latency and jitter stress harness for the realtime path.
+ *
+ * Runs #lively_audio_main on whichever backend this program was linked
+ * against while several threads edit the scene as fast as they can:
+ * connecting and disconnecting plugs, removing and re-adding nodes and
+ * resizing buffers. The audio thread records its wakeup latency and
+ * processing time per period into cyclictest-style histograms.
+ *
+ * The run fails if any period took longer than the budget, measured from the
+ * moment the period was due until its output was written, or if the backend
+ * reported an xrun.
+ *
+ * With -c, the audio thread also keeps all of its input in a capture, which
+ * is saved to a file at the end, so its cost shows in the same histograms.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "../lively_app.h"
+#include "../lively_audio_config.h"
+#include "../lively_audio_stats.h"
+#include "../lively_capture.h"
+#include "../lively_node.h"
+#include "../lively_scene.h"
+#include "../lively_thread.h"
+#include "../platform.h"
+
+/** Nodes in the scene: two inputs, two outputs and the rest processing */
+#define STRESS_NODES 32
+#define STRESS_INPUTS 2
+#define STRESS_OUTPUTS 2
+
+typedef struct stress {
+	lively_app_t *app;
+
+	pthread_mutex_t lock;
+	lively_node_io_t nodes[STRESS_NODES];
+	char names[STRESS_NODES][16];
+	bool present[STRESS_NODES];
+	bool edges[STRESS_NODES][STRESS_NODES];
+
+	unsigned int base_length;
+	unsigned int interval_us;
+	atomic_bool stop;
+	atomic_ullong operations;
+} stress_t;
+
+typedef struct stress_worker {
+	stress_t *stress;
+	pthread_t thread;
+	uint32_t seed;
+} stress_worker_t;
+
+static lively_app_t app;
+static lively_audio_stats_t stats;
+static lively_capture_t capture;
+static stress_t stress;
+
+static uint32_t
+stress_random (uint32_t *state) {
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/**
+* Nodes are ranked inputs first, outputs last; plugs only go up in rank so
+* the scene always stays acyclic.
+*/
+static bool
+stress_can_connect (unsigned int source, unsigned int target) {
+	return source < target
+		&& target >= STRESS_INPUTS
+		&& source < STRESS_NODES - STRESS_OUTPUTS;
+}
+
+static void
+stress_toggle_edge (stress_t *stress, unsigned int source, unsigned int target) {
+	lively_scene_t *scene = &stress->app->scene;
+	lively_node_t *a = (lively_node_t *) &stress->nodes[source];
+	lively_node_t *b = (lively_node_t *) &stress->nodes[target];
+
+	if (!stress->present[source] || !stress->present[target]) {
+		return;
+	}
+
+	if (stress->edges[source][target]) {
+		lively_scene_disconnect (scene, a, LIVELY_MONO, b, LIVELY_MONO);
+	} else {
+		lively_scene_connect (scene, a, LIVELY_MONO, b, LIVELY_MONO);
+	}
+	stress->edges[source][target] = !stress->edges[source][target];
+}
+
+static void
+stress_toggle_node (stress_t *stress, unsigned int index) {
+	lively_scene_t *scene = &stress->app->scene;
+	lively_node_t *node = (lively_node_t *) &stress->nodes[index];
+
+	if (stress->present[index]) {
+		// Removing a node also removes the plugs to and from it.
+		for (unsigned int i = 0; i < STRESS_NODES; i++) {
+			stress->edges[i][index] = false;
+			stress->edges[index][i] = false;
+		}
+		lively_scene_remove_node (scene, node);
+		stress->present[index] = false;
+	} else {
+		lively_scene_add_node (scene, node);
+		stress->present[index] = true;
+	}
+}
+
+static void *
+stress_worker_main (void *arg) {
+	stress_worker_t *worker = arg;
+	stress_t *stress = worker->stress;
+	lively_scene_t *scene = &stress->app->scene;
+
+	while (!atomic_load (&stress->stop)) {
+		uint32_t choice = stress_random (&worker->seed) % 100;
+
+		pthread_mutex_lock (&stress->lock);
+		if (choice < 70) {
+			unsigned int source = stress_random (&worker->seed) % STRESS_NODES;
+			unsigned int target = stress_random (&worker->seed) % STRESS_NODES;
+			if (stress_can_connect (source, target)) {
+				stress_toggle_edge (stress, source, target);
+			}
+		} else if (choice < 95) {
+			unsigned int processing = STRESS_NODES - STRESS_INPUTS - STRESS_OUTPUTS;
+			unsigned int index = STRESS_INPUTS + stress_random (&worker->seed) % processing;
+			stress_toggle_node (stress, index);
+		} else {
+			unsigned int length = stress->base_length
+				+ stress_random (&worker->seed) % (stress->base_length + 1);
+			lively_scene_set_buffer_length (scene, length);
+		}
+		pthread_mutex_unlock (&stress->lock);
+
+		atomic_fetch_add (&stress->operations, 1);
+
+		if (stress->interval_us) {
+			platform_sleep_until (platform_time () + stress->interval_us * 1e-6);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+stress_app_main (lively_thread_t *thread) {
+	lively_app_run (thread->app);
+}
+
+static void
+stress_build_scene (stress_t *stress) {
+	lively_scene_t *scene = &stress->app->scene;
+
+	for (unsigned int i = 0; i < STRESS_NODES; i++) {
+		lively_node_type_t type = LIVELY_NODE_PROCESS;
+		unsigned int port = 0;
+
+		if (i < STRESS_INPUTS) {
+			type = LIVELY_NODE_INPUT;
+			port = i;
+		} else if (i >= STRESS_NODES - STRESS_OUTPUTS) {
+			type = LIVELY_NODE_OUTPUT;
+			port = i - (STRESS_NODES - STRESS_OUTPUTS);
+		}
+
+		lively_node_io_init (&stress->nodes[i], type);
+		stress->nodes[i].port = port;
+		snprintf (stress->names[i], sizeof stress->names[i], "stress%02u", i);
+		stress->nodes[i].node.name = stress->names[i];
+
+		lively_scene_add_node (scene, (lively_node_t *) &stress->nodes[i]);
+		stress->present[i] = true;
+	}
+
+	// Start with a straight path from each input through to an output.
+	for (unsigned int i = 0; i < STRESS_INPUTS; i++) {
+		stress_toggle_edge (stress, i, STRESS_INPUTS + i);
+		stress_toggle_edge (stress, STRESS_INPUTS + i, STRESS_NODES - STRESS_OUTPUTS + i);
+	}
+}
+
+static void
+usage (const char *program) {
+	fprintf (stderr,
+		"Usage: %s [-d seconds] [-b microseconds] [-t threads] [-i microseconds] [-c file] [-v]\n"
+		"\n"
+		"  -d seconds       Duration of the run (default 10)\n"
+		"  -b microseconds  Budget from period due to output written (default 5000)\n"
+		"  -t threads       Number of threads editing the scene (default 2)\n"
+		"  -i microseconds  Pause between edits in each thread (default 100)\n"
+		"  -c file          Keep the input of the run, and save it to file\n"
+		"  -v               Print every histogram bucket\n",
+		program);
+}
+
+int
+main (int argc, char **argv) {
+	double duration = 10.0;
+	double budget = 5000e-6;
+	unsigned int threads = 2;
+	bool verbose = false;
+	const char *capture_path = NULL;
+	int opt;
+
+	stress.interval_us = 100;
+
+	while ((opt = getopt (argc, argv, "d:b:t:i:c:vh")) != -1) {
+		switch (opt) {
+		case 'd': duration = strtod (optarg, NULL); break;
+		case 'b': budget = strtod (optarg, NULL) * 1e-6; break;
+		case 't': threads = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 'i': stress.interval_us = (unsigned int) strtoul (optarg, NULL, 10); break;
+		case 'c': capture_path = optarg; break;
+		case 'v': verbose = true; break;
+		default:
+			usage (argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	stress_worker_t *workers = calloc (threads ? threads : 1, sizeof *workers);
+	if (!workers) {
+		fprintf (stderr, "Could not allocate memory\n");
+		return 1;
+	}
+
+	lively_audio_stats_init (&stats);
+	lively_app_init (&app);
+	app.audio_stats = &stats;
+
+	if (capture_path) {
+		// Keeps the channels the scene takes, sized for the default rate.
+		lively_audio_config_t config;
+		lively_audio_config_init (&config);
+		if (!lively_capture_init (&capture, &app, LIVELY_WAV_PCM_24,
+				STRESS_INPUTS, config.frames_per_second, duration)) {
+			fprintf (stderr, "Could not set up the capture\n");
+			return 1;
+		}
+		app.capture = &capture;
+	}
+
+	stress.app = &app;
+	pthread_mutex_init (&stress.lock, NULL);
+	atomic_init (&stress.stop, false);
+	atomic_init (&stress.operations, 0);
+	stress_build_scene (&stress);
+
+	lively_thread_t app_thread;
+	if (!lively_thread_init (&app_thread, &app, stress_app_main)) {
+		fprintf (stderr, "Could not start the application thread\n");
+		return 1;
+	}
+
+	stress.base_length = lively_scene_get_buffer_length (&app.scene);
+
+	for (unsigned int i = 0; i < threads; i++) {
+		workers[i].stress = &stress;
+		workers[i].seed = 0x9e3779b9u * (i + 1);
+		pthread_create (&workers[i].thread, NULL, stress_worker_main, &workers[i]);
+	}
+
+	platform_sleep_until (platform_time () + duration);
+
+	atomic_store (&stress.stop, true);
+	for (unsigned int i = 0; i < threads; i++) {
+		pthread_join (workers[i].thread, NULL);
+	}
+
+	if (capture_path) {
+		lively_capture_save (&capture, capture_path, duration, duration);
+	}
+	lively_app_shutdown (&app);
+	lively_thread_join (&app_thread);
+	if (capture_path) {
+		lively_capture_wait (&capture);
+		lively_capture_destroy (&capture);
+		app.capture = NULL;
+	}
+
+	if (verbose) {
+		lively_audio_stats_print (&stats, stdout);
+	} else {
+		printf ("# periods %llu xruns %lu\n", stats.periods, stats.xruns);
+		printf ("# wakeup  max %.1fus\n", stats.wakeup.max * 1e6);
+		printf ("# process max %.1fus\n", stats.process.max * 1e6);
+		printf ("# total   max %.1fus\n", stats.total.max * 1e6);
+	}
+	printf ("# edits %llu in %.1fs by %u threads\n",
+		(unsigned long long) atomic_load (&stress.operations), duration, threads);
+
+	bool failed = false;
+	double worst = stats.total.count ? stats.total.max : stats.process.max;
+	if (stats.periods == 0) {
+		printf ("FAIL: no periods were processed\n");
+		failed = true;
+	}
+	if (worst > budget) {
+		printf ("FAIL: worst period took %.1fus, budget is %.1fus\n",
+			worst * 1e6, budget * 1e6);
+		failed = true;
+	}
+	if (stats.xruns) {
+		printf ("FAIL: %lu xruns\n", stats.xruns);
+		failed = true;
+	}
+	if (!failed) {
+		printf ("PASS\n");
+	}
+
+	lively_app_destroy (&app);
+	pthread_mutex_destroy (&stress.lock);
+	free (workers);
+
+	return failed ? 1 : 0;
+}
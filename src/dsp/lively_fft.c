@@ -0,0 +1,566 @@
+/**
+ * @file lively_fft.c
+ * Lively FFT: Mixed-radix fast Fourier transforms with shared plans
+ *
+ * The complex transform is a Stockham autosort FFT: every stage reads one
+ * buffer and writes the other, so the output comes out in natural order
+ * without a bit reversal pass. Stages are radix 4, 2, 3 and 5. Within a
+ * stage, the butterflies of consecutive elements are independent and read
+ * and write consecutive addresses of split arrays, which lets the compiler
+ * run them across vector lanes.
+ *
+ * Real transforms of size n run as a complex transform of n / 2, with the
+ * even samples as real parts and the odd samples as imaginary parts.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_fft.h"
+
+#define FFT_PI 3.14159265358979323846
+
+static pthread_mutex_t fft_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static lively_fft_t *fft_cache = NULL;
+
+static inline void
+fft_butterfly2 (float *re, float *im) {
+	float r = re[0] - re[1], i = im[0] - im[1];
+	re[0] += re[1];
+	im[0] += im[1];
+	re[1] = r;
+	im[1] = i;
+}
+
+static inline void
+fft_butterfly3 (float *re, float *im) {
+	const float s = 0.86602540378443865f;
+	float t1r = re[1] + re[2], t1i = im[1] + im[2];
+	float t2r = re[0] - 0.5f * t1r, t2i = im[0] - 0.5f * t1i;
+	// -i * s * (a1 - a2)
+	float t3r = s * (im[1] - im[2]), t3i = -s * (re[1] - re[2]);
+
+	re[0] += t1r;
+	im[0] += t1i;
+	re[1] = t2r + t3r;
+	im[1] = t2i + t3i;
+	re[2] = t2r - t3r;
+	im[2] = t2i - t3i;
+}
+
+static inline void
+fft_butterfly4 (float *re, float *im) {
+	float t0r = re[0] + re[2], t0i = im[0] + im[2];
+	float t1r = re[0] - re[2], t1i = im[0] - im[2];
+	float t2r = re[1] + re[3], t2i = im[1] + im[3];
+	float t3r = re[1] - re[3], t3i = im[1] - im[3];
+
+	re[0] = t0r + t2r;
+	im[0] = t0i + t2i;
+	re[2] = t0r - t2r;
+	im[2] = t0i - t2i;
+	// y1 = t1 - i t3, y3 = t1 + i t3
+	re[1] = t1r + t3i;
+	im[1] = t1i - t3r;
+	re[3] = t1r - t3i;
+	im[3] = t1i + t3r;
+}
+
+static inline void
+fft_butterfly5 (float *re, float *im) {
+	const float c1 = 0.30901699437494742f, c2 = -0.80901699437494742f;
+	const float s1 = 0.95105651629515357f, s2 = 0.58778525229247313f;
+	float t1r = re[1] + re[4], t1i = im[1] + im[4];
+	float t2r = re[2] + re[3], t2i = im[2] + im[3];
+	float t3r = re[1] - re[4], t3i = im[1] - im[4];
+	float t4r = re[2] - re[3], t4i = im[2] - im[3];
+
+	float b1r = re[0] + c1 * t1r + c2 * t2r, b1i = im[0] + c1 * t1i + c2 * t2i;
+	float b2r = re[0] + c2 * t1r + c1 * t2r, b2i = im[0] + c2 * t1i + c1 * t2i;
+	float d1r = s1 * t3r + s2 * t4r, d1i = s1 * t3i + s2 * t4i;
+	float d2r = s2 * t3r - s1 * t4r, d2i = s2 * t3i - s1 * t4i;
+
+	re[0] += t1r + t2r;
+	im[0] += t1i + t2i;
+	// y1 = b1 - i d1, y4 = b1 + i d1, y2 = b2 - i d2, y3 = b2 + i d2
+	re[1] = b1r + d1i;
+	im[1] = b1i - d1r;
+	re[4] = b1r - d1i;
+	im[4] = b1i + d1r;
+	re[2] = b2r + d2i;
+	im[2] = b2i - d2r;
+	re[3] = b2r - d2i;
+	im[3] = b2i + d2r;
+}
+
+/**
+* Defines one Stockham stage of a radix. The stage combines sub-transforms
+* of span elements into transforms of span * radix elements.
+*
+* The first stage has no twiddles and a span of one, so it runs along the
+* blocks instead of within them.
+*/
+#define FFT_STAGE(R) \
+static void \
+fft_stage##R ( \
+	unsigned int size, \
+	unsigned int span, \
+	const float *twiddle_re, \
+	const float *twiddle_im, \
+	const float *restrict in_re, \
+	const float *restrict in_im, \
+	float *restrict out_re, \
+	float *restrict out_im) { \
+	\
+	unsigned int stride = size / R; \
+	unsigned int blocks = stride / span; \
+	float re[R], im[R]; \
+	\
+	if (span == 1) { \
+		for (unsigned int b = 0; b < blocks; b++) { \
+			for (unsigned int r = 0; r < R; r++) { \
+				re[r] = in_re[b + r * stride]; \
+				im[r] = in_im[b + r * stride]; \
+			} \
+			fft_butterfly##R (re, im); \
+			for (unsigned int r = 0; r < R; r++) { \
+				out_re[b * R + r] = re[r]; \
+				out_im[b * R + r] = im[r]; \
+			} \
+		} \
+		return; \
+	} \
+	\
+	for (unsigned int b = 0; b < blocks; b++) { \
+		const float *block_re = in_re + b * span; \
+		const float *block_im = in_im + b * span; \
+		float *target_re = out_re + b * span * R; \
+		float *target_im = out_im + b * span * R; \
+		\
+		for (unsigned int k = 0; k < span; k++) { \
+			re[0] = block_re[k]; \
+			im[0] = block_im[k]; \
+			for (unsigned int r = 1; r < R; r++) { \
+				float xr = block_re[k + r * stride]; \
+				float xi = block_im[k + r * stride]; \
+				float wr = twiddle_re[(r - 1) * span + k]; \
+				float wi = twiddle_im[(r - 1) * span + k]; \
+				re[r] = xr * wr - xi * wi; \
+				im[r] = xr * wi + xi * wr; \
+			} \
+			fft_butterfly##R (re, im); \
+			for (unsigned int r = 0; r < R; r++) { \
+				target_re[k + r * span] = re[r]; \
+				target_im[k + r * span] = im[r]; \
+			} \
+		} \
+	} \
+}
+
+FFT_STAGE (2)
+FFT_STAGE (3)
+FFT_STAGE (4)
+FFT_STAGE (5)
+
+/**
+* Splits a size into radix stages, or returns false if it has other prime
+* factors.
+*/
+static bool
+fft_factor (unsigned int size, unsigned char *radix, unsigned int *stages) {
+	static const unsigned int radices[] = {4, 2, 3, 5};
+	unsigned int count = 0;
+
+	if (size == 0) {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < sizeof radices / sizeof *radices; i++) {
+		while (size % radices[i] == 0) {
+			radix[count++] = (unsigned char) radices[i];
+			size /= radices[i];
+			if (radices[i] == 2) {
+				break;
+			}
+		}
+	}
+
+	*stages = count;
+	return size == 1;
+}
+
+/**
+* Returns true if plans of the given size and kind can be made.
+*
+* @param size The number of samples of the transform
+* @param kind The kind of transform
+*/
+bool
+lively_fft_size_supported (unsigned int size, lively_fft_kind_t kind) {
+	unsigned char radix[LIVELY_FFT_STAGES_MAX];
+	unsigned int stages;
+
+	if (kind == LIVELY_FFT_REAL) {
+		if (size % 2 != 0) {
+			return false;
+		}
+		size /= 2;
+	}
+	return fft_factor (size, radix, &stages);
+}
+
+/**
+* Returns the smallest supported size of at least the given size, which is
+* never much larger.
+*
+* @param size The number of samples needed
+* @param kind The kind of transform
+*/
+unsigned int
+lively_fft_good_size (unsigned int size, lively_fft_kind_t kind) {
+	if (size < 2) {
+		size = 2;
+	}
+	while (!lively_fft_size_supported (size, kind)) {
+		size++;
+	}
+	return size;
+}
+
+static void
+fft_free (lively_fft_t *fft) {
+	free (fft->twiddle_re);
+	free (fft->twiddle_im);
+	free (fft->post_re);
+	free (fft->post_im);
+	free (fft);
+}
+
+static void fft_release_locked (lively_fft_t *);
+
+static lively_fft_t *
+fft_acquire_locked (unsigned int size, lively_fft_kind_t kind) {
+	for (lively_fft_t *fft = fft_cache; fft; fft = fft->next) {
+		if (fft->size == size && fft->kind == kind) {
+			fft->references++;
+			return fft;
+		}
+	}
+
+	if (!lively_fft_size_supported (size, kind)) {
+		return NULL;
+	}
+
+	lively_fft_t *fft = calloc (1, sizeof *fft);
+	if (!fft) {
+		return NULL;
+	}
+	fft->size = size;
+	fft->kind = kind;
+	fft->references = 1;
+
+	if (kind == LIVELY_FFT_REAL) {
+		unsigned int half = size / 2;
+
+		fft->half = fft_acquire_locked (half, LIVELY_FFT_COMPLEX);
+		fft->post_re = malloc ((half + 1) * sizeof *fft->post_re);
+		fft->post_im = malloc ((half + 1) * sizeof *fft->post_im);
+		if (!fft->half || !fft->post_re || !fft->post_im) {
+			if (fft->half) {
+				fft_release_locked (fft->half);
+			}
+			fft_free (fft);
+			return NULL;
+		}
+
+		for (unsigned int k = 0; k <= half; k++) {
+			double angle = -2.0 * FFT_PI * k / size;
+			fft->post_re[k] = (float) cos (angle);
+			fft->post_im[k] = (float) sin (angle);
+		}
+	} else {
+		fft_factor (size, fft->radix, &fft->stages);
+
+		size_t twiddles = 0;
+		unsigned int span = 1;
+		for (unsigned int s = 0; s < fft->stages; s++) {
+			twiddles += (size_t) (fft->radix[s] - 1) * span;
+			span *= fft->radix[s];
+		}
+
+		fft->twiddle_re = malloc ((twiddles ? twiddles : 1) * sizeof (float));
+		fft->twiddle_im = malloc ((twiddles ? twiddles : 1) * sizeof (float));
+		if (!fft->twiddle_re || !fft->twiddle_im) {
+			fft_free (fft);
+			return NULL;
+		}
+
+		size_t offset = 0;
+		span = 1;
+		for (unsigned int s = 0; s < fft->stages; s++) {
+			unsigned int radix = fft->radix[s];
+			for (unsigned int r = 1; r < radix; r++) {
+				for (unsigned int k = 0; k < span; k++) {
+					double angle = -2.0 * FFT_PI * r * k / ((double) span * radix);
+					fft->twiddle_re[offset] = (float) cos (angle);
+					fft->twiddle_im[offset] = (float) sin (angle);
+					offset++;
+				}
+			}
+			span *= radix;
+		}
+	}
+
+	fft->next = fft_cache;
+	fft_cache = fft;
+	return fft;
+}
+
+static void
+fft_release_locked (lively_fft_t *fft) {
+	if (--fft->references > 0) {
+		return;
+	}
+
+	lively_fft_t **link = &fft_cache;
+	while (*link != fft) {
+		link = &(*link)->next;
+	}
+	*link = fft->next;
+
+	if (fft->half) {
+		fft_release_locked (fft->half);
+	}
+	fft_free (fft);
+}
+
+/**
+* Returns the plan for transforms of a size and kind, creating it if no
+* one holds it yet. Allocates, so it must not be called on the audio thread.
+*
+* @param size The number of samples of the transform
+* @param kind The kind of transform
+*
+* @return The plan, or NULL if the size is not supported or memory ran out
+*/
+lively_fft_t *
+lively_fft_acquire (unsigned int size, lively_fft_kind_t kind) {
+	pthread_mutex_lock (&fft_cache_lock);
+	lively_fft_t *fft = fft_acquire_locked (size, kind);
+	pthread_mutex_unlock (&fft_cache_lock);
+	return fft;
+}
+
+/**
+* Gives up a plan from #lively_fft_acquire.
+*
+* @param fft The plan, or NULL
+*/
+void
+lively_fft_release (lively_fft_t *fft) {
+	if (!fft) {
+		return;
+	}
+	pthread_mutex_lock (&fft_cache_lock);
+	fft_release_locked (fft);
+	pthread_mutex_unlock (&fft_cache_lock);
+}
+
+/**
+* Returns the number of floats of work area an execution of a plan needs.
+*
+* @param fft The plan
+*/
+size_t
+lively_fft_work_size (const lively_fft_t *fft) {
+	// Complex: one buffer to alternate with. Real: the packed input and
+	// output of the half size transform, and its work area.
+	return fft->kind == LIVELY_FFT_COMPLEX
+		? 2 * (size_t) fft->size
+		: 3 * (size_t) fft->size;
+}
+
+static void
+fft_execute (
+	const lively_fft_t *fft,
+	const float *input_re,
+	const float *input_im,
+	float *output_re,
+	float *output_im,
+	float *work) {
+
+	unsigned int size = fft->size;
+	float *work_re = work;
+	float *work_im = work + size;
+
+	if (fft->stages == 0) {
+		memmove (output_re, input_re, size * sizeof *output_re);
+		memmove (output_im, input_im, size * sizeof *output_im);
+		return;
+	}
+
+	// Stages alternate between the work area and the output, arranged so
+	// that the last one writes the output.
+	const float *from_re = input_re, *from_im = input_im;
+	const float *twiddle_re = fft->twiddle_re, *twiddle_im = fft->twiddle_im;
+	unsigned int span = 1;
+
+	for (unsigned int s = 0; s < fft->stages; s++) {
+		bool to_output = (fft->stages - 1 - s) % 2 == 0;
+		float *to_re = to_output ? output_re : work_re;
+		float *to_im = to_output ? output_im : work_im;
+		unsigned int radix = fft->radix[s];
+
+		switch (radix) {
+		case 2:
+			fft_stage2 (size, span, twiddle_re, twiddle_im, from_re, from_im, to_re, to_im);
+			break;
+		case 3:
+			fft_stage3 (size, span, twiddle_re, twiddle_im, from_re, from_im, to_re, to_im);
+			break;
+		case 4:
+			fft_stage4 (size, span, twiddle_re, twiddle_im, from_re, from_im, to_re, to_im);
+			break;
+		default:
+			fft_stage5 (size, span, twiddle_re, twiddle_im, from_re, from_im, to_re, to_im);
+			break;
+		}
+
+		twiddle_re += (radix - 1) * span;
+		twiddle_im += (radix - 1) * span;
+		span *= radix;
+		from_re = to_re;
+		from_im = to_im;
+	}
+}
+
+/**
+* Computes a forward complex transform. The input and output must not
+* overlap.
+*
+* @param fft A complex plan
+* @param input_re Real parts of the fft->size input samples
+* @param input_im Imaginary parts of the input
+* @param output_re Receives the real parts of the spectrum
+* @param output_im Receives the imaginary parts of the spectrum
+* @param work A work area of #lively_fft_work_size floats
+*/
+void
+lively_fft_complex (
+	const lively_fft_t *fft,
+	const float *input_re,
+	const float *input_im,
+	float *output_re,
+	float *output_im,
+	float *work) {
+
+	fft_execute (fft, input_re, input_im, output_re, output_im, work);
+}
+
+/**
+* Computes an inverse complex transform, scaled by fft->size.
+*
+* @see lively_fft_complex()
+*/
+void
+lively_fft_complex_inverse (
+	const lively_fft_t *fft,
+	const float *input_re,
+	const float *input_im,
+	float *output_re,
+	float *output_im,
+	float *work) {
+
+	// Swapping real and imaginary parts on the way in and out conjugates
+	// the twiddles.
+	fft_execute (fft, input_im, input_re, output_im, output_re, work);
+}
+
+/**
+* Computes the spectrum of fft->size real samples, as fft->size / 2 + 1
+* bins from DC to Nyquist.
+*
+* @param fft A real plan
+* @param input The samples
+* @param output_re Receives the real parts of the bins
+* @param output_im Receives the imaginary parts of the bins
+* @param work A work area of #lively_fft_work_size floats
+*/
+void
+lively_fft_real (
+	const lively_fft_t *fft,
+	const float *input,
+	float *output_re,
+	float *output_im,
+	float *work) {
+
+	unsigned int half = fft->size / 2;
+	float *z_re = work, *z_im = work + half;
+	float *y_re = work + 2 * half, *y_im = work + 3 * half;
+
+	for (unsigned int m = 0; m < half; m++) {
+		z_re[m] = input[2 * m];
+		z_im[m] = input[2 * m + 1];
+	}
+	fft_execute (fft->half, z_re, z_im, y_re, y_im, work + 4 * half);
+
+	output_re[0] = y_re[0] + y_im[0];
+	output_im[0] = 0.0f;
+	output_re[half] = y_re[0] - y_im[0];
+	output_im[half] = 0.0f;
+
+	// The spectra of the even and odd samples are separated using the
+	// symmetry of real spectra, and combined with one more twiddle.
+	for (unsigned int k = 1; k < half; k++) {
+		float zr = y_re[k], zi = y_im[k];
+		float cr = y_re[half - k], ci = -y_im[half - k];
+		float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+		float odd_re = 0.5f * (zi - ci), odd_im = -0.5f * (zr - cr);
+		float wr = fft->post_re[k], wi = fft->post_im[k];
+
+		output_re[k] = er + wr * odd_re - wi * odd_im;
+		output_im[k] = ei + wr * odd_im + wi * odd_re;
+	}
+}
+
+/**
+* Computes fft->size real samples from fft->size / 2 + 1 bins, scaled by
+* fft->size. The imaginary parts of the DC and Nyquist bins are ignored.
+*
+* @see lively_fft_real()
+*/
+void
+lively_fft_real_inverse (
+	const lively_fft_t *fft,
+	const float *input_re,
+	const float *input_im,
+	float *output,
+	float *work) {
+
+	unsigned int half = fft->size / 2;
+	float *z_re = work, *z_im = work + half;
+	float *y_re = work + 2 * half, *y_im = work + 3 * half;
+
+	// The inverse of the separation in lively_fft_real, without its
+	// halving, which scales the result by size rather than half of it.
+	for (unsigned int k = 0; k < half; k++) {
+		float xr = input_re[k], xi = k ? input_im[k] : 0.0f;
+		float cr = input_re[half - k], ci = k ? -input_im[half - k] : 0.0f;
+		float wr = fft->post_re[k], wi = -fft->post_im[k];
+		float er = xr + cr, ei = xi + ci;
+		float dr = xr - cr, di = xi - ci;
+		float odd_re = dr * wr - di * wi, odd_im = dr * wi + di * wr;
+
+		z_re[k] = er - odd_im;
+		z_im[k] = ei + odd_re;
+	}
+
+	fft_execute (fft->half, z_im, z_re, y_im, y_re, work + 4 * half);
+
+	for (unsigned int m = 0; m < half; m++) {
+		output[2 * m] = y_re[m];
+		output[2 * m + 1] = y_im[m];
+	}
+}
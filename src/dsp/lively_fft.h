@@ -0,0 +1,83 @@
+#ifndef LIVELY_FFT_H
+#define LIVELY_FFT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Most radix stages in a plan, enough for any 32-bit size */
+#define LIVELY_FFT_STAGES_MAX 32
+
+/**
+ * Specifies the kind of transform of a plan.
+ */
+typedef enum lively_fft_kind {
+	LIVELY_FFT_COMPLEX, /**< Complex to complex, of any supported size */
+	LIVELY_FFT_REAL /**< Real to half spectrum and back, of even sizes */
+} lively_fft_kind_t;
+
+/**
+ * A plan for transforms of one size and kind, with its factorization and
+ * twiddle tables computed in advance.
+ *
+ * Plans are cached and shared: every acquire of the same size and kind
+ * returns the same plan, which is freed after its last release. A plan is
+ * never modified after it is created, so any number of threads may execute
+ * it at once, each with its own work area. Executing never allocates.
+ *
+ * Sizes must factor into 2, 3 and 5. Spectra are stored split, as separate
+ * arrays of real and imaginary parts, so that the butterflies vectorize
+ * across independent elements. Inverse transforms are not scaled; a round
+ * trip multiplies by the size.
+ */
+typedef struct lively_fft {
+	struct lively_fft *next; /**< In the cache */
+	unsigned int references;
+
+	lively_fft_kind_t kind;
+	unsigned int size;
+
+	/** Radices of the stages of the complex transform, in order */
+	unsigned int stages;
+	unsigned char radix[LIVELY_FFT_STAGES_MAX];
+	float *twiddle_re, *twiddle_im; /**< The twiddles of every stage, in order */
+
+	/** For real transforms, the complex transform of half the size */
+	struct lively_fft *half;
+	float *post_re, *post_im; /**< exp (-2 pi i k / size), for k up to size / 2 */
+} lively_fft_t;
+
+bool lively_fft_size_supported (unsigned int size, lively_fft_kind_t kind);
+unsigned int lively_fft_good_size (unsigned int size, lively_fft_kind_t kind);
+
+lively_fft_t *lively_fft_acquire (unsigned int size, lively_fft_kind_t kind);
+void lively_fft_release (lively_fft_t *);
+size_t lively_fft_work_size (const lively_fft_t *);
+
+void lively_fft_complex (
+	const lively_fft_t *,
+	const float *input_re,
+	const float *input_im,
+	float *output_re,
+	float *output_im,
+	float *work);
+void lively_fft_complex_inverse (
+	const lively_fft_t *,
+	const float *input_re,
+	const float *input_im,
+	float *output_re,
+	float *output_im,
+	float *work);
+void lively_fft_real (
+	const lively_fft_t *,
+	const float *input,
+	float *output_re,
+	float *output_im,
+	float *work);
+void lively_fft_real_inverse (
+	const lively_fft_t *,
+	const float *input_re,
+	const float *input_im,
+	float *output,
+	float *work);
+
+#endif
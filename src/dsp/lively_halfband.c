@@ -0,0 +1,319 @@
+/**
+ * @file lively_halfband.c
+ * Lively Halfband: Oversampling by cascaded half-band filters
+ *
+ * A half-band filter is a Kaiser windowed sinc cut off at a quarter of the
+ * doubled rate, h[m] = sin(pi m / 2) / (pi m) w[m], whose only nonzero
+ * coefficients are the middle one, 1/2, and the odd ones. A stage with 2K
+ * odd coefficients delays its signal by K frames of its lower rate, which
+ * makes the latency of the whole cascade a whole number of base frames.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_halfband.h"
+
+#define HALFBAND_PI 3.14159265358979323846
+/** Of the Kaiser window; over 90 dB of stopband attenuation in every stage */
+#define HALFBAND_BETA 10.0
+/** Most odd coefficients of a stage */
+#define HALFBAND_TAPS_MAX 40
+/** Most frames of the lower rate of a stage, in one block */
+#define HALFBAND_FRAMES_MAX (LIVELY_HALFBAND_BLOCK << (LIVELY_HALFBAND_STAGES_MAX - 1))
+/** Frames filtered together, in as many registers as fit without spilling */
+#define HALFBAND_GROUP 32
+
+/**
+* Half the odd coefficients of each stage, from the base rate up. The first
+* stage keeps 20 kHz at 48 kHz within 0.001 dB; the others only need to
+* stop the images of that band, which lie further from theirs.
+*/
+static const unsigned int halfband_half_taps[LIVELY_HALFBAND_STAGES_MAX] = {20, 8, 4};
+
+/** The odd coefficients of each stage, from the latest input frame back */
+static float halfband_taps[LIVELY_HALFBAND_STAGES_MAX][HALFBAND_TAPS_MAX];
+static pthread_once_t halfband_taps_once = PTHREAD_ONCE_INIT;
+
+/**
+* The zeroth order modified Bessel function of the first kind, by its
+* power series.
+*/
+static double
+halfband_bessel (double x) {
+	double sum = 1.0, term = 1.0;
+	for (unsigned int k = 1; k < 64 && term > sum * 1e-12; k++) {
+		double half = x / (2.0 * k);
+		term *= half * half;
+		sum += term;
+	}
+	return sum;
+}
+
+/**
+* Computes the coefficients of every stage, scaled so that each phase
+* passes DC at unity gain.
+*/
+static void
+halfband_design (void) {
+	double scale = 1.0 / halfband_bessel (HALFBAND_BETA);
+
+	for (unsigned int s = 0; s < LIVELY_HALFBAND_STAGES_MAX; s++) {
+		unsigned int half = halfband_half_taps[s];
+		double coefficients[HALFBAND_TAPS_MAX];
+		double length = 2.0 * half;
+		double sum = 0.0;
+
+		for (unsigned int j = 0; j < 2 * half; j++) {
+			// Tap j is h[m] at the odd m = 2K - 1 - 2j.
+			double m = 2.0 * half - 1.0 - 2.0 * j;
+			double ratio = m / length;
+			double window = halfband_bessel (HALFBAND_BETA * sqrt (1.0 - ratio * ratio)) * scale;
+			coefficients[j] = sin (HALFBAND_PI * m / 2.0) / (HALFBAND_PI * m) * window;
+			sum += coefficients[j];
+		}
+		for (unsigned int j = 0; j < 2 * half; j++) {
+			halfband_taps[s][j] = (float) (coefficients[j] * 0.5 / sum);
+		}
+	}
+}
+
+/**
+* Filters a block a group of frames at a time, each group summed over all
+* the taps in a handful of vector registers. The block is rounded up to
+* whole groups, reading past its end into the slack of the line.
+*/
+static void
+halfband_filter (
+	const float *restrict line,
+	const float *restrict taps,
+	unsigned int count,
+	float *restrict sums,
+	unsigned int frames) {
+
+	for (unsigned int i = 0; i < frames; i += HALFBAND_GROUP) {
+		float group[HALFBAND_GROUP] = {0.0f};
+
+		for (unsigned int j = 0; j < count; j++) {
+			const float *window = line + i + j;
+			float tap = taps[j];
+			for (unsigned int k = 0; k < HALFBAND_GROUP; k++) {
+				group[k] += tap * window[k];
+			}
+		}
+		for (unsigned int k = 0; k < HALFBAND_GROUP; k++) {
+			sums[i + k] = group[k];
+		}
+	}
+}
+
+/**
+* Doubles the rate of a block. The line holds 2K - 1 frames of history and
+* then the frames of the block; the even output frames are the input,
+* delayed by K, and the odd ones are filtered from the line.
+*/
+static void
+halfband_double (
+	const float *restrict line,
+	const float *restrict taps,
+	unsigned int half,
+	float *restrict output,
+	unsigned int frames) {
+
+	float odd[HALFBAND_FRAMES_MAX + HALFBAND_GROUP];
+
+	halfband_filter (line, taps, 2 * half, odd, frames);
+	for (unsigned int i = 0; i < frames; i++) {
+		output[2 * i] = line[i + half - 1];
+		output[2 * i + 1] = 2.0f * odd[i];
+	}
+}
+
+/**
+* Halves the rate of a block, from lines of its odd frames, after 2K frames
+* of history, and of its even frames, after K frames of history.
+*/
+static void
+halfband_halve (
+	const float *restrict odd,
+	const float *restrict even,
+	const float *restrict taps,
+	unsigned int half,
+	float *restrict output,
+	unsigned int frames) {
+
+	float sums[HALFBAND_FRAMES_MAX + HALFBAND_GROUP];
+
+	halfband_filter (odd, taps, 2 * half, sums, frames);
+	for (unsigned int i = 0; i < frames; i++) {
+		output[i] = 0.5f * even[i] + sums[i];
+	}
+}
+
+/**
+* Initializes a cascade with silent history.
+*
+* @param halfband The cascade
+* @param factor The oversampling factor: 1, 2, 4 or 8
+*
+* @return A success value
+*/
+bool
+lively_halfband_init (lively_halfband_t *halfband, unsigned int factor) {
+	unsigned int stages = 0;
+	size_t size = 0;
+
+	while ((1u << stages) < factor && stages < LIVELY_HALFBAND_STAGES_MAX) {
+		stages++;
+	}
+	if ((1u << stages) != factor) {
+		return false;
+	}
+
+	pthread_once (&halfband_taps_once, halfband_design);
+
+	for (unsigned int s = 0; s < stages; s++) {
+		unsigned int half = halfband_half_taps[s];
+		size += 5 * half - 1 + 3 * (LIVELY_HALFBAND_BLOCK << s) + 2 * HALFBAND_GROUP;
+	}
+	halfband->lines = NULL;
+	if (size && !(halfband->lines = malloc (size * sizeof *halfband->lines))) {
+		return false;
+	}
+
+	float *line = halfband->lines;
+	for (unsigned int s = 0; s < stages; s++) {
+		unsigned int half = halfband_half_taps[s];
+		unsigned int frames = LIVELY_HALFBAND_BLOCK << s;
+
+		halfband->up[s] = line;
+		line += 2 * half - 1 + frames + HALFBAND_GROUP;
+		halfband->down_odd[s] = line;
+		line += 2 * half + frames + HALFBAND_GROUP;
+		halfband->down_even[s] = line;
+		line += half + frames;
+	}
+
+	halfband->stages = stages;
+	halfband->factor = factor;
+	halfband->size = size;
+	lively_halfband_reset (halfband);
+	return true;
+}
+
+/**
+* Frees the lines of a cascade.
+*
+* @param halfband The cascade
+*/
+void
+lively_halfband_destroy (lively_halfband_t *halfband) {
+	free (halfband->lines);
+	halfband->lines = NULL;
+}
+
+/**
+* Silences the history of a cascade.
+*
+* @param halfband The cascade
+*/
+void
+lively_halfband_reset (lively_halfband_t *halfband) {
+	if (halfband->lines) {
+		memset (halfband->lines, 0, halfband->size * sizeof *halfband->lines);
+	}
+}
+
+/**
+* Returns the frames, at the base rate, by which oversampling and coming
+* back down delays a signal.
+*
+* @param factor The oversampling factor: 1, 2, 4 or 8
+*/
+unsigned int
+lively_halfband_latency (unsigned int factor) {
+	unsigned int latency = 0;
+
+	for (unsigned int s = 0; s < LIVELY_HALFBAND_STAGES_MAX && (1u << s) < factor; s++) {
+		latency += (2 * halfband_half_taps[s]) >> s;
+	}
+	return latency;
+}
+
+/**
+* Raises a block to the oversampled rate.
+*
+* @param halfband The cascade
+* @param input The frames at the base rate
+* @param output Receives frames times the factor frames
+* @param frames The number of frames, up to #LIVELY_HALFBAND_BLOCK
+*/
+void
+lively_halfband_up (
+	lively_halfband_t *halfband,
+	const float *input,
+	float *output,
+	unsigned int frames) {
+
+	if (halfband->stages == 0) {
+		memcpy (output, input, frames * sizeof *output);
+		return;
+	}
+
+	memcpy (halfband->up[0] + 2 * halfband_half_taps[0] - 1, input, frames * sizeof *input);
+
+	for (unsigned int s = 0; s < halfband->stages; s++) {
+		unsigned int half = halfband_half_taps[s];
+		float *line = halfband->up[s];
+		// Each stage writes straight into the line of the next.
+		float *target = s + 1 < halfband->stages
+			? halfband->up[s + 1] + 2 * halfband_half_taps[s + 1] - 1 : output;
+
+		halfband_double (line, halfband_taps[s], half, target, frames);
+		memmove (line, line + frames, (2 * half - 1) * sizeof *line);
+		frames *= 2;
+	}
+}
+
+/**
+* Brings a block back down to the base rate.
+*
+* @param halfband The cascade
+* @param input Frames times the factor frames at the oversampled rate
+* @param output Receives the frames at the base rate
+* @param frames The number of frames, up to #LIVELY_HALFBAND_BLOCK
+*/
+void
+lively_halfband_down (
+	lively_halfband_t *halfband,
+	const float *input,
+	float *output,
+	unsigned int frames) {
+
+	float block[HALFBAND_FRAMES_MAX];
+
+	if (halfband->stages == 0) {
+		memcpy (output, input, frames * sizeof *output);
+		return;
+	}
+
+	for (unsigned int s = halfband->stages; s-- > 0;) {
+		unsigned int half = halfband_half_taps[s];
+		unsigned int count = frames << s;
+		float *odd = halfband->down_odd[s];
+		float *even = halfband->down_even[s];
+
+		// The input is read out into the lines before the block is
+		// overwritten, so every stage can leave its output there.
+		for (unsigned int i = 0; i < count; i++) {
+			even[half + i] = input[2 * i];
+			odd[2 * half + i] = input[2 * i + 1];
+		}
+		halfband_halve (odd, even, halfband_taps[s], half, s ? block : output, count);
+		memmove (odd, odd + count, 2 * half * sizeof *odd);
+		memmove (even, even + count, half * sizeof *even);
+		input = block;
+	}
+}
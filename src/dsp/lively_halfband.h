@@ -0,0 +1,56 @@
+#ifndef LIVELY_HALFBAND_H
+#define LIVELY_HALFBAND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Most halvings of the sample rate, for oversampling by up to 8 */
+#define LIVELY_HALFBAND_STAGES_MAX 3
+/** Most frames, at the base rate, converted at once */
+#define LIVELY_HALFBAND_BLOCK 64
+
+/**
+ * Oversamples one channel by 2, 4 or 8 and back, through a cascade of
+ * half-band filters which each double or halve the rate.
+ *
+ * Every other coefficient of a half-band filter is zero, so each stage is
+ * polyphase: doubling keeps the input as the even frames and computes only
+ * the odd ones, and halving takes a single sum over the odd input frames.
+ * Each sum is run a tap at a time over a whole block of frames, so the
+ * inner loops are plain vector multiply-adds. Later stages see more
+ * headroom between the band and its images, and get shorter filters.
+ *
+ * Both directions keep their history in lines allocated up front, so
+ * converting never allocates.
+ */
+typedef struct lively_halfband {
+	unsigned int stages;
+	unsigned int factor; /**< 1 << stages */
+
+	/** Per stage: the base-rate history and block to double */
+	float *up[LIVELY_HALFBAND_STAGES_MAX];
+	/** Per stage: the odd and even frames of the block to halve */
+	float *down_odd[LIVELY_HALFBAND_STAGES_MAX];
+	float *down_even[LIVELY_HALFBAND_STAGES_MAX];
+	float *lines; /**< One allocation holding every line */
+	size_t size; /**< Samples of the lines */
+} lively_halfband_t;
+
+bool lively_halfband_init (lively_halfband_t *, unsigned int factor);
+void lively_halfband_destroy (lively_halfband_t *);
+void lively_halfband_reset (lively_halfband_t *);
+
+unsigned int lively_halfband_latency (unsigned int factor);
+
+void lively_halfband_up (
+	lively_halfband_t *,
+	const float *input,
+	float *output,
+	unsigned int frames);
+void lively_halfband_down (
+	lively_halfband_t *,
+	const float *input,
+	float *output,
+	unsigned int frames);
+
+#endif
@@ -0,0 +1,476 @@
+/**
+ * @file lively_resampler.c
+ * Lively Resampler: Polyphase sample rate conversion with shared banks
+ *
+ * The filters are Kaiser windowed sincs. An output frame at input time t,
+ * between frames i and i + 1, is the sum over the taps of the window
+ * starting at i - taps / 2 + 1, each weighted by the sinc at its distance
+ * from t. Splitting the fraction of t into phases gives one row of
+ * coefficients per phase, computed once for every resampler of the same
+ * filter.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_resampler.h"
+
+#define RESAMPLER_PI 3.14159265358979323846
+/** Of the Kaiser window; about 90 dB of stopband attenuation */
+#define RESAMPLER_BETA 9.0
+/** Passband edge, as a fraction of the lower Nyquist frequency */
+#define RESAMPLER_ROLLOFF 0.92
+/** Taps are a multiple of this, so that each half of a dot product is whole vectors */
+#define RESAMPLER_ALIGN 8
+/** Bits of a variable fraction which select the row */
+#define RESAMPLER_ROW_BITS 8
+
+_Static_assert (LIVELY_RESAMPLER_VARIABLE_PHASES == 1 << RESAMPLER_ROW_BITS,
+	"The row of a variable fraction is its top bits");
+
+static pthread_mutex_t resampler_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static lively_resampler_bank_t *resampler_cache = NULL;
+
+/**
+* The zeroth order modified Bessel function of the first kind, by its
+* power series.
+*/
+static double
+resampler_bessel (double x) {
+	double sum = 1.0, term = 1.0;
+	for (unsigned int k = 1; k < 64 && term > sum * 1e-12; k++) {
+		double half = x / (2.0 * k);
+		term *= half * half;
+		sum += term;
+	}
+	return sum;
+}
+
+static lively_resampler_bank_t *
+resampler_bank_acquire_locked (unsigned int phases, unsigned int taps, double cutoff) {
+	for (lively_resampler_bank_t *bank = resampler_cache; bank; bank = bank->next) {
+		if (bank->phases == phases && bank->taps == taps && bank->cutoff == cutoff) {
+			bank->references++;
+			return bank;
+		}
+	}
+
+	lively_resampler_bank_t *bank = malloc (sizeof *bank);
+	if (!bank) {
+		return NULL;
+	}
+	bank->coefficients = malloc ((size_t) (phases + 1) * taps * sizeof *bank->coefficients);
+	if (!bank->coefficients) {
+		free (bank);
+		return NULL;
+	}
+	bank->references = 1;
+	bank->phases = phases;
+	bank->taps = taps;
+	bank->cutoff = cutoff;
+
+	double half = taps / 2;
+	double scale = 1.0 / resampler_bessel (RESAMPLER_BETA);
+
+	for (unsigned int p = 0; p <= phases; p++) {
+		float *row = bank->coefficients + (size_t) p * taps;
+		double sum = 0.0;
+
+		for (unsigned int k = 0; k < taps; k++) {
+			double distance = (double) p / phases + half - 1.0 - k;
+			double x = distance / half;
+			double window = x * x < 1.0
+				? resampler_bessel (RESAMPLER_BETA * sqrt (1.0 - x * x)) * scale : 0.0;
+			double argument = 2.0 * cutoff * distance;
+			double sinc = argument == 0.0
+				? 1.0 : sin (RESAMPLER_PI * argument) / (RESAMPLER_PI * argument);
+
+			row[k] = (float) (2.0 * cutoff * sinc * window);
+			sum += row[k];
+		}
+
+		// Every row passes DC at exactly unit gain, so that the phases do
+		// not modulate a constant signal.
+		for (unsigned int k = 0; k < taps; k++) {
+			row[k] = (float) (row[k] / sum);
+		}
+	}
+
+	bank->next = resampler_cache;
+	resampler_cache = bank;
+	return bank;
+}
+
+static void
+resampler_bank_release (lively_resampler_bank_t *bank) {
+	if (!bank) {
+		return;
+	}
+
+	pthread_mutex_lock (&resampler_cache_lock);
+	if (--bank->references == 0) {
+		lively_resampler_bank_t **link = &resampler_cache;
+		while (*link != bank) {
+			link = &(*link)->next;
+		}
+		*link = bank->next;
+		free (bank->coefficients);
+		free (bank);
+	}
+	pthread_mutex_unlock (&resampler_cache_lock);
+}
+
+static unsigned int
+resampler_gcd (unsigned int a, unsigned int b) {
+	while (b) {
+		unsigned int r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+/**
+* A dot product, as two sums over the halves of the taps. Each sum runs
+* across vector lanes, and the two of them overlap in the pipeline.
+*/
+static float
+resampler_dot (const float *restrict x, const float *restrict h, unsigned int taps) {
+	unsigned int half = taps / 2;
+	float first = 0.0f, second = 0.0f;
+
+	for (unsigned int k = 0; k < half; k++) {
+		first += x[k] * h[k];
+		second += x[half + k] * h[half + k];
+	}
+	return first + second;
+}
+
+/**
+* A dot product with the coefficients interpolated between two rows.
+*/
+static float
+resampler_dot_between (
+	const float *restrict x,
+	const float *restrict h0,
+	const float *restrict h1,
+	float weight,
+	unsigned int taps) {
+
+	unsigned int half = taps / 2;
+	float first = 0.0f, second = 0.0f;
+
+	for (unsigned int k = 0; k < half; k++) {
+		first += x[k] * (h0[k] + weight * (h1[k] - h0[k]));
+		second += x[half + k] * (h0[half + k] + weight * (h1[half + k] - h0[half + k]));
+	}
+	return first + second;
+}
+
+/**
+* Computes the output frames of a batch for one channel.
+*/
+static void
+resampler_run (
+	const lively_resampler_t *resampler,
+	unsigned int channel,
+	unsigned int count,
+	float *restrict output) {
+
+	const float *history = resampler->history + (size_t) channel * resampler->stride;
+	const float *coefficients = resampler->bank->coefficients;
+	const unsigned int *offset = resampler->batch_offset;
+	const unsigned int *row = resampler->batch_row;
+	unsigned int taps = resampler->bank->taps;
+
+	if (resampler->variable) {
+		const float *weight = resampler->batch_weight;
+		for (unsigned int m = 0; m < count; m++) {
+			const float *h = coefficients + (size_t) row[m] * taps;
+			output[m] = resampler_dot_between (history + offset[m], h, h + taps, weight[m], taps);
+		}
+	} else {
+		for (unsigned int m = 0; m < count; m++) {
+			output[m] = resampler_dot (history + offset[m],
+				coefficients + (size_t) row[m] * taps, taps);
+		}
+	}
+}
+
+/**
+* Initializes a resampler, sharing the bank of any other resampler with
+* the same filter. Allocates, so it must not be called on the audio thread.
+*
+* @param resampler The resampler
+* @param channels The number of channels
+* @param rate_in The sample rate of the input
+* @param rate_out The sample rate of the output
+* @param variable Whether the ratio may be adjusted with
+* #lively_resampler_set_ratio. Rates whose reduced ratio has more than
+* #LIVELY_RESAMPLER_PHASES_MAX phases are always variable.
+*
+* @return A success value
+*/
+bool
+lively_resampler_init (
+	lively_resampler_t *resampler,
+	unsigned int channels,
+	unsigned int rate_in,
+	unsigned int rate_out,
+	bool variable) {
+
+	if (channels == 0 || rate_in == 0 || rate_out == 0) {
+		return false;
+	}
+
+	unsigned int divisor = resampler_gcd (rate_in, rate_out);
+	resampler->up = rate_out / divisor;
+	resampler->down = rate_in / divisor;
+	resampler->variable = variable || resampler->up > LIVELY_RESAMPLER_PHASES_MAX;
+	resampler->channels = channels;
+	resampler->rate_in = rate_in;
+	resampler->rate_out = rate_out;
+	resampler->nominal = (uint64_t) llround (ldexp ((double) rate_in / rate_out, 32));
+	resampler->step = resampler->nominal;
+
+	// Decimating filters are longer by the ratio, so that their transition
+	// band is as narrow at the output rate.
+	double decimation = rate_in > rate_out ? (double) rate_in / rate_out : 1.0;
+	unsigned int taps = (unsigned int) ceil (LIVELY_RESAMPLER_TAPS * decimation / RESAMPLER_ALIGN)
+		* RESAMPLER_ALIGN;
+	double cutoff = 0.5 * RESAMPLER_ROLLOFF / decimation;
+	unsigned int phases = resampler->variable
+		? LIVELY_RESAMPLER_VARIABLE_PHASES : resampler->up;
+
+	pthread_mutex_lock (&resampler_cache_lock);
+	resampler->bank = resampler_bank_acquire_locked (phases, taps, cutoff);
+	pthread_mutex_unlock (&resampler_cache_lock);
+	if (!resampler->bank) {
+		return false;
+	}
+
+	resampler->stride = taps + LIVELY_RESAMPLER_CHUNK;
+	resampler->history = malloc ((size_t) resampler->stride * channels * sizeof *resampler->history);
+	if (!resampler->history) {
+		resampler_bank_release (resampler->bank);
+		resampler->bank = NULL;
+		return false;
+	}
+
+	lively_resampler_reset (resampler);
+	return true;
+}
+
+/**
+* Frees the history of a resampler, and gives up its bank.
+*
+* @param resampler The resampler
+*/
+void
+lively_resampler_destroy (lively_resampler_t *resampler) {
+	resampler_bank_release (resampler->bank);
+	free (resampler->history);
+	resampler->bank = NULL;
+	resampler->history = NULL;
+}
+
+/**
+* Forgets all input, as if the resampler were new. The ratio is kept.
+*
+* @param resampler The resampler
+*/
+void
+lively_resampler_reset (lively_resampler_t *resampler) {
+	unsigned int taps = resampler->bank->taps;
+
+	// The window of the first output ends half the taps into the input,
+	// so that the first output frame lines up with the first input frame.
+	memset (resampler->history, 0,
+		(size_t) resampler->stride * resampler->channels * sizeof *resampler->history);
+	resampler->fill = taps / 2 - 1;
+	resampler->position = 0;
+	resampler->phase = 0;
+	resampler->fraction = 0;
+}
+
+/**
+* Adjusts the ratio of a variable resampler: the input frames it consumes
+* per output frame are multiplied by ratio. May be called on the audio
+* thread, between calls to #lively_resampler_process.
+*
+* @param resampler The resampler
+* @param ratio The adjustment, between 0.5 and 2
+*
+* @return A success value; false for an exact resampler
+*/
+bool
+lively_resampler_set_ratio (lively_resampler_t *resampler, double ratio) {
+	if (!resampler->variable || !(ratio >= 0.5 && ratio <= 2.0)) {
+		return false;
+	}
+	resampler->step = (uint64_t) llround ((double) resampler->nominal * ratio);
+	return true;
+}
+
+/**
+* Returns the delay of the resampler, in input frames.
+*
+* @param resampler The resampler
+*/
+unsigned int
+lively_resampler_latency (const lively_resampler_t *resampler) {
+	return resampler->bank->taps / 2;
+}
+
+/**
+* Returns how many more input frames a resampler needs before it can
+* produce a number of output frames.
+*
+* @param resampler The resampler
+* @param output_frames The number of output frames
+*/
+unsigned int
+lively_resampler_input_needed (const lively_resampler_t *resampler, unsigned int output_frames) {
+	if (output_frames == 0) {
+		return 0;
+	}
+
+	uint64_t last;
+	if (resampler->variable) {
+		last = resampler->position
+			+ (((uint64_t) resampler->fraction + resampler->step * (output_frames - 1)) >> 32);
+	} else {
+		last = resampler->position
+			+ ((uint64_t) resampler->phase + (uint64_t) resampler->down * (output_frames - 1))
+			/ resampler->up;
+	}
+
+	uint64_t needed = last + resampler->bank->taps;
+	return needed > resampler->fill ? (unsigned int) (needed - resampler->fill) : 0;
+}
+
+/**
+* Works out the window and row of up to limit output frames, as many as
+* the history holds, and steps past them.
+*
+* @return The number of output frames scheduled
+*/
+static unsigned int
+resampler_schedule (lively_resampler_t *resampler, unsigned int limit) {
+	unsigned int taps = resampler->bank->taps;
+	unsigned int position = resampler->position;
+	unsigned int count = 0;
+
+	if (resampler->variable) {
+		uint32_t fraction = resampler->fraction;
+		for (; count < limit && position + taps <= resampler->fill; count++) {
+			uint64_t next = (uint64_t) fraction + resampler->step;
+			resampler->batch_offset[count] = position;
+			resampler->batch_row[count] = fraction >> (32 - RESAMPLER_ROW_BITS);
+			resampler->batch_weight[count] = (float) ldexp (
+				fraction & ((1u << (32 - RESAMPLER_ROW_BITS)) - 1),
+				RESAMPLER_ROW_BITS - 32);
+			position += (unsigned int) (next >> 32);
+			fraction = (uint32_t) next;
+		}
+		resampler->fraction = fraction;
+	} else {
+		unsigned int phase = resampler->phase;
+		unsigned int whole = resampler->down / resampler->up;
+		unsigned int rest = resampler->down % resampler->up;
+		for (; count < limit && position + taps <= resampler->fill; count++) {
+			resampler->batch_offset[count] = position;
+			resampler->batch_row[count] = phase;
+			position += whole;
+			phase += rest;
+			if (phase >= resampler->up) {
+				phase -= resampler->up;
+				position++;
+			}
+		}
+		resampler->phase = phase;
+	}
+
+	resampler->position = position;
+	return count;
+}
+
+/**
+* Drops the frames of the history before the next window.
+*/
+static void
+resampler_compact (lively_resampler_t *resampler) {
+	unsigned int drop = resampler->position < resampler->fill
+		? resampler->position : resampler->fill;
+
+	if (drop == 0) {
+		return;
+	}
+	for (unsigned int c = 0; c < resampler->channels; c++) {
+		float *history = resampler->history + (size_t) c * resampler->stride;
+		memmove (history, history + drop, (resampler->fill - drop) * sizeof *history);
+	}
+	resampler->fill -= drop;
+	resampler->position -= drop;
+}
+
+/**
+* Converts as much input as fits in the output. Input which is not needed
+* yet for the output is left to the caller.
+*
+* @param resampler The resampler
+* @param input The input of every channel
+* @param input_frames The number of input frames; on return, the number
+* consumed
+* @param output The output of every channel
+* @param output_frames The room in the output
+*
+* @return The number of output frames produced
+*/
+unsigned int
+lively_resampler_process (
+	lively_resampler_t *resampler,
+	const float *const *input,
+	unsigned int *input_frames,
+	float *const *output,
+	unsigned int output_frames) {
+
+	unsigned int consumed = 0;
+	unsigned int produced = 0;
+
+	for (;;) {
+		while (produced < output_frames) {
+			unsigned int limit = output_frames - produced;
+			unsigned int count = resampler_schedule (resampler,
+				limit < LIVELY_RESAMPLER_BATCH ? limit : LIVELY_RESAMPLER_BATCH);
+			if (count == 0) {
+				break;
+			}
+
+			for (unsigned int c = 0; c < resampler->channels; c++) {
+				resampler_run (resampler, c, count, output[c] + produced);
+			}
+			produced += count;
+		}
+
+		if (produced == output_frames || consumed == *input_frames) {
+			break;
+		}
+
+		resampler_compact (resampler);
+
+		unsigned int room = resampler->stride - resampler->fill;
+		unsigned int take = *input_frames - consumed < room ? *input_frames - consumed : room;
+		for (unsigned int c = 0; c < resampler->channels; c++) {
+			memcpy (resampler->history + (size_t) c * resampler->stride + resampler->fill,
+				input[c] + consumed, take * sizeof (float));
+		}
+		resampler->fill += take;
+		consumed += take;
+	}
+
+	*input_frames = consumed;
+	return produced;
+}
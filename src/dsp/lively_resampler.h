@@ -0,0 +1,98 @@
+#ifndef LIVELY_RESAMPLER_H
+#define LIVELY_RESAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Taps of a filter which does not decimate; decimating filters get more */
+#define LIVELY_RESAMPLER_TAPS 64
+/** Largest number of phases of an exact ratio */
+#define LIVELY_RESAMPLER_PHASES_MAX 1024
+/** Phases of a variable ratio, between which coefficients are interpolated */
+#define LIVELY_RESAMPLER_VARIABLE_PHASES 256
+/** Most input frames buffered per channel beyond the taps */
+#define LIVELY_RESAMPLER_CHUNK 256
+/** Most output frames scheduled at once */
+#define LIVELY_RESAMPLER_BATCH 256
+
+/**
+ * A bank of polyphase filters: phases + 1 rows of taps coefficients, row p
+ * being a windowed sinc delayed by p / phases of an input frame.
+ *
+ * Banks are cached and shared like #lively_fft plans, and never modified
+ * after they are created.
+ */
+typedef struct lively_resampler_bank {
+	struct lively_resampler_bank *next; /**< In the cache */
+	unsigned int references;
+
+	unsigned int phases;
+	unsigned int taps;
+	double cutoff; /**< In cycles per input frame */
+	float *coefficients;
+} lively_resampler_bank_t;
+
+/**
+ * Converts planar streams of any number of channels from one sample rate
+ * to another.
+ *
+ * An exact resampler steps through the phases of the reduced ratio of the
+ * rates with integers, so it never drifts, and needs no interpolation. A
+ * variable resampler steps in 32.32 fixed point and interpolates between
+ * the rows of a finer bank, which lets its ratio be adjusted while it
+ * runs, for instance to follow the drift between two clocks.
+ *
+ * Input is copied into a short history per channel, and each output frame
+ * is the dot product of a row of the bank with taps frames of it. Each dot
+ * product keeps two independent sums, over the halves of the taps, which
+ * the compiler runs across vector lanes. Processing never allocates.
+ */
+typedef struct lively_resampler {
+	lively_resampler_bank_t *bank;
+	unsigned int channels;
+	unsigned int rate_in;
+	unsigned int rate_out;
+	bool variable;
+
+	/** Of an exact resampler: output is up / down times the input rate */
+	unsigned int up, down;
+	unsigned int phase; /**< Of the next output frame, below up */
+
+	/** Of a variable resampler, in 2^-32 input frames */
+	uint64_t step;
+	uint64_t nominal; /**< The step at a ratio of 1 */
+	uint32_t fraction; /**< Of the next output frame */
+
+	/** taps + #LIVELY_RESAMPLER_CHUNK frames per channel */
+	float *history;
+	unsigned int stride;
+	unsigned int fill; /**< Frames in the history of every channel */
+	unsigned int position; /**< First frame of the window of the next output */
+
+	/** The window and row of each output frame of a batch */
+	unsigned int batch_offset[LIVELY_RESAMPLER_BATCH];
+	unsigned int batch_row[LIVELY_RESAMPLER_BATCH];
+	float batch_weight[LIVELY_RESAMPLER_BATCH];
+} lively_resampler_t;
+
+bool lively_resampler_init (
+	lively_resampler_t *,
+	unsigned int channels,
+	unsigned int rate_in,
+	unsigned int rate_out,
+	bool variable);
+void lively_resampler_destroy (lively_resampler_t *);
+void lively_resampler_reset (lively_resampler_t *);
+
+bool lively_resampler_set_ratio (lively_resampler_t *, double ratio);
+unsigned int lively_resampler_latency (const lively_resampler_t *);
+unsigned int lively_resampler_input_needed (const lively_resampler_t *, unsigned int output_frames);
+
+unsigned int lively_resampler_process (
+	lively_resampler_t *,
+	const float *const *input,
+	unsigned int *input_frames,
+	float *const *output,
+	unsigned int output_frames);
+
+#endif
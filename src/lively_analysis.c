@@ -0,0 +1,153 @@
+/**
+ * @file lively_analysis.c
+ * Lively Analysis: Runs measurements of nodes off the audio thread
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <time.h>
+
+#include "lively_analysis.h"
+#include "lively_app.h"
+#include "platform.h"
+
+/**
+* Initializes an analysis service with no tasks. The thread is started
+* separately, with #lively_analysis_main.
+*
+* @param analysis The analysis service
+* @param app The Lively Application, for logging
+*
+* @return A success value
+*/
+bool
+lively_analysis_init (lively_analysis_t *analysis, struct lively_app *app) {
+	analysis->app = app;
+	analysis->tasks = NULL;
+	atomic_init (&analysis->woken, false);
+
+	if (sem_init (&analysis->wake, 0, 0) != 0) {
+		return false;
+	}
+	pthread_mutex_init (&analysis->lock, NULL);
+	return true;
+}
+
+/**
+* Destroys an analysis service. Its tasks must be removed, and its thread
+* stopped.
+*
+* @param analysis The analysis service
+*/
+void
+lively_analysis_destroy (lively_analysis_t *analysis) {
+	pthread_mutex_destroy (&analysis->lock);
+	sem_destroy (&analysis->wake);
+}
+
+/**
+* Wakes the analysis thread for an early pass. Only the first call between
+* two passes posts.
+*
+* @param analysis The analysis service
+*/
+void
+lively_analysis_wake (lively_analysis_t *analysis) {
+	if (!atomic_exchange_explicit (&analysis->woken, true, memory_order_relaxed)) {
+		sem_post (&analysis->wake);
+	}
+}
+
+/**
+* Runs every task which is due.
+*
+* @param analysis The analysis service
+*
+* @return The seconds until the next task is due, at most
+* #LIVELY_ANALYSIS_INTERVAL
+*/
+double
+lively_analysis_service (lively_analysis_t *analysis) {
+	double wait = LIVELY_ANALYSIS_INTERVAL;
+
+	atomic_store_explicit (&analysis->woken, false, memory_order_relaxed);
+
+	pthread_mutex_lock (&analysis->lock);
+	for (lively_analysis_task_t *task = analysis->tasks; task; task = task->next) {
+		double now = platform_time ();
+		if (task->due <= now) {
+			// Late tasks are not run twice to catch up.
+			double period = task->run (task);
+			task->due = task->due + period > now ? task->due + period : now + period;
+		}
+		if (task->due - now < wait) {
+			wait = task->due - now;
+		}
+	}
+	pthread_mutex_unlock (&analysis->lock);
+
+	return wait > 0.0 ? wait : 0.0;
+}
+
+/**
+* The main routine of the analysis thread: runs the tasks as they fall
+* due, and passes over them again whenever it is woken.
+*
+* @param thread The Lively Thread
+*/
+void
+lively_analysis_main (lively_thread_t *thread) {
+	lively_analysis_t *analysis = &thread->app->analysis;
+
+	while (lively_thread_get_state (thread) != THREAD_STOP) {
+		double wait = lively_analysis_service (analysis);
+
+		struct timespec deadline;
+		clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (long) (wait * 1e9);
+		while (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (sem_timedwait (&analysis->wake, &deadline) != 0 && errno == EINTR) {
+		}
+	}
+}
+
+/**
+* Adds a task, due at once.
+*
+* @param analysis The analysis service
+* @param task The task, with its run function set
+*/
+void
+lively_analysis_add (lively_analysis_t *analysis, lively_analysis_task_t *task) {
+	task->due = platform_time ();
+
+	pthread_mutex_lock (&analysis->lock);
+	task->next = analysis->tasks;
+	analysis->tasks = task;
+	pthread_mutex_unlock (&analysis->lock);
+
+	lively_analysis_wake (analysis);
+}
+
+/**
+* Removes a task. Once this returns, the task is not running and never
+* runs again.
+*
+* @param analysis The analysis service
+* @param task The task
+*/
+void
+lively_analysis_remove (lively_analysis_t *analysis, lively_analysis_task_t *task) {
+	pthread_mutex_lock (&analysis->lock);
+	for (lively_analysis_task_t **link = &analysis->tasks; *link; link = &(*link)->next) {
+		if (*link == task) {
+			*link = task->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&analysis->lock);
+}
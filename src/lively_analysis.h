@@ -0,0 +1,57 @@
+#ifndef LIVELY_ANALYSIS_H
+#define LIVELY_ANALYSIS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "lively_thread.h"
+
+/** Seconds the analysis thread sleeps at most, when nothing is due */
+#define LIVELY_ANALYSIS_INTERVAL 0.1
+
+struct lively_app;
+
+/**
+ * Work done periodically by the analysis thread on behalf of a node, such
+ * as the spectrum of an analyzer. Embedded in the node.
+ */
+typedef struct lively_analysis_task {
+	struct lively_analysis_task *next;
+	/** Does the work, and returns the seconds until it is due again */
+	double (*run) (struct lively_analysis_task *);
+	double due; /**< As returned by #platform_time */
+} lively_analysis_task_t;
+
+/**
+ * The analysis service of a Lively Application, run by its
+ * thread_analysis.
+ *
+ * Measurements which cost too much for the audio thread, such as FFTs,
+ * are done here, each task as often as it asks. Nodes only copy their
+ * input into lock-free rings, and tasks read from them, so the audio
+ * thread never waits for the analysis. Tasks run under the lock of the
+ * service, which the audio thread never takes; removing a task therefore
+ * waits for it to finish.
+ */
+typedef struct lively_analysis {
+	struct lively_app *app;
+	pthread_mutex_t lock;
+	lively_analysis_task_t *tasks;
+
+	sem_t wake;
+	atomic_bool woken; /**< Whether wake was posted since the last pass */
+} lively_analysis_t;
+
+bool lively_analysis_init (lively_analysis_t *, struct lively_app *);
+void lively_analysis_destroy (lively_analysis_t *);
+void lively_analysis_main (lively_thread_t *);
+void lively_analysis_wake (lively_analysis_t *);
+double lively_analysis_service (lively_analysis_t *);
+
+void lively_analysis_add (lively_analysis_t *, lively_analysis_task_t *);
+void lively_analysis_remove (lively_analysis_t *, lively_analysis_task_t *);
+
+#endif
@@ -26,18 +26,57 @@ void lively_app_init (lively_app_t *app) {
 		"%s <%s>", PACKAGE_STRING, PACKAGE_URL);
 
 	app->running = false;
+	app->audio_stats = NULL;
+	app->capture = NULL;
+
+	app->disk_ready = lively_disk_init (&app->disk, app);
+	if (!app->disk_ready) {
+		lively_app_log (app, LIVELY_ERROR, "main", "Could not set up the disk service");
+	}
+	app->pool_ready = lively_pool_init (&app->pool, app);
+	if (!app->pool_ready) {
+		lively_app_log (app, LIVELY_ERROR, "main", "Could not set up the sample pool");
+	}
+	app->analysis_ready = lively_analysis_init (&app->analysis, app);
+	if (!app->analysis_ready) {
+		lively_app_log (app, LIVELY_ERROR, "main", "Could not set up the analysis service");
+	}
+
+	lively_scene_init (&app->scene, app);
+	lively_scene_set_buffer_length (&app->scene, LIVELY_QUANTUM);
+
+	lively_scene_set_init (&app->scenes);
+	lively_scene_set_add (&app->scenes, &app->scene, NULL);
 }
 
 /**
 * Destroys a Lively Application
 *
 * This function will stop the Lively Application if it is already running.
+* In that case, resources are left for the next call after
+* #lively_app_run has returned.
 *
 * @param app The Lively Application
 */
 void lively_app_destroy (lively_app_t *app) {
 	if (app->running) {
 		lively_app_shutdown (app);
+		return;
+	}
+
+	lively_scene_set_destroy (&app->scenes);
+	lively_scene_destroy (&app->scene);
+	if (app->disk_ready) {
+		lively_disk_destroy (&app->disk);
+		app->disk_ready = false;
+	}
+	if (app->pool_ready) {
+		lively_pool_destroy (&app->pool);
+		app->pool_ready = false;
+	}
+	if (app->analysis_ready) {
+		lively_analysis_destroy (&app->analysis);
+		app->analysis_ready = false;
 	}
 }
 
@@ -63,15 +102,38 @@ void lively_app_run (lively_app_t *app) {
 	lively_app_log (app, LIVELY_INFO, "main", "Running lively");
 
 	// Start submodules
-	if (!lively_thread_init (
+	bool disk = app->disk_ready && lively_thread_init (
+		&app->thread_disk, app,
+		lively_disk_main);
+	if (!disk) {
+		lively_app_log (app, LIVELY_ERROR, "main", "Could not start the disk thread");
+	}
+	bool analysis = app->analysis_ready && lively_thread_init (
+		&app->thread_analysis, app,
+		lively_analysis_main);
+	if (!analysis) {
+		lively_app_log (app, LIVELY_ERROR, "main", "Could not start the analysis thread");
+	}
+
+	if (lively_thread_init (
 		&app->thread_audio, app,
 		lively_audio_main)) {
-		return;
+		app->running = true;
+		lively_thread_join (&app->thread_audio);
+		app->running = false;
 	}
 
-	app->running = true;
-	lively_thread_join_multiple (&app->thread_audio, NULL);
-	app->running = false;
+	// The audio thread may also stop by itself; the others follow.
+	if (disk) {
+		lively_thread_set_state (&app->thread_disk, THREAD_STOP);
+		lively_disk_wake (&app->disk);
+		lively_thread_join (&app->thread_disk);
+	}
+	if (analysis) {
+		lively_thread_set_state (&app->thread_analysis, THREAD_STOP);
+		lively_analysis_wake (&app->analysis);
+		lively_thread_join (&app->thread_analysis);
+	}
 
 	lively_app_log (app, LIVELY_INFO, "main", "Stopping lively");
 }
@@ -94,7 +156,15 @@ void lively_app_shutdown (lively_app_t *app) {
 
 	lively_thread_set_state_multiple (THREAD_STOP, 
 		&app->thread_audio,
+		&app->thread_disk,
+		&app->thread_analysis,
 		NULL);
+	if (app->disk_ready) {
+		lively_disk_wake (&app->disk);
+	}
+	if (app->analysis_ready) {
+		lively_analysis_wake (&app->analysis);
+	}
 }
 
 /**
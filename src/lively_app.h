@@ -4,8 +4,16 @@
 #include <stdarg.h>
 #include <stdbool.h>
 
+#include "lively_analysis.h"
+#include "lively_disk.h"
+#include "lively_pool.h"
+#include "lively_scene.h"
+#include "lively_scene_set.h"
 #include "lively_thread.h"
 
+struct lively_audio_stats;
+struct lively_capture;
+
 /**
  * Specifies the level used for logging messages within lively.
  */
@@ -28,7 +36,27 @@ typedef struct lively_app {
 	bool running;
 	lively_thread_t thread_audio;
 	lively_thread_t thread_disk;
+	lively_thread_t thread_analysis;
 	lively_thread_t thread_server;
+
+	/** Streams files for nodes, on thread_disk */
+	lively_disk_t disk;
+	bool disk_ready;
+	/** The samples every node plays from, each loaded once */
+	lively_pool_t pool;
+	bool pool_ready;
+	/** Measures for nodes what the audio thread has no time for, on thread_analysis */
+	lively_analysis_t analysis;
+	bool analysis_ready;
+
+	lively_scene_t scene;
+	/** The scenes the audio thread can switch between; scene is the first */
+	lively_scene_set_t scenes;
+
+	/** If set, the audio thread records its timing here */
+	struct lively_audio_stats *audio_stats;
+	/** If set, the audio thread keeps its input here */
+	struct lively_capture *capture;
 } lively_app_t;
 
 void lively_app_init (lively_app_t *);
@@ -2,6 +2,10 @@
 #include "lively_audio.h"
 #include "lively_audio_backend.h"
 #include "lively_audio_config.h"
+#include "lively_audio_quantum.h"
+#include "lively_audio_stats.h"
+#include "lively_capture.h"
+#include "lively_scene.h"
 
 #include "platform.h"
 
@@ -14,7 +18,16 @@ audio_logger (void *user, enum lively_log_level level, const char *fmt, ...);
 * The main function for the Lively audio component.
 *
 * This function begins by initializing the configuration structure and creating
-* a new audio backend.
+* a new audio backend. Each period, the captured channels are fed to the input
+* nodes of the application's active scene and its output nodes are played
+* back, see #lively_scene_set. The scene always runs in steps of
+* #LIVELY_QUANTUM frames, whatever the period size of the device, see
+* #lively_audio_quantum.
+*
+* If the application has #lively_app::audio_stats set, the wakeup latency and
+* processing time of every period are recorded there. If it has
+* #lively_app::capture set, the input of every period is kept there, as
+* soon as it is read.
 *
 * @param thread The Lively Thread
 */
@@ -22,6 +35,9 @@ void lively_audio_main (lively_thread_t *thread) {
 	lively_audio_config_t config;
 	lively_audio_backend_t *backend;
 	lively_audio_block_t block;
+	lively_audio_quantum_t quantum;
+	lively_app_t *app = thread->app;
+	lively_audio_stats_t *stats = app->audio_stats;
 
 	if (lively_thread_get_state (thread) == THREAD_STOP)
 		return;
@@ -54,28 +70,73 @@ void lively_audio_main (lively_thread_t *thread) {
 		if (!lively_audio_block_init (&block, &config)) {
 			lively_app_log (thread->app, LIVELY_ERROR, module,
 				"Could not allocate audio channel block structure");
+		} else if (!lively_audio_quantum_init (&quantum, &block)) {
+			lively_app_log (thread->app, LIVELY_ERROR, module,
+				"Could not allocate audio quantum buffers");
 		} else {
+			if (!lively_scene_set_use_sample_rate (&app->scenes, config.frames_per_second)) {
+				lively_app_log (thread->app, LIVELY_ERROR, module,
+					"Could not prepare every scene for %u Hz", config.frames_per_second);
+			}
+
+			lively_scene_t *scene = lively_scene_set_get_active (&app->scenes);
+			unsigned int scene_latency = scene ? lively_scene_get_latency (scene) : 0;
+			lively_app_log (thread->app, LIVELY_INFO, module,
+				"Scene runs in quanta of %u frames, adding %u frames of latency",
+				LIVELY_QUANTUM, quantum.latency);
+			lively_app_log (thread->app, LIVELY_INFO, module,
+				"Scene '%s' has a latency of %u frames (%.2fms)",
+				scene ? scene->name : "", scene_latency,
+				scene_latency * 1000.0 / config.frames_per_second);
+
+			if (app->capture) {
+				lively_capture_begin (app->capture, config.frames_per_second);
+			}
 
 			lively_audio_block_silence_output (&block);
 			if (lively_audio_backend_start (backend, &block)) {
 				while (lively_audio_backend_wait (backend)) {
+					double woken = platform_time ();
+					double due = 0.0;
+					bool due_known = stats
+						&& lively_audio_backend_get_period_due (backend, &due);
+
 					if (!lively_audio_backend_read (backend, &block)) {
 						lively_app_log (thread->app, LIVELY_ERROR, module,
 							"Read failed");
 						break;
 					}
+					if (app->capture) {
+						lively_capture_write (app->capture, &block);
+					}
+
+					lively_audio_quantum_process (&quantum, &block, &app->scenes);
+
 					if (!lively_audio_backend_write (backend, &block)) {
 						lively_app_log (thread->app, LIVELY_ERROR, module,
 							"Write failed");
 						break;
 					}
 
+					if (stats) {
+						double done = platform_time ();
+
+						stats->periods++;
+						stats->xruns = lively_audio_backend_get_xruns (backend);
+						lively_histogram_record (&stats->process, done - woken);
+						if (due_known) {
+							lively_histogram_record (&stats->wakeup, woken - due);
+							lively_histogram_record (&stats->total, done - due);
+						}
+					}
+
 					if (lively_thread_get_state (thread) == THREAD_STOP)
 						break;
 				}
 				lively_audio_backend_stop (backend);
 			}
 
+			lively_audio_quantum_destroy (&quantum);
 		}
 
 		lively_audio_block_destroy (&block);
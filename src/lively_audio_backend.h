@@ -55,6 +55,8 @@ bool lively_audio_backend_start (lively_audio_backend_t *, lively_audio_block_t
 bool lively_audio_backend_stop (lively_audio_backend_t *);
 
 bool lively_audio_backend_wait (lively_audio_backend_t *);
+bool lively_audio_backend_get_period_due (lively_audio_backend_t *, double *);
+unsigned long lively_audio_backend_get_xruns (lively_audio_backend_t *);
 
 bool lively_audio_backend_read (lively_audio_backend_t *, lively_audio_block_t *);
 bool lively_audio_backend_write (lively_audio_backend_t *, lively_audio_block_t *);
@@ -0,0 +1,236 @@
+/**
+ * @file lively_audio_quantum.c
+ * Lively Audio Quantum: Runs the scene at a fixed size, whatever the device
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_audio_quantum.h"
+
+static unsigned int
+quantum_gcd (unsigned int a, unsigned int b) {
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/**
+* Processes one block of a scene, reading from the input queue at in_offset
+* and writing to the output queue at out_offset.
+*
+* With a gain, the output is scaled frame by frame; with accumulate, it is
+* added to what the queue already holds instead of replacing it.
+*/
+static void
+quantum_process_block (
+	lively_audio_quantum_t *quantum,
+	lively_scene_plan_t *plan,
+	unsigned int in_offset,
+	unsigned int out_offset,
+	unsigned int length,
+	const float *gain,
+	bool accumulate) {
+
+	size_t bytes = length * sizeof (float);
+
+	if (!accumulate) {
+		for (unsigned int c = 0; c < quantum->num_out; c++) {
+			float *fifo = quantum->out_fifo + (size_t) c * quantum->out_capacity;
+			memset (fifo + out_offset, 0, bytes);
+		}
+	}
+
+	if (!plan) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < plan->inputs_count; i++) {
+		lively_node_io_t *input = plan->inputs[i];
+		unsigned int port = input->port;
+
+		if (port < quantum->num_in) {
+			float *fifo = quantum->in_fifo + (size_t) port * quantum->in_capacity;
+			memcpy (input->buffer, fifo + in_offset, bytes);
+		} else {
+			memset (input->buffer, 0, bytes);
+		}
+	}
+
+	lively_scene_plan_process (plan, length);
+
+	for (unsigned int i = 0; i < plan->outputs_count; i++) {
+		lively_node_io_t *output = plan->outputs[i];
+		unsigned int port = output->port;
+
+		if (port >= quantum->num_out) {
+			continue;
+		}
+
+		float *fifo = quantum->out_fifo + (size_t) port * quantum->out_capacity + out_offset;
+		if (gain) {
+			for (unsigned int f = 0; f < length; f++) {
+				fifo[f] += gain[f] * output->buffer[f];
+			}
+		} else if (accumulate) {
+			for (unsigned int f = 0; f < length; f++) {
+				fifo[f] += output->buffer[f];
+			}
+		} else {
+			memcpy (fifo, output->buffer, bytes);
+		}
+	}
+}
+
+/**
+* Runs one quantum of a scene, split wherever an event is due.
+*/
+static void
+quantum_process_scene (
+	lively_audio_quantum_t *quantum,
+	lively_scene_t *scene,
+	unsigned int in_offset,
+	const float *gain,
+	bool accumulate) {
+
+	lively_scene_plan_t *plan = lively_scene_plan_acquire (scene);
+
+	unsigned int done = 0;
+	while (done < LIVELY_QUANTUM) {
+		unsigned int length = lively_scene_plan_begin_block (
+			scene, plan, LIVELY_QUANTUM - done);
+
+		quantum_process_block (quantum, plan,
+			in_offset + done, quantum->out_fill + done, length,
+			gain ? gain + done : NULL, accumulate);
+
+		done += length;
+	}
+
+	lively_scene_plan_release (scene);
+}
+
+/**
+* Initializes the adapter for the channel counts and period of a block.
+*
+* @param quantum The adapter
+* @param block The audio block it will be used with
+*
+* @return A success value
+*/
+bool
+lively_audio_quantum_init (
+	lively_audio_quantum_t *quantum,
+	lively_audio_block_t *block) {
+
+	unsigned int period = block->frames;
+
+	quantum->num_in = block->num_in;
+	quantum->num_out = block->num_out;
+
+	// Always frames(n) * period >= processed(n) * LIVELY_QUANTUM - latency.
+	quantum->latency = LIVELY_QUANTUM - quantum_gcd (period, LIVELY_QUANTUM);
+
+	quantum->in_capacity = period + LIVELY_QUANTUM;
+	quantum->in_fill = 0;
+	quantum->out_capacity = quantum->latency + period + LIVELY_QUANTUM;
+	quantum->out_fill = quantum->latency;
+
+	quantum->in_fifo = calloc (
+		(size_t) quantum->num_in * quantum->in_capacity + 1, sizeof (float));
+	quantum->out_fifo = calloc (
+		(size_t) quantum->num_out * quantum->out_capacity + 1, sizeof (float));
+
+	if (!quantum->in_fifo || !quantum->out_fifo) {
+		lively_audio_quantum_destroy (quantum);
+		return false;
+	}
+
+	return true;
+}
+
+void
+lively_audio_quantum_destroy (lively_audio_quantum_t *quantum) {
+	free (quantum->in_fifo);
+	free (quantum->out_fifo);
+	quantum->in_fifo = NULL;
+	quantum->out_fifo = NULL;
+}
+
+/**
+* Processes one device period.
+*
+* The captured block is queued, the active scene runs once for every whole
+* quantum available, and the block's output is filled from the processed
+* queue. A quantum is only split into shorter blocks where an event is due.
+* A switch between scenes takes effect at the start of the period.
+*
+* @param quantum The adapter
+* @param block The audio block for this period
+* @param set The scene set
+*/
+void
+lively_audio_quantum_process (
+	lively_audio_quantum_t *quantum,
+	lively_audio_block_t *block,
+	lively_scene_set_t *set) {
+
+	unsigned int period = block->frames;
+	size_t bytes = period * sizeof (float);
+
+	for (unsigned int c = 0; c < quantum->num_in; c++) {
+		float *fifo = quantum->in_fifo + (size_t) c * quantum->in_capacity;
+		if (block->in[c].ready) {
+			memcpy (fifo + quantum->in_fill, block->in[c].data, bytes);
+		} else {
+			memset (fifo + quantum->in_fill, 0, bytes);
+		}
+	}
+	quantum->in_fill += period;
+
+	lively_scene_set_begin_period (set);
+
+	unsigned int offset = 0;
+	while (quantum->in_fill - offset >= LIVELY_QUANTUM) {
+		lively_scene_t *active = lively_scene_set_get_active (set);
+		lively_scene_t *fading = lively_scene_set_get_fading (set);
+
+		if (fading) {
+			lively_scene_set_fade_gains (set,
+				quantum->gain_in, quantum->gain_out, LIVELY_QUANTUM);
+			quantum_process_scene (quantum, fading, offset, quantum->gain_out, false);
+			if (active) {
+				quantum_process_scene (quantum, active, offset, quantum->gain_in, true);
+			}
+			lively_scene_set_advance (set, LIVELY_QUANTUM);
+		} else if (active) {
+			quantum_process_scene (quantum, active, offset, NULL, false);
+		} else {
+			quantum_process_block (quantum, NULL,
+				offset, quantum->out_fill, LIVELY_QUANTUM, NULL, false);
+		}
+
+		offset += LIVELY_QUANTUM;
+		quantum->out_fill += LIVELY_QUANTUM;
+	}
+
+	// Keep the unprocessed remainder, which is less than a quantum.
+	quantum->in_fill -= offset;
+	if (offset && quantum->in_fill) {
+		for (unsigned int c = 0; c < quantum->num_in; c++) {
+			float *fifo = quantum->in_fifo + (size_t) c * quantum->in_capacity;
+			memmove (fifo, fifo + offset, quantum->in_fill * sizeof (float));
+		}
+	}
+
+	quantum->out_fill -= period;
+	for (unsigned int c = 0; c < quantum->num_out; c++) {
+		float *fifo = quantum->out_fifo + (size_t) c * quantum->out_capacity;
+		memcpy (block->out[c].data, fifo, bytes);
+		memmove (fifo, fifo + period, quantum->out_fill * sizeof (float));
+		block->out[c].ready = true;
+	}
+}
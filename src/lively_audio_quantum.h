@@ -0,0 +1,47 @@
+#ifndef LIVELY_AUDIO_QUANTUM_H
+#define LIVELY_AUDIO_QUANTUM_H
+
+#include <stdbool.h>
+
+#include "lively_audio_backend.h"
+#include "lively_scene.h"
+#include "lively_scene_set.h"
+
+/**
+ * Adapts device periods of any size to the fixed quantum of the scene.
+ *
+ * Captured frames are queued until a whole #LIVELY_QUANTUM is available and
+ * processed frames are queued until the device asks for them. When the
+ * period is not a multiple of the quantum, the output queue starts out
+ * partially filled with silence so that it can never run dry; that much
+ * latency is added.
+ *
+ * The scene is the active one of a #lively_scene_set. During a crossfade
+ * both scenes are processed and their outputs mixed.
+ */
+typedef struct lively_audio_quantum {
+	unsigned int num_in;
+	unsigned int num_out;
+
+	unsigned int in_capacity;
+	unsigned int in_fill;
+	float *in_fifo;
+
+	unsigned int out_capacity;
+	unsigned int out_fill;
+	float *out_fifo;
+
+	unsigned int latency;
+
+	float gain_in[LIVELY_QUANTUM];
+	float gain_out[LIVELY_QUANTUM];
+} lively_audio_quantum_t;
+
+bool lively_audio_quantum_init (lively_audio_quantum_t *, lively_audio_block_t *);
+void lively_audio_quantum_destroy (lively_audio_quantum_t *);
+void lively_audio_quantum_process (
+	lively_audio_quantum_t *,
+	lively_audio_block_t *,
+	lively_scene_set_t *);
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file lively_audio_stats.c
+ * Lively Audio Statistics: Worst-case timing of the realtime path
+ */
+
+#include <math.h>
+
+#include "lively_audio_stats.h"
+
+/**
+* Initializes an empty histogram.
+*
+* @param histogram The histogram
+* @param name A short name used when printing
+*/
+void
+lively_histogram_init (lively_histogram_t *histogram, const char *name) {
+	histogram->name = name;
+	histogram->count = 0;
+	histogram->overflows = 0;
+	histogram->min = INFINITY;
+	histogram->max = 0.0;
+	histogram->sum = 0.0;
+
+	for (unsigned int i = 0; i < LIVELY_HISTOGRAM_BUCKETS; i++) {
+		histogram->buckets[i] = 0;
+	}
+}
+
+/**
+* Records one sample. Safe to call from the audio thread.
+*
+* @param histogram The histogram
+* @param seconds The measured duration
+*/
+void
+lively_histogram_record (lively_histogram_t *histogram, double seconds) {
+	if (seconds < 0.0) {
+		seconds = 0.0;
+	}
+
+	histogram->count++;
+	histogram->sum += seconds;
+	if (seconds < histogram->min) histogram->min = seconds;
+	if (seconds > histogram->max) histogram->max = seconds;
+
+	double microseconds = seconds * 1e6;
+	if (microseconds >= LIVELY_HISTOGRAM_BUCKETS) {
+		histogram->overflows++;
+	} else {
+		histogram->buckets[(unsigned int) microseconds]++;
+	}
+}
+
+/**
+* Prints a summary line followed by every non-empty bucket.
+*
+* @param histogram The histogram
+* @param file The stream to print to
+*/
+void
+lively_histogram_print (lively_histogram_t *histogram, FILE *file) {
+	if (histogram->count == 0) {
+		fprintf (file, "# %s: no samples\n", histogram->name);
+		return;
+	}
+
+	fprintf (file, "# %s: count %llu min %.1fus avg %.1fus max %.1fus overflows %llu\n",
+		histogram->name,
+		histogram->count,
+		histogram->min * 1e6,
+		histogram->sum / histogram->count * 1e6,
+		histogram->max * 1e6,
+		histogram->overflows);
+
+	for (unsigned int i = 0; i < LIVELY_HISTOGRAM_BUCKETS; i++) {
+		if (histogram->buckets[i]) {
+			fprintf (file, "%s %06u %llu\n", histogram->name, i, histogram->buckets[i]);
+		}
+	}
+}
+
+/**
+* Initializes the statistics for a new run of the audio thread.
+*
+* @param stats The statistics
+*/
+void
+lively_audio_stats_init (lively_audio_stats_t *stats) {
+	lively_histogram_init (&stats->wakeup, "wakeup");
+	lively_histogram_init (&stats->process, "process");
+	lively_histogram_init (&stats->total, "total");
+	stats->periods = 0;
+	stats->xruns = 0;
+}
+
+/**
+* Prints all histograms.
+*
+* @param stats The statistics
+* @param file The stream to print to
+*/
+void
+lively_audio_stats_print (lively_audio_stats_t *stats, FILE *file) {
+	fprintf (file, "# periods %llu xruns %lu\n", stats->periods, stats->xruns);
+	lively_histogram_print (&stats->wakeup, file);
+	lively_histogram_print (&stats->process, file);
+	lively_histogram_print (&stats->total, file);
+}
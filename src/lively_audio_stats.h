@@ -0,0 +1,47 @@
+#ifndef LIVELY_AUDIO_STATS_H
+#define LIVELY_AUDIO_STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/** Number of one-microsecond buckets in a histogram */
+#define LIVELY_HISTOGRAM_BUCKETS 20000
+
+/**
+ * A cyclictest-style latency histogram with one-microsecond buckets.
+ *
+ * Samples beyond the last bucket are counted as overflows, but still
+ * contribute to the maximum.
+ */
+typedef struct lively_histogram {
+	const char *name;
+
+	unsigned long long count;
+	unsigned long long overflows;
+	double min;
+	double max;
+	double sum;
+
+	unsigned long long buckets[LIVELY_HISTOGRAM_BUCKETS];
+} lively_histogram_t;
+
+/**
+ * Timing statistics recorded by the audio thread, once per period.
+ */
+typedef struct lively_audio_stats {
+	lively_histogram_t wakeup;  /**< Period due until the wait returned */
+	lively_histogram_t process; /**< Wait returned until the write finished */
+	lively_histogram_t total;   /**< Period due until the write finished */
+
+	unsigned long long periods;
+	unsigned long xruns;
+} lively_audio_stats_t;
+
+void lively_histogram_init (lively_histogram_t *, const char *name);
+void lively_histogram_record (lively_histogram_t *, double seconds);
+void lively_histogram_print (lively_histogram_t *, FILE *);
+
+void lively_audio_stats_init (lively_audio_stats_t *);
+void lively_audio_stats_print (lively_audio_stats_t *, FILE *);
+
+#endif
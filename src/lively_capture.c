@@ -0,0 +1,429 @@
+/**
+ * @file lively_capture.c
+ * Lively Capture: Keeps the last minutes of the input, to save on demand
+ *
+ * The ring holds the input already encoded as the samples of a WAV file,
+ * so saving a window is a matter of writing a header and handing the
+ * kernel spans of the ring. Frames are counted since the capture was
+ * initialized; the audio thread publishes its count with a release store,
+ * and the capture thread checks it again after each span it wrote, to
+ * tell whether the span was overwritten in the meantime.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "lively_capture.h"
+#include "lively_app.h"
+#include "lively_hash.h"
+#include "lively_node.h"
+
+static void capture_main (lively_thread_t *thread);
+
+/**
+* Frees the ring and the lock of a capture whose thread is not running.
+*/
+static void
+capture_free (lively_capture_t *capture) {
+	if (capture->locked) {
+		munlock (capture->ring, (size_t) capture->capacity * capture->wav.frame_bytes);
+		capture->locked = false;
+	}
+	free (capture->ring);
+	capture->ring = NULL;
+	pthread_cond_destroy (&capture->work);
+	pthread_cond_destroy (&capture->idle);
+	pthread_mutex_destroy (&capture->lock);
+}
+
+/**
+* Initializes a capture, and starts its thread. The ring is allocated and
+* locked in memory here, so this may take a while for a long history.
+*
+* @param capture The capture
+* @param app The Lively Application, for logging
+* @param encoding How the samples are to be kept, and saved
+* @param channels The number of channels to keep, up to
+* #LIVELY_CHANNELS_MAX; the first ones of the input are kept
+* @param rate The sample rate to size the ring for
+* @param seconds How far back windows can be saved, at that rate
+*
+* @return A success value; failures are logged
+*/
+bool
+lively_capture_init (
+	lively_capture_t *capture,
+	struct lively_app *app,
+	lively_wav_encoding_t encoding,
+	unsigned int channels,
+	unsigned int rate,
+	double seconds) {
+
+	if (channels == 0 || channels > LIVELY_CHANNELS_MAX || rate == 0 || !(seconds > 0.0)) {
+		return false;
+	}
+
+	capture->app = app;
+	lively_wav_init (&capture->wav, encoding, channels, rate);
+	capture->history = (uint64_t) ceil (seconds * rate);
+	capture->capacity = capture->history + capture->history / LIVELY_CAPTURE_SLACK
+		+ LIVELY_CAPTURE_GUARD;
+
+	if (capture->capacity > SIZE_MAX / capture->wav.frame_bytes) {
+		return false;
+	}
+	size_t bytes = (size_t) capture->capacity * capture->wav.frame_bytes;
+	capture->ring = malloc (bytes);
+	if (!capture->ring) {
+		lively_app_log (app, LIVELY_ERROR, "capture",
+			"Could not allocate %.1f MiB for %.0f s of input", bytes / 1048576.0, seconds);
+		return false;
+	}
+
+	// Touching every page up front keeps the audio thread from faulting them
+	// in, even when they cannot be locked.
+	memset (capture->ring, 0, bytes);
+	capture->locked = mlock (capture->ring, bytes) == 0;
+	if (!capture->locked) {
+		lively_app_log (app, LIVELY_WARN, "capture",
+			"Could not lock %.1f MiB of input in memory: %s", bytes / 1048576.0, strerror (errno));
+	}
+
+	atomic_init (&capture->written, 0);
+	atomic_init (&capture->start, 0);
+	atomic_init (&capture->rate, 0);
+	capture->requests = NULL;
+	capture->saving = false;
+	pthread_mutex_init (&capture->lock, NULL);
+	pthread_cond_init (&capture->work, NULL);
+	pthread_cond_init (&capture->idle, NULL);
+
+	if (!lively_thread_init (&capture->thread, app, capture_main)) {
+		lively_app_log (app, LIVELY_ERROR, "capture", "Could not start the capture thread");
+		capture_free (capture);
+		return false;
+	}
+	return true;
+}
+
+/**
+* Stops the thread of a capture, once it has saved every window asked for,
+* and frees the ring.
+*
+* @param capture The capture, which the audio thread must be done with
+*/
+void
+lively_capture_destroy (lively_capture_t *capture) {
+	pthread_mutex_lock (&capture->lock);
+	lively_thread_set_state (&capture->thread, THREAD_STOP);
+	pthread_cond_signal (&capture->work);
+	pthread_mutex_unlock (&capture->lock);
+	lively_thread_join (&capture->thread);
+
+	capture_free (capture);
+}
+
+/**
+* Starts a run of the audio thread at a rate. What was kept of a previous
+* run can no longer be saved, as it may have been at another rate.
+*
+* Called by the audio thread before its first period.
+*
+* @param capture The capture
+* @param rate The sample rate of the device
+*/
+void
+lively_capture_begin (lively_capture_t *capture, unsigned int rate) {
+	atomic_store_explicit (&capture->rate, rate, memory_order_relaxed);
+	atomic_store_explicit (&capture->start,
+		atomic_load_explicit (&capture->written, memory_order_relaxed), memory_order_release);
+}
+
+/**
+* Keeps the input of a period. Channels the device did not fill are kept
+* as silence. Never blocks nor allocates, so it is safe on the audio thread.
+*
+* @param capture The capture
+* @param block The block the backend just read into
+*/
+void
+lively_capture_write (lively_capture_t *capture, const lively_audio_block_t *block) {
+	const lively_wav_t *wav = &capture->wav;
+	uint64_t written = atomic_load_explicit (&capture->written, memory_order_relaxed);
+	const float *input[LIVELY_CHANNELS_MAX];
+
+	for (unsigned int done = 0; done < block->frames;) {
+		unsigned int frames = block->frames - done;
+		if (frames > LIVELY_CAPTURE_GUARD) {
+			frames = LIVELY_CAPTURE_GUARD;
+		}
+
+		// A span which crosses the end of the ring wraps to its start.
+		uint64_t index = written % capture->capacity;
+		unsigned int first = capture->capacity - index < frames
+			? (unsigned int) (capture->capacity - index) : frames;
+		for (unsigned int c = 0; c < wav->channels; c++) {
+			input[c] = (c < block->num_in && block->in[c].ready
+				? block->in[c].data : block->silence) + done;
+		}
+		lively_wav_encode (wav, input, capture->ring + index * wav->frame_bytes, first);
+		if (first < frames) {
+			for (unsigned int c = 0; c < wav->channels; c++) {
+				input[c] += first;
+			}
+			lively_wav_encode (wav, input, capture->ring, frames - first);
+		}
+
+		written += frames;
+		done += frames;
+		atomic_store_explicit (&capture->written, written, memory_order_release);
+	}
+}
+
+/**
+* Returns the first frame of the history which can still be saved, given
+* the frames written.
+*/
+static uint64_t
+capture_oldest (lively_capture_t *capture, uint64_t written) {
+	uint64_t start = atomic_load_explicit (&capture->start, memory_order_acquire);
+	uint64_t oldest = written > capture->history ? written - capture->history : 0;
+	return oldest > start ? oldest : start;
+}
+
+/**
+* Returns the seconds of input which can be saved at the moment.
+*
+* @param capture The capture
+*/
+double
+lively_capture_get_seconds (lively_capture_t *capture) {
+	unsigned int rate = atomic_load_explicit (&capture->rate, memory_order_relaxed);
+	uint64_t written = atomic_load_explicit (&capture->written, memory_order_acquire);
+
+	return rate ? (double) (written - capture_oldest (capture, written)) / rate : 0.0;
+}
+
+/**
+* Asks for a window of the input to be saved to a WAV file, in the
+* background. The window is fixed when this is called, and clamped to what
+* is kept; it is saved as long as the disk keeps ahead of the audio thread.
+* The outcome is logged.
+*
+* Must not be called from the audio thread.
+*
+* @param capture The capture
+* @param path The path of the file, which is replaced if it exists
+* @param ago Seconds before now where the window starts
+* @param seconds The length of the window
+*
+* @return Whether the window was queued; false if it holds no frames
+*/
+bool
+lively_capture_save (lively_capture_t *capture, const char *path, double ago, double seconds) {
+	unsigned int rate = atomic_load_explicit (&capture->rate, memory_order_relaxed);
+	uint64_t written = atomic_load_explicit (&capture->written, memory_order_acquire);
+	uint64_t oldest = capture_oldest (capture, written);
+
+	if (rate == 0 || !(ago > 0.0) || !(seconds > 0.0)) {
+		return false;
+	}
+
+	uint64_t back = (uint64_t) llround (fmin (ago * rate, (double) (written - oldest)));
+	uint64_t start = written - back;
+	uint64_t frames = (uint64_t) llround (fmin (seconds * rate, (double) back));
+	if (frames == 0) {
+		lively_app_log (capture->app, LIVELY_WARN, "capture",
+			"Nothing to save to '%s'", path);
+		return false;
+	}
+
+	lively_capture_request_t *request = malloc (sizeof *request);
+	size_t length = strlen (path) + 1;
+	char *copy = malloc (length);
+	if (!request || !copy) {
+		free (request);
+		free (copy);
+		return false;
+	}
+	memcpy (copy, path, length);
+	request->next = NULL;
+	request->path = copy;
+	request->start = start;
+	request->frames = frames;
+	request->rate = rate;
+
+	pthread_mutex_lock (&capture->lock);
+	lively_capture_request_t **link = &capture->requests;
+	while (*link) {
+		link = &(*link)->next;
+	}
+	*link = request;
+	pthread_cond_signal (&capture->work);
+	pthread_mutex_unlock (&capture->lock);
+	return true;
+}
+
+/**
+* Waits until every window asked for has been saved, or has failed.
+*
+* @param capture The capture
+*/
+void
+lively_capture_wait (lively_capture_t *capture) {
+	pthread_mutex_lock (&capture->lock);
+	while (capture->requests || capture->saving) {
+		pthread_cond_wait (&capture->idle, &capture->lock);
+	}
+	pthread_mutex_unlock (&capture->lock);
+}
+
+/**
+* Writes all of a buffer at an offset of a file, whatever the number of
+* calls it takes.
+*/
+static bool
+capture_pwrite (int fd, const unsigned char *bytes, size_t size, uint64_t offset) {
+	while (size > 0) {
+		ssize_t done = pwrite (fd, bytes, size, (off_t) offset);
+		if (done < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		bytes += done;
+		size -= (size_t) done;
+		offset += (uint64_t) done;
+	}
+	return true;
+}
+
+/**
+* Writes the spans of the ring a window covers, oldest first, until the
+* window ends or the audio thread catches up with it.
+*
+* @return The frames written which are sure to be whole
+*/
+static uint64_t
+capture_write_window (lively_capture_t *capture, const lively_capture_request_t *request, int fd) {
+	unsigned int frame_bytes = capture->wav.frame_bytes;
+	uint64_t position = 0;
+
+	while (position < request->frames) {
+		uint64_t frame = request->start + position;
+		uint64_t index = frame % capture->capacity;
+		uint64_t frames = request->frames - position;
+		if (frames > LIVELY_CAPTURE_CHUNK / frame_bytes) {
+			frames = LIVELY_CAPTURE_CHUNK / frame_bytes;
+		}
+		if (frames > capture->capacity - index) {
+			frames = capture->capacity - index;
+		}
+
+		if (!capture_pwrite (fd, capture->ring + index * frame_bytes, (size_t) frames * frame_bytes,
+				LIVELY_WAV_HEADER_BYTES + position * frame_bytes)) {
+			lively_app_log (capture->app, LIVELY_ERROR, "capture",
+				"Could not write '%s': %s", request->path, strerror (errno));
+			break;
+		}
+
+		// The span was read before this load; if its first frame is still
+		// outside what the audio thread may be writing over, all of it was.
+		atomic_thread_fence (memory_order_acquire);
+		uint64_t written = atomic_load_explicit (&capture->written, memory_order_acquire);
+		uint64_t kept = capture->capacity - LIVELY_CAPTURE_GUARD;
+		if (written > kept && frame < written - kept) {
+			lively_app_log (capture->app, LIVELY_ERROR, "capture",
+				"Could not save all of '%s': the input overtook it after %.1f s",
+				request->path, (double) position / request->rate);
+			break;
+		}
+		position += frames;
+	}
+	return position;
+}
+
+/**
+* Saves a window of the history to a WAV file.
+*
+* @return Whether the whole window was saved; failures are logged, and a
+* file cut short is left complete up to where it was whole
+*/
+static bool
+capture_save (lively_capture_t *capture, const lively_capture_request_t *request) {
+	static const unsigned char pad = 0;
+	unsigned char header[LIVELY_WAV_HEADER_BYTES];
+	lively_wav_t wav = capture->wav;
+
+	int fd = open (request->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		lively_app_log (capture->app, LIVELY_ERROR, "capture",
+			"Could not create '%s': %s", request->path, strerror (errno));
+		return false;
+	}
+
+	wav.rate = request->rate;
+	wav.frames = capture_write_window (capture, request, fd);
+
+	// Chunks are padded to an even size.
+	uint64_t size = LIVELY_WAV_HEADER_BYTES + wav.frames * wav.frame_bytes;
+	lively_wav_write_header (&wav, header);
+	bool success = capture_pwrite (fd, header, sizeof header, 0)
+		&& (!(size & 1) || capture_pwrite (fd, &pad, 1, size))
+		&& ftruncate (fd, (off_t) (size + (size & 1))) == 0
+		&& fdatasync (fd) == 0;
+	if (!success) {
+		lively_app_log (capture->app, LIVELY_ERROR, "capture",
+			"Could not write '%s': %s", request->path, strerror (errno));
+	}
+	close (fd);
+
+	if (success && wav.frames == request->frames) {
+		lively_app_log (capture->app, LIVELY_INFO, "capture",
+			"Saved %.1f s of input to '%s'", (double) wav.frames / wav.rate, request->path);
+		return true;
+	}
+	return false;
+}
+
+/**
+* Saves the windows asked for, one at a time, until the capture is
+* destroyed.
+*/
+static void
+capture_main (lively_thread_t *thread) {
+	lively_capture_t *capture = LIVELY_CONTAINER_OF (thread, lively_capture_t, thread);
+
+	pthread_mutex_lock (&capture->lock);
+	for (;;) {
+		while (!capture->requests && lively_thread_get_state (thread) != THREAD_STOP) {
+			pthread_cond_wait (&capture->work, &capture->lock);
+		}
+		lively_capture_request_t *request = capture->requests;
+		if (!request) {
+			break;
+		}
+		capture->requests = request->next;
+		capture->saving = true;
+		pthread_mutex_unlock (&capture->lock);
+
+		capture_save (capture, request);
+		free (request->path);
+		free (request);
+
+		pthread_mutex_lock (&capture->lock);
+		capture->saving = false;
+		if (!capture->requests) {
+			pthread_cond_broadcast (&capture->idle);
+		}
+	}
+	pthread_mutex_unlock (&capture->lock);
+}
@@ -0,0 +1,92 @@
+#ifndef LIVELY_CAPTURE_H
+#define LIVELY_CAPTURE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include "lively_audio_backend.h"
+#include "lively_thread.h"
+#include "lively_wav.h"
+
+struct lively_app;
+
+/**
+ * Frames past the history which the audio thread may be overwriting while
+ * a window is saved. Longer periods are written in pieces of this size.
+ */
+#define LIVELY_CAPTURE_GUARD 8192
+/** Bytes written to the file at a time while saving */
+#define LIVELY_CAPTURE_CHUNK (1 << 20)
+/**
+ * The ring keeps this fraction of the history more than can be saved, so
+ * that a window which starts at the oldest frame has that long to be
+ * written before the input overtakes it.
+ */
+#define LIVELY_CAPTURE_SLACK 8
+
+/**
+ * A window of the history to be saved, waiting for the capture thread.
+ */
+typedef struct lively_capture_request {
+	struct lively_capture_request *next;
+	char *path;
+	uint64_t start; /**< First frame, counted since the capture began */
+	uint64_t frames;
+	unsigned int rate;
+} lively_capture_request_t;
+
+/**
+ * Keeps the last minutes of every captured channel, so that a moment can be
+ * saved after it happened.
+ *
+ * Each period, the audio thread encodes its input into a ring, already in
+ * the layout of a WAV file, and publishes the frames it wrote. The ring is
+ * allocated, touched and locked in memory up front, so that this costs
+ * nothing but the conversion: no allocation, no page fault and no lock.
+ *
+ * Saving a window is handed to a thread of its own, which writes it
+ * straight from the ring, oldest first, so that it stays ahead of the
+ * audio thread. A window which is overwritten all the same, as when the
+ * disk stalls for longer than it had left, ends where it was still whole.
+ */
+typedef struct lively_capture {
+	struct lively_app *app;
+	lively_wav_t wav; /**< Encoding and channels of the ring */
+	unsigned char *ring;
+	uint64_t capacity; /**< Frames of the ring */
+	uint64_t history; /**< Frames before the last one written which can be saved */
+	bool locked;
+
+	/** Written by the audio thread */
+	atomic_ullong written; /**< Frames ever written */
+	atomic_ullong start; /**< Frames written before this run of the audio thread */
+	atomic_uint rate;
+
+	lively_thread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	lively_capture_request_t *requests; /**< Oldest first */
+	bool saving;
+} lively_capture_t;
+
+bool lively_capture_init (
+	lively_capture_t *,
+	struct lively_app *,
+	lively_wav_encoding_t encoding,
+	unsigned int channels,
+	unsigned int rate,
+	double seconds);
+void lively_capture_destroy (lively_capture_t *);
+
+void lively_capture_begin (lively_capture_t *, unsigned int rate);
+void lively_capture_write (lively_capture_t *, const lively_audio_block_t *);
+
+double lively_capture_get_seconds (lively_capture_t *);
+bool lively_capture_save (lively_capture_t *, const char *path, double ago, double seconds);
+void lively_capture_wait (lively_capture_t *);
+
+#endif
@@ -0,0 +1,1392 @@
+/**
+ * @file lively_disk.c
+ * Lively Disk: Streams files between the disk and lock-free rings
+ *
+ * The disk thread is the only one to touch files once they are open, so
+ * the audio thread never waits for the filesystem; it only moves frames
+ * in and out of rings. Each ring has one writer and one reader, which
+ * publish their progress with release stores of their frame counters.
+ *
+ * Recordings are written so that a crash loses at most the last few
+ * seconds: the samples are synced before each update of the header, which
+ * only ever claims frames already on the disk.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lively_disk.h"
+#include "lively_app.h"
+#include "lively_hash.h"
+#include "lively_node.h"
+#include "platform.h"
+
+#define DISK_MASK (LIVELY_DISK_RING - 1)
+/** Frames of the smallest read, once reads adapt */
+#define DISK_CHUNK_MIN 4096
+
+enum disk_job_state {
+	JOB_FREE,
+	JOB_QUEUED, /**< Owned by the workers */
+	JOB_DONE
+};
+
+_Static_assert ((LIVELY_DISK_RING & DISK_MASK) == 0,
+	"Rings are indexed by masking");
+_Static_assert (LIVELY_WAV_HEADER_BYTES % LIVELY_DISK_BLOCK == 0
+	&& LIVELY_LOSSLESS_HEADER_BYTES % LIVELY_DISK_BLOCK == 0
+	&& LIVELY_DISK_CHUNK % LIVELY_DISK_BLOCK == 0,
+	"Samples are written in whole blocks");
+
+/**
+* Initializes a disk service with no streams. The thread is started
+* separately, with #lively_disk_main.
+*
+* @param disk The disk service
+* @param app The Lively Application, for logging
+*
+* @return A success value
+*/
+bool
+lively_disk_init (lively_disk_t *disk, struct lively_app *app) {
+	disk->app = app;
+	disk->streams = NULL;
+	atomic_init (&disk->woken, false);
+	disk->workers_running = false;
+	disk->queue = NULL;
+	disk->queue_last = NULL;
+
+	disk->bytes = aligned_alloc (LIVELY_DISK_BLOCK, LIVELY_DISK_CHUNK);
+	disk->samples = malloc (LIVELY_DISK_CHUNK / 2 * sizeof *disk->samples);
+	if (!disk->bytes || !disk->samples) {
+		free (disk->bytes);
+		free (disk->samples);
+		return false;
+	}
+	if (sem_init (&disk->wake, 0, 0) != 0) {
+		free (disk->bytes);
+		free (disk->samples);
+		return false;
+	}
+	pthread_mutex_init (&disk->lock, NULL);
+	pthread_mutex_init (&disk->queue_lock, NULL);
+	pthread_cond_init (&disk->queue_work, NULL);
+	pthread_cond_init (&disk->queue_done, NULL);
+	return true;
+}
+
+/**
+* Destroys a disk service. Its streams must be closed, and its thread
+* stopped.
+*
+* @param disk The disk service
+*/
+void
+lively_disk_destroy (lively_disk_t *disk) {
+	if (disk->workers_running) {
+		pthread_mutex_lock (&disk->queue_lock);
+		for (unsigned int i = 0; i < LIVELY_DISK_WORKERS; i++) {
+			lively_thread_set_state (&disk->workers[i].thread, THREAD_STOP);
+		}
+		pthread_cond_broadcast (&disk->queue_work);
+		pthread_mutex_unlock (&disk->queue_lock);
+
+		for (unsigned int i = 0; i < LIVELY_DISK_WORKERS; i++) {
+			lively_thread_join (&disk->workers[i].thread);
+			lively_lossless_encoder_destroy (&disk->workers[i].encoder);
+		}
+		disk->workers_running = false;
+	}
+
+	pthread_cond_destroy (&disk->queue_work);
+	pthread_cond_destroy (&disk->queue_done);
+	pthread_mutex_destroy (&disk->queue_lock);
+	pthread_mutex_destroy (&disk->lock);
+	sem_destroy (&disk->wake);
+	free (disk->bytes);
+	free (disk->samples);
+	disk->bytes = NULL;
+	disk->samples = NULL;
+}
+
+/**
+* Wakes the disk thread for an early pass. Safe to call from the audio
+* thread; only the first call between two passes posts.
+*
+* @param disk The disk service
+*/
+void
+lively_disk_wake (lively_disk_t *disk) {
+	if (!atomic_exchange_explicit (&disk->woken, true, memory_order_relaxed)) {
+		sem_post (&disk->wake);
+	}
+}
+
+/**
+* The main routine of the disk thread: passes over the streams whenever it
+* is woken, and at least every #LIVELY_DISK_INTERVAL seconds.
+*
+* @param thread The Lively Thread
+*/
+void
+lively_disk_main (lively_thread_t *thread) {
+	lively_disk_t *disk = &thread->app->disk;
+
+	while (lively_thread_get_state (thread) != THREAD_STOP) {
+		lively_disk_service (disk);
+
+		struct timespec deadline;
+		clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (long) (LIVELY_DISK_INTERVAL * 1e9);
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (sem_timedwait (&disk->wake, &deadline) != 0 && errno == EINTR) {
+		}
+	}
+}
+
+/**
+* Writes frames into the ring of a reader, through its resampler if it has
+* one, in at most two spans. Input which does not fit is left over.
+*
+* @param frames The number of frames of input; on return, the number taken
+*
+* @return The number of frames written to the ring
+*/
+static unsigned int
+disk_ring_write (lively_disk_stream_t *stream, const float *const *input, unsigned int *frames) {
+	unsigned int written = atomic_load_explicit (&stream->written, memory_order_relaxed);
+	unsigned int read = atomic_load_explicit (&stream->read, memory_order_acquire);
+	unsigned int room = LIVELY_DISK_RING - (written - read);
+	const float *in[LIVELY_CHANNELS_MAX];
+	float *out[LIVELY_CHANNELS_MAX];
+	unsigned int consumed = 0, produced = 0;
+
+	for (unsigned int span = 0; span < 2 && consumed < *frames && produced < room; span++) {
+		unsigned int index = (written + produced) & DISK_MASK;
+		unsigned int length = LIVELY_DISK_RING - index < room - produced
+			? LIVELY_DISK_RING - index : room - produced;
+		unsigned int taken = *frames - consumed;
+
+		for (unsigned int c = 0; c < stream->channels; c++) {
+			in[c] = input[c] + consumed;
+			out[c] = stream->ring + (size_t) c * LIVELY_DISK_RING + index;
+		}
+		if (stream->resampling) {
+			produced += lively_resampler_process (&stream->resampler, in, &taken, out, length);
+		} else {
+			taken = taken < length ? taken : length;
+			for (unsigned int c = 0; c < stream->channels; c++) {
+				memcpy (out[c], in[c], taken * sizeof *out[c]);
+			}
+			produced += taken;
+		}
+		consumed += taken;
+	}
+
+	*frames = consumed;
+	atomic_store_explicit (&stream->written, written + produced, memory_order_release);
+	return produced;
+}
+
+/**
+* Returns the frames of the ring of a stream which hold frames not read yet.
+*/
+static unsigned int
+disk_fill (lively_disk_stream_t *stream) {
+	return atomic_load_explicit (&stream->written, memory_order_relaxed)
+		- atomic_load_explicit (&stream->read, memory_order_acquire);
+}
+
+/**
+* Returns the frames a stream can go before its ring runs dry, or for a
+* writer, overflows.
+*/
+static unsigned int
+disk_slack (lively_disk_stream_t *stream) {
+	unsigned int fill = disk_fill (stream);
+	return stream->writer ? LIVELY_DISK_RING - fill : fill;
+}
+
+/**
+* Returns whether a stream is due: a reader whose ring has room for a
+* whole chunk, or for the rest of the file, or a writer whose ring holds a
+* whole chunk. A lossless writer is also due when a block is done.
+*/
+static bool
+disk_due (lively_disk_stream_t *stream) {
+	if (atomic_load_explicit (&stream->finished, memory_order_relaxed)) {
+		return false;
+	}
+	if (stream->writer && stream->lossless) {
+		lively_disk_job_t *oldest = &stream->jobs[stream->collected % LIVELY_DISK_JOBS];
+		return (stream->collected != stream->submitted
+				&& atomic_load_explicit (&oldest->state, memory_order_acquire) == JOB_DONE)
+			|| (disk_fill (stream) >= stream->chunk
+				&& stream->submitted - stream->collected < LIVELY_DISK_JOBS);
+	}
+	if (stream->writer) {
+		return disk_fill (stream) >= stream->chunk;
+	}
+	unsigned int room = LIVELY_DISK_RING - disk_fill (stream);
+	if (stream->wav.frames == LIVELY_LOSSLESS_FRAMES_UNKNOWN) {
+		return room >= stream->chunk;
+	}
+	uint64_t left = stream->wav.frames - stream->position + stream->tail;
+	if (stream->resampling) {
+		// In frames of the ring, rounded up.
+		left = (left * stream->rate + stream->wav.rate - 1) / stream->wav.rate;
+	}
+	return room >= stream->chunk || (left < stream->chunk && room >= left + 2);
+}
+
+/**
+* Reads the next blocks of a lossless reader into its ring, as many as
+* fit in a chunk and in frames. A file which ends in a block cut short, as
+* left by a crash, ends with the last whole one.
+*
+* @param input Staging for the samples of each channel
+* @param frames The most frames of the file the ring can take
+*
+* @return Whether frames were read, or the end was found
+*/
+static bool
+disk_read_blocks (lively_disk_t *disk, lively_disk_stream_t *stream, float *const *input, unsigned int frames) {
+	const unsigned char *data = disk->bytes;
+	float *output[LIVELY_CHANNELS_MAX];
+	unsigned int decoded = 0, block_frames = 0;
+	size_t got, used = 0;
+	bool valid = true, full = false;
+
+	if (stream->sample) {
+		// Samples are decoded where they are.
+		data = stream->sample->data + stream->offset;
+		got = stream->sample->size - (size_t) stream->offset;
+	} else {
+		ssize_t length = pread (stream->fd, disk->bytes, LIVELY_DISK_CHUNK, (off_t) stream->offset);
+		if (length < 0) {
+			lively_app_log (disk->app, LIVELY_ERROR, "disk",
+				"Could not read a stream: %s", strerror (errno));
+			atomic_store_explicit (&stream->finished, true, memory_order_release);
+			return false;
+		}
+		got = (size_t) length;
+	}
+
+	for (;;) {
+		size_t size = lively_lossless_block_size (data + used, got - used, &block_frames);
+		if (size == 0 || size > got - used) {
+			break;
+		}
+		if (decoded + block_frames > frames) {
+			full = true;
+			break;
+		}
+		for (unsigned int c = 0; c < stream->channels; c++) {
+			output[c] = input[c] + decoded;
+		}
+		if (!lively_lossless_decode (&stream->wav, data + used, size, output)) {
+			valid = false;
+			break;
+		}
+		used += size;
+		decoded += block_frames;
+	}
+
+	if (decoded == 0) {
+		if (full) {
+			// The next block waits for room in the ring.
+			return false;
+		}
+		if (stream->wav.frames != LIVELY_LOSSLESS_FRAMES_UNKNOWN) {
+			lively_app_log (disk->app, LIVELY_ERROR, "disk",
+				"Could not read a stream: %s", valid ? "file was cut short" : "block is corrupt");
+		}
+		stream->wav.frames = stream->position;
+		return true;
+	}
+
+	// Frames before the one a change of rate resumed from are dropped.
+	unsigned int dropped = stream->skip < decoded ? (unsigned int) stream->skip : decoded;
+	const float *kept[LIVELY_CHANNELS_MAX];
+	for (unsigned int c = 0; c < stream->channels; c++) {
+		kept[c] = input[c] + dropped;
+	}
+
+	unsigned int count = decoded - dropped;
+	disk_ring_write (stream, kept, &count);
+	stream->skip -= dropped;
+	stream->position += dropped + count;
+	stream->offset += used;
+
+	// Ask the kernel to start on the chunk after this one.
+	if (stream->sample) {
+		lively_pool_sample_prefetch (stream->sample, (size_t) stream->offset, LIVELY_DISK_CHUNK);
+	} else {
+		posix_fadvise (stream->fd, (off_t) stream->offset, LIVELY_DISK_CHUNK, POSIX_FADV_WILLNEED);
+	}
+	return true;
+}
+
+/**
+* Reads the next chunk of a stream into its ring. Called with the lock
+* held, which guards the staging buffers.
+*/
+static void
+disk_read (lively_disk_t *disk, lively_disk_stream_t *stream) {
+	unsigned int fill = disk_fill (stream);
+	unsigned int room = LIVELY_DISK_RING - fill;
+	float *input[LIVELY_CHANNELS_MAX];
+
+	// Reads grow while the ring runs low, and shrink while it stays full.
+	if (fill < LIVELY_DISK_RING / 4 && stream->chunk < LIVELY_DISK_RING / 2) {
+		stream->chunk *= 2;
+	} else if (fill > LIVELY_DISK_RING / 2 && stream->chunk / 2 >= DISK_CHUNK_MIN
+		&& stream->chunk / 2 >= stream->least) {
+		stream->chunk /= 2;
+	}
+
+	// Leave the resampler room for the frame its rounding may add.
+	uint64_t frames = room - 2 < stream->chunk ? room - 2 : stream->chunk;
+	if (stream->resampling) {
+		frames = frames * stream->wav.rate / stream->rate;
+	}
+	if (frames > LIVELY_DISK_CHUNK / stream->wav.frame_bytes) {
+		frames = LIVELY_DISK_CHUNK / stream->wav.frame_bytes;
+	}
+	if (frames > LIVELY_DISK_CHUNK / 2 / stream->channels) {
+		frames = LIVELY_DISK_CHUNK / 2 / stream->channels;
+	}
+
+	for (unsigned int c = 0; c < stream->channels; c++) {
+		input[c] = disk->samples + (size_t) c * frames;
+	}
+
+	if (stream->position < stream->wav.frames && stream->lossless) {
+		if (!disk_read_blocks (disk, stream, input, (unsigned int) frames)) {
+			return;
+		}
+	} else if (stream->position < stream->wav.frames && stream->sample) {
+		if (frames > stream->wav.frames - stream->position) {
+			frames = stream->wav.frames - stream->position;
+		}
+		size_t offset = (size_t) (stream->position * stream->wav.frame_bytes);
+		lively_wav_decode (&stream->wav, stream->sample->data + offset, input, (unsigned int) frames);
+
+		unsigned int count = (unsigned int) frames;
+		disk_ring_write (stream, (const float *const *) input, &count);
+		stream->position += count;
+		lively_pool_sample_prefetch (stream->sample, offset + count * stream->wav.frame_bytes,
+			LIVELY_DISK_CHUNK);
+	} else if (stream->position < stream->wav.frames) {
+		if (frames > stream->wav.frames - stream->position) {
+			frames = stream->wav.frames - stream->position;
+		}
+		size_t size = (size_t) frames * stream->wav.frame_bytes;
+		off_t offset = (off_t) (stream->wav.data_offset + stream->position * stream->wav.frame_bytes);
+		ssize_t got = pread (stream->fd, disk->bytes, size, offset);
+		if (got < (ssize_t) stream->wav.frame_bytes) {
+			lively_app_log (disk->app, LIVELY_ERROR, "disk",
+				"Could not read a stream: %s", got < 0 ? strerror (errno) : "file was cut short");
+			atomic_store_explicit (&stream->finished, true, memory_order_release);
+			return;
+		}
+		frames = (size_t) got / stream->wav.frame_bytes;
+		lively_wav_decode (&stream->wav, disk->bytes, input, (unsigned int) frames);
+
+		unsigned int count = (unsigned int) frames;
+		disk_ring_write (stream, (const float *const *) input, &count);
+		stream->position += count;
+
+		// Ask the kernel to start on the chunk after this one.
+		posix_fadvise (stream->fd,
+			(off_t) (stream->wav.data_offset + stream->position * stream->wav.frame_bytes),
+			(off_t) size, POSIX_FADV_WILLNEED);
+	} else {
+		// Silence pushes the end of the file out of the resampler.
+		unsigned int count = stream->tail < frames ? stream->tail : (unsigned int) frames;
+		for (unsigned int c = 0; c < stream->channels; c++) {
+			memset (input[c], 0, count * sizeof *input[c]);
+		}
+		disk_ring_write (stream, (const float *const *) input, &count);
+		stream->tail -= count;
+	}
+
+	if (stream->position == stream->wav.frames && stream->tail == 0) {
+		atomic_store_explicit (&stream->finished, true, memory_order_release);
+	}
+}
+
+/**
+* Returns the most frames of a writer which fit in the staging buffer
+* after the bytes it holds back.
+*/
+static unsigned int
+disk_write_frames_max (lively_disk_stream_t *stream) {
+	return (LIVELY_DISK_CHUNK - LIVELY_DISK_BLOCK) / stream->wav.frame_bytes;
+}
+
+/**
+* Writes all of a buffer at an offset of a file, whatever the number of
+* calls it takes.
+*/
+static bool
+disk_pwrite (int fd, const unsigned char *bytes, size_t size, uint64_t offset) {
+	while (size > 0) {
+		ssize_t done = pwrite (fd, bytes, size, (off_t) offset);
+		if (done < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		bytes += done;
+		size -= (size_t) done;
+		offset += (uint64_t) done;
+	}
+	return true;
+}
+
+/**
+* Writes the head of the staging buffer to the file of a writer: the bytes
+* it held back, then new ones. Only whole blocks are written, at offsets
+* which are whole blocks too; the rest is held back for the next write,
+* unless this is the last.
+*
+* @param size The bytes of the staging buffer to write
+* @param last Whether to write the bytes short of a block as well
+*
+* @return A success value; a failure is logged, and stops the writer
+*/
+static bool
+disk_store (lively_disk_t *disk, lively_disk_stream_t *stream, size_t size, bool last) {
+	size_t whole = last ? size : size & ~(size_t) (LIVELY_DISK_BLOCK - 1);
+
+	if (stream->stored + whole > stream->allocated) {
+		// Reserving ahead keeps the file from fragmenting, and its metadata
+		// from being updated on every write. Not every filesystem can.
+		uint64_t allocated = stream->allocated + LIVELY_DISK_PREALLOCATE;
+		if (posix_fallocate (stream->fd, (off_t) (stream->wav.data_offset + stream->allocated),
+				(off_t) LIVELY_DISK_PREALLOCATE) == 0) {
+			stream->allocated = allocated;
+		} else {
+			// Write without, and do not ask again.
+			stream->allocated = UINT64_MAX;
+		}
+	}
+
+	if (!disk_pwrite (stream->fd, disk->bytes, whole, stream->wav.data_offset + stream->stored)) {
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not write a stream: %s", strerror (errno));
+		atomic_store_explicit (&stream->finished, true, memory_order_release);
+		return false;
+	}
+
+	stream->pending = (unsigned int) (size - whole);
+	memcpy (stream->block, disk->bytes + whole, stream->pending);
+	stream->stored += whole;
+	return true;
+}
+
+/**
+* Drains the ring of a writer into its file, as far as the staging buffer
+* allows. Only whole blocks are written, at offsets which are whole blocks
+* too; the rest is held back for the next write, unless this is the last.
+* Called with the lock held, which guards the staging buffers.
+*
+* @param last Whether to write the bytes short of a block as well
+*
+* @return A success value; a failure is logged, and stops the writer
+*/
+static bool
+disk_write (lively_disk_t *disk, lively_disk_stream_t *stream, bool last) {
+	unsigned int read = atomic_load_explicit (&stream->read, memory_order_relaxed);
+	unsigned int fill = disk_fill (stream);
+	unsigned int frames = fill < disk_write_frames_max (stream) ? fill : disk_write_frames_max (stream);
+	unsigned char *bytes = disk->bytes + stream->pending;
+	const float *input[LIVELY_CHANNELS_MAX];
+
+	memcpy (disk->bytes, stream->block, stream->pending);
+
+	// The frames are at most two spans, before and after the end of the ring.
+	for (unsigned int done = 0; done < frames;) {
+		unsigned int index = (read + done) & DISK_MASK;
+		unsigned int span = LIVELY_DISK_RING - index < frames - done
+			? LIVELY_DISK_RING - index : frames - done;
+		for (unsigned int c = 0; c < stream->channels; c++) {
+			input[c] = stream->ring + (size_t) c * LIVELY_DISK_RING + index;
+		}
+		lively_wav_encode (&stream->wav, input, bytes, span);
+		bytes += (size_t) span * stream->wav.frame_bytes;
+		done += span;
+	}
+
+	if (!disk_store (disk, stream, (size_t) (bytes - disk->bytes), last)) {
+		return false;
+	}
+	stream->position += frames;
+	atomic_store_explicit (&stream->read, read + frames, memory_order_release);
+	return true;
+}
+
+/**
+* Writes bytes to the file of a writer, after those it held back, through
+* the staging buffer.
+*/
+static bool
+disk_append (lively_disk_t *disk, lively_disk_stream_t *stream, const unsigned char *bytes, size_t size) {
+	while (size > 0) {
+		size_t length = LIVELY_DISK_CHUNK - stream->pending;
+		if (length > size) {
+			length = size;
+		}
+		memcpy (disk->bytes, stream->block, stream->pending);
+		memcpy (disk->bytes + stream->pending, bytes, length);
+		if (!disk_store (disk, stream, stream->pending + length, false)) {
+			return false;
+		}
+		bytes += length;
+		size -= length;
+	}
+	return true;
+}
+
+/**
+* Compresses blocks, handed over by #disk_compress.
+*/
+static void
+disk_worker_main (lively_thread_t *thread) {
+	lively_disk_worker_t *worker = LIVELY_CONTAINER_OF (thread, lively_disk_worker_t, thread);
+	lively_disk_t *disk = worker->disk;
+	const float *input[LIVELY_CHANNELS_MAX];
+
+	pthread_mutex_lock (&disk->queue_lock);
+	for (;;) {
+		while (!disk->queue && lively_thread_get_state (thread) != THREAD_STOP) {
+			pthread_cond_wait (&disk->queue_work, &disk->queue_lock);
+		}
+		if (lively_thread_get_state (thread) == THREAD_STOP) {
+			break;
+		}
+
+		lively_disk_job_t *job = disk->queue;
+		disk->queue = job->next;
+		if (!disk->queue) {
+			disk->queue_last = NULL;
+		}
+		pthread_mutex_unlock (&disk->queue_lock);
+
+		lively_disk_stream_t *stream = job->stream;
+		for (unsigned int c = 0; c < stream->channels; c++) {
+			input[c] = job->input + (size_t) c * stream->block_frames;
+		}
+		job->size = lively_lossless_encode (&worker->encoder, &stream->wav, input, job->frames, job->output);
+
+		pthread_mutex_lock (&disk->queue_lock);
+		atomic_store_explicit (&job->state, JOB_DONE, memory_order_release);
+		pthread_cond_broadcast (&disk->queue_done);
+		lively_disk_wake (disk);
+	}
+	pthread_mutex_unlock (&disk->queue_lock);
+}
+
+/**
+* Starts the workers, unless they run already. Called with the lock held.
+*/
+static bool
+disk_start_workers (lively_disk_t *disk) {
+	unsigned int started = 0;
+
+	if (disk->workers_running) {
+		return true;
+	}
+	for (; started < LIVELY_DISK_WORKERS; started++) {
+		lively_disk_worker_t *worker = &disk->workers[started];
+		worker->disk = disk;
+		if (!lively_lossless_encoder_init (&worker->encoder, LIVELY_LOSSLESS_BLOCK_FRAMES)) {
+			break;
+		}
+		if (!lively_thread_init (&worker->thread, disk->app, disk_worker_main)) {
+			lively_lossless_encoder_destroy (&worker->encoder);
+			break;
+		}
+	}
+	if (started == LIVELY_DISK_WORKERS) {
+		disk->workers_running = true;
+		return true;
+	}
+
+	pthread_mutex_lock (&disk->queue_lock);
+	for (unsigned int i = 0; i < started; i++) {
+		lively_thread_set_state (&disk->workers[i].thread, THREAD_STOP);
+	}
+	pthread_cond_broadcast (&disk->queue_work);
+	pthread_mutex_unlock (&disk->queue_lock);
+	for (unsigned int i = 0; i < started; i++) {
+		lively_thread_join (&disk->workers[i].thread);
+		lively_lossless_encoder_destroy (&disk->workers[i].encoder);
+	}
+	return false;
+}
+
+/**
+* Moves a lossless writer along: writes the blocks the workers are done
+* with, in order, then hands them the whole blocks in the ring, as long as
+* there are jobs free. Called with the lock held.
+*
+* @param last Whether to hand over the frames short of a block as well
+*
+* @return A success value; a failure is logged, and stops the writer
+*/
+static bool
+disk_compress (lively_disk_t *disk, lively_disk_stream_t *stream, bool last) {
+	while (stream->collected != stream->submitted) {
+		lively_disk_job_t *job = &stream->jobs[stream->collected % LIVELY_DISK_JOBS];
+		if (atomic_load_explicit (&job->state, memory_order_acquire) != JOB_DONE) {
+			break;
+		}
+		if (!disk_append (disk, stream, job->output, job->size)) {
+			return false;
+		}
+		stream->position += job->frames;
+		atomic_store_explicit (&job->state, JOB_FREE, memory_order_relaxed);
+		stream->collected++;
+	}
+
+	while (stream->submitted - stream->collected < LIVELY_DISK_JOBS) {
+		unsigned int read = atomic_load_explicit (&stream->read, memory_order_relaxed);
+		unsigned int fill = disk_fill (stream);
+		unsigned int frames = fill < stream->block_frames ? fill : stream->block_frames;
+		if (frames == 0 || (frames < stream->block_frames && !last)) {
+			break;
+		}
+
+		lively_disk_job_t *job = &stream->jobs[stream->submitted % LIVELY_DISK_JOBS];
+		unsigned int index = read & DISK_MASK;
+		unsigned int first = LIVELY_DISK_RING - index < frames ? LIVELY_DISK_RING - index : frames;
+		for (unsigned int c = 0; c < stream->channels; c++) {
+			const float *ring = stream->ring + (size_t) c * LIVELY_DISK_RING;
+			float *input = job->input + (size_t) c * stream->block_frames;
+			memcpy (input, ring + index, first * sizeof *ring);
+			memcpy (input + first, ring, (frames - first) * sizeof *ring);
+		}
+		atomic_store_explicit (&stream->read, read + frames, memory_order_release);
+
+		job->frames = frames;
+		job->next = NULL;
+		pthread_mutex_lock (&disk->queue_lock);
+		atomic_store_explicit (&job->state, JOB_QUEUED, memory_order_relaxed);
+		if (disk->queue_last) {
+			disk->queue_last->next = job;
+		} else {
+			disk->queue = job;
+		}
+		disk->queue_last = job;
+		pthread_cond_signal (&disk->queue_work);
+		pthread_mutex_unlock (&disk->queue_lock);
+		stream->submitted++;
+	}
+	return true;
+}
+
+/**
+* Builds the header of a writer for its format, and the frames of its
+* layout.
+*/
+static void
+disk_header (lively_disk_stream_t *stream, unsigned char *header) {
+	if (stream->lossless) {
+		lively_lossless_write_header (&stream->wav, stream->block_frames, header);
+	} else {
+		lively_wav_write_header (&stream->wav, header);
+	}
+}
+
+/**
+* Rewrites the header of a writer for the frames in its file, once they
+* are sure to be on the disk.
+*
+* @param frames The number of frames the header is to claim
+*
+* @return A success value; a failure is logged
+*/
+static bool
+disk_sync (lively_disk_t *disk, lively_disk_stream_t *stream, uint64_t frames) {
+	unsigned char header[LIVELY_WAV_HEADER_BYTES];
+
+	stream->wav.frames = frames;
+	disk_header (stream, header);
+	if (fdatasync (stream->fd) != 0
+		|| !disk_pwrite (stream->fd, header, sizeof header, 0)) {
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not update a recording: %s", strerror (errno));
+		return false;
+	}
+	stream->synced = stream->stored;
+	stream->synced_at = platform_time ();
+	return true;
+}
+
+/**
+* Serves the streams which are due, the closest to running dry or
+* overflowing first, until none is. Then updates the headers of writers
+* which were not for a while.
+*/
+static void
+disk_service_locked (lively_disk_t *disk) {
+	for (;;) {
+		lively_disk_stream_t *next = NULL;
+		unsigned int lowest = LIVELY_DISK_RING;
+
+		for (lively_disk_stream_t *stream = disk->streams; stream; stream = stream->next) {
+			unsigned int slack = disk_slack (stream);
+			if (slack <= lowest && disk_due (stream)) {
+				next = stream;
+				lowest = slack;
+			}
+		}
+		if (!next) {
+			break;
+		}
+		if (next->writer && next->lossless) {
+			disk_compress (disk, next, false);
+		} else if (next->writer) {
+			disk_write (disk, next, false);
+		} else {
+			disk_read (disk, next);
+		}
+	}
+
+	// The header of a lossless file claims no frames until it is complete;
+	// its blocks tell where it ends.
+	double now = platform_time ();
+	for (lively_disk_stream_t *stream = disk->streams; stream; stream = stream->next) {
+		if (stream->writer && stream->stored > stream->synced
+			&& now - stream->synced_at >= LIVELY_DISK_SYNC_INTERVAL
+			&& !atomic_load_explicit (&stream->finished, memory_order_relaxed)) {
+			disk_sync (disk, stream, stream->lossless
+				? LIVELY_LOSSLESS_FRAMES_UNKNOWN : stream->stored / stream->wav.frame_bytes);
+		}
+	}
+}
+
+/**
+* Runs one pass of the disk service. Normally called by the disk thread;
+* programs without one may call it themselves.
+*
+* @param disk The disk service
+*/
+void
+lively_disk_service (lively_disk_t *disk) {
+	atomic_store_explicit (&disk->woken, false, memory_order_relaxed);
+
+	pthread_mutex_lock (&disk->lock);
+	disk_service_locked (disk);
+	pthread_mutex_unlock (&disk->lock);
+}
+
+static void
+disk_stream_free (lively_disk_stream_t *stream) {
+	if (stream->resampling) {
+		lively_resampler_destroy (&stream->resampler);
+	}
+	if (stream->fd >= 0) {
+		close (stream->fd);
+	}
+	if (stream->sample) {
+		lively_pool_release (stream->sample);
+	}
+	if (stream->jobs) {
+		for (unsigned int i = 0; i < LIVELY_DISK_JOBS; i++) {
+			free (stream->jobs[i].input);
+			free (stream->jobs[i].output);
+		}
+		free (stream->jobs);
+	}
+	free (stream->block);
+	free (stream->ring);
+	free (stream);
+}
+
+/**
+* Allocates the jobs of a lossless writer.
+*/
+static bool
+disk_alloc_jobs (lively_disk_stream_t *stream) {
+	stream->jobs = calloc (LIVELY_DISK_JOBS, sizeof *stream->jobs);
+	if (!stream->jobs) {
+		return false;
+	}
+	for (unsigned int i = 0; i < LIVELY_DISK_JOBS; i++) {
+		lively_disk_job_t *job = &stream->jobs[i];
+		job->stream = stream;
+		atomic_init (&job->state, JOB_FREE);
+		job->input = malloc ((size_t) stream->block_frames * stream->channels * sizeof *job->input);
+		job->output = malloc (lively_lossless_block_bytes_max (&stream->wav, stream->block_frames));
+		if (!job->input || !job->output) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+* Allocates a reader whose layout is known, or frees it on failure.
+*/
+static lively_disk_stream_t *
+disk_new_reader (lively_disk_t *disk, unsigned int rate) {
+	lively_disk_stream_t *stream = calloc (1, sizeof *stream);
+	if (!stream) {
+		return NULL;
+	}
+	stream->disk = disk;
+	stream->fd = -1;
+	stream->rate = rate;
+	stream->chunk = LIVELY_DISK_CHUNK_FRAMES;
+	atomic_init (&stream->written, 0);
+	atomic_init (&stream->read, 0);
+	atomic_init (&stream->finished, false);
+	atomic_init (&stream->underruns, 0);
+	atomic_init (&stream->overflows, 0);
+	return stream;
+}
+
+/**
+* Sets up the ring of a reader whose layout is known, and fills it before
+* adding the reader to the service.
+*
+* @param name What the reader plays, for the log
+*
+* @return A success value; on failure the reader is freed
+*/
+static bool
+disk_start_reader (lively_disk_t *disk, lively_disk_stream_t *stream, const char *name) {
+	stream->channels = stream->wav.channels;
+
+	if (stream->lossless) {
+		// Blocks are read whole, so every read must have room for one.
+		stream->least = (unsigned int) (((uint64_t) stream->block_frames * stream->rate
+			+ stream->wav.rate - 1) / stream->wav.rate) + 3;
+		if (stream->least > LIVELY_DISK_RING / 2) {
+			lively_app_log (disk->app, LIVELY_ERROR, "disk",
+				"Could not convert '%s' from %u Hz", name, stream->wav.rate);
+			disk_stream_free (stream);
+			return false;
+		}
+		if (stream->chunk < stream->least) {
+			stream->chunk = stream->least;
+		}
+	}
+
+	stream->ring = calloc ((size_t) LIVELY_DISK_RING * stream->channels, sizeof *stream->ring);
+	if (!stream->ring) {
+		disk_stream_free (stream);
+		return false;
+	}
+	if (stream->wav.rate != stream->rate) {
+		if (!lively_resampler_init (&stream->resampler, stream->channels,
+				stream->wav.rate, stream->rate, false)) {
+			lively_app_log (disk->app, LIVELY_ERROR, "disk",
+				"Could not convert '%s' from %u Hz", name, stream->wav.rate);
+			disk_stream_free (stream);
+			return false;
+		}
+		stream->resampling = true;
+		stream->tail = lively_resampler_latency (&stream->resampler);
+	}
+
+	pthread_mutex_lock (&disk->lock);
+	while (disk_due (stream)) {
+		disk_read (disk, stream);
+	}
+	stream->next = disk->streams;
+	disk->streams = stream;
+	pthread_mutex_unlock (&disk->lock);
+	return true;
+}
+
+/**
+* Opens a WAV file, or a lossless one, for streaming, and fills its ring
+* before returning, so that it can play at once. Must not be called from
+* the audio thread.
+*
+* @param disk The disk service
+* @param path The path of the file
+* @param rate The rate to read the file at; it is converted if its own
+* differs
+*
+* @return The stream, or NULL on failure, which is logged
+*/
+lively_disk_stream_t *
+lively_disk_open_reader (lively_disk_t *disk, const char *path, unsigned int rate) {
+	lively_disk_stream_t *stream = disk_new_reader (disk, rate);
+	if (!stream) {
+		return NULL;
+	}
+
+	stream->fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (stream->fd < 0) {
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not open '%s': %s", path, strerror (errno));
+		free (stream);
+		return NULL;
+	}
+	stream->lossless = lively_lossless_read_header (&stream->wav, &stream->block_frames, stream->fd);
+	if ((!stream->lossless && (stream->wav.error
+			|| !lively_wav_read_header (&stream->wav, stream->fd)))
+		|| stream->wav.channels > LIVELY_CHANNELS_MAX) {
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not read '%s': %s", path,
+			stream->wav.error ? stream->wav.error : "too many channels");
+		disk_stream_free (stream);
+		return NULL;
+	}
+	stream->offset = stream->wav.data_offset;
+
+	posix_fadvise (stream->fd, (off_t) stream->wav.data_offset, 0, POSIX_FADV_SEQUENTIAL);
+	return disk_start_reader (disk, stream, path) ? stream : NULL;
+}
+
+/**
+* Streams a sample of the pool, as #lively_disk_open_reader does a file.
+* The stream takes a reference to the sample, so that it may be released
+* while the stream plays it. Must not be called from the audio thread.
+*
+* Rings are filled on the disk thread, which is where the pages of a
+* mapped sample are faulted in and the blocks of a compressed one decoded.
+*
+* @param disk The disk service
+* @param sample The sample
+* @param rate The rate to play the sample at; it is converted if its own
+* differs
+*
+* @return The stream, or NULL on failure, which is logged
+*/
+lively_disk_stream_t *
+lively_disk_open_sample (lively_disk_t *disk, lively_pool_sample_t *sample, unsigned int rate) {
+	lively_disk_stream_t *stream = disk_new_reader (disk, rate);
+	if (!stream) {
+		return NULL;
+	}
+
+	lively_pool_retain (sample);
+	stream->sample = sample;
+	stream->wav = sample->wav;
+	stream->lossless = sample->compressed;
+	stream->block_frames = sample->block_frames;
+	return disk_start_reader (disk, stream, "sample") ? stream : NULL;
+}
+
+/**
+* Converts a reader to another rate, from the frame of the file its
+* consumer had reached, and fills its ring again before returning. What
+* the ring held at the previous rate is dropped. A lossless file is
+* decoded again from its start, up to that frame, since its blocks can
+* only be found in order.
+*
+* Must not be called from the audio thread, nor while the consumer may
+* read the stream.
+*
+* @param stream The reader
+* @param rate The rate to read the file at from now on
+*
+* @return A success value; on failure, which is logged, the stream is
+* unchanged
+*/
+bool
+lively_disk_stream_set_rate (lively_disk_stream_t *stream, unsigned int rate) {
+	lively_disk_t *disk = stream->disk;
+	bool resampling = stream->wav.rate != rate;
+	unsigned int least = 0;
+	lively_resampler_t resampler;
+
+	if (stream->writer || rate == stream->rate) {
+		return true;
+	}
+	if (stream->lossless) {
+		least = (unsigned int) (((uint64_t) stream->block_frames * rate
+			+ stream->wav.rate - 1) / stream->wav.rate) + 3;
+	}
+	if (least > LIVELY_DISK_RING / 2 || (resampling
+			&& !lively_resampler_init (&resampler, stream->channels, stream->wav.rate, rate, false))) {
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not convert a stream from %u Hz", stream->wav.rate);
+		return false;
+	}
+
+	pthread_mutex_lock (&disk->lock);
+
+	// The first frame of the ring lines up with the frame of the file it
+	// started from, at either rate.
+	uint64_t reached = atomic_load_explicit (&stream->read, memory_order_relaxed);
+	if (stream->resampling) {
+		reached = (reached * stream->wav.rate + stream->rate / 2) / stream->rate;
+		lively_resampler_destroy (&stream->resampler);
+	}
+	reached += stream->start;
+	if (stream->wav.frames != LIVELY_LOSSLESS_FRAMES_UNKNOWN && reached > stream->wav.frames) {
+		reached = stream->wav.frames;
+	}
+
+	stream->rate = rate;
+	stream->resampling = resampling;
+	if (resampling) {
+		stream->resampler = resampler;
+	}
+	stream->tail = resampling ? lively_resampler_latency (&resampler) : 0;
+	stream->least = least;
+	stream->chunk = LIVELY_DISK_CHUNK_FRAMES > least ? LIVELY_DISK_CHUNK_FRAMES : least;
+
+	stream->start = reached;
+	if (stream->lossless) {
+		stream->position = 0;
+		stream->offset = stream->sample ? 0 : stream->wav.data_offset;
+		stream->skip = reached;
+	} else {
+		stream->position = reached;
+	}
+	atomic_store_explicit (&stream->written, 0, memory_order_relaxed);
+	atomic_store_explicit (&stream->read, 0, memory_order_relaxed);
+	atomic_store_explicit (&stream->finished, false, memory_order_relaxed);
+
+	while (disk_due (stream)) {
+		disk_read (disk, stream);
+	}
+	pthread_mutex_unlock (&disk->lock);
+	return true;
+}
+
+/**
+* Creates a WAV file to record into, replacing any file at the path. Must
+* not be called from the audio thread.
+*
+* A lossless file holds the same samples in about half the bytes, or less:
+* the disk thread hands whole blocks to a pool of workers, which compress
+* them with #lively_lossless_encode, and writes them back in order. Floats
+* are only compressed when they are exact 24-bit samples.
+*
+* @param disk The disk service
+* @param path The path of the file
+* @param encoding How the samples are to be stored
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX
+* @param rate The sample rate of the frames to be written
+* @param lossless Whether to write a lossless file rather than a WAV one
+*
+* @return The stream, or NULL on failure, which is logged
+*/
+lively_disk_stream_t *
+lively_disk_open_writer (
+	lively_disk_t *disk,
+	const char *path,
+	lively_wav_encoding_t encoding,
+	unsigned int channels,
+	unsigned int rate,
+	bool lossless) {
+
+	unsigned char header[LIVELY_WAV_HEADER_BYTES];
+
+	if (channels == 0 || channels > LIVELY_CHANNELS_MAX) {
+		return NULL;
+	}
+
+	lively_disk_stream_t *stream = calloc (1, sizeof *stream);
+	if (!stream) {
+		return NULL;
+	}
+	stream->disk = disk;
+	stream->writer = true;
+	stream->channels = channels;
+	stream->rate = rate;
+	atomic_init (&stream->written, 0);
+	atomic_init (&stream->read, 0);
+	atomic_init (&stream->finished, false);
+	atomic_init (&stream->underruns, 0);
+	atomic_init (&stream->overflows, 0);
+	lively_wav_init (&stream->wav, encoding, channels, rate);
+	stream->chunk = LIVELY_DISK_CHUNK_FRAMES < disk_write_frames_max (stream)
+		? LIVELY_DISK_CHUNK_FRAMES : disk_write_frames_max (stream);
+	if (lossless) {
+		stream->lossless = true;
+		stream->block_frames = lively_lossless_block_frames (&stream->wav, LIVELY_DISK_CHUNK / 2);
+		stream->chunk = stream->block_frames;
+		stream->wav.data_offset = LIVELY_LOSSLESS_HEADER_BYTES;
+		stream->wav.frames = LIVELY_LOSSLESS_FRAMES_UNKNOWN;
+	}
+
+	stream->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (stream->fd < 0) {
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not create '%s': %s", path, strerror (errno));
+		free (stream);
+		return NULL;
+	}
+
+	stream->ring = calloc ((size_t) LIVELY_DISK_RING * channels, sizeof *stream->ring);
+	stream->block = malloc (LIVELY_DISK_BLOCK);
+	if (!stream->ring || !stream->block || (lossless && !disk_alloc_jobs (stream))) {
+		disk_stream_free (stream);
+		return NULL;
+	}
+
+	disk_header (stream, header);
+	if (!disk_pwrite (stream->fd, header, sizeof header, 0)) {
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not write '%s': %s", path, strerror (errno));
+		disk_stream_free (stream);
+		return NULL;
+	}
+	stream->synced_at = platform_time ();
+
+	pthread_mutex_lock (&disk->lock);
+	if (lossless && !disk_start_workers (disk)) {
+		pthread_mutex_unlock (&disk->lock);
+		lively_app_log (disk->app, LIVELY_ERROR, "disk",
+			"Could not start the workers for '%s'", path);
+		disk_stream_free (stream);
+		return NULL;
+	}
+	stream->next = disk->streams;
+	disk->streams = stream;
+	pthread_mutex_unlock (&disk->lock);
+
+	return stream;
+}
+
+/**
+* Compresses and writes what is left of a lossless writer, then completes
+* its header, which claims every frame.
+*/
+static bool
+disk_finish_lossless (lively_disk_t *disk, lively_disk_stream_t *stream) {
+	for (;;) {
+		if (!disk_compress (disk, stream, true)) {
+			return false;
+		}
+		if (stream->collected == stream->submitted) {
+			break;
+		}
+		lively_disk_job_t *oldest = &stream->jobs[stream->collected % LIVELY_DISK_JOBS];
+		pthread_mutex_lock (&disk->queue_lock);
+		while (atomic_load_explicit (&oldest->state, memory_order_acquire) != JOB_DONE) {
+			pthread_cond_wait (&disk->queue_done, &disk->queue_lock);
+		}
+		pthread_mutex_unlock (&disk->queue_lock);
+	}
+
+	memcpy (disk->bytes, stream->block, stream->pending);
+	if (!disk_store (disk, stream, stream->pending, true)) {
+		return false;
+	}
+	if (ftruncate (stream->fd, (off_t) (stream->wav.data_offset + stream->stored)) != 0) {
+		return false;
+	}
+	return disk_sync (disk, stream, stream->position);
+}
+
+/**
+* Writes what is left of a writer, and leaves its file complete: its
+* header claims every frame, and the space reserved past them is given back.
+*/
+static bool
+disk_finish (lively_disk_t *disk, lively_disk_stream_t *stream) {
+	static const unsigned char pad = 0;
+
+	if (atomic_load_explicit (&stream->finished, memory_order_relaxed)) {
+		// Failed already; the header still holds what was synced.
+		return false;
+	}
+	if (stream->lossless) {
+		return disk_finish_lossless (disk, stream);
+	}
+	while (disk_fill (stream) > disk_write_frames_max (stream)) {
+		if (!disk_write (disk, stream, false)) {
+			return false;
+		}
+	}
+	if (!disk_write (disk, stream, true)) {
+		return false;
+	}
+
+	// Chunks are padded to an even size.
+	uint64_t size = stream->wav.data_offset + stream->position * stream->wav.frame_bytes;
+	if ((size & 1) && !disk_pwrite (stream->fd, &pad, 1, size)) {
+		return false;
+	}
+	if (ftruncate (stream->fd, (off_t) (size + (size & 1))) != 0) {
+		return false;
+	}
+	return disk_sync (disk, stream, stream->position);
+}
+
+/**
+* Takes the jobs of a lossless writer back from the workers: those still
+* queued are removed, and those being compressed are waited for, so that
+* none is in use once this returns, whether or not the writer failed.
+*/
+static void
+disk_cancel_jobs (lively_disk_t *disk, lively_disk_stream_t *stream) {
+	pthread_mutex_lock (&disk->queue_lock);
+
+	disk->queue_last = NULL;
+	for (lively_disk_job_t **link = &disk->queue; *link; ) {
+		lively_disk_job_t *job = *link;
+		if (job->stream == stream) {
+			*link = job->next;
+			atomic_store_explicit (&job->state, JOB_FREE, memory_order_relaxed);
+		} else {
+			disk->queue_last = job;
+			link = &job->next;
+		}
+	}
+
+	for (unsigned int i = 0; i < LIVELY_DISK_JOBS; i++) {
+		lively_disk_job_t *job = &stream->jobs[i];
+		while (atomic_load_explicit (&job->state, memory_order_acquire) == JOB_QUEUED) {
+			pthread_cond_wait (&disk->queue_done, &disk->queue_lock);
+		}
+	}
+
+	pthread_mutex_unlock (&disk->queue_lock);
+}
+
+/**
+* Stops streaming a file and frees its stream. Its consumer, or producer,
+* must be done with it. What is left in the ring of a writer is written
+* first, and its file completed.
+*
+* @param stream The stream
+*
+* @return Whether a writer left its file complete; always true for a reader
+*/
+bool
+lively_disk_close (lively_disk_stream_t *stream) {
+	lively_disk_t *disk = stream->disk;
+	bool success = true;
+
+	pthread_mutex_lock (&disk->lock);
+	for (lively_disk_stream_t **link = &disk->streams; *link; link = &(*link)->next) {
+		if (*link == stream) {
+			*link = stream->next;
+			break;
+		}
+	}
+	if (stream->writer) {
+		success = disk_finish (disk, stream);
+	}
+	if (stream->jobs) {
+		disk_cancel_jobs (disk, stream);
+	}
+	pthread_mutex_unlock (&disk->lock);
+
+	disk_stream_free (stream);
+	return success;
+}
+
+/**
+* Takes frames from the ring of a reader. Never blocks, so it is safe on
+* the audio thread.
+*
+* A ring which cannot fill the request before the end of the file counts
+* an underrun, and wakes the disk thread, as does one left less than half
+* full.
+*
+* @param stream The stream
+* @param output Receives the frames of every channel of the stream; a
+* channel whose pointer is NULL is dropped
+* @param frames The number of frames wanted
+*
+* @return The number of frames taken
+*/
+unsigned int
+lively_disk_stream_read (lively_disk_stream_t *stream, float *const *output, unsigned int frames) {
+	unsigned int read = atomic_load_explicit (&stream->read, memory_order_relaxed);
+	bool finished = atomic_load_explicit (&stream->finished, memory_order_acquire);
+	unsigned int available = atomic_load_explicit (&stream->written, memory_order_acquire) - read;
+	unsigned int index = read & DISK_MASK;
+
+	if (frames > available) {
+		if (!finished) {
+			atomic_fetch_add_explicit (&stream->underruns, 1, memory_order_relaxed);
+		}
+		frames = available;
+	}
+
+	unsigned int first = LIVELY_DISK_RING - index < frames ? LIVELY_DISK_RING - index : frames;
+	for (unsigned int c = 0; c < stream->channels; c++) {
+		const float *ring = stream->ring + (size_t) c * LIVELY_DISK_RING;
+		if (!output[c]) {
+			continue;
+		}
+		memcpy (output[c], ring + index, first * sizeof *ring);
+		memcpy (output[c] + first, ring, (frames - first) * sizeof *ring);
+	}
+
+	atomic_store_explicit (&stream->read, read + frames, memory_order_release);
+	if (!finished && available - frames < LIVELY_DISK_RING / 2) {
+		lively_disk_wake (stream->disk);
+	}
+	return frames;
+}
+
+/**
+* Returns whether every frame of a reader has been taken.
+*
+* @param stream The stream
+*/
+bool
+lively_disk_stream_is_finished (lively_disk_stream_t *stream) {
+	return atomic_load_explicit (&stream->finished, memory_order_acquire)
+		&& atomic_load_explicit (&stream->written, memory_order_relaxed)
+			== atomic_load_explicit (&stream->read, memory_order_relaxed);
+}
+
+/**
+* Puts frames into the ring of a writer. Never blocks, so it is safe on the
+* audio thread.
+*
+* A ring which cannot take all of the frames, because the disk fell behind
+* or the writer failed, counts an overflow and drops the rest. A ring
+* filled past a quarter wakes the disk thread.
+*
+* @param stream The stream
+* @param input The frames of every channel of the stream
+* @param frames The number of frames
+*
+* @return The number of frames taken
+*/
+unsigned int
+lively_disk_stream_write (lively_disk_stream_t *stream, const float *const *input, unsigned int frames) {
+	unsigned int written = atomic_load_explicit (&stream->written, memory_order_relaxed);
+	unsigned int fill = written - atomic_load_explicit (&stream->read, memory_order_acquire);
+	unsigned int room = LIVELY_DISK_RING - fill;
+	unsigned int index = written & DISK_MASK;
+
+	if (atomic_load_explicit (&stream->finished, memory_order_relaxed)) {
+		room = 0;
+	}
+	if (frames > room) {
+		atomic_fetch_add_explicit (&stream->overflows, 1, memory_order_relaxed);
+		frames = room;
+	}
+
+	unsigned int first = LIVELY_DISK_RING - index < frames ? LIVELY_DISK_RING - index : frames;
+	for (unsigned int c = 0; c < stream->channels; c++) {
+		float *ring = stream->ring + (size_t) c * LIVELY_DISK_RING;
+		memcpy (ring + index, input[c], first * sizeof *ring);
+		memcpy (ring, input[c] + first, (frames - first) * sizeof *ring);
+	}
+
+	atomic_store_explicit (&stream->written, written + frames, memory_order_release);
+	if (fill + frames >= LIVELY_DISK_RING / 4) {
+		lively_disk_wake (stream->disk);
+	}
+	return frames;
+}
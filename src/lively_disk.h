@@ -0,0 +1,203 @@
+#ifndef LIVELY_DISK_H
+#define LIVELY_DISK_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "lively_lossless.h"
+#include "lively_pool.h"
+#include "lively_thread.h"
+#include "lively_wav.h"
+#include "dsp/lively_resampler.h"
+
+/** Frames of the ring of each channel of a stream; a power of two */
+#define LIVELY_DISK_RING 65536
+/** Bytes of the largest single read */
+#define LIVELY_DISK_CHUNK (1 << 20)
+/** Frames of the first reads of a stream, before they adapt to its use */
+#define LIVELY_DISK_CHUNK_FRAMES 8192
+/** Seconds the disk thread sleeps when nothing wakes it */
+#define LIVELY_DISK_INTERVAL 0.01
+/** Bytes which writes are aligned to, in the file */
+#define LIVELY_DISK_BLOCK 4096
+/** Bytes reserved at a time ahead of a writer */
+#define LIVELY_DISK_PREALLOCATE (64 << 20)
+/** Seconds between the updates of the header of a writer */
+#define LIVELY_DISK_SYNC_INTERVAL 1.0
+/** Threads which compress the blocks of lossless writers */
+#define LIVELY_DISK_WORKERS 2
+/** Blocks of a lossless writer between the disk thread and the workers */
+#define LIVELY_DISK_JOBS 8
+
+struct lively_app;
+struct lively_disk;
+struct lively_disk_stream;
+
+/**
+ * A block of a lossless writer, handed to the workers to compress.
+ */
+typedef struct lively_disk_job {
+	struct lively_disk_job *next; /**< In the queue of the workers */
+	struct lively_disk_stream *stream;
+	atomic_int state;
+
+	unsigned int frames;
+	float *input; /**< Block frames of each channel */
+	unsigned char *output;
+	size_t size; /**< Bytes of output */
+} lively_disk_job_t;
+
+/**
+ * A thread which compresses blocks, with its own scratch space.
+ */
+typedef struct lively_disk_worker {
+	lively_thread_t thread;
+	struct lively_disk *disk;
+	lively_lossless_encoder_t encoder;
+} lively_disk_worker_t;
+
+/**
+ * A file streamed through a ring of planar frames, between the disk
+ * thread and one other thread, usually the audio thread.
+ *
+ * A reader fills the ring ahead of its consumer, converting the file to
+ * the rate of the ring when they differ. A writer drains the ring behind
+ * its producer into the file. The counters of frames written and read are
+ * the only state both sides touch.
+ *
+ * Files are either WAV or, for writers which ask for it and for readers
+ * which find it, lossless, as written by #lively_lossless_encode. A reader
+ * may also play a sample of a #lively_pool rather than a file.
+ */
+typedef struct lively_disk_stream {
+	struct lively_disk_stream *next; /**< In the list of the disk service */
+	struct lively_disk *disk;
+
+	int fd;
+	lively_wav_t wav;
+	unsigned int channels; /**< Of the ring, the same as the file */
+	unsigned int rate; /**< Of the ring */
+
+	/** #LIVELY_DISK_RING frames per channel */
+	float *ring;
+	atomic_uint written; /**< Frames ever written, by the disk thread */
+	atomic_uint read; /**< Frames ever read, by the consumer */
+	/** Whether the whole file is in the ring, or a writer failed */
+	atomic_bool finished;
+	atomic_ulong underruns; /**< Blocks the ring of a reader could not fill */
+	atomic_ulong overflows; /**< Blocks the ring of a writer could not take */
+
+	/** Owned by the disk thread */
+	bool writer;
+	bool lossless;
+	uint64_t position; /**< Next frame of the file to read or write */
+	unsigned int chunk; /**< Frames of the next read, or of the least write */
+	unsigned int least; /**< Frames of the ring the smallest read needs */
+	lively_resampler_t resampler;
+	bool resampling;
+	unsigned int tail; /**< Frames of silence left to push the end out of the resampler */
+
+	/** Bytes of a writer short of a whole #LIVELY_DISK_BLOCK */
+	unsigned char *block;
+	unsigned int pending;
+	uint64_t stored; /**< Bytes of samples in the file, a multiple of the block */
+	uint64_t allocated; /**< Bytes reserved for samples */
+	uint64_t synced; /**< Bytes of samples in the file at the last sync */
+	double synced_at;
+
+	/** Of a lossless file */
+	unsigned int block_frames;
+	uint64_t offset; /**< Of the next block to read, in the file or the sample */
+
+	/** Frame of the file the ring of a reader starts from, at its rate */
+	uint64_t start;
+	uint64_t skip; /**< Frames of a lossless file to drop before the ring */
+
+	lively_pool_sample_t *sample; /**< Read rather than a file, if set */
+	lively_disk_job_t *jobs; /**< #LIVELY_DISK_JOBS of a writer */
+	unsigned int submitted; /**< Jobs ever handed to the workers */
+	unsigned int collected; /**< Jobs ever written */
+} lively_disk_stream_t;
+
+/**
+ * The disk service of a Lively Application, run by its thread_disk.
+ *
+ * Streams are registered and removed under a lock which the audio thread
+ * never takes. Each pass, the service reads into the emptiest rings first,
+ * in chunks which grow while a stream drains faster than it is filled and
+ * shrink while it stays full, so that many streams get large sequential
+ * reads without any of them running dry. Writers are drained in the same
+ * order of urgency, fullest first, in writes of whole blocks into space
+ * reserved ahead of them. A consumer that falls below half a ring, or a
+ * producer past a quarter, wakes the service early, through a semaphore,
+ * which is safe to post from the audio thread.
+ *
+ * Lossless writers hand their blocks to a few workers, started with the
+ * first of them, and write them back in order as they are done. The
+ * workers wake the service as well, so that compression never stands
+ * between the ring and the disk for long.
+ */
+typedef struct lively_disk {
+	struct lively_app *app;
+	pthread_mutex_t lock;
+	lively_disk_stream_t *streams;
+
+	sem_t wake;
+	atomic_bool woken; /**< Whether wake was posted since the last pass */
+
+	/**
+	 * Staging for one chunk, owned by whichever thread holds the lock;
+	 * bytes are aligned to #LIVELY_DISK_BLOCK
+	 */
+	unsigned char *bytes;
+	float *samples;
+
+	lively_disk_worker_t workers[LIVELY_DISK_WORKERS];
+	bool workers_running;
+	/** Guards the queue, and signals work and jobs done */
+	pthread_mutex_t queue_lock;
+	pthread_cond_t queue_work;
+	pthread_cond_t queue_done;
+	lively_disk_job_t *queue; /**< Oldest first */
+	lively_disk_job_t *queue_last;
+} lively_disk_t;
+
+bool lively_disk_init (lively_disk_t *, struct lively_app *);
+void lively_disk_destroy (lively_disk_t *);
+void lively_disk_main (lively_thread_t *);
+void lively_disk_wake (lively_disk_t *);
+void lively_disk_service (lively_disk_t *);
+
+lively_disk_stream_t *lively_disk_open_reader (
+	lively_disk_t *,
+	const char *path,
+	unsigned int rate);
+lively_disk_stream_t *lively_disk_open_sample (
+	lively_disk_t *,
+	lively_pool_sample_t *,
+	unsigned int rate);
+lively_disk_stream_t *lively_disk_open_writer (
+	lively_disk_t *,
+	const char *path,
+	lively_wav_encoding_t encoding,
+	unsigned int channels,
+	unsigned int rate,
+	bool lossless);
+bool lively_disk_close (lively_disk_stream_t *);
+bool lively_disk_stream_set_rate (lively_disk_stream_t *, unsigned int rate);
+
+unsigned int lively_disk_stream_read (
+	lively_disk_stream_t *,
+	float *const *output,
+	unsigned int frames);
+bool lively_disk_stream_is_finished (lively_disk_stream_t *);
+unsigned int lively_disk_stream_write (
+	lively_disk_stream_t *,
+	const float *const *input,
+	unsigned int frames);
+
+#endif
@@ -0,0 +1,210 @@
+/**
+ * @file lively_event.c
+ * Lively Events: Timestamped messages for nodes in a Lively Scene
+ */
+
+#include "lively_event.h"
+
+#define RING_MASK (LIVELY_EVENT_QUEUE_SIZE - 1)
+
+_Static_assert ((LIVELY_EVENT_QUEUE_SIZE & RING_MASK) == 0,
+	"LIVELY_EVENT_QUEUE_SIZE must be a power of two");
+
+/**
+* Initializes an empty event queue.
+*
+* @param queue The event queue
+*/
+void
+lively_event_queue_init (lively_event_queue_t *queue) {
+	pthread_mutex_init (&queue->lock, NULL);
+	queue->sequence = 0;
+
+	atomic_init (&queue->ring_head, 0);
+	atomic_init (&queue->ring_tail, 0);
+	queue->heap_count = 0;
+
+	atomic_flag_clear (&queue->busy);
+}
+
+void
+lively_event_queue_destroy (lively_event_queue_t *queue) {
+	pthread_mutex_destroy (&queue->lock);
+}
+
+static bool
+event_before (const lively_event_t *a, const lively_event_t *b) {
+	if (a->time != b->time) {
+		return a->time < b->time;
+	}
+	return a->sequence < b->sequence;
+}
+
+static void
+event_heap_push (lively_event_queue_t *queue, const lively_event_t *event) {
+	unsigned int i = queue->heap_count++;
+
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!event_before (event, &queue->heap[parent])) {
+			break;
+		}
+		queue->heap[i] = queue->heap[parent];
+		i = parent;
+	}
+	queue->heap[i] = *event;
+}
+
+static void
+event_heap_remove (lively_event_queue_t *queue, unsigned int i) {
+	lively_event_t last = queue->heap[--queue->heap_count];
+	if (i == queue->heap_count) {
+		return;
+	}
+
+	// The replacement may need to move either way.
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!event_before (&last, &queue->heap[parent])) {
+			break;
+		}
+		queue->heap[i] = queue->heap[parent];
+		i = parent;
+	}
+	for (;;) {
+		unsigned int child = 2 * i + 1;
+		if (child >= queue->heap_count) {
+			break;
+		}
+		if (child + 1 < queue->heap_count
+			&& event_before (&queue->heap[child + 1], &queue->heap[child])) {
+			child++;
+		}
+		if (!event_before (&queue->heap[child], &last)) {
+			break;
+		}
+		queue->heap[i] = queue->heap[child];
+		i = child;
+	}
+	queue->heap[i] = last;
+}
+
+/**
+* Moves events from the ring into the heap, as far as the heap has room.
+*/
+static void
+event_queue_drain (lively_event_queue_t *queue) {
+	unsigned int tail = atomic_load_explicit (&queue->ring_tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit (&queue->ring_head, memory_order_acquire);
+
+	while (tail != head && queue->heap_count < LIVELY_EVENT_QUEUE_SIZE) {
+		event_heap_push (queue, &queue->ring[tail & RING_MASK]);
+		tail++;
+	}
+
+	atomic_store_explicit (&queue->ring_tail, tail, memory_order_release);
+}
+
+/**
+* Posts an event. May be called from any thread except the audio thread.
+*
+* @param queue The event queue
+* @param event The event, which is copied
+*
+* @return false if the queue is full
+*/
+bool
+lively_event_queue_push (lively_event_queue_t *queue, const lively_event_t *event) {
+	bool success = false;
+
+	pthread_mutex_lock (&queue->lock);
+
+	unsigned int head = atomic_load_explicit (&queue->ring_head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit (&queue->ring_tail, memory_order_acquire);
+	if (head - tail < LIVELY_EVENT_QUEUE_SIZE) {
+		lively_event_t *slot = &queue->ring[head & RING_MASK];
+		*slot = *event;
+		slot->sequence = queue->sequence++;
+		atomic_store_explicit (&queue->ring_head, head + 1, memory_order_release);
+		success = true;
+	}
+
+	pthread_mutex_unlock (&queue->lock);
+
+	return success;
+}
+
+/**
+* Drops every pending event for a node. Called when the node leaves the scene.
+*
+* This briefly takes the queue away from the audio thread, which then
+* postpones its events by one block rather than wait.
+*
+* @param queue The event queue
+* @param node The node
+*/
+void
+lively_event_queue_purge (lively_event_queue_t *queue, struct lively_node *node) {
+	pthread_mutex_lock (&queue->lock);
+
+	while (atomic_flag_test_and_set_explicit (&queue->busy, memory_order_acquire));
+
+	// Only one producer can run while we hold the lock, so the ring is ours.
+	event_queue_drain (queue);
+
+	unsigned int i = 0;
+	while (i < queue->heap_count) {
+		if (queue->heap[i].node == node) {
+			event_heap_remove (queue, i);
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+
+	atomic_flag_clear_explicit (&queue->busy, memory_order_release);
+
+	pthread_mutex_unlock (&queue->lock);
+}
+
+/**
+* Starts consuming events from the audio thread. Never blocks.
+*
+* @param queue The event queue
+*
+* @return false if the queue is being purged; try again next block
+*/
+bool
+lively_event_queue_begin (lively_event_queue_t *queue) {
+	if (atomic_flag_test_and_set_explicit (&queue->busy, memory_order_acquire)) {
+		return false;
+	}
+
+	event_queue_drain (queue);
+	return true;
+}
+
+void
+lively_event_queue_end (lively_event_queue_t *queue) {
+	atomic_flag_clear_explicit (&queue->busy, memory_order_release);
+}
+
+/**
+* Returns the earliest pending event, or NULL if there is none.
+*
+* Only valid between #lively_event_queue_begin and #lively_event_queue_end.
+*/
+const lively_event_t *
+lively_event_queue_peek (lively_event_queue_t *queue) {
+	return queue->heap_count ? &queue->heap[0] : NULL;
+}
+
+/**
+* Removes the earliest pending event.
+*/
+void
+lively_event_queue_pop (lively_event_queue_t *queue) {
+	if (queue->heap_count) {
+		event_heap_remove (queue, 0);
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef LIVELY_EVENT_H
+#define LIVELY_EVENT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+struct lively_node;
+
+/** Maximum number of events waiting in a scene; must be a power of two */
+#define LIVELY_EVENT_QUEUE_SIZE 1024
+
+/**
+ * Specifies a type of Lively Event.
+ */
+typedef enum lively_event_type {
+	LIVELY_EVENT_PARAM, /**< Sets a parameter of a node */
+	LIVELY_EVENT_NOTE_ON, /**< Starts a note on a node */
+	LIVELY_EVENT_NOTE_OFF, /**< Stops a note on a node */
+	LIVELY_EVENT_TRANSPORT_START, /**< Starts the scene transport; sent to every node */
+	LIVELY_EVENT_TRANSPORT_STOP /**< Stops the scene transport; sent to every node */
+} lively_event_type_t;
+
+/**
+ * An event which takes effect on an exact frame of the scene clock.
+ */
+typedef struct lively_event {
+	unsigned long long time; /**< Scene frame, see #lively_scene_get_frame */
+	enum lively_event_type type;
+	struct lively_node *node; /**< Target node, or NULL for transport events */
+
+	union {
+		struct {
+			unsigned int index;
+			float value;
+		} param;
+		struct {
+			unsigned int key;
+			float velocity;
+		} note;
+	};
+
+	unsigned long long sequence; /**< Orders events with equal times */
+} lively_event_t;
+
+/**
+ * A queue of events, written by any thread and consumed by the audio thread.
+ *
+ * Writers are serialized by a mutex and hand events over through a
+ * single-producer ring. The audio thread moves them into a heap sorted by
+ * time, which only it touches, except while #lively_event_queue_purge holds
+ * the busy flag.
+ */
+typedef struct lively_event_queue {
+	pthread_mutex_t lock;
+	unsigned long long sequence;
+
+	lively_event_t ring[LIVELY_EVENT_QUEUE_SIZE];
+	atomic_uint ring_head;
+	atomic_uint ring_tail;
+
+	lively_event_t heap[LIVELY_EVENT_QUEUE_SIZE];
+	unsigned int heap_count;
+
+	atomic_flag busy;
+} lively_event_queue_t;
+
+void lively_event_queue_init (lively_event_queue_t *);
+void lively_event_queue_destroy (lively_event_queue_t *);
+
+bool lively_event_queue_push (lively_event_queue_t *, const lively_event_t *);
+void lively_event_queue_purge (lively_event_queue_t *, struct lively_node *);
+
+bool lively_event_queue_begin (lively_event_queue_t *);
+void lively_event_queue_end (lively_event_queue_t *);
+const lively_event_t *lively_event_queue_peek (lively_event_queue_t *);
+void lively_event_queue_pop (lively_event_queue_t *);
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @file lively_hash.c
+ * Lively Hash: An intrusive hash table for indexing scenes
+ */
+
+#include <stdlib.h>
+
+#include "lively_hash.h"
+
+#define HASH_INITIAL_BUCKETS 16
+
+/**
+* Initializes an empty hash table. No memory is allocated until the first
+* insert.
+*
+* @param table The hash table
+*/
+void
+lively_hash_init (lively_hash_t *table) {
+	table->buckets = NULL;
+	table->mask = 0;
+	table->count = 0;
+}
+
+/**
+* Frees the buckets of a hash table. The entries belong to the caller.
+*
+* @param table The hash table
+*/
+void
+lively_hash_destroy (lively_hash_t *table) {
+	free (table->buckets);
+	lively_hash_init (table);
+}
+
+static bool
+hash_resize (lively_hash_t *table, size_t size) {
+	lively_hash_entry_t **buckets = calloc (size, sizeof *buckets);
+	if (!buckets) {
+		return false;
+	}
+
+	for (size_t i = 0; table->buckets && i <= table->mask; i++) {
+		lively_hash_entry_t *entry = table->buckets[i];
+		while (entry) {
+			lively_hash_entry_t *next = entry->next;
+			size_t index = entry->hash & (size - 1);
+			entry->next = buckets[index];
+			buckets[index] = entry;
+			entry = next;
+		}
+	}
+
+	free (table->buckets);
+	table->buckets = buckets;
+	table->mask = size - 1;
+	return true;
+}
+
+/**
+* Inserts an entry into the hash table. Entries with equal hashes may be
+* inserted any number of times.
+*
+* @param table The hash table
+* @param entry The entry, which must not already be in a table
+* @param hash The hash of the key of the entry
+*
+* @return A success value; false if memory could not be allocated
+*/
+bool
+lively_hash_insert (lively_hash_t *table, lively_hash_entry_t *entry, uint64_t hash) {
+	if (!table->buckets) {
+		if (!hash_resize (table, HASH_INITIAL_BUCKETS)) {
+			return false;
+		}
+	} else if (table->count > table->mask) {
+		// Failing to grow only makes chains longer.
+		hash_resize (table, (table->mask + 1) * 2);
+	}
+
+	size_t index = hash & table->mask;
+	entry->hash = hash;
+	entry->next = table->buckets[index];
+	table->buckets[index] = entry;
+	table->count++;
+
+	return true;
+}
+
+/**
+* Removes an entry from the hash table.
+*
+* @param table The hash table
+* @param entry The entry, which must be in the table
+*/
+void
+lively_hash_remove (lively_hash_t *table, lively_hash_entry_t *entry) {
+	lively_hash_entry_t **iterator = &table->buckets[entry->hash & table->mask];
+	while (*iterator) {
+		if (*iterator == entry) {
+			*iterator = entry->next;
+			table->count--;
+			return;
+		}
+		iterator = &(*iterator)->next;
+	}
+}
+
+/**
+* Returns the first entry with the given hash, or NULL.
+*
+* @param table The hash table
+* @param hash The hash to look up
+*/
+lively_hash_entry_t *
+lively_hash_first (lively_hash_t *table, uint64_t hash) {
+	if (!table->buckets) {
+		return NULL;
+	}
+
+	lively_hash_entry_t *entry = table->buckets[hash & table->mask];
+	while (entry && entry->hash != hash) {
+		entry = entry->next;
+	}
+	return entry;
+}
+
+/**
+* Returns the next entry with the same hash as the given one, or NULL.
+*
+* @param entry An entry returned by #lively_hash_first or this function
+*/
+lively_hash_entry_t *
+lively_hash_next (lively_hash_entry_t *entry) {
+	uint64_t hash = entry->hash;
+
+	entry = entry->next;
+	while (entry && entry->hash != hash) {
+		entry = entry->next;
+	}
+	return entry;
+}
+
+/**
+* Hashes a string with FNV-1a.
+*
+* @param string A null-terminated string
+*/
+uint64_t
+lively_hash_string (const char *string) {
+	uint64_t hash = 0xcbf29ce484222325u;
+	while (*string) {
+		hash ^= (unsigned char) *string++;
+		hash *= 0x100000001b3u;
+	}
+	return lively_hash_mix (hash);
+}
+
+/**
+* Scrambles the bits of a key so that the low bits used for bucket indices
+* depend on all of them.
+*
+* @param key The key, for example a pointer or an identifier
+*/
+uint64_t
+lively_hash_mix (uint64_t key) {
+	// splitmix64 finalizer
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9u;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebu;
+	key ^= key >> 31;
+	return key;
+}
@@ -0,0 +1,46 @@
+#ifndef LIVELY_HASH_H
+#define LIVELY_HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Returns the structure that contains a member, given a pointer to it.
+ */
+#define LIVELY_CONTAINER_OF(pointer, type, member) \
+	((type *) ((char *) (pointer) - offsetof (type, member)))
+
+/**
+ * An entry of a #lively_hash, embedded in the structure it indexes.
+ */
+typedef struct lively_hash_entry {
+	struct lively_hash_entry *next;
+	uint64_t hash;
+} lively_hash_entry_t;
+
+/**
+ * An intrusive hash table with separate chaining.
+ *
+ * The table never allocates entries and never compares keys; lookups walk
+ * the entries with a matching hash and leave the comparison to the caller.
+ * It grows to keep chains short, so inserting is amortized O(1).
+ */
+typedef struct lively_hash {
+	lively_hash_entry_t **buckets;
+	size_t mask;
+	size_t count;
+} lively_hash_t;
+
+void lively_hash_init (lively_hash_t *);
+void lively_hash_destroy (lively_hash_t *);
+
+bool lively_hash_insert (lively_hash_t *, lively_hash_entry_t *, uint64_t hash);
+void lively_hash_remove (lively_hash_t *, lively_hash_entry_t *);
+lively_hash_entry_t *lively_hash_first (lively_hash_t *, uint64_t hash);
+lively_hash_entry_t *lively_hash_next (lively_hash_entry_t *);
+
+uint64_t lively_hash_string (const char *);
+uint64_t lively_hash_mix (uint64_t);
+
+#endif
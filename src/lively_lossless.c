@@ -0,0 +1,887 @@
+/**
+ * @file lively_lossless.c
+ * Lively Lossless: Compresses recordings without losing a bit
+ *
+ * A lossless file is a header of #LIVELY_LOSSLESS_HEADER_BYTES followed by
+ * blocks, each with its own small header and checksum, so that a file cut
+ * short by a crash plays up to its last whole block. In each block, each
+ * channel is one of:
+ *
+ * - constant: a single sample, repeated
+ * - predicted: the residuals of the best of the fixed polynomial
+ *   predictors of orders 0 to 4, in partitions with a Rice parameter each
+ * - verbatim: the samples as they are, when nothing else is smaller
+ *
+ * Samples are predicted as integers: PCM encodings are quantized exactly
+ * as #lively_wav_encode would, and floats only when they hold 24-bit
+ * samples, as they do straight from most converters; other floats are
+ * kept verbatim, bit for bit.
+ *
+ * Every field is big-endian bits within bytes, and each channel starts on
+ * a byte.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lively_lossless.h"
+
+#define LOSSLESS_VERSION 1
+#define LOSSLESS_ORDER_MAX 4
+/** Most partitions of the residuals of a channel, as a power of two */
+#define LOSSLESS_PARTITION_ORDER_MAX 8
+/** Fewest residuals of a partition */
+#define LOSSLESS_PARTITION_MIN 16
+#define LOSSLESS_RICE_MAX 30
+/** Quotients from here on are escaped, and followed by the value itself */
+#define LOSSLESS_RICE_ESCAPE 24
+
+enum lossless_mode {
+	LOSSLESS_CONSTANT,
+	LOSSLESS_PREDICTED,
+	LOSSLESS_VERBATIM
+};
+
+/** Four tables, to take the checksum four bytes at a time */
+static uint32_t lossless_crc_table[4][256];
+static pthread_once_t lossless_crc_once = PTHREAD_ONCE_INIT;
+
+static void
+lossless_crc_init (void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (unsigned int bit = 0; bit < 8; bit++) {
+			crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+		}
+		lossless_crc_table[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; i++) {
+		for (unsigned int t = 1; t < 4; t++) {
+			uint32_t crc = lossless_crc_table[t - 1][i];
+			lossless_crc_table[t][i] = lossless_crc_table[0][crc & 0xff] ^ (crc >> 8);
+		}
+	}
+}
+
+/**
+* Returns the CRC-32 of bytes, as used by zlib and PNG.
+*/
+static uint32_t
+lossless_crc (const unsigned char *bytes, size_t size) {
+	uint32_t crc = 0xffffffffu;
+	size_t i = 0;
+
+	pthread_once (&lossless_crc_once, lossless_crc_init);
+	for (; i + 4 <= size; i += 4) {
+		crc ^= (uint32_t) bytes[i] | (uint32_t) bytes[i + 1] << 8
+			| (uint32_t) bytes[i + 2] << 16 | (uint32_t) bytes[i + 3] << 24;
+		crc = lossless_crc_table[3][crc & 0xff] ^ lossless_crc_table[2][(crc >> 8) & 0xff]
+			^ lossless_crc_table[1][(crc >> 16) & 0xff] ^ lossless_crc_table[0][crc >> 24];
+	}
+	for (; i < size; i++) {
+		crc = lossless_crc_table[0][(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint32_t
+lossless_u32 (const unsigned char *bytes) {
+	return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8
+		| (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void
+lossless_put_u32 (unsigned char *bytes, uint32_t value) {
+	for (unsigned int i = 0; i < 4; i++) {
+		bytes[i] = (unsigned char) (value >> 8 * i);
+	}
+}
+
+/** Writes bits after one another, the first in the highest bit of a byte */
+typedef struct lossless_writer {
+	unsigned char *out;
+	uint64_t acc;
+	unsigned int bits; /**< Bits of acc not written yet, fewer than 32 */
+} lossless_writer_t;
+
+/**
+* Writes the low count bits of value, up to 32.
+*/
+static inline void
+lossless_put (lossless_writer_t *writer, uint32_t value, unsigned int count) {
+	writer->acc = writer->acc << count | value;
+	writer->bits += count;
+	if (writer->bits >= 32) {
+		writer->bits -= 32;
+		uint32_t word = (uint32_t) (writer->acc >> writer->bits);
+		writer->out[0] = (unsigned char) (word >> 24);
+		writer->out[1] = (unsigned char) (word >> 16);
+		writer->out[2] = (unsigned char) (word >> 8);
+		writer->out[3] = (unsigned char) word;
+		writer->out += 4;
+	}
+}
+
+static void
+lossless_put_wide (lossless_writer_t *writer, uint64_t value, unsigned int count) {
+	if (count > 32) {
+		lossless_put (writer, (uint32_t) (value >> 32), count - 32);
+		count = 32;
+	}
+	lossless_put (writer, (uint32_t) value & (uint32_t) (((uint64_t) 1 << count) - 1), count);
+}
+
+/**
+* Writes the bits left, padded with zeros to a whole byte.
+*/
+static void
+lossless_flush (lossless_writer_t *writer) {
+	if (writer->bits % 8) {
+		lossless_put (writer, 0, 8 - writer->bits % 8);
+	}
+	while (writer->bits > 0) {
+		writer->bits -= 8;
+		*writer->out++ = (unsigned char) (writer->acc >> writer->bits);
+	}
+}
+
+/** Reads what #lossless_writer_t writes */
+typedef struct lossless_reader {
+	const unsigned char *data;
+	size_t size;
+	size_t position; /**< Of the next byte to load, which may be past the end */
+	uint64_t acc; /**< The next bits, from the highest one */
+	unsigned int bits;
+} lossless_reader_t;
+
+/**
+* Loads bytes until at least 57 bits are ready. Past the end of the data,
+* zeros are loaded, and #lossless_overrun tells.
+*/
+static inline void
+lossless_refill (lossless_reader_t *reader) {
+	if (reader->bits <= 56 && reader->position + 8 <= reader->size) {
+		// Eight bytes at once, of which as many as fit are kept.
+		const unsigned char *bytes = reader->data + reader->position;
+		uint64_t word = 0;
+		for (unsigned int i = 0; i < 8; i++) {
+			word = word << 8 | bytes[i];
+		}
+		reader->acc |= word >> reader->bits;
+		reader->position += (63 - reader->bits) >> 3;
+		reader->bits |= 56;
+		return;
+	}
+	while (reader->bits <= 56) {
+		uint64_t byte = reader->position < reader->size ? reader->data[reader->position] : 0;
+		reader->position++;
+		reader->acc |= byte << (56 - reader->bits);
+		reader->bits += 8;
+	}
+}
+
+/**
+* Reads count bits, up to 32.
+*/
+static inline uint32_t
+lossless_get (lossless_reader_t *reader, unsigned int count) {
+	if (count == 0) {
+		return 0;
+	}
+	lossless_refill (reader);
+	uint32_t value = (uint32_t) (reader->acc >> (64 - count));
+	reader->acc <<= count;
+	reader->bits -= count;
+	return value;
+}
+
+static uint64_t
+lossless_get_wide (lossless_reader_t *reader, unsigned int count) {
+	uint64_t high = 0;
+	if (count > 32) {
+		high = (uint64_t) lossless_get (reader, count - 32) << 32;
+		count = 32;
+	}
+	return high | lossless_get (reader, count);
+}
+
+/**
+* Skips to the next whole byte.
+*/
+static void
+lossless_align (lossless_reader_t *reader) {
+	lossless_get (reader, reader->bits % 8);
+}
+
+static bool
+lossless_overrun (const lossless_reader_t *reader) {
+	return reader->position - reader->bits / 8 > reader->size;
+}
+
+static inline uint64_t
+lossless_zigzag (int64_t value) {
+	return (uint64_t) value << 1 ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t
+lossless_unzigzag (uint64_t value) {
+	return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static unsigned int
+lossless_width (uint64_t value) {
+	unsigned int width = 0;
+	while (value) {
+		width++;
+		value >>= 1;
+	}
+	return width;
+}
+
+/**
+* Returns the Rice parameter for values which add up to sum, and in
+* cost, an estimate of their bits with it.
+*/
+static unsigned int
+lossless_rice_parameter (uint64_t sum, unsigned int count, uint64_t *cost) {
+	unsigned int k = 0;
+	uint64_t mean = count ? sum / count : 0;
+
+	while (k < LOSSLESS_RICE_MAX && mean >> (k + 1)) {
+		k++;
+	}
+	*cost = (uint64_t) count * (k + 1) + (sum >> k);
+	return k;
+}
+
+/**
+* Returns the first of the residuals of a partition, which are split as
+* evenly as they go.
+*/
+static inline unsigned int
+lossless_partition_start (unsigned int count, unsigned int order, unsigned int partition) {
+	return (unsigned int) (((uint64_t) partition * count) >> order);
+}
+
+/**
+* Sets up scratch space for blocks of up to block_frames.
+*
+* @param encoder The encoder
+* @param block_frames The most frames of a block, up to
+* #LIVELY_LOSSLESS_BLOCK_FRAMES
+*
+* @return A success value
+*/
+bool
+lively_lossless_encoder_init (lively_lossless_encoder_t *encoder, unsigned int block_frames) {
+	encoder->block_frames = block_frames;
+	encoder->samples = malloc (block_frames * sizeof *encoder->samples);
+	encoder->residuals = malloc (block_frames * sizeof *encoder->residuals);
+	if (!encoder->samples || !encoder->residuals) {
+		lively_lossless_encoder_destroy (encoder);
+		return false;
+	}
+	return true;
+}
+
+void
+lively_lossless_encoder_destroy (lively_lossless_encoder_t *encoder) {
+	free (encoder->samples);
+	free (encoder->residuals);
+	encoder->samples = NULL;
+	encoder->residuals = NULL;
+}
+
+/**
+* Returns the most bytes a block of a layout can take.
+*
+* @param wav The layout
+* @param frames The frames of the block
+*/
+size_t
+lively_lossless_block_bytes_max (const lively_wav_t *wav, unsigned int frames) {
+	// Every channel is at most verbatim, but the last may take up to two
+	// escaped words a sample before it is found not to be smaller.
+	return LIVELY_LOSSLESS_BLOCK_HEADER + (size_t) wav->channels * (4 * (size_t) frames + 8)
+		+ 8 * (size_t) frames + 512;
+}
+
+/**
+* Returns the frames of the blocks to write for a layout: the most, up to
+* #LIVELY_LOSSLESS_BLOCK_FRAMES and a power of two, whose blocks always
+* fit in a number of bytes.
+*
+* @param wav The layout
+* @param bytes The room for a block
+*/
+unsigned int
+lively_lossless_block_frames (const lively_wav_t *wav, size_t bytes) {
+	unsigned int frames = LIVELY_LOSSLESS_BLOCK_FRAMES;
+	while (frames > 64 && lively_lossless_block_bytes_max (wav, frames) > bytes) {
+		frames /= 2;
+	}
+	return frames;
+}
+
+/**
+* Builds the header of a lossless file.
+*
+* @param wav The layout, whose frames are #LIVELY_LOSSLESS_FRAMES_UNKNOWN
+* until the file is complete
+* @param block_frames The most frames of a block
+* @param header Receives #LIVELY_LOSSLESS_HEADER_BYTES bytes
+*/
+void
+lively_lossless_write_header (const lively_wav_t *wav, unsigned int block_frames, unsigned char *header) {
+	memset (header, 0, LIVELY_LOSSLESS_HEADER_BYTES);
+	memcpy (header, "LVLC", 4);
+	lossless_put_u32 (header + 4, LOSSLESS_VERSION);
+	lossless_put_u32 (header + 8, wav->encoding);
+	lossless_put_u32 (header + 12, wav->channels);
+	lossless_put_u32 (header + 16, wav->rate);
+	lossless_put_u32 (header + 20, block_frames);
+	lossless_put_u32 (header + 24, (uint32_t) wav->frames);
+	lossless_put_u32 (header + 28, (uint32_t) (wav->frames >> 32));
+}
+
+/**
+* Reads the layout of a lossless file.
+*
+* @param wav Receives the layout, or the reason in #lively_wav::error, which
+* is left NULL for a file of another format; its frames are
+* #LIVELY_LOSSLESS_FRAMES_UNKNOWN if the file was not completed
+* @param block_frames Receives the most frames of a block
+* @param fd The file, open for reading
+*
+* @return A success value
+*/
+bool
+lively_lossless_read_header (lively_wav_t *wav, unsigned int *block_frames, int fd) {
+	unsigned char header[32];
+
+	wav->error = NULL;
+	if (pread (fd, header, sizeof header, 0) != (ssize_t) sizeof header
+		|| memcmp (header, "LVLC", 4) != 0) {
+		return false;
+	}
+	uint32_t encoding = lossless_u32 (header + 8);
+	unsigned int channels = lossless_u32 (header + 12);
+	unsigned int rate = lossless_u32 (header + 16);
+	*block_frames = lossless_u32 (header + 20);
+
+	if (lossless_u32 (header + 4) != LOSSLESS_VERSION || encoding > LIVELY_WAV_FLOAT_32
+		|| channels == 0 || rate == 0 || *block_frames == 0
+		|| *block_frames > LIVELY_LOSSLESS_BLOCK_FRAMES) {
+		wav->error = "unsupported lossless file";
+		return false;
+	}
+
+	lively_wav_init (wav, (lively_wav_encoding_t) encoding, channels, rate);
+	wav->data_offset = LIVELY_LOSSLESS_HEADER_BYTES;
+	wav->frames = (uint64_t) lossless_u32 (header + 24) | (uint64_t) lossless_u32 (header + 28) << 32;
+	return true;
+}
+
+/**
+* Converts floats to integer samples, as #lively_wav_encode would.
+*/
+static void
+lossless_quantize_pcm (const float *in, int64_t *out, unsigned int frames, float scale, float high) {
+	for (unsigned int i = 0; i < frames; i++) {
+		out[i] = lrintf (fminf (fmaxf (in[i] * scale, -scale), high));
+	}
+}
+
+/**
+* Converts a float to an integer, if it is exactly a 24-bit sample.
+*
+* The check is made on the bits, so that it holds whatever the math flags:
+* the float is exact when its significand has no bits below 2^-23, and it
+* is below 2^2 in magnitude. Negative zero is not.
+*/
+static inline bool
+lossless_quantize_exact (float sample, int64_t *value) {
+	uint32_t bits;
+	memcpy (&bits, &sample, sizeof bits);
+	uint32_t magnitude = bits & 0x7fffffffu;
+	if (magnitude == 0) {
+		*value = 0;
+		return bits == 0;
+	}
+	int exponent = (int) (magnitude >> 23);
+	if (exponent == 0 || exponent == 255) {
+		return false;
+	}
+	int64_t significand = (int64_t) ((magnitude & 0x7fffffu) | 0x800000u);
+	int shift = 127 - exponent;
+	if (shift < -1 || shift > 23
+		|| (shift > 0 && (significand & (((int64_t) 1 << shift) - 1)) != 0)) {
+		return false;
+	}
+	int64_t integer = shift >= 0 ? significand >> shift : significand << 1;
+	*value = bits >> 31 ? -integer : integer;
+	return true;
+}
+
+/**
+* Converts the samples of a channel to integers, as PCM is quantized, or
+* for floats, if every one is exactly a 24-bit sample.
+*
+* @return Whether the samples are integers, always for PCM
+*/
+static bool
+lossless_quantize (lively_wav_encoding_t encoding, const float *in, int64_t *out, unsigned int frames) {
+	switch (encoding) {
+	case LIVELY_WAV_PCM_16:
+		lossless_quantize_pcm (in, out, frames, 32768.0f, 32767.0f);
+		return true;
+	case LIVELY_WAV_PCM_24:
+		lossless_quantize_pcm (in, out, frames, 8388608.0f, 8388607.0f);
+		return true;
+	case LIVELY_WAV_PCM_32:
+		// The largest float below 2^31, as 2^31 - 1 is not one.
+		lossless_quantize_pcm (in, out, frames, 2147483648.0f, 2147483520.0f);
+		return true;
+	case LIVELY_WAV_FLOAT_32:
+		break;
+	}
+	for (unsigned int i = 0; i < frames; i++) {
+		if (!lossless_quantize_exact (in[i], &out[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+* Returns what integer samples are scaled by to become floats.
+*/
+static float
+lossless_scale (lively_wav_encoding_t encoding) {
+	switch (encoding) {
+	case LIVELY_WAV_PCM_16:
+		return 1.0f / 32768.0f;
+	case LIVELY_WAV_PCM_32:
+		return 1.0f / 2147483648.0f;
+	default:
+		return 1.0f / 8388608.0f;
+	}
+}
+
+/**
+* Returns the residual of a sample after the fixed predictor of an order.
+*/
+static inline int64_t
+lossless_residual (const int64_t *s, unsigned int order) {
+	switch (order) {
+	case 0:
+		return s[0];
+	case 1:
+		return s[0] - s[-1];
+	case 2:
+		return s[0] - 2 * s[-1] + s[-2];
+	case 3:
+		return s[0] - 3 * s[-1] + 3 * s[-2] - s[-3];
+	default:
+		return s[0] - 4 * s[-1] + 6 * s[-2] - 4 * s[-3] + s[-4];
+	}
+}
+
+static void
+lossless_write_verbatim (lossless_writer_t *writer, const float *input, unsigned int frames) {
+	lossless_put (writer, LOSSLESS_VERBATIM, 2);
+	for (unsigned int i = 0; i < frames; i++) {
+		uint32_t bits;
+		memcpy (&bits, &input[i], sizeof bits);
+		lossless_put (writer, bits, 32);
+	}
+	lossless_flush (writer);
+}
+
+/**
+* Encodes the samples of one channel, which are integers, as constant or
+* predicted.
+*/
+static void
+lossless_write_predicted (lively_lossless_encoder_t *encoder, lossless_writer_t *writer, unsigned int frames) {
+	const int64_t *s = encoder->samples;
+	uint64_t *residuals = encoder->residuals;
+	bool constant = true;
+
+	for (unsigned int i = 1; i < frames && constant; i++) {
+		constant = s[i] == s[0];
+	}
+	if (constant) {
+		lossless_put (writer, LOSSLESS_CONSTANT, 2);
+		lossless_put (writer, (uint32_t) s[0], 32);
+		lossless_flush (writer);
+		return;
+	}
+
+	// The predictor whose residuals are smallest in sum, from the
+	// differences of each order.
+	uint64_t sums[LOSSLESS_ORDER_MAX + 1] = {0};
+	unsigned int order = 0;
+	for (unsigned int i = LOSSLESS_ORDER_MAX; i < frames; i++) {
+		int64_t e0 = s[i];
+		int64_t e1 = e0 - s[i - 1];
+		int64_t e2 = e1 - (s[i - 1] - s[i - 2]);
+		int64_t e3 = e2 - (s[i - 1] - 2 * s[i - 2] + s[i - 3]);
+		int64_t e4 = e3 - (s[i - 1] - 3 * s[i - 2] + 3 * s[i - 3] - s[i - 4]);
+		sums[0] += (uint64_t) llabs (e0);
+		sums[1] += (uint64_t) llabs (e1);
+		sums[2] += (uint64_t) llabs (e2);
+		sums[3] += (uint64_t) llabs (e3);
+		sums[4] += (uint64_t) llabs (e4);
+	}
+	for (unsigned int k = 1; k <= LOSSLESS_ORDER_MAX; k++) {
+		if (sums[k] < sums[order]) {
+			order = k;
+		}
+	}
+
+	unsigned int count = frames - order;
+	uint64_t largest = 0;
+	switch (order) {
+	case 0:
+		for (unsigned int i = 0; i < count; i++) {
+			residuals[i] = lossless_zigzag (lossless_residual (s + i, 0));
+		}
+		break;
+	case 1:
+		for (unsigned int i = 0; i < count; i++) {
+			residuals[i] = lossless_zigzag (lossless_residual (s + 1 + i, 1));
+		}
+		break;
+	case 2:
+		for (unsigned int i = 0; i < count; i++) {
+			residuals[i] = lossless_zigzag (lossless_residual (s + 2 + i, 2));
+		}
+		break;
+	case 3:
+		for (unsigned int i = 0; i < count; i++) {
+			residuals[i] = lossless_zigzag (lossless_residual (s + 3 + i, 3));
+		}
+		break;
+	default:
+		for (unsigned int i = 0; i < count; i++) {
+			residuals[i] = lossless_zigzag (lossless_residual (s + 4 + i, 4));
+		}
+		break;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		largest |= residuals[i];
+	}
+	unsigned int width = lossless_width (largest);
+
+	// The partition order whose parameters and residuals are smallest,
+	// from the sums of the finest partitions merged in pairs.
+	unsigned int finest = 0;
+	while (finest < LOSSLESS_PARTITION_ORDER_MAX && (count >> (finest + 1)) >= LOSSLESS_PARTITION_MIN) {
+		finest++;
+	}
+	uint64_t partition_sums[1 << LOSSLESS_PARTITION_ORDER_MAX];
+	for (unsigned int p = 0; p < 1u << finest; p++) {
+		unsigned int end = lossless_partition_start (count, finest, p + 1);
+		partition_sums[p] = 0;
+		for (unsigned int i = lossless_partition_start (count, finest, p); i < end; i++) {
+			partition_sums[p] += residuals[i];
+		}
+	}
+	unsigned int partition_order = finest;
+	uint64_t best = UINT64_MAX;
+	for (unsigned int o = finest + 1; o-- > 0;) {
+		uint64_t cost = 5u << o;
+		for (unsigned int p = 0; p < 1u << o; p++) {
+			uint64_t part;
+			unsigned int length = lossless_partition_start (count, o, p + 1)
+				- lossless_partition_start (count, o, p);
+			lossless_rice_parameter (partition_sums[p], length, &part);
+			cost += part;
+		}
+		if (cost <= best) {
+			best = cost;
+			partition_order = o;
+		}
+		if (o > 0) {
+			for (unsigned int p = 0; p < 1u << (o - 1); p++) {
+				partition_sums[p] = partition_sums[2 * p] + partition_sums[2 * p + 1];
+			}
+		}
+	}
+	// Sum the chosen partitions again, as the merges went past them.
+	for (unsigned int p = 0; p < 1u << partition_order; p++) {
+		unsigned int end = lossless_partition_start (count, partition_order, p + 1);
+		partition_sums[p] = 0;
+		for (unsigned int i = lossless_partition_start (count, partition_order, p); i < end; i++) {
+			partition_sums[p] += residuals[i];
+		}
+	}
+
+	lossless_put (writer, LOSSLESS_PREDICTED, 2);
+	lossless_put (writer, order, 3);
+	lossless_put (writer, partition_order, 4);
+	lossless_put (writer, width, 7);
+	for (unsigned int i = 0; i < order; i++) {
+		lossless_put (writer, (uint32_t) s[i], 32);
+	}
+
+	for (unsigned int p = 0; p < 1u << partition_order; p++) {
+		unsigned int start = lossless_partition_start (count, partition_order, p);
+		unsigned int end = lossless_partition_start (count, partition_order, p + 1);
+		uint64_t cost;
+		unsigned int k = lossless_rice_parameter (partition_sums[p], end - start, &cost);
+
+		lossless_put (writer, k, 5);
+		for (unsigned int i = start; i < end; i++) {
+			uint64_t quotient = residuals[i] >> k;
+			if (quotient < LOSSLESS_RICE_ESCAPE) {
+				// The quotient in unary, ended by a one, then the rest.
+				unsigned int length = (unsigned int) quotient + 1 + k;
+				uint64_t code = (uint64_t) 1 << k | (residuals[i] & (((uint64_t) 1 << k) - 1));
+				if (length <= 32) {
+					lossless_put (writer, (uint32_t) code, length);
+				} else {
+					lossless_put (writer, 0, (unsigned int) quotient);
+					lossless_put_wide (writer, code, k + 1);
+				}
+			} else {
+				lossless_put (writer, 0, LOSSLESS_RICE_ESCAPE);
+				lossless_put_wide (writer, residuals[i], width);
+			}
+		}
+	}
+	lossless_flush (writer);
+}
+
+/**
+* Encodes a block. Must be given no more frames than the encoder was set
+* up for.
+*
+* @param encoder Scratch space, owned by the calling thread
+* @param wav The layout
+* @param input The samples of every channel
+* @param frames The number of frames, at least one
+* @param output Receives the block, of at most
+* #lively_lossless_block_bytes_max bytes
+*
+* @return The bytes of the block
+*/
+size_t
+lively_lossless_encode (
+	lively_lossless_encoder_t *encoder,
+	const lively_wav_t *wav,
+	const float *const *input,
+	unsigned int frames,
+	unsigned char *output) {
+
+	lossless_writer_t writer = {
+		.out = output + LIVELY_LOSSLESS_BLOCK_HEADER,
+		.acc = 0,
+		.bits = 0
+	};
+
+	for (unsigned int c = 0; c < wav->channels; c++) {
+		const float *in = input[c];
+		unsigned char *start = writer.out;
+		if (lossless_quantize (wav->encoding, in, encoder->samples, frames)) {
+			lossless_write_predicted (encoder, &writer, frames);
+			if ((size_t) (writer.out - start) <= 4 * (size_t) frames) {
+				continue;
+			}
+			writer.out = start;
+		}
+		if (wav->encoding == LIVELY_WAV_FLOAT_32) {
+			lossless_write_verbatim (&writer, in, frames);
+		} else {
+			// Verbatim integers, as 32 bits each.
+			lossless_put (&writer, LOSSLESS_VERBATIM, 2);
+			for (unsigned int i = 0; i < frames; i++) {
+				lossless_put (&writer, (uint32_t) encoder->samples[i], 32);
+			}
+			lossless_flush (&writer);
+		}
+	}
+
+	size_t size = (size_t) (writer.out - output);
+	unsigned char *payload = output + LIVELY_LOSSLESS_BLOCK_HEADER;
+	memcpy (output, "LVBK", 4);
+	lossless_put_u32 (output + 4, (uint32_t) size);
+	lossless_put_u32 (output + 8, frames);
+	lossless_put_u32 (output + 12, lossless_crc (payload, size - LIVELY_LOSSLESS_BLOCK_HEADER));
+	return size;
+}
+
+/**
+* Reads the header of the block data starts with.
+*
+* @param data The data
+* @param size The bytes of data
+* @param frames Receives the frames of the block
+*
+* @return The bytes of the block, which may be more than size; 0 if data
+* does not start with a block
+*/
+size_t
+lively_lossless_block_size (const unsigned char *data, size_t size, unsigned int *frames) {
+	if (size < LIVELY_LOSSLESS_BLOCK_HEADER || memcmp (data, "LVBK", 4) != 0) {
+		return 0;
+	}
+	size_t block = lossless_u32 (data + 4);
+	*frames = lossless_u32 (data + 8);
+	if (block < LIVELY_LOSSLESS_BLOCK_HEADER || *frames == 0 || *frames > LIVELY_LOSSLESS_BLOCK_FRAMES) {
+		return 0;
+	}
+	return block;
+}
+
+/**
+* Decodes the samples of one channel, given its mode.
+*/
+static bool
+lossless_read_channel (const lively_wav_t *wav, lossless_reader_t *reader, float *out, unsigned int frames) {
+	float scale = lossless_scale (wav->encoding);
+
+	switch (lossless_get (reader, 2)) {
+	case LOSSLESS_CONSTANT: {
+		float value = (float) (int32_t) lossless_get (reader, 32) * scale;
+		for (unsigned int i = 0; i < frames; i++) {
+			out[i] = value;
+		}
+		break;
+	}
+	case LOSSLESS_VERBATIM:
+		for (unsigned int i = 0; i < frames; i++) {
+			uint32_t bits = lossless_get (reader, 32);
+			if (wav->encoding == LIVELY_WAV_FLOAT_32) {
+				memcpy (&out[i], &bits, sizeof bits);
+			} else {
+				out[i] = (float) (int32_t) bits * scale;
+			}
+		}
+		break;
+	case LOSSLESS_PREDICTED: {
+		unsigned int order = lossless_get (reader, 3);
+		unsigned int partition_order = lossless_get (reader, 4);
+		unsigned int width = lossless_get (reader, 7);
+		int64_t h0 = 0, h1 = 0, h2 = 0, h3 = 0;
+
+		if (order > LOSSLESS_ORDER_MAX || order >= frames
+			|| partition_order > LOSSLESS_PARTITION_ORDER_MAX || width > 64) {
+			return false;
+		}
+		for (unsigned int i = 0; i < order; i++) {
+			h3 = h2;
+			h2 = h1;
+			h1 = h0;
+			h0 = (int32_t) lossless_get (reader, 32);
+			out[i] = (float) h0 * scale;
+		}
+
+		unsigned int count = frames - order;
+		for (unsigned int p = 0; p < 1u << partition_order; p++) {
+			unsigned int start = lossless_partition_start (count, partition_order, p);
+			unsigned int end = lossless_partition_start (count, partition_order, p + 1);
+			unsigned int k = lossless_get (reader, 5);
+
+			if (k > LOSSLESS_RICE_MAX) {
+				return false;
+			}
+			for (unsigned int i = start; i < end; i++) {
+				uint64_t value;
+
+				// One refill holds the longest code short of an escape.
+				lossless_refill (reader);
+				unsigned int zeros = 0;
+				while (zeros < LOSSLESS_RICE_ESCAPE && !(reader->acc >> (63 - zeros) & 1)) {
+					zeros++;
+				}
+				if (zeros < LOSSLESS_RICE_ESCAPE) {
+					uint64_t acc = reader->acc << zeros << 1;
+					value = (uint64_t) zeros << k | (k ? acc >> (64 - k) : 0);
+					reader->acc = acc << k;
+					reader->bits -= zeros + 1 + k;
+				} else {
+					lossless_get (reader, LOSSLESS_RICE_ESCAPE);
+					value = lossless_get_wide (reader, width);
+				}
+
+				int64_t sample = lossless_unzigzag (value);
+				switch (order) {
+				case 1:
+					sample += h0;
+					break;
+				case 2:
+					sample += 2 * h0 - h1;
+					break;
+				case 3:
+					sample += 3 * h0 - 3 * h1 + h2;
+					break;
+				case 4:
+					sample += 4 * h0 - 6 * h1 + 4 * h2 - h3;
+					break;
+				}
+				h3 = h2;
+				h2 = h1;
+				h1 = h0;
+				h0 = sample;
+				out[order + i] = (float) sample * scale;
+			}
+			if (lossless_overrun (reader)) {
+				return false;
+			}
+		}
+		break;
+	}
+	default:
+		return false;
+	}
+
+	lossless_align (reader);
+	return !lossless_overrun (reader);
+}
+
+/**
+* Decodes a block, after checking it against its checksum.
+*
+* @param wav The layout of the file
+* @param data The block, as found by #lively_lossless_block_size
+* @param size The bytes of the block
+* @param output Receives the samples of every channel, as many as the
+* frames of the block
+*
+* @return Whether the block was whole and valid
+*/
+bool
+lively_lossless_decode (
+	const lively_wav_t *wav,
+	const unsigned char *data,
+	size_t size,
+	float *const *output) {
+
+	unsigned int frames;
+	if (lively_lossless_block_size (data, size, &frames) != size
+		|| lossless_crc (data + LIVELY_LOSSLESS_BLOCK_HEADER, size - LIVELY_LOSSLESS_BLOCK_HEADER)
+			!= lossless_u32 (data + 12)) {
+		return false;
+	}
+
+	lossless_reader_t reader = {
+		.data = data + LIVELY_LOSSLESS_BLOCK_HEADER,
+		.size = size - LIVELY_LOSSLESS_BLOCK_HEADER,
+		.position = 0,
+		.acc = 0,
+		.bits = 0
+	};
+	for (unsigned int c = 0; c < wav->channels; c++) {
+		if (!lossless_read_channel (wav, &reader, output[c], frames)) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,53 @@
+#ifndef LIVELY_LOSSLESS_H
+#define LIVELY_LOSSLESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lively_wav.h"
+
+/** Bytes of the header of a lossless file, so that its blocks start on a block of the disk */
+#define LIVELY_LOSSLESS_HEADER_BYTES 4096
+/** Bytes of the header of each block */
+#define LIVELY_LOSSLESS_BLOCK_HEADER 16
+/** Most frames of a block */
+#define LIVELY_LOSSLESS_BLOCK_FRAMES 4096
+/** Frames of a file whose header was written before it was complete */
+#define LIVELY_LOSSLESS_FRAMES_UNKNOWN UINT64_MAX
+
+/**
+ * Scratch space to encode blocks with; one per thread.
+ */
+typedef struct lively_lossless_encoder {
+	unsigned int block_frames;
+	int64_t *samples;
+	uint64_t *residuals;
+} lively_lossless_encoder_t;
+
+bool lively_lossless_encoder_init (lively_lossless_encoder_t *, unsigned int block_frames);
+void lively_lossless_encoder_destroy (lively_lossless_encoder_t *);
+
+unsigned int lively_lossless_block_frames (const lively_wav_t *, size_t bytes);
+size_t lively_lossless_block_bytes_max (const lively_wav_t *, unsigned int frames);
+
+void lively_lossless_write_header (
+	const lively_wav_t *,
+	unsigned int block_frames,
+	unsigned char *header);
+bool lively_lossless_read_header (lively_wav_t *, unsigned int *block_frames, int fd);
+
+size_t lively_lossless_encode (
+	lively_lossless_encoder_t *,
+	const lively_wav_t *,
+	const float *const *input,
+	unsigned int frames,
+	unsigned char *output);
+size_t lively_lossless_block_size (const unsigned char *data, size_t size, unsigned int *frames);
+bool lively_lossless_decode (
+	const lively_wav_t *,
+	const unsigned char *data,
+	size_t size,
+	float *const *output);
+
+#endif
@@ -2,18 +2,116 @@
 
 #include "lively_node.h"
 
+/**
+* Returns the index of a channel on a multichannel node: mono and left are
+* the first channel, right the second, and numbered channels are their
+* number.
+*
+* @param channel The channel
+*/
+unsigned int
+lively_node_channel_index (lively_node_channel_t channel) {
+	switch (channel) {
+	case LIVELY_MONO:
+	case LIVELY_LEFT:
+		return 0;
+	case LIVELY_RIGHT:
+		return 1;
+	default:
+		return channel - LIVELY_CHANNEL (0);
+	}
+}
+
+static bool
+node_has_channel (unsigned int count, lively_node_channel_t channel) {
+	return LIVELY_CHANNEL_VALID (channel)
+		&& (count == 0 || lively_node_channel_index (channel) < count);
+}
+
+/**
+* Returns true if a node has a channel to be read from.
+*
+* @param node The Lively Node
+* @param channel The channel
+*/
+bool
+lively_node_can_read (const lively_node_t *node, lively_node_channel_t channel) {
+	return node_has_channel (node->read_channels, channel);
+}
+
+/**
+* Returns true if a node has a channel to be written to.
+*
+* @param node The Lively Node
+* @param channel The channel
+*/
+bool
+lively_node_can_write (const lively_node_t *node, lively_node_channel_t channel) {
+	return node_has_channel (node->write_channels, channel);
+}
+
+/**
+* Processes a node through its kernel, in place.
+*
+* This is the process function of kernel nodes, used when the node could
+* not be fused with its neighbours. Like a fused chain, it hands the kernel
+* at most #LIVELY_KERNEL_TILE samples at a time.
+*
+* @param node The Lively Node, which must have a kernel
+* @param length The number of samples to process
+*
+* @return A success value
+*/
+bool
+lively_node_kernel_process (lively_node_t *node, unsigned int length) {
+	float *buffer = node->get_write_buffer (node, LIVELY_MONO);
+
+	for (unsigned int offset = 0; offset < length; offset += LIVELY_KERNEL_TILE) {
+		unsigned int count = length - offset < LIVELY_KERNEL_TILE
+			? length - offset : LIVELY_KERNEL_TILE;
+		node->kernel (node, buffer + offset, count);
+	}
+	return true;
+}
+
 void
 lively_node_io_init (lively_node_io_t *node_io, lively_node_type_t type) {
 	lively_node_t *node = (lively_node_t *) node_io;
 
+	node->scene = NULL;
 	node->type = type;
 	node->process = lively_node_io_process;
 	node->get_read_buffer = lively_node_io_get_buffer;
 	node->get_write_buffer = lively_node_io_get_buffer;
 	node->set_buffer_length = lively_node_io_set_buffer_length;
+	node->handle_event = NULL;
+	node->kernel = NULL;
+	node->params_count = 0;
+	node->params = NULL;
+	atomic_init (&node->params_changes, 0);
 
 	node->buffer_length = 0;
+	node->sample_rate = 0;
+	node->read_channels = 0;
+	node->write_channels = 0;
+	node->latency = 0;
+	node->input_latency = 0;
 	node_io->buffer = NULL;
+	node_io->port = 0;
+}
+
+/**
+* Frees the buffer of an input, output or pass-through node.
+*
+* @param node The Lively Node, which must not be in a scene
+*/
+void
+lively_node_io_destroy (lively_node_t *node) {
+	lively_node_io_t *node_io = (lively_node_io_t *) node;
+
+	free (node_io->buffer);
+	node_io->buffer = NULL;
+	node->buffer_length = 0;
 }
 
 bool
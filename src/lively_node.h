@@ -1,8 +1,18 @@
 #ifndef LIVELY_NODE_H
 #define LIVELY_NODE_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 
+#include "lively_hash.h"
+
+struct lively_event;
+struct lively_param;
+struct lively_scene;
+
+/** Number of samples a fused chain of kernels processes at a time */
+#define LIVELY_KERNEL_TILE 64
+
 /**
  * Specifies a type of Lively Node.
  *
@@ -17,6 +27,9 @@ typedef enum lively_node_type {
 
 /**
  * Specifies a named channel on a Lively Node
+ *
+ * Nodes with more than two channels also accept numbered channels, see
+ * #LIVELY_CHANNEL.
  */
 typedef enum lively_node_channel {
 	LIVELY_MONO, /**< The main mono channel */
@@ -24,39 +37,133 @@ typedef enum lively_node_channel {
 	LIVELY_RIGHT /**< The main stereo right channel */
 } lively_node_channel_t;
 
+/** Maximum number of channels on a node */
+#define LIVELY_CHANNELS_MAX 64
+
+/** The numbered channel i of a multichannel node, counting from 0 */
+#define LIVELY_CHANNEL(i) ((lively_node_channel_t) (LIVELY_RIGHT + 1 + (i)))
+
+/** Returns true if a channel is a named or numbered channel */
+#define LIVELY_CHANNEL_VALID(channel) \
+	((unsigned int) (channel) < LIVELY_RIGHT + 1 + LIVELY_CHANNELS_MAX)
+
+/**
+ * A connection between two Lively Nodes.
+ *
+ * Every plug is linked into the outbound list of its source and the inbound
+ * list of its target, and indexed by the scene, so that it can be found and
+ * removed from either end in constant time.
+ */
 typedef struct lively_node_plug {
 	struct lively_node_plug *next;
+	struct lively_node_plug *prev;
+	struct lively_node_plug *inbound_next;
+	struct lively_node_plug *inbound_prev;
+	lively_hash_entry_t entry;
 
+	struct lively_node *source;
 	struct lively_node *target;
 	enum lively_node_channel source_ch;
 	enum lively_node_channel target_ch;
 } lively_node_plug_t;
 
-// TODO: Figure out what access needs to be atomized.
+/**
+ * A node in a Lively Scene.
+ *
+ * The plugs and list links are only touched by the thread editing the scene,
+ * under the scene lock. The audio thread never follows them; it works from a
+ * compiled plan, see #lively_scene_plan.
+ *
+ * The index entries are kept by the scene under the same lock.
+ *
+ * The process function of a node in the application's scene is called with
+ * a length of #LIVELY_QUANTUM, so inner loops may be specialized for it. The
+ * only exception is a quantum split by a #lively_event, in which case the
+ * pieces are shorter. Events for the node are handed to handle_event, if it
+ * is set, just before the first frame they apply to is processed.
+ *
+ * A process node may instead declare a per-sample kernel, which transforms
+ * samples in place, in order, without looking at other nodes. Such a node
+ * has a single buffer, returned for every channel, and uses
+ * #lively_node_kernel_process. The scene fuses linear chains of kernel
+ * nodes into one pass over tiles of #LIVELY_KERNEL_TILE samples, so their
+ * buffers between the first and the last node are never touched. A kernel
+ * is never given more than a tile at a time.
+ *
+ * #LIVELY_EVENT_PARAM events set the node's parameters, if it has any,
+ * before they are handed to handle_event.
+ */
 typedef struct lively_node {
 	struct lively_node *next;
+	struct lively_node *prev;
+	struct lively_scene *scene;
+
+	/** Identifier assigned by the scene, unique among its nodes */
+	unsigned int id;
+	lively_hash_entry_t id_entry;
+	lively_hash_entry_t name_entry;
 
-	struct lively_node_plug *plug_head;
-	unsigned int inputs_ready;
+	struct lively_node_plug *plug_head; /**< Plugs leaving the node */
+	struct lively_node_plug *inbound_head; /**< Plugs into the node */
 	unsigned int inputs_total;
+	unsigned int inputs_pending; /**< Scratch counter used while compiling */
+
+	/**
+	 * Samples of delay the node adds between its inputs and its outputs, such
+	 * as a lookahead. Call #lively_scene_update_latency after changing it.
+	 */
+	unsigned int latency;
+	/** Latency of the signal arriving at the node's inputs, as compiled */
+	unsigned int input_latency;
 
 	enum lively_node_type type;
-	char *name;
+	char *name; /**< Must not change while the node is in a scene */
 
 	unsigned int buffer_length;
+	/**
+	 * Sample rate of the scene, in Hz, set by the scene before every call to
+	 * set_buffer_length. Processing reads this rather than the scene, which
+	 * a node removed during a batch of edits no longer has.
+	 */
+	unsigned int sample_rate;
+	/**
+	 * Channels read from and written to, for nodes with a buffer of each;
+	 * 0 for nodes whose one buffer serves every channel. Set when the node
+	 * is created, and checked by #lively_scene_connect.
+	 */
+	unsigned int read_channels;
+	unsigned int write_channels;
 	bool (*process)(struct lively_node *, unsigned int size);
 	bool (*set_buffer_length)(struct lively_node *, unsigned int count);
 	float *(*get_read_buffer)(struct lively_node *, lively_node_channel_t);
 	float *(*get_write_buffer)(struct lively_node *, lively_node_channel_t);
+	void (*handle_event)(struct lively_node *, const struct lively_event *);
+	void (*kernel)(struct lively_node *, float *samples, unsigned int count);
+
+	/** Parameters, see #lively_node_params_init */
+	unsigned int params_count;
+	struct lively_param *params;
+	/**
+	 * Bumped after the target of any parameter is set, so that a node with
+	 * many parameters can tell that none changed without polling each one.
+	 */
+	atomic_uint params_changes;
 } lively_node_t;
 
 typedef struct lively_node_io {
 	struct lively_node node;
 	
 	float *buffer;
+	unsigned int port; /**< The audio device channel this node maps to */
 } lively_node_io_t;
 
+unsigned int lively_node_channel_index (lively_node_channel_t);
+bool lively_node_can_read (const lively_node_t *, lively_node_channel_t);
+bool lively_node_can_write (const lively_node_t *, lively_node_channel_t);
+bool lively_node_kernel_process (lively_node_t *, unsigned int);
+
 void lively_node_io_init (lively_node_io_t *, lively_node_type_t);
+void lively_node_io_destroy (lively_node_t *);
 bool lively_node_io_process (lively_node_t *, unsigned int);
 bool lively_node_io_set_buffer_length(lively_node_t *, unsigned int);
 float* lively_node_io_get_buffer(lively_node_t *, lively_node_channel_t);
@@ -0,0 +1,247 @@
+/**
+ * @file lively_node_class.c
+ * Lively Node Class: A registry of the kinds of Lively Nodes
+ */
+
+#include <string.h>
+
+#include "lively_node_class.h"
+
+#include "nodes/lively_node_analyzer.h"
+#include "nodes/lively_node_biquad.h"
+#include "nodes/lively_node_clip.h"
+#include "nodes/lively_node_convolution.h"
+#include "nodes/lively_node_delay.h"
+#include "nodes/lively_node_dynamics.h"
+#include "nodes/lively_node_gain.h"
+#include "nodes/lively_node_matrix.h"
+#include "nodes/lively_node_meter.h"
+#include "nodes/lively_node_oversample.h"
+#include "nodes/lively_node_playback.h"
+#include "nodes/lively_node_recorder.h"
+#include "nodes/lively_node_resample.h"
+
+static bool
+node_io_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	lively_node_io_init ((lively_node_io_t *) node, options->type);
+	((lively_node_io_t *) node)->port = options->port;
+	return true;
+}
+
+static const lively_node_class_t node_io_class = {
+	.name = "io",
+	.size = sizeof (lively_node_io_t),
+	.init = node_io_class_init,
+	.destroy = lively_node_io_destroy
+};
+
+static bool
+node_gain_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	lively_node_gain_init ((lively_node_gain_t *) node);
+	return true;
+}
+
+static const lively_node_class_t node_gain_class = {
+	.name = "gain",
+	.size = sizeof (lively_node_gain_t),
+	.init = node_gain_class_init,
+	.destroy = lively_node_io_destroy
+};
+
+static bool
+node_clip_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	lively_node_clip_init ((lively_node_clip_t *) node);
+	return true;
+}
+
+static const lively_node_class_t node_clip_class = {
+	.name = "clip",
+	.size = sizeof (lively_node_clip_t),
+	.init = node_clip_class_init,
+	.destroy = lively_node_io_destroy
+};
+
+static bool
+node_biquad_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_biquad_init ((lively_node_biquad_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_biquad_class = {
+	.name = "biquad",
+	.size = sizeof (lively_node_biquad_t),
+	.init = node_biquad_class_init,
+	.destroy = lively_node_biquad_destroy
+};
+
+static bool
+node_convolution_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	lively_node_convolution_init ((lively_node_convolution_t *) node);
+	return true;
+}
+
+static const lively_node_class_t node_convolution_class = {
+	.name = "convolution",
+	.size = sizeof (lively_node_convolution_t),
+	.init = node_convolution_class_init,
+	.destroy = lively_node_convolution_destroy
+};
+
+static bool
+node_matrix_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_matrix_init ((lively_node_matrix_t *) node,
+		options->channels, options->outputs);
+}
+
+static const lively_node_class_t node_matrix_class = {
+	.name = "matrix",
+	.size = sizeof (lively_node_matrix_t),
+	.init = node_matrix_class_init,
+	.destroy = lively_node_matrix_destroy
+};
+
+static bool
+node_dynamics_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_dynamics_init ((lively_node_dynamics_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_dynamics_class = {
+	.name = "dynamics",
+	.size = sizeof (lively_node_dynamics_t),
+	.init = node_dynamics_class_init,
+	.destroy = lively_node_dynamics_destroy
+};
+
+static bool
+node_delay_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_delay_init ((lively_node_delay_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_delay_class = {
+	.name = "delay",
+	.size = sizeof (lively_node_delay_t),
+	.init = node_delay_class_init,
+	.destroy = lively_node_delay_destroy
+};
+
+static bool
+node_resample_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_resample_init ((lively_node_resample_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_resample_class = {
+	.name = "resample",
+	.size = sizeof (lively_node_resample_t),
+	.init = node_resample_class_init,
+	.destroy = lively_node_resample_destroy
+};
+
+static bool
+node_oversample_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	const lively_node_class_t *inner = options->inner ? lively_node_class_find (options->inner) : NULL;
+	return lively_node_oversample_init ((lively_node_oversample_t *) node, options->channels, inner);
+}
+
+static const lively_node_class_t node_oversample_class = {
+	.name = "oversample",
+	.size = sizeof (lively_node_oversample_t),
+	.init = node_oversample_class_init,
+	.destroy = lively_node_oversample_destroy
+};
+
+static bool
+node_playback_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_playback_init ((lively_node_playback_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_playback_class = {
+	.name = "playback",
+	.size = sizeof (lively_node_playback_t),
+	.init = node_playback_class_init,
+	.destroy = lively_node_playback_destroy
+};
+
+static bool
+node_recorder_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_recorder_init ((lively_node_recorder_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_recorder_class = {
+	.name = "recorder",
+	.size = sizeof (lively_node_recorder_t),
+	.init = node_recorder_class_init,
+	.destroy = lively_node_recorder_destroy
+};
+
+static bool
+node_meter_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_meter_init ((lively_node_meter_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_meter_class = {
+	.name = "meter",
+	.size = sizeof (lively_node_meter_t),
+	.init = node_meter_class_init,
+	.destroy = lively_node_meter_destroy
+};
+
+static bool
+node_analyzer_class_init (lively_node_t *node, const lively_node_options_t *options) {
+	return lively_node_analyzer_init ((lively_node_analyzer_t *) node, options->channels);
+}
+
+static const lively_node_class_t node_analyzer_class = {
+	.name = "analyzer",
+	.size = sizeof (lively_node_analyzer_t),
+	.init = node_analyzer_class_init,
+	.destroy = lively_node_analyzer_destroy
+};
+
+static const lively_node_class_t *classes[LIVELY_NODE_CLASSES_MAX] = {
+	&node_io_class,
+	&node_gain_class,
+	&node_clip_class,
+	&node_biquad_class,
+	&node_convolution_class,
+	&node_matrix_class,
+	&node_dynamics_class,
+	&node_delay_class,
+	&node_resample_class,
+	&node_oversample_class,
+	&node_playback_class,
+	&node_recorder_class,
+	&node_meter_class,
+	&node_analyzer_class
+};
+static unsigned int classes_count = 14;
+
+/**
+* Registers a node class. Registration is not thread-safe and is meant to
+* happen at startup.
+*
+* @param class The node class, which must outlive the registry
+*
+* @return A success value; false if the registry is full or the name is taken
+*/
+bool
+lively_node_class_register (const lively_node_class_t *class) {
+	if (classes_count == LIVELY_NODE_CLASSES_MAX || lively_node_class_find (class->name)) {
+		return false;
+	}
+	classes[classes_count++] = class;
+	return true;
+}
+
+/**
+* Returns the node class with the given name, or NULL.
+*
+* @param name The name of the class
+*/
+const lively_node_class_t *
+lively_node_class_find (const char *name) {
+	for (unsigned int i = 0; i < classes_count; i++) {
+		if (strcmp (classes[i]->name, name) == 0) {
+			return classes[i];
+		}
+	}
+	return NULL;
+}
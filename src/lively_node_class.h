@@ -0,0 +1,40 @@
+#ifndef LIVELY_NODE_CLASS_H
+#define LIVELY_NODE_CLASS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lively_node.h"
+
+/** Maximum number of node classes that can be registered */
+#define LIVELY_NODE_CLASSES_MAX 64
+
+/**
+ * Options for creating a node of a class.
+ */
+typedef struct lively_node_options {
+	lively_node_type_t type;
+	unsigned int port; /**< For input and output nodes */
+	unsigned int channels; /**< For multichannel nodes, or 0 for the default */
+	unsigned int outputs; /**< For nodes whose outputs differ from their inputs, or 0 */
+	const char *inner; /**< Class of the node a container wraps, or NULL */
+} lively_node_options_t;
+
+/**
+ * Describes a kind of Lively Node, so that nodes can be created by name,
+ * for example when loading a scene file.
+ *
+ * Parameters are applied after init, before the node is added to a scene,
+ * with #lively_node_set_param and as #LIVELY_EVENT_PARAM events.
+ */
+typedef struct lively_node_class {
+	const char *name;
+	size_t size; /**< Size of the node structure, which embeds #lively_node */
+	bool (*init) (lively_node_t *, const lively_node_options_t *);
+	void (*destroy) (lively_node_t *);
+} lively_node_class_t;
+
+bool lively_node_class_register (const lively_node_class_t *);
+const lively_node_class_t *lively_node_class_find (const char *name);
+
+#endif
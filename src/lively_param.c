@@ -0,0 +1,288 @@
+/**
+ * @file lively_param.c
+ * Lively Param: Typed, ranged and smoothed parameters of Lively Nodes
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "lively_node.h"
+#include "lively_param.h"
+#include "lively_scene.h"
+
+/** A one-pole ramp this close to its target has arrived */
+#define PARAM_SETTLED 1e-6f
+
+_Static_assert (sizeof (float) == sizeof (unsigned int),
+	"Parameter slots store floats in unsigned integers");
+
+static unsigned int
+param_to_bits (float value) {
+	unsigned int bits;
+	memcpy (&bits, &value, sizeof bits);
+	return bits;
+}
+
+static float
+param_from_bits (unsigned int bits) {
+	float value;
+	memcpy (&value, &bits, sizeof value);
+	return value;
+}
+
+static float
+param_constrain (const lively_param_info_t *info, float value) {
+	if (isnan (value)) {
+		value = info->initial;
+	}
+	value = fminf (fmaxf (value, info->min), info->max);
+
+	switch (info->type) {
+	case LIVELY_PARAM_INT:
+		return roundf (value);
+	case LIVELY_PARAM_BOOL:
+		return value >= 0.5f ? 1.0f : 0.0f;
+	default:
+		return value;
+	}
+}
+
+/**
+* Sets up the parameters of a node, each at its initial value.
+*
+* @param node The Lively Node
+* @param params Storage for the parameters, usually part of the node
+* @param infos Descriptions of the parameters, which must outlive the node
+* @param count The number of parameters
+*/
+void
+lively_node_params_init (
+	lively_node_t *node,
+	lively_param_t *params,
+	const lively_param_info_t *infos,
+	unsigned int count) {
+
+	for (unsigned int i = 0; i < count; i++) {
+		lively_param_t *param = &params[i];
+		float initial = param_constrain (&infos[i], infos[i].initial);
+
+		param->info = &infos[i];
+		param->node = node;
+		atomic_init (&param->target, param_to_bits (initial));
+		param->current = initial;
+		param->ramp_target = initial;
+		param->step = 0.0f;
+		param->remaining = 0;
+	}
+
+	node->params = params;
+	node->params_count = count;
+}
+
+/**
+* Returns the index of the parameter with the given name, or -1.
+*
+* @param node The Lively Node
+* @param name The name of the parameter
+*/
+int
+lively_node_find_param (lively_node_t *node, const char *name) {
+	for (unsigned int i = 0; i < node->params_count; i++) {
+		if (strcmp (node->params[i].info->name, name) == 0) {
+			return (int) i;
+		}
+	}
+	return -1;
+}
+
+/**
+* Sets the target of a parameter from any thread. The value is clamped to
+* the range of the parameter, and the audio thread smooths towards it from
+* its next block. A node which is not in a scene takes the value at once.
+*
+* @param node The Lively Node
+* @param index The index of the parameter
+* @param value The new value
+*
+* @return A success value; false if there is no such parameter
+*/
+bool
+lively_node_set_param (lively_node_t *node, unsigned int index, float value) {
+	if (index >= node->params_count) {
+		return false;
+	}
+
+	lively_param_t *param = &node->params[index];
+	value = param_constrain (param->info, value);
+	atomic_store_explicit (&param->target, param_to_bits (value), memory_order_relaxed);
+	atomic_fetch_add_explicit (&node->params_changes, 1, memory_order_release);
+
+	if (!node->scene) {
+		param->current = value;
+		param->ramp_target = value;
+		param->remaining = 0;
+	}
+	return true;
+}
+
+/**
+* Returns the target of a parameter, which the audio thread may still be
+* smoothing towards.
+*
+* @param node The Lively Node
+* @param index The index of the parameter
+*/
+float
+lively_node_get_param (lively_node_t *node, unsigned int index) {
+	if (index >= node->params_count) {
+		return 0.0f;
+	}
+	return param_from_bits (atomic_load_explicit (
+		&node->params[index].target, memory_order_relaxed));
+}
+
+/**
+* Starts a new ramp if the target changed since the last block.
+*/
+static void
+param_update (lively_param_t *param) {
+	float target = param_from_bits (atomic_load_explicit (
+		&param->target, memory_order_relaxed));
+	if (target == param->ramp_target) {
+		return;
+	}
+	param->ramp_target = target;
+
+	const lively_param_info_t *info = param->info;
+	float frames = info->smoothing_time * param->node->sample_rate;
+
+	if (info->type != LIVELY_PARAM_FLOAT || frames < 1.0f) {
+		param->current = target;
+		param->remaining = 0;
+		return;
+	}
+
+	switch (info->smoothing) {
+	case LIVELY_SMOOTH_LINEAR:
+		param->remaining = (unsigned int) frames;
+		param->step = (target - param->current) / param->remaining;
+		break;
+	case LIVELY_SMOOTH_ONE_POLE:
+		param->remaining = 1;
+		param->step = expf (-1.0f / frames);
+		break;
+	default:
+		param->current = target;
+		param->remaining = 0;
+		break;
+	}
+}
+
+static void
+param_settle (lively_param_t *param, float distance) {
+	param->current = param->ramp_target + distance;
+	if (fabsf (distance) <= PARAM_SETTLED * fmaxf (1.0f, fabsf (param->ramp_target))) {
+		param->current = param->ramp_target;
+		param->remaining = 0;
+	}
+}
+
+/**
+* Computes the per-sample values of a parameter for the next block. Audio
+* thread only.
+*
+* While the parameter is steady nothing is written and the node should use
+* #lively_param::current, so that the common case costs nothing.
+*
+* @param param The parameter
+* @param values Receives one value per sample, if the parameter is moving
+* @param length The number of samples in the block
+*
+* @return true if values were written
+*/
+bool
+lively_param_ramp (lively_param_t *param, float *values, unsigned int length) {
+	param_update (param);
+	if (!param->remaining) {
+		return false;
+	}
+
+	if (param->info->smoothing == LIVELY_SMOOTH_LINEAR) {
+		unsigned int count = length < param->remaining ? length : param->remaining;
+		float start = param->current;
+		float step = param->step;
+
+		for (unsigned int i = 0; i < count; i++) {
+			values[i] = start + step * (float) (i + 1);
+		}
+		for (unsigned int i = count; i < length; i++) {
+			values[i] = param->ramp_target;
+		}
+
+		param->remaining -= count;
+		param->current = param->remaining ? start + step * count : param->ramp_target;
+		return true;
+	}
+
+	// A one-pole filter in closed form: target + distance * coefficient^n,
+	// evaluated a lane at a time so that the loop vectorizes.
+	float coefficient = param->step;
+	float target = param->ramp_target;
+	float distance = param->current - target;
+	float powers[LIVELY_PARAM_LANES];
+
+	powers[0] = coefficient;
+	for (unsigned int j = 1; j < LIVELY_PARAM_LANES; j++) {
+		powers[j] = powers[j - 1] * coefficient;
+	}
+	float stride = powers[LIVELY_PARAM_LANES - 1];
+
+	unsigned int i = 0;
+	for (; i + LIVELY_PARAM_LANES <= length; i += LIVELY_PARAM_LANES) {
+		for (unsigned int j = 0; j < LIVELY_PARAM_LANES; j++) {
+			values[i + j] = target + distance * powers[j];
+		}
+		distance *= stride;
+	}
+	if (i < length) {
+		unsigned int rest = length - i;
+		for (unsigned int j = 0; j < rest; j++) {
+			values[i + j] = target + distance * powers[j];
+		}
+		distance *= powers[rest - 1];
+	}
+
+	param_settle (param, distance);
+	return true;
+}
+
+/**
+* Advances a parameter by a block and returns its value at the end of it,
+* for nodes which only update once per block. Audio thread only.
+*
+* @param param The parameter
+* @param length The number of samples in the block
+*
+* @return The value of the parameter after the block
+*/
+float
+lively_param_advance (lively_param_t *param, unsigned int length) {
+	param_update (param);
+	if (!param->remaining) {
+		return param->current;
+	}
+
+	if (param->info->smoothing == LIVELY_SMOOTH_LINEAR) {
+		unsigned int count = length < param->remaining ? length : param->remaining;
+		param->remaining -= count;
+		param->current = param->remaining
+			? param->current + param->step * count
+			: param->ramp_target;
+	} else {
+		float distance = (param->current - param->ramp_target)
+			* powf (param->step, (float) length);
+		param_settle (param, distance);
+	}
+
+	return param->current;
+}
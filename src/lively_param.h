@@ -0,0 +1,74 @@
+#ifndef LIVELY_PARAM_H
+#define LIVELY_PARAM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+struct lively_node;
+
+/** Values are smoothed in lanes of this many samples */
+#define LIVELY_PARAM_LANES 4
+
+/**
+ * Specifies the type of a parameter. Integer and boolean parameters are
+ * rounded when set and never smoothed.
+ */
+typedef enum lively_param_type {
+	LIVELY_PARAM_FLOAT,
+	LIVELY_PARAM_INT,
+	LIVELY_PARAM_BOOL
+} lively_param_type_t;
+
+/**
+ * Specifies how the audio thread moves a parameter to a new value.
+ */
+typedef enum lively_param_smoothing {
+	LIVELY_SMOOTH_NONE, /**< Jumps to the new value */
+	LIVELY_SMOOTH_LINEAR, /**< Ramps linearly over the smoothing time */
+	LIVELY_SMOOTH_ONE_POLE /**< Approaches exponentially; time is the time constant */
+} lively_param_smoothing_t;
+
+/**
+ * Describes a parameter. Usually a static table per kind of node.
+ */
+typedef struct lively_param_info {
+	const char *name;
+	enum lively_param_type type;
+	float min;
+	float max;
+	float initial;
+	enum lively_param_smoothing smoothing;
+	float smoothing_time; /**< In seconds */
+} lively_param_info_t;
+
+/**
+ * A parameter of a node.
+ *
+ * Any thread may set the target through an atomic slot, without locks. The
+ * rest is owned by the audio thread, which notices a new target at the
+ * start of a block and smooths towards it.
+ */
+typedef struct lively_param {
+	const lively_param_info_t *info;
+	struct lively_node *node;
+	atomic_uint target; /**< Bits of the float target value */
+
+	float current;
+	float ramp_target;
+	float step; /**< Per sample increment, or the one-pole coefficient */
+	unsigned int remaining; /**< Samples left in a linear ramp */
+} lively_param_t;
+
+void lively_node_params_init (
+	struct lively_node *,
+	lively_param_t *params,
+	const lively_param_info_t *infos,
+	unsigned int count);
+int lively_node_find_param (struct lively_node *, const char *name);
+bool lively_node_set_param (struct lively_node *, unsigned int index, float value);
+float lively_node_get_param (struct lively_node *, unsigned int index);
+
+bool lively_param_ramp (lively_param_t *, float *values, unsigned int length);
+float lively_param_advance (lively_param_t *, unsigned int length);
+
+#endif
@@ -0,0 +1,499 @@
+/**
+ * @file lively_pool.c
+ * Lively Pool: Loads each sample once, and shares it between streams
+ *
+ * A sample is found again by the file it was loaded from, before loading
+ * it, and by its contents, after; two copies of a file, or a file replaced
+ * by the same audio, end up as one sample. Mapped and compressed samples
+ * are told apart by their contents as well, as their bytes differ.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lively_pool.h"
+#include "lively_app.h"
+#include "lively_node.h"
+
+/**
+* Initializes an empty pool.
+*
+* @param pool The pool
+* @param app The Lively Application, for logging
+*
+* @return A success value
+*/
+bool
+lively_pool_init (lively_pool_t *pool, struct lively_app *app) {
+	pool->app = app;
+	pool->bytes = 0;
+	lively_hash_init (&pool->files);
+	lively_hash_init (&pool->samples);
+	return pthread_mutex_init (&pool->lock, NULL) == 0;
+}
+
+/**
+* Frees the storage of a sample, and the sample.
+*/
+static void
+pool_sample_free (lively_pool_sample_t *sample) {
+	if (sample->map) {
+		munmap (sample->map, sample->map_size);
+	}
+	free (sample->blocks);
+	while (sample->files) {
+		lively_pool_file_t *file = sample->files;
+		sample->files = file->next;
+		free (file);
+	}
+	free (sample);
+}
+
+/**
+* Frees what is left of a pool. Every sample should have been released,
+* as streams may still read those which were not; they are freed all the
+* same, with a warning.
+*
+* @param pool The pool
+*/
+void
+lively_pool_destroy (lively_pool_t *pool) {
+	if (pool->samples.count > 0) {
+		lively_app_log (pool->app, LIVELY_WARN, "pool",
+			"%zu samples were never released", pool->samples.count);
+	}
+	for (size_t i = 0; pool->samples.buckets && i <= pool->samples.mask; i++) {
+		lively_hash_entry_t *entry = pool->samples.buckets[i];
+		while (entry) {
+			lively_hash_entry_t *next = entry->next;
+			pool_sample_free (LIVELY_CONTAINER_OF (entry, lively_pool_sample_t, entry));
+			entry = next;
+		}
+	}
+
+	lively_hash_destroy (&pool->files);
+	lively_hash_destroy (&pool->samples);
+	pthread_mutex_destroy (&pool->lock);
+	pool->bytes = 0;
+}
+
+static uint64_t
+pool_file_hash (const struct stat *st) {
+	return lively_hash_mix ((uint64_t) st->st_dev * 0x9e3779b97f4a7c15u ^ (uint64_t) st->st_ino);
+}
+
+static bool
+pool_file_matches (const lively_pool_file_t *file, const struct stat *st) {
+	return file->device == st->st_dev && file->inode == st->st_ino && file->size == st->st_size
+		&& file->modified.tv_sec == st->st_mtim.tv_sec
+		&& file->modified.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+* Returns the sample loaded from a file, unless it changed since. Called
+* with the lock held.
+*/
+static lively_pool_sample_t *
+pool_find_file (lively_pool_t *pool, const struct stat *st) {
+	lively_hash_entry_t *entry = lively_hash_first (&pool->files, pool_file_hash (st));
+
+	for (; entry; entry = lively_hash_next (entry)) {
+		lively_pool_file_t *file = LIVELY_CONTAINER_OF (entry, lively_pool_file_t, entry);
+		if (pool_file_matches (file, st)) {
+			return file->sample;
+		}
+	}
+	return NULL;
+}
+
+/**
+* Hashes the layout and the storage of a sample, eight bytes at a time.
+*/
+static uint64_t
+pool_content_hash (const lively_pool_sample_t *sample) {
+	uint64_t hash = lively_hash_mix ((uint64_t) sample->wav.encoding << 56
+		^ (uint64_t) sample->wav.channels << 40 ^ sample->wav.rate ^ (uint64_t) sample->compressed << 63);
+	size_t i = 0;
+
+	hash = lively_hash_mix (hash ^ sample->wav.frames);
+	for (; i + 8 <= sample->size; i += 8) {
+		uint64_t word;
+		memcpy (&word, sample->data + i, 8);
+		hash = (hash ^ word) * 0x100000001b3u;
+		hash ^= hash >> 29;
+	}
+	for (; i < sample->size; i++) {
+		hash = (hash ^ sample->data[i]) * 0x100000001b3u;
+	}
+	return lively_hash_mix (hash);
+}
+
+static bool
+pool_same_contents (const lively_pool_sample_t *a, const lively_pool_sample_t *b) {
+	return a->compressed == b->compressed && a->wav.encoding == b->wav.encoding
+		&& a->wav.channels == b->wav.channels && a->wav.rate == b->wav.rate
+		&& a->wav.frames == b->wav.frames && a->size == b->size
+		&& memcmp (a->data, b->data, a->size) == 0;
+}
+
+/**
+* Maps a whole file into memory, for the sample to read from.
+*/
+static bool
+pool_map (lively_pool_sample_t *sample, int fd, const struct stat *st) {
+	if (st->st_size <= 0) {
+		return false;
+	}
+	void *map = mmap (NULL, (size_t) st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+	sample->map = map;
+	sample->map_size = (size_t) st->st_size;
+	return true;
+}
+
+/**
+* Finds the blocks of a mapped lossless file, and the frames they hold. A
+* file left by a crash ends with its last whole block.
+*/
+static void
+pool_scan_blocks (lively_pool_sample_t *sample) {
+	const unsigned char *blocks = (const unsigned char *) sample->map + sample->wav.data_offset;
+	size_t size = sample->map_size > sample->wav.data_offset
+		? sample->map_size - (size_t) sample->wav.data_offset : 0;
+	uint64_t frames = 0;
+	size_t used = 0;
+
+	for (;;) {
+		unsigned int block_frames;
+		size_t block = lively_lossless_block_size (blocks + used, size - used, &block_frames);
+		if (block == 0 || block > size - used || frames + block_frames > sample->wav.frames) {
+			break;
+		}
+		used += block;
+		frames += block_frames;
+	}
+
+	sample->data = blocks;
+	sample->size = used;
+	sample->wav.frames = frames;
+}
+
+/**
+* Compresses the samples of a WAV file into blocks in memory, one block at
+* a time through the staging buffers.
+*/
+static bool
+pool_compress_blocks (
+	lively_pool_sample_t *sample,
+	int fd,
+	lively_lossless_encoder_t *encoder,
+	unsigned char *bytes,
+	float *const *input) {
+
+	lively_wav_t *wav = &sample->wav;
+	size_t block_bytes = lively_lossless_block_bytes_max (wav, encoder->block_frames);
+	size_t size = 0, capacity = 0;
+
+	for (uint64_t position = 0; position < wav->frames;) {
+		unsigned int frames = wav->frames - position < encoder->block_frames
+			? (unsigned int) (wav->frames - position) : encoder->block_frames;
+		size_t length = (size_t) frames * wav->frame_bytes;
+		if (pread (fd, bytes, length, (off_t) (wav->data_offset + position * wav->frame_bytes))
+				!= (ssize_t) length) {
+			return false;
+		}
+		lively_wav_decode (wav, bytes, input, frames);
+
+		if (size + block_bytes > capacity) {
+			size_t grown = capacity ? capacity * 2 : block_bytes * 16;
+			unsigned char *blocks = realloc (sample->blocks, grown);
+			if (!blocks) {
+				return false;
+			}
+			sample->blocks = blocks;
+			capacity = grown;
+		}
+		size += lively_lossless_encode (encoder, wav, (const float *const *) input, frames,
+			sample->blocks + size);
+		position += frames;
+	}
+
+	// Give back what the last growth reserved.
+	unsigned char *blocks = realloc (sample->blocks, size);
+	if (blocks) {
+		sample->blocks = blocks;
+	}
+	sample->data = sample->blocks;
+	sample->size = size;
+	sample->block_frames = encoder->block_frames;
+	sample->compressed = true;
+	return true;
+}
+
+/**
+* Compresses the samples of a WAV file into blocks in memory.
+*/
+static bool
+pool_compress (lively_pool_sample_t *sample, int fd) {
+	const lively_wav_t *wav = &sample->wav;
+	lively_lossless_encoder_t encoder;
+	float *input[LIVELY_CHANNELS_MAX];
+
+	if (!lively_lossless_encoder_init (&encoder, LIVELY_LOSSLESS_BLOCK_FRAMES)) {
+		return false;
+	}
+	unsigned char *bytes = malloc ((size_t) encoder.block_frames * wav->frame_bytes);
+	float *samples = malloc ((size_t) encoder.block_frames * wav->channels * sizeof *samples);
+	bool success = bytes && samples;
+
+	if (success) {
+		for (unsigned int c = 0; c < wav->channels; c++) {
+			input[c] = samples + (size_t) c * encoder.block_frames;
+		}
+		success = pool_compress_blocks (sample, fd, &encoder, bytes, input);
+	}
+
+	free (bytes);
+	free (samples);
+	lively_lossless_encoder_destroy (&encoder);
+	return success;
+}
+
+/**
+* Loads a sample from an open file, as a lossless file or a WAV one.
+*
+* @return The error, or NULL
+*/
+static const char *
+pool_load_file (lively_pool_sample_t *sample, int fd, const struct stat *st, bool compress) {
+	if (lively_lossless_read_header (&sample->wav, &sample->block_frames, fd)) {
+		if (sample->wav.channels > LIVELY_CHANNELS_MAX) {
+			return "too many channels";
+		}
+		if (!pool_map (sample, fd, st)) {
+			return strerror (errno);
+		}
+		sample->compressed = true;
+		pool_scan_blocks (sample);
+		return NULL;
+	}
+	if (sample->wav.error) {
+		return sample->wav.error;
+	}
+
+	if (!lively_wav_read_header (&sample->wav, fd)) {
+		return sample->wav.error;
+	}
+	if (sample->wav.channels > LIVELY_CHANNELS_MAX) {
+		return "too many channels";
+	}
+	if (compress) {
+		return pool_compress (sample, fd) ? NULL : "could not compress it";
+	}
+	if (!pool_map (sample, fd, st)) {
+		return strerror (errno);
+	}
+	sample->data = (const unsigned char *) sample->map + sample->wav.data_offset;
+	sample->size = (size_t) (sample->wav.frames * sample->wav.frame_bytes);
+	return NULL;
+}
+
+/**
+* Returns the bytes a sample holds on to.
+*/
+static size_t
+pool_sample_bytes (const lively_pool_sample_t *sample) {
+	return sample->map ? sample->map_size : sample->size;
+}
+
+/**
+* Returns a reference to the sample of a file, loading it unless the pool
+* has it already, from this file or from another with the same audio.
+* Must not be called from the audio thread.
+*
+* @param pool The pool
+* @param path The path of a WAV file, or of a lossless one
+* @param compress Whether to compress a WAV file in memory, rather than
+* map it; a sample the pool has already keeps its storage
+*
+* @return The sample, to be released with #lively_pool_release, or NULL on
+* failure, which is logged
+*/
+lively_pool_sample_t *
+lively_pool_load (lively_pool_t *pool, const char *path, bool compress) {
+	struct stat st;
+
+	int fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat (fd, &st) != 0) {
+		lively_app_log (pool->app, LIVELY_ERROR, "pool",
+			"Could not open '%s': %s", path, strerror (errno));
+		if (fd >= 0) {
+			close (fd);
+		}
+		return NULL;
+	}
+
+	pthread_mutex_lock (&pool->lock);
+	lively_pool_sample_t *found = pool_find_file (pool, &st);
+	if (found) {
+		found->references++;
+	}
+	pthread_mutex_unlock (&pool->lock);
+	if (found) {
+		close (fd);
+		return found;
+	}
+
+	// Loading may take a while, so it happens without the lock; a file
+	// loaded twice at once is found by its contents below.
+	lively_pool_sample_t *sample = calloc (1, sizeof *sample);
+	lively_pool_file_t *file = calloc (1, sizeof *file);
+	const char *error = !sample || !file ? "out of memory" : pool_load_file (sample, fd, &st, compress);
+	if (!error && sample->wav.frames == 0) {
+		error = "no audio";
+	}
+	close (fd);
+	if (error) {
+		lively_app_log (pool->app, LIVELY_ERROR, "pool",
+			"Could not load '%s': %s", path, error);
+		if (sample) {
+			pool_sample_free (sample);
+		}
+		free (file);
+		return NULL;
+	}
+
+	sample->pool = pool;
+	sample->references = 1;
+	file->device = st.st_dev;
+	file->inode = st.st_ino;
+	file->size = st.st_size;
+	file->modified = st.st_mtim;
+	uint64_t hash = pool_content_hash (sample);
+
+	pthread_mutex_lock (&pool->lock);
+	lively_hash_entry_t *entry = lively_hash_first (&pool->samples, hash);
+	for (; entry; entry = lively_hash_next (entry)) {
+		found = LIVELY_CONTAINER_OF (entry, lively_pool_sample_t, entry);
+		if (pool_same_contents (found, sample)) {
+			break;
+		}
+	}
+
+	if (entry) {
+		found->references++;
+		if (pool_find_file (pool, &st) != found) {
+			file->sample = found;
+			file->next = found->files;
+			found->files = file;
+			lively_hash_insert (&pool->files, &file->entry, pool_file_hash (&st));
+			file = NULL;
+		}
+		pthread_mutex_unlock (&pool->lock);
+		free (file);
+		pool_sample_free (sample);
+		return found;
+	}
+
+	file->sample = sample;
+	sample->files = file;
+	if (!lively_hash_insert (&pool->samples, &sample->entry, hash)) {
+		pthread_mutex_unlock (&pool->lock);
+		pool_sample_free (sample);
+		return NULL;
+	}
+	lively_hash_insert (&pool->files, &file->entry, pool_file_hash (&st));
+	pool->bytes += pool_sample_bytes (sample);
+	pthread_mutex_unlock (&pool->lock);
+
+	lively_app_log (pool->app, LIVELY_DEBUG, "pool",
+		"Loaded '%s' into %.1f MiB", path, pool_sample_bytes (sample) / 1048576.0);
+	return sample;
+}
+
+/**
+* Takes another reference to a sample.
+*
+* @param sample The sample
+*/
+void
+lively_pool_retain (lively_pool_sample_t *sample) {
+	lively_pool_t *pool = sample->pool;
+
+	pthread_mutex_lock (&pool->lock);
+	sample->references++;
+	pthread_mutex_unlock (&pool->lock);
+}
+
+/**
+* Gives back a reference to a sample, and frees it with the last one.
+* Must not be called from the audio thread.
+*
+* @param sample The sample
+*/
+void
+lively_pool_release (lively_pool_sample_t *sample) {
+	lively_pool_t *pool = sample->pool;
+
+	pthread_mutex_lock (&pool->lock);
+	if (--sample->references > 0) {
+		pthread_mutex_unlock (&pool->lock);
+		return;
+	}
+	for (lively_pool_file_t *file = sample->files; file; file = file->next) {
+		lively_hash_remove (&pool->files, &file->entry);
+	}
+	lively_hash_remove (&pool->samples, &sample->entry);
+	pool->bytes -= pool_sample_bytes (sample);
+	pthread_mutex_unlock (&pool->lock);
+
+	pool_sample_free (sample);
+}
+
+/**
+* Returns the bytes the samples of a pool hold, mapped or in memory. Mapped
+* bytes are only resident once read, and shared with the page cache.
+*
+* @param pool The pool
+*/
+size_t
+lively_pool_get_bytes (lively_pool_t *pool) {
+	pthread_mutex_lock (&pool->lock);
+	size_t bytes = pool->bytes;
+	pthread_mutex_unlock (&pool->lock);
+	return bytes;
+}
+
+/**
+* Asks the kernel to read ahead the pages of a mapped sample, so that
+* decoding them later does not wait for the disk. Does nothing for a
+* sample in memory.
+*
+* @param sample The sample
+* @param offset The first byte of data to read ahead
+* @param size The number of bytes
+*/
+void
+lively_pool_sample_prefetch (lively_pool_sample_t *sample, size_t offset, size_t size) {
+	if (!sample->map || offset >= sample->size) {
+		return;
+	}
+	if (size > sample->size - offset) {
+		size = sample->size - offset;
+	}
+
+	// Advice is given in whole pages.
+	size_t page = (size_t) sysconf (_SC_PAGESIZE);
+	size_t start = (size_t) (sample->data - (const unsigned char *) sample->map) + offset;
+	size_t aligned = start & ~(page - 1);
+	posix_madvise ((unsigned char *) sample->map + aligned, start + size - aligned, POSIX_MADV_WILLNEED);
+}
@@ -0,0 +1,90 @@
+#ifndef LIVELY_POOL_H
+#define LIVELY_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "lively_hash.h"
+#include "lively_lossless.h"
+#include "lively_wav.h"
+
+struct lively_app;
+struct lively_pool_sample;
+
+/**
+ * A file a sample was loaded from. A sample found again under another
+ * file, with the same contents, keeps both.
+ */
+typedef struct lively_pool_file {
+	lively_hash_entry_t entry; /**< In the files of the pool */
+	struct lively_pool_file *next; /**< Of the same sample */
+	struct lively_pool_sample *sample;
+
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	struct timespec modified;
+} lively_pool_file_t;
+
+/**
+ * The audio of a file, loaded once and shared by every stream which plays
+ * it. Its storage never changes once loaded, so streams read it without
+ * any lock.
+ *
+ * A WAV file is mapped into memory as it is, so its pages are those of
+ * the page cache, shared with any other process reading the file, and
+ * the kernel can drop them when they have not been played for a while. A
+ * compressed sample holds blocks of #lively_lossless_encode instead,
+ * about half the size or less, either mapped from a lossless file or
+ * compressed from a WAV one when it is loaded.
+ */
+typedef struct lively_pool_sample {
+	lively_hash_entry_t entry; /**< In the samples of the pool, by contents */
+	struct lively_pool *pool;
+	lively_pool_file_t *files;
+	unsigned int references;
+
+	lively_wav_t wav; /**< Layout of the audio; its frames are known */
+	bool compressed;
+	unsigned int block_frames; /**< Most frames of a block, if compressed */
+	const unsigned char *data; /**< First frame, or first block */
+	size_t size; /**< Bytes of data */
+
+	void *map;
+	size_t map_size;
+	unsigned char *blocks; /**< Compressed when loaded, if not mapped */
+} lively_pool_sample_t;
+
+/**
+ * The samples of the application, each loaded once, however many nodes
+ * play it. Samples are counted references, released by whoever loaded
+ * them, and freed with the last reference.
+ *
+ * Loading and releasing may happen on any thread but the audio one; the
+ * pool has a lock of its own. Streams read samples on the disk thread,
+ * which keeps both the faults of mapped pages and the decoding of blocks
+ * off the audio thread.
+ */
+typedef struct lively_pool {
+	struct lively_app *app;
+	pthread_mutex_t lock;
+	lively_hash_t files; /**< By device and inode */
+	lively_hash_t samples; /**< By contents */
+	size_t bytes; /**< Of the storage of every sample */
+} lively_pool_t;
+
+bool lively_pool_init (lively_pool_t *, struct lively_app *);
+void lively_pool_destroy (lively_pool_t *);
+
+lively_pool_sample_t *lively_pool_load (lively_pool_t *, const char *path, bool compress);
+void lively_pool_retain (lively_pool_sample_t *);
+void lively_pool_release (lively_pool_sample_t *);
+size_t lively_pool_get_bytes (lively_pool_t *);
+
+void lively_pool_sample_prefetch (lively_pool_sample_t *, size_t offset, size_t size);
+
+#endif
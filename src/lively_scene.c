@@ -3,11 +3,22 @@
  * Lively Scene: A graph structure for Lively Nodes.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lively_app.h"
+#include "lively_hash.h"
 #include "lively_scene.h"
 #include "lively_node.h"
+#include "lively_param.h"
+
+#include "platform.h"
+
+static void scene_commit (lively_scene_t *scene);
+static void scene_publish (lively_scene_t *scene, lively_scene_plan_t *plan);
 
 /**
 * Initializes a new Lively Scene
@@ -17,10 +28,35 @@
 */
 void
 lively_scene_init(lively_scene_t *scene, lively_app_t *app) {
+	pthread_mutexattr_t attr;
+
 	scene->app = app;
 	scene->buffer_length = 0;
+	atomic_init (&scene->sample_rate, 48000);
 	scene->head = NULL;
 	scene->name = "scene000";
+
+	scene->next_id = 1;
+	lively_hash_init (&scene->nodes_by_id);
+	lively_hash_init (&scene->nodes_by_name);
+	lively_hash_init (&scene->plugs);
+
+	scene->edit_depth = 0;
+	scene->edit_dirty = false;
+
+	// Recursive, so that callbacks and helpers may call back into the scene.
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&scene->lock, &attr);
+	pthread_mutexattr_destroy (&attr);
+
+	atomic_init (&scene->plan, NULL);
+	atomic_init (&scene->process_sequence, 0);
+	atomic_init (&scene->latency, 0);
+
+	lively_event_queue_init (&scene->events);
+	atomic_init (&scene->frame, 0);
+	atomic_init (&scene->rolling, false);
 }
 
 /**
@@ -33,11 +69,24 @@ lively_scene_init(lively_scene_t *scene, lively_app_t *app) {
 */
 void
 lively_scene_destroy(lively_scene_t *scene) {
+	pthread_mutex_lock (&scene->lock);
+
 	lively_node_t *node_iterator = scene->head;
 	while (node_iterator) {
 		lively_scene_disconnect_node (scene, node_iterator);
 		node_iterator = node_iterator->next;
 	}
+
+	scene_publish (scene, NULL);
+
+	lively_hash_destroy (&scene->nodes_by_id);
+	lively_hash_destroy (&scene->nodes_by_name);
+	lively_hash_destroy (&scene->plugs);
+
+	pthread_mutex_unlock (&scene->lock);
+	pthread_mutex_destroy (&scene->lock);
+
+	lively_event_queue_destroy (&scene->events);
 }
 
 /**
@@ -53,11 +102,16 @@ lively_scene_nodes_foreach(
 	void (*callback) (lively_scene_t *scene, lively_node_t *node, void *data),
 	void *data) {
 
+	pthread_mutex_lock (&scene->lock);
+
 	lively_node_t *node = scene->head;
 	while (node) {
+		lively_node_t *next = node->next;
 		callback (scene, node, data);
-		node = node->next;
+		node = next;
 	}
+
+	pthread_mutex_unlock (&scene->lock);
 }
 
 /**
@@ -73,6 +127,98 @@ lively_scene_get_buffer_length (lively_scene_t *scene) {
 	return scene->buffer_length;
 }
 
+/**
+* Returns the latency of the scene: the delay from its input nodes to its
+* output nodes, including the compensation that keeps parallel paths aligned.
+*
+* @param scene The Lively Scene
+*
+* @return The latency, in number of samples
+*/
+unsigned int
+lively_scene_get_latency (lively_scene_t *scene) {
+	return atomic_load (&scene->latency);
+}
+
+/**
+* Returns the sample rate the scene runs at, which is 48000 until the audio
+* device says otherwise.
+*
+* @param scene The Lively Scene
+*/
+unsigned int
+lively_scene_get_sample_rate (lively_scene_t *scene) {
+	return atomic_load_explicit (&scene->sample_rate, memory_order_relaxed);
+}
+
+/**
+* Sets the sample rate the scene runs at, for all of its nodes, and returns
+* its success.
+*
+* Every node is given the new rate in #lively_node::sample_rate and has its
+* set_buffer_length called again with the current length, so that it can
+* resize or redesign whatever depends on the rate. As when the buffer length
+* changes, the audio thread is parked on an empty plan meanwhile, and the
+* previous rate is restored if any node fails.
+*
+* @param scene The Lively Scene
+* @param rate The sample rate, in frames per second
+*
+* @return A success value
+*/
+bool
+lively_scene_set_sample_rate (lively_scene_t *scene, unsigned int rate) {
+	bool success = true;
+
+	pthread_mutex_lock (&scene->lock);
+
+	unsigned int previous = lively_scene_get_sample_rate (scene);
+	if (rate == previous) {
+		pthread_mutex_unlock (&scene->lock);
+		return true;
+	}
+	scene_publish (scene, NULL);
+
+	lively_node_t *node_iterator = scene->head;
+	while (node_iterator) {
+		node_iterator->sample_rate = rate;
+		if (!node_iterator->set_buffer_length (node_iterator, scene->buffer_length)) {
+			success = false;
+			break;
+		}
+		node_iterator = node_iterator->next;
+	}
+
+	if (success) {
+		atomic_store_explicit (&scene->sample_rate, rate, memory_order_relaxed);
+	} else {
+		// Revert back
+		node_iterator = scene->head;
+		while (node_iterator) {
+			node_iterator->sample_rate = previous;
+			node_iterator->set_buffer_length (node_iterator, scene->buffer_length);
+			node_iterator = node_iterator->next;
+		}
+	}
+
+	scene_commit (scene);
+	pthread_mutex_unlock (&scene->lock);
+
+	return success;
+}
+
+/**
+* Recompiles the delay compensation after a node changed its latency.
+*
+* @param scene The Lively Scene
+*/
+void
+lively_scene_update_latency (lively_scene_t *scene) {
+	pthread_mutex_lock (&scene->lock);
+	scene_commit (scene);
+	pthread_mutex_unlock (&scene->lock);
+}
+
 /**
 * Sets the buffer length for all nodes in the Lively Scene, atomically, and
 * returns its success.
@@ -80,6 +226,12 @@ lively_scene_get_buffer_length (lively_scene_t *scene) {
 * The function first sets the buffer length for all nodes, but if we are
 * unsuccessful, we will revert back to the previous buffer length.
 *
+* Nodes are free to reallocate their buffers, so the audio thread is
+* parked on an empty plan for the duration of the change.
+*
+* The scene processes blocks of up to #LIVELY_QUANTUM frames whatever the
+* length, so a shorter length is raised to it.
+*
 * @param scene The Lively Scene
 * @param length The buffer length, in number of samples
 *
@@ -88,7 +240,15 @@ lively_scene_get_buffer_length (lively_scene_t *scene) {
 bool
 lively_scene_set_buffer_length (lively_scene_t *scene, unsigned int length) {
 	bool success = true;
+
+	if (length < LIVELY_QUANTUM) {
+		length = LIVELY_QUANTUM;
+	}
+
+	pthread_mutex_lock (&scene->lock);
+
 	unsigned int previous = scene->buffer_length;
+	scene_publish (scene, NULL);
 
 	lively_node_t *node_iterator = scene->head;
 	while (node_iterator) {
@@ -110,12 +270,54 @@ lively_scene_set_buffer_length (lively_scene_t *scene, unsigned int length) {
 		}
 	}
 
+	scene_commit (scene);
+	pthread_mutex_unlock (&scene->lock);
+
 	return success;
 }
 
+/**
+* Starts a batch of edits to the Lively Scene.
+*
+* The scene stays locked, and is not recompiled, until the matching
+* #lively_scene_end_edit; loading a large scene this way costs one compile
+* instead of one per edit. Batches may be nested.
+*
+* Nodes removed during a batch are still referenced by the audio thread
+* until the batch ends, so they must not be freed before then.
+*
+* @param scene The Lively Scene
+*/
+void
+lively_scene_begin_edit (lively_scene_t *scene) {
+	pthread_mutex_lock (&scene->lock);
+	scene->edit_depth++;
+}
+
+/**
+* Ends a batch of edits started with #lively_scene_begin_edit, publishing
+* them all at once.
+*
+* @param scene The Lively Scene
+*/
+void
+lively_scene_end_edit (lively_scene_t *scene) {
+	if (--scene->edit_depth == 0 && scene->edit_dirty) {
+		scene_commit (scene);
+	}
+	pthread_mutex_unlock (&scene->lock);
+}
+
+static uint64_t
+scene_node_id_hash (unsigned int id) {
+	return lively_hash_mix (id);
+}
+
 /**
 * Adds a Lively Node to the Lively Scene
 *
+* The node is assigned an identifier, and is indexed by it and by its name.
+*
 * @param scene The Lively Scene
 * @param node The Lively Node
 *
@@ -123,48 +325,179 @@ lively_scene_set_buffer_length (lively_scene_t *scene, unsigned int length) {
 */
 bool
 lively_scene_add_node(lively_scene_t *scene, lively_node_t *node) {
+	bool success;
+
+	pthread_mutex_lock (&scene->lock);
+
+	node->id = scene->next_id++;
+	if (!lively_hash_insert (&scene->nodes_by_id, &node->id_entry,
+			scene_node_id_hash (node->id))) {
+		pthread_mutex_unlock (&scene->lock);
+		lively_app_log (scene->app, LIVELY_FATAL, "scene", "Could not allocate memory");
+		return false;
+	}
+	if (node->name && !lively_hash_insert (&scene->nodes_by_name, &node->name_entry,
+			lively_hash_string (node->name))) {
+		lively_hash_remove (&scene->nodes_by_id, &node->id_entry);
+		pthread_mutex_unlock (&scene->lock);
+		lively_app_log (scene->app, LIVELY_FATAL, "scene", "Could not allocate memory");
+		return false;
+	}
+
 	lively_node_t *head = scene->head;
 	scene->head = node;
 
 	node->next = head;
+	node->prev = NULL;
+	if (head) {
+		head->prev = node;
+	}
+	node->scene = scene;
 
 	node->plug_head = NULL;
-	node->inputs_ready = 0;
+	node->inbound_head = NULL;
 	node->inputs_total = 0;
+	node->inputs_pending = 0;
+
+	node->sample_rate = lively_scene_get_sample_rate (scene);
+	success = node->set_buffer_length (node, scene->buffer_length);
+
+	scene_commit (scene);
+	pthread_mutex_unlock (&scene->lock);
 
-	return node->set_buffer_length (node, scene->buffer_length);
+	return success;
+}
+
+/**
+* Returns the node of the Lively Scene with the given name, or NULL. If
+* several nodes share the name, the one added last is returned.
+*
+* @param scene The Lively Scene
+* @param name The name of the node
+*/
+lively_node_t *
+lively_scene_find_node (lively_scene_t *scene, const char *name) {
+	lively_node_t *found = NULL;
+
+	pthread_mutex_lock (&scene->lock);
+
+	lively_hash_entry_t *entry = lively_hash_first (&scene->nodes_by_name,
+		lively_hash_string (name));
+	for (; entry; entry = lively_hash_next (entry)) {
+		lively_node_t *node = LIVELY_CONTAINER_OF (entry, lively_node_t, name_entry);
+		if (strcmp (node->name, name) == 0) {
+			found = node;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock (&scene->lock);
+	return found;
+}
+
+/**
+* Returns the node of the Lively Scene with the given identifier, or NULL.
+*
+* @param scene The Lively Scene
+* @param id The identifier, see #lively_node::id
+*/
+lively_node_t *
+lively_scene_find_node_by_id (lively_scene_t *scene, unsigned int id) {
+	lively_node_t *found = NULL;
+
+	pthread_mutex_lock (&scene->lock);
+
+	lively_hash_entry_t *entry = lively_hash_first (&scene->nodes_by_id,
+		scene_node_id_hash (id));
+	for (; entry; entry = lively_hash_next (entry)) {
+		lively_node_t *node = LIVELY_CONTAINER_OF (entry, lively_node_t, id_entry);
+		if (node->id == id) {
+			found = node;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock (&scene->lock);
+	return found;
 }
 
 /**
 * Removes a Lively Node from the Lively Scene
 *
 * This function will produce a warning if the Lively Node doesn’t belong
-* to the Lively Scene.
+* to the Lively Scene. Outside a batch of edits, once it returns, the audio
+* thread no longer references the node and the caller may free it. Inside
+* a batch, the audio thread keeps processing the node until
+* #lively_scene_end_edit, although its scene is already cleared; this is
+* why processing reads #lively_node::sample_rate rather than the scene.
 *
 * @param scene The Lively Scene
 * @param node The Lively Node
 */
 void
 lively_scene_remove_node(lively_scene_t *scene, lively_node_t *node) {
-	lively_node_t **iterator = &scene->head;
-	while (*iterator) {
-		if (*iterator == node) {
-			lively_scene_disconnect_node (scene, node);
-
-			lively_node_t *next = (*iterator)->next;
-			*iterator = next;
-			return;
-		}
-		iterator = &(*iterator)->next;
+	pthread_mutex_lock (&scene->lock);
+
+	if (node->scene != scene) {
+		pthread_mutex_unlock (&scene->lock);
+		lively_app_log (
+			scene->app,
+			LIVELY_WARN,
+			"scene",
+			"Attempt to remove non-existant node '%s' from scene '%s'",
+			node->name,
+			scene->name);
+		return;
 	}
 
-	lively_app_log (
-		scene->app,
-		LIVELY_WARN,
-		"scene",
-		"Attempt to remove non-existant node '%s' from scene '%s'",
-		node->name,
-		scene->name);
+	lively_scene_disconnect_node (scene, node);
+
+	if (node->prev) {
+		node->prev->next = node->next;
+	} else {
+		scene->head = node->next;
+	}
+	if (node->next) {
+		node->next->prev = node->prev;
+	}
+
+	lively_hash_remove (&scene->nodes_by_id, &node->id_entry);
+	if (node->name) {
+		lively_hash_remove (&scene->nodes_by_name, &node->name_entry);
+	}
+
+	scene_commit (scene);
+	node->scene = NULL;
+	lively_event_queue_purge (&scene->events, node);
+	pthread_mutex_unlock (&scene->lock);
+}
+
+/**
+* Unlinks a plug from both of its nodes and from the index, and frees it.
+*/
+static void
+scene_plug_destroy (lively_scene_t *scene, lively_node_plug_t *plug) {
+	if (plug->prev) {
+		plug->prev->next = plug->next;
+	} else {
+		plug->source->plug_head = plug->next;
+	}
+	if (plug->next) {
+		plug->next->prev = plug->prev;
+	}
+
+	if (plug->inbound_prev) {
+		plug->inbound_prev->inbound_next = plug->inbound_next;
+	} else {
+		plug->target->inbound_head = plug->inbound_next;
+	}
+	if (plug->inbound_next) {
+		plug->inbound_next->inbound_prev = plug->inbound_prev;
+	}
+
+	lively_hash_remove (&scene->plugs, &plug->entry);
+	plug->target->inputs_total--;
+	free (plug);
 }
 
 /**
@@ -175,98 +508,752 @@ lively_scene_remove_node(lively_scene_t *scene, lively_node_t *node) {
 */
 void
 lively_scene_disconnect_node (lively_scene_t *scene, lively_node_t *node) {
-	lively_node_t *node_iterator = scene->head;
-	while (node_iterator) {
-		if (node_iterator == node) {
-			lively_node_plug_t *plug_iterator = node_iterator->plug_head;
-			while (plug_iterator) {
-				lively_node_plug_t *plug_iterator_next = plug_iterator->next;
+	pthread_mutex_lock (&scene->lock);
+
+	if (node->scene == scene) {
+		while (node->plug_head) {
+			scene_plug_destroy (scene, node->plug_head);
+		}
+		while (node->inbound_head) {
+			scene_plug_destroy (scene, node->inbound_head);
+		}
+	}
 
-				// Disconnect, then free plug.
-				plug_iterator->target->inputs_total--;
-				free (plug_iterator);
+	scene_commit (scene);
+	pthread_mutex_unlock (&scene->lock);
+}
 
-				plug_iterator = plug_iterator_next;
+/**
+* Processes one period of the Lively Scene.
+*
+* This must only be called from a single thread, normally the audio thread.
+*
+* @param scene The Lively Scene
+* @param length The number of samples to process
+*/
+void
+lively_scene_process (lively_scene_t *scene, unsigned int length) {
+	lively_scene_plan_t *plan = lively_scene_plan_acquire (scene);
+	if (plan) {
+		lively_scene_plan_process (plan, length);
+	}
+	lively_scene_plan_release (scene);
+}
+
+/**
+* Marks the start of processing and returns the current plan.
+*
+* The plan, and every node it references, stays valid until
+* #lively_scene_plan_release is called. Edits made in the meantime wait
+* for the release before freeing anything. Never blocks.
+*
+* @param scene The Lively Scene
+*
+* @return The current plan, or NULL if the scene has nothing to process
+*/
+lively_scene_plan_t *
+lively_scene_plan_acquire (lively_scene_t *scene) {
+	// An odd sequence number means that processing is in progress.
+	atomic_fetch_add (&scene->process_sequence, 1);
+	return atomic_load (&scene->plan);
+}
+
+/**
+* Marks the end of processing started with #lively_scene_plan_acquire.
+*
+* @param scene The Lively Scene
+*/
+void
+lively_scene_plan_release (lively_scene_t *scene) {
+	atomic_fetch_add (&scene->process_sequence, 1);
+}
+
+/**
+* Transfers a block through the compensation delay of a plug.
+*
+* The ring always holds at least the delay plus one block, so the block is
+* written first and the delayed block read back after.
+*/
+static void
+scene_plug_delay (
+	lively_scene_plug_t *plug,
+	const float *source,
+	float *target,
+	unsigned int length) {
+
+	float *ring = plug->delay_ring->samples;
+	unsigned int mask = plug->delay_ring->mask;
+	unsigned int position = plug->delay_ring->position;
+
+	for (unsigned int i = 0; i < length; i++) {
+		ring[(position + i) & mask] = source[i];
+	}
+
+	unsigned int read = position - plug->delay;
+	if (plug->accumulate) {
+		for (unsigned int i = 0; i < length; i++) {
+			target[i] += ring[(read + i) & mask];
+		}
+	} else {
+		for (unsigned int i = 0; i < length; i++) {
+			target[i] = ring[(read + i) & mask];
+		}
+	}
+
+	plug->delay_ring->position = (position + length) & mask;
+}
+
+/**
+* Runs a fused chain of kernels over a block, one tile at a time, from the
+* buffer of the first node to the buffer of the last.
+*/
+static void
+scene_process_chain (
+	lively_scene_plan_t *plan,
+	lively_scene_step_t *step,
+	unsigned int length) {
+
+	lively_node_t **chain = &plan->chain[step->chain_start];
+	lively_node_t *first = chain[0];
+	lively_node_t *last = chain[step->chain_count - 1];
+	const float *input = first->get_write_buffer (first, LIVELY_MONO);
+	float *output = last->get_write_buffer (last, LIVELY_MONO);
+	float tile[LIVELY_KERNEL_TILE];
+
+	for (unsigned int offset = 0; offset < length; offset += LIVELY_KERNEL_TILE) {
+		unsigned int count = length - offset < LIVELY_KERNEL_TILE
+			? length - offset : LIVELY_KERNEL_TILE;
+
+		memcpy (tile, input + offset, count * sizeof *tile);
+		for (unsigned int i = 0; i < step->chain_count; i++) {
+			chain[i]->kernel (chain[i], tile, count);
+		}
+		memcpy (output + offset, tile, count * sizeof *tile);
+	}
+}
+
+/**
+* Runs every step of a compiled plan. A node whose process fails outputs
+* silence for the block.
+*
+* @param plan The plan, as returned by #lively_scene_plan_acquire
+* @param length The number of samples to process
+*/
+void
+lively_scene_plan_process (lively_scene_plan_t *plan, unsigned int length) {
+	for (unsigned int s = 0; s < plan->steps_count; s++) {
+		lively_scene_step_t *step = &plan->steps[s];
+		lively_node_t *node = step->node;
+
+		lively_scene_plug_t *plug = &plan->plugs[step->plugs_start];
+		lively_scene_plug_t *plug_end = plug + step->plugs_count;
+
+		if (step->chain_count) {
+			scene_process_chain (plan, step, length);
+		} else if (!node->process (node, length)) {
+			// TODO: Safe logging from audio processing thread.
+			// The plugs still run, so that targets they copy into are
+			// written, but carry silence rather than the last block.
+			for (lively_scene_plug_t *silent = plug; silent < plug_end; silent++) {
+				memset (node->get_read_buffer (node, silent->source_ch), 0,
+					length * sizeof (float));
+			}
+		}
+
+		for (; plug < plug_end; plug++) {
+			lively_node_t *target = plug->target;
+
+			float *source_buffer = node->get_read_buffer (node, plug->source_ch);
+			float *target_buffer = target->get_write_buffer (target, plug->target_ch);
+			if (plug->delay) {
+				scene_plug_delay (plug, source_buffer, target_buffer, length);
+			} else if (plug->accumulate) {
+				for (size_t i = 0; i < length; i++) {
+					target_buffer[i] += source_buffer[i];
+				}
+			} else {
+				memcpy (target_buffer, source_buffer, length * sizeof *target_buffer);
 			}
-			node_iterator->plug_head = NULL;
-			break;
 		}
-		node_iterator = node_iterator->next;
 	}
 }
 
 static void
-lively_scene_process_node (
+scene_dispatch_event (
 	lively_scene_t *scene,
-	lively_node_t *node,
+	lively_scene_plan_t *plan,
+	const lively_event_t *event) {
+
+	bool broadcast = false;
+
+	switch (event->type) {
+	case LIVELY_EVENT_TRANSPORT_START:
+		atomic_store (&scene->rolling, true);
+		broadcast = true;
+		break;
+	case LIVELY_EVENT_TRANSPORT_STOP:
+		atomic_store (&scene->rolling, false);
+		broadcast = true;
+		break;
+	default:
+		break;
+	}
+
+	if (broadcast) {
+		for (unsigned int s = 0; plan && s < plan->steps_count; s++) {
+			lively_scene_step_t *step = &plan->steps[s];
+			lively_node_t **nodes = &step->node;
+			unsigned int count = 1;
+
+			if (step->chain_count) {
+				nodes = &plan->chain[step->chain_start];
+				count = step->chain_count;
+			}
+			for (unsigned int i = 0; i < count; i++) {
+				if (nodes[i]->handle_event) {
+					nodes[i]->handle_event (nodes[i], event);
+				}
+			}
+		}
+	} else if (event->node) {
+		if (event->type == LIVELY_EVENT_PARAM) {
+			lively_node_set_param (event->node, event->param.index, event->param.value);
+		}
+		if (event->node->handle_event) {
+			event->node->handle_event (event->node, event);
+		}
+	}
+}
+
+/**
+* Applies the events due at the current scene frame and decides how long the
+* next block may be.
+*
+* A block ends just before the next pending event, so that every event takes
+* effect on its exact frame. Without pending events the whole length is used.
+* The scene clock advances by the returned length, which the caller must
+* then process.
+*
+* @param scene The Lively Scene
+* @param plan The plan, as returned by #lively_scene_plan_acquire, or NULL
+* @param length The frames left to process
+*
+* @return The length of the next block, between 1 and length
+*/
+unsigned int
+lively_scene_plan_begin_block (
+	lively_scene_t *scene,
+	lively_scene_plan_t *plan,
 	unsigned int length) {
 
-	// First we call the node's process() func.
-	bool success = node->process (node, length);
-	if (!success) {
-		// TODO: Safe logging from audio processing thread.
-		/*lively_app_log (scene->app, LIVELY_WARN, "scene",
-			"Node '%s' in scene '%s' reported processing failure",
-			node->name, scene->name);*/
+	unsigned long long now = atomic_load_explicit (&scene->frame, memory_order_relaxed);
+	unsigned int block = length;
+
+	if (lively_event_queue_begin (&scene->events)) {
+		const lively_event_t *event;
+
+		// Late events are applied as soon as possible.
+		while ((event = lively_event_queue_peek (&scene->events))
+			&& event->time <= now) {
+
+			scene_dispatch_event (scene, plan, event);
+			lively_event_queue_pop (&scene->events);
+		}
+
+		if (event && event->time < now + length) {
+			block = (unsigned int) (event->time - now);
+		}
+
+		lively_event_queue_end (&scene->events);
+	}
+
+	atomic_store_explicit (&scene->frame, now + block, memory_order_relaxed);
+	return block;
+}
+
+/**
+* Returns the scene clock: the number of frames processed so far.
+*
+* Events should be timestamped against this clock. Since the audio thread
+* runs ahead of the device by the output latency, an event stamped with the
+* current frame is applied on the next block.
+*
+* @param scene The Lively Scene
+*
+* @return The frame at which the next block starts
+*/
+unsigned long long
+lively_scene_get_frame (lively_scene_t *scene) {
+	return atomic_load_explicit (&scene->frame, memory_order_relaxed);
+}
+
+/**
+* Returns true if the scene transport is rolling.
+*
+* @param scene The Lively Scene
+*/
+bool
+lively_scene_is_rolling (lively_scene_t *scene) {
+	return atomic_load (&scene->rolling);
+}
+
+/**
+* Posts an event to a node of the scene, or to the scene itself.
+*
+* This function will produce #LIVELY_WARN if too many events are pending.
+*
+* @param scene The Lively Scene
+* @param event The event, which is copied
+*
+* @return A success value
+*/
+bool
+lively_scene_post_event (lively_scene_t *scene, const lively_event_t *event) {
+	if (!lively_event_queue_push (&scene->events, event)) {
+		lively_app_log (scene->app, LIVELY_WARN, "scene",
+			"Event queue of scene '%s' is full", scene->name);
+		return false;
+	}
+	return true;
+}
+
+/**
+* Waits until the audio thread is no longer inside a plan it acquired
+* before this call.
+*
+* Nodes use this to retire state the audio thread may still be reading,
+* after publishing its replacement.
+*
+* @param scene The Lively Scene
+*/
+void
+lively_scene_synchronize (lively_scene_t *scene) {
+	unsigned int sequence = atomic_load (&scene->process_sequence);
+	if (!(sequence & 1)) {
+		return;
+	}
+
+	// Processing is bounded by a period, so this never waits for long.
+	while (atomic_load (&scene->process_sequence) == sequence) {
+		platform_sleep_until (platform_time () + 50e-6);
+	}
+}
+
+static void
+scene_plan_free (lively_scene_plan_t *plan) {
+	if (!plan) {
 		return;
 	}
 
-	lively_node_plug_t *plug_iterator = node->plug_head;
-	while (plug_iterator) {
-		// #plug = *plug_iterator
-		// #target = *plug_iterator->target
-		//
-		// Given: #plug is written.
-		// Goal: All plug_head to #target are written.
-		//
-		// It follows that to reach the goal, we need to know if there are any
-		// other plug_head. If there are no more other plug_head to target, it follows
-		// that we have accomplished our goal. Otherwise, we need to wait for
-		// the other plug_head before we go on.
-		//
-		// We can keep track of the number of written plug_head with a temporary
-		// lengther variable on #target. This can be reset after the node is
-		// processed.
-		//
-		// #target.inputs_ready += 1.
-		// if (#target.inputs_ready == #target.inputs_total) {
-		// 		#goal reached
-		// } else {
-		// 		#skip target, not ready
-		// }
-
-		lively_node_plug_t *plug = plug_iterator;
+	// Rings taken over by a later plan are now freed with it.
+	for (unsigned int i = 0; i < plan->plugs_count; i++) {
+		lively_scene_delay_t *ring = plan->plugs[i].delay_ring;
+		if (ring && ring->owner == plan) {
+			free (ring);
+		}
+	}
+
+	free (plan->steps);
+	free (plan->plugs);
+	free (plan->chain);
+	free (plan->inputs);
+	free (plan->outputs);
+	free (plan);
+}
+
+/**
+* Replaces the current plan and frees the previous one once the audio
+* thread is done with it, except for the rings the new plan took over.
+*/
+static void
+scene_publish (lively_scene_t *scene, lively_scene_plan_t *plan) {
+	for (unsigned int i = 0; plan && i < plan->plugs_count; i++) {
+		if (plan->plugs[i].delay_ring) {
+			plan->plugs[i].delay_ring->owner = plan;
+		}
+	}
+
+	lively_scene_plan_t *previous = atomic_exchange (&scene->plan, plan);
+	lively_scene_synchronize (scene);
+	scene_plan_free (previous);
+}
+
+typedef struct scene_plug_key {
+	uintptr_t target;
+	uintptr_t buffer;
+	unsigned int index;
+} scene_plug_key_t;
+
+static int
+scene_plug_key_compare (const void *a, const void *b) {
+	const scene_plug_key_t *x = a;
+	const scene_plug_key_t *y = b;
+
+	if (x->target != y->target) return x->target < y->target ? -1 : 1;
+	if (x->buffer != y->buffer) return x->buffer < y->buffer ? -1 : 1;
+	if (x->index != y->index) return x->index < y->index ? -1 : 1;
+	return 0;
+}
+
+/**
+* Decides which plugs copy and which accumulate.
+*
+* Several channels of a node may share one buffer, so plugs are grouped by
+* the buffer they write rather than by channel.
+*/
+static bool
+scene_plan_mark_accumulate (lively_scene_plan_t *plan) {
+	if (plan->plugs_count == 0) {
+		return true;
+	}
+
+	scene_plug_key_t *keys = malloc (plan->plugs_count * sizeof *keys);
+	if (!keys) {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < plan->plugs_count; i++) {
+		lively_scene_plug_t *plug = &plan->plugs[i];
 		lively_node_t *target = plug->target;
 
-		float *source_buffer = node->get_read_buffer (node, plug->source_ch);
-		float *target_buffer = target->get_write_buffer (target, plug->target_ch);
-		for (size_t i = 0; i < length; i++) {
-			target_buffer[i] += source_buffer[i];
+		keys[i].target = (uintptr_t) target;
+		keys[i].buffer = (uintptr_t) target->get_write_buffer (target, plug->target_ch);
+		keys[i].index = i;
+	}
+
+	qsort (keys, plan->plugs_count, sizeof *keys, scene_plug_key_compare);
+
+	for (unsigned int i = 0; i < plan->plugs_count; i++) {
+		bool first = i == 0
+			|| keys[i].target != keys[i - 1].target
+			|| keys[i].buffer != keys[i - 1].buffer;
+		plan->plugs[keys[i].index].accumulate = !first;
+	}
+
+	free (keys);
+	return true;
+}
+
+/** A plug of the previous plan with a compensation delay, found by its ends */
+typedef struct scene_delay_key {
+	uintptr_t source;
+	uintptr_t target;
+	unsigned int source_ch;
+	unsigned int target_ch;
+	lively_scene_delay_t *ring;
+} scene_delay_key_t;
+
+static int
+scene_delay_key_compare (const void *a, const void *b) {
+	const scene_delay_key_t *x = a;
+	const scene_delay_key_t *y = b;
+
+	if (x->source != y->source) return x->source < y->source ? -1 : 1;
+	if (x->target != y->target) return x->target < y->target ? -1 : 1;
+	if (x->source_ch != y->source_ch) return x->source_ch < y->source_ch ? -1 : 1;
+	if (x->target_ch != y->target_ch) return x->target_ch < y->target_ch ? -1 : 1;
+	return 0;
+}
+
+/**
+* Lists the plugs of a plan which have a compensation delay, sorted by
+* their ends.
+*
+* @return The list, or NULL if there are none or memory could not be
+* allocated, in which case no ring is taken over
+*/
+static scene_delay_key_t *
+scene_plan_delay_keys (lively_scene_plan_t *plan, unsigned int *count) {
+	*count = 0;
+	if (!plan || plan->plugs_count == 0) {
+		return NULL;
+	}
+
+	scene_delay_key_t *keys = malloc (plan->plugs_count * sizeof *keys);
+	if (!keys) {
+		return NULL;
+	}
+
+	for (unsigned int s = 0; s < plan->steps_count; s++) {
+		lively_scene_step_t *step = &plan->steps[s];
+		for (unsigned int p = 0; p < step->plugs_count; p++) {
+			lively_scene_plug_t *plug = &plan->plugs[step->plugs_start + p];
+			if (plug->delay_ring) {
+				keys[(*count)++] = (scene_delay_key_t) {
+					(uintptr_t) step->node, (uintptr_t) plug->target,
+					plug->source_ch, plug->target_ch, plug->delay_ring
+				};
+			}
 		}
+	}
+
+	qsort (keys, *count, sizeof *keys, scene_delay_key_compare);
+	return keys;
+}
 
-		target->inputs_ready += 1;
-		if (target->inputs_ready == target->inputs_total) {
-			target->inputs_ready = 0;
-			lively_scene_process_node (scene, target, length);
+/**
+* Inserts compensation delays so that all plugs into a node carry signals
+* with the same latency, and all output nodes end up with the latency of the
+* slowest path.
+*
+* Expects #lively_node::input_latency to hold the latency of the slowest
+* path into every node of the plan.
+*
+* A plug which had a ring of the same size in the previous plan takes it
+* over, with the audio it holds; it stays owned by the previous plan until
+* this one is published. Other rings start out silent.
+*/
+static bool
+scene_plan_compensate (
+	lively_scene_t *scene,
+	lively_scene_plan_t *plan,
+	lively_scene_plan_t *previous) {
+	unsigned int max_block = scene->buffer_length > LIVELY_QUANTUM
+		? scene->buffer_length : LIVELY_QUANTUM;
+
+	plan->latency = 0;
+	for (unsigned int i = 0; i < plan->outputs_count; i++) {
+		lively_node_t *output = (lively_node_t *) plan->outputs[i];
+		unsigned int latency = output->input_latency + output->latency;
+		if (latency > plan->latency) {
+			plan->latency = latency;
 		}
+	}
+	for (unsigned int i = 0; i < plan->outputs_count; i++) {
+		lively_node_t *output = (lively_node_t *) plan->outputs[i];
+		output->input_latency = plan->latency - output->latency;
+	}
 
-		plug_iterator = plug_iterator->next;
+	unsigned int keys_count;
+	scene_delay_key_t *keys = scene_plan_delay_keys (previous, &keys_count);
+
+	for (unsigned int s = 0; s < plan->steps_count; s++) {
+		lively_scene_step_t *step = &plan->steps[s];
+		unsigned int arrival = step->node->input_latency + step->node->latency;
+
+		for (unsigned int p = 0; p < step->plugs_count; p++) {
+			lively_scene_plug_t *plug = &plan->plugs[step->plugs_start + p];
+			unsigned int delay = plug->target->input_latency - arrival;
+			if (delay == 0) {
+				continue;
+			}
+
+			unsigned int size = 1;
+			while (size < delay + max_block) {
+				size <<= 1;
+			}
+
+			scene_delay_key_t key = {
+				(uintptr_t) step->node, (uintptr_t) plug->target,
+				plug->source_ch, plug->target_ch, NULL
+			};
+			scene_delay_key_t *found = keys_count
+				? bsearch (&key, keys, keys_count, sizeof *keys, scene_delay_key_compare)
+				: NULL;
+
+			if (found && found->ring->mask == size - 1) {
+				plug->delay_ring = found->ring;
+			} else {
+				plug->delay_ring = calloc (1, sizeof *plug->delay_ring + size * sizeof (float));
+				if (!plug->delay_ring) {
+					free (keys);
+					return false;
+				}
+				plug->delay_ring->owner = plan;
+				plug->delay_ring->mask = size - 1;
+				plug->delay_ring->position = 0;
+			}
+			plug->delay = delay;
+		}
 	}
+
+	free (keys);
+	return true;
 }
 
-void
-lively_scene_process (lively_scene_t *scene, unsigned int length) {
-	// We do a depth-first search, starting with the input nodes.
-	lively_node_t *node_iterator = scene->head;
-	while (node_iterator) {
-		if (node_iterator->type == LIVELY_NODE_INPUT) {
-			lively_scene_process_node (scene, node_iterator, length);
+/**
+* Returns the node a kernel node can be fused with, if any: its only plug
+* must lead to a kernel node with no other input.
+*/
+static lively_node_t *
+scene_fusable_next (lively_node_t *node) {
+	lively_node_plug_t *plug = node->plug_head;
+	if (!node->kernel || !plug || plug->next) {
+		return NULL;
+	}
+
+	lively_node_t *target = plug->target;
+	if (!target->kernel || target->type != LIVELY_NODE_PROCESS || target->inputs_total != 1) {
+		return NULL;
+	}
+	return target;
+}
+
+/**
+* Compiles the scene into a topologically sorted plan.
+*
+* Nodes that are part of a cycle can never have all of their inputs ready,
+* so they are left out of the plan with a warning. Linear chains of kernel
+* nodes are fused into a single step.
+*
+* Compensation delays of plugs which persist keep their audio from the
+* previous plan, see #scene_plan_compensate.
+*
+* @return The new plan, or NULL if memory could not be allocated
+*/
+static lively_scene_plan_t *
+scene_compile (lively_scene_t *scene) {
+	unsigned int nodes_count = 0;
+	unsigned int plugs_count = 0;
+	unsigned int inputs_count = 0;
+	unsigned int outputs_count = 0;
+
+	for (lively_node_t *node = scene->head; node; node = node->next) {
+		node->inputs_pending = 0;
+		node->input_latency = 0;
+	}
+	for (lively_node_t *node = scene->head; node; node = node->next) {
+		nodes_count++;
+		if (node->type == LIVELY_NODE_INPUT) inputs_count++;
+		if (node->type == LIVELY_NODE_OUTPUT) outputs_count++;
+
+		for (lively_node_plug_t *plug = node->plug_head; plug; plug = plug->next) {
+			plug->target->inputs_pending++;
+			plugs_count++;
+		}
+	}
+
+	lively_scene_plan_t *plan = calloc (1, sizeof *plan);
+	if (!plan) {
+		return NULL;
+	}
+
+	plan->steps = malloc ((nodes_count + 1) * sizeof *plan->steps);
+	plan->plugs = malloc ((plugs_count + 1) * sizeof *plan->plugs);
+	plan->chain = malloc ((nodes_count + 1) * sizeof *plan->chain);
+	plan->inputs = malloc ((inputs_count + 1) * sizeof *plan->inputs);
+	plan->outputs = malloc ((outputs_count + 1) * sizeof *plan->outputs);
+	if (!plan->steps || !plan->plugs || !plan->chain || !plan->inputs || !plan->outputs) {
+		scene_plan_free (plan);
+		return NULL;
+	}
+
+	// The steps array doubles as the queue for Kahn's algorithm.
+	unsigned int queue_tail = 0;
+	unsigned int fused_count = 0;
+	for (lively_node_t *node = scene->head; node; node = node->next) {
+		if (node->inputs_pending == 0) {
+			plan->steps[queue_tail++].node = node;
 		}
-		node_iterator = node_iterator->next;
 	}
+
+	for (unsigned int s = 0; s < queue_tail; s++) {
+		lively_scene_step_t *step = &plan->steps[s];
+		lively_node_t *node = step->node;
+
+		// Nodes fused into the chain only depend on the one before them,
+		// so they are ready as soon as the first one is.
+		step->chain_start = plan->chain_count;
+		step->chain_count = 0;
+		lively_node_t *next = scene_fusable_next (node);
+		if (next) {
+			plan->chain[plan->chain_count++] = node;
+			do {
+				next->input_latency = node->input_latency + node->latency;
+				next->inputs_pending = 0;
+				plan->chain[plan->chain_count++] = next;
+				fused_count++;
+				node = next;
+			} while ((next = scene_fusable_next (node)));
+
+			step->node = node;
+			step->chain_count = plan->chain_count - step->chain_start;
+		}
+
+		step->plugs_start = plan->plugs_count;
+		for (lively_node_plug_t *plug = node->plug_head; plug; plug = plug->next) {
+			lively_node_t *target = plug->target;
+
+			lively_scene_plug_t *compiled = &plan->plugs[plan->plugs_count++];
+			compiled->target = target;
+			compiled->source_ch = plug->source_ch;
+			compiled->target_ch = plug->target_ch;
+			compiled->accumulate = false;
+			compiled->delay = 0;
+			compiled->delay_ring = NULL;
+
+			unsigned int arrival = node->input_latency + node->latency;
+			if (arrival > target->input_latency) {
+				target->input_latency = arrival;
+			}
+
+			if (--target->inputs_pending == 0) {
+				plan->steps[queue_tail++].node = target;
+			}
+		}
+		step->plugs_count = plan->plugs_count - step->plugs_start;
+
+		if (node->type == LIVELY_NODE_INPUT) {
+			plan->inputs[plan->inputs_count++] = (lively_node_io_t *) node;
+		} else if (node->type == LIVELY_NODE_OUTPUT && node->inputs_total > 0) {
+			plan->outputs[plan->outputs_count++] = (lively_node_io_t *) node;
+		}
+	}
+	plan->steps_count = queue_tail;
+
+	if (plan->steps_count + fused_count < nodes_count) {
+		lively_app_log (scene->app, LIVELY_WARN, "scene",
+			"Scene '%s' contains a cycle; %u nodes will not be processed",
+			scene->name, nodes_count - plan->steps_count - fused_count);
+	}
+
+	if (!scene_plan_mark_accumulate (plan)
+		|| !scene_plan_compensate (scene, plan, atomic_load (&scene->plan))) {
+		scene_plan_free (plan);
+		return NULL;
+	}
+
+	return plan;
+}
+
+/**
+* Compiles and publishes the current state of the scene.
+*
+* Must be called with the scene lock held, after every edit. Inside a batch
+* of edits the commit is deferred to #lively_scene_end_edit.
+*/
+static void
+scene_commit (lively_scene_t *scene) {
+	if (scene->edit_depth > 0) {
+		scene->edit_dirty = true;
+		return;
+	}
+	scene->edit_dirty = false;
+
+	lively_scene_plan_t *plan = scene_compile (scene);
+	if (!plan) {
+		lively_app_log (scene->app, LIVELY_ERROR, "scene",
+			"Could not allocate memory for the plan of scene '%s'", scene->name);
+	}
+
+	// Even on failure the old plan must go; it may reference removed nodes.
+	scene_publish (scene, plan);
+	atomic_store (&scene->latency, plan ? plan->latency : 0);
+}
+
+static uint64_t
+scene_plug_hash (
+	lively_node_t *source,
+	lively_node_channel_t source_ch,
+	lively_node_t *target,
+	lively_node_channel_t target_ch) {
+
+	uint64_t channels = (uint64_t) source_ch << 16 | (uint64_t) target_ch;
+	return lively_hash_mix ((uintptr_t) source
+		^ lively_hash_mix ((uintptr_t) target ^ channels));
 }
 
-static lively_node_plug_t **
+static lively_node_plug_t *
 scene_find_plug (
 	lively_scene_t *scene,
 	lively_node_t *source,
@@ -274,16 +1261,14 @@ scene_find_plug (
 	lively_node_t *target,
 	lively_node_channel_t target_ch) {
 
-	lively_node_plug_t **plug_iterator = &source->plug_head;
-	while (*plug_iterator) {
-		bool target_match = (*plug_iterator)->target == target;
-		bool channel_match = (*plug_iterator)->target_ch == target_ch
-			&& (*plug_iterator)->source_ch == source_ch;
-
-		if (target_match && channel_match) {
-			return plug_iterator;
+	lively_hash_entry_t *entry = lively_hash_first (&scene->plugs,
+		scene_plug_hash (source, source_ch, target, target_ch));
+	for (; entry; entry = lively_hash_next (entry)) {
+		lively_node_plug_t *plug = LIVELY_CONTAINER_OF (entry, lively_node_plug_t, entry);
+		if (plug->source == source && plug->target == target
+			&& plug->source_ch == source_ch && plug->target_ch == target_ch) {
+			return plug;
 		}
-		plug_iterator = &(*plug_iterator)->next;
 	}
 
 	return NULL;
@@ -308,15 +1293,20 @@ lively_scene_is_connected (
 	lively_node_t *target,
 	lively_node_channel_t target_ch) {
 
-	return scene_find_plug (
+	pthread_mutex_lock (&scene->lock);
+	bool connected = scene_find_plug (
 		scene, source, source_ch, target, target_ch) != NULL;
+	pthread_mutex_unlock (&scene->lock);
+
+	return connected;
 }
 
 /**
 * Creates a plug from the source to the target
 *
 * This function will produce #LIVELY_WARN if the plug already exists,
-* or a #LIVELY_FATAL if memory could not be allocated for the plug.
+* either node is not in the scene or does not have the channel, or a
+* #LIVELY_FATAL if memory could not be allocated for the plug.
 *
 * @param scene The Lively Scene
 * @param source The source node
@@ -334,21 +1324,45 @@ lively_scene_connect(
 
 	lively_node_plug_t *plug;
 
-	if (lively_scene_is_connected (
-		scene, source, source_ch, target, target_ch)) {
+	pthread_mutex_lock (&scene->lock);
 
+	if (source->scene != scene || target->scene != scene) {
+		pthread_mutex_unlock (&scene->lock);
 		lively_app_log (
 			scene->app,
 			LIVELY_WARN,
 			"scene",
-			"Attempted to connect channels that are already connected");
+			"Attempted to connect nodes that are not in scene '%s'",
+			scene->name);
+		return;
+	}
+
+	if (!lively_node_can_read (source, source_ch)
+		|| !lively_node_can_write (target, target_ch)) {
+		pthread_mutex_unlock (&scene->lock);
+		lively_app_log (
+			scene->app,
+			LIVELY_WARN,
+			"scene",
+			"Attempted to connect a channel that a node does not have");
 		return;
 	}
 
-	// TODO: Check for cyclic connections
+	if (scene_find_plug (scene, source, source_ch, target, target_ch)) {
+		pthread_mutex_unlock (&scene->lock);
+		lively_app_log (
+			scene->app,
+			LIVELY_WARN,
+			"scene",
+			"Attempted to connect channels that are already connected");
+		return;
+	}
 
 	plug = malloc (sizeof *plug);
-	if (!plug) {
+	if (!plug || !lively_hash_insert (&scene->plugs, &plug->entry,
+			scene_plug_hash (source, source_ch, target, target_ch))) {
+		free (plug);
+		pthread_mutex_unlock (&scene->lock);
 		lively_app_log (
 			scene->app,
 			LIVELY_FATAL,
@@ -357,16 +1371,29 @@ lively_scene_connect(
 		return;
 	}
 
-	plug->next = NULL;
+	plug->source = source;
 	plug->target = target;
 	plug->source_ch = source_ch;
 	plug->target_ch = target_ch;
 
-	lively_node_plug_t *head = source->plug_head;
+	plug->prev = NULL;
+	plug->next = source->plug_head;
+	if (plug->next) {
+		plug->next->prev = plug;
+	}
 	source->plug_head = plug;
-	plug->next = head;
+
+	plug->inbound_prev = NULL;
+	plug->inbound_next = target->inbound_head;
+	if (plug->inbound_next) {
+		plug->inbound_next->inbound_prev = plug;
+	}
+	target->inbound_head = plug;
 
 	target->inputs_total++;
+
+	scene_commit (scene);
+	pthread_mutex_unlock (&scene->lock);
 }
 
 /**
@@ -389,11 +1416,14 @@ lively_scene_disconnect(
 	lively_node_t *target,
 	lively_node_channel_t target_ch) {
 
-	lively_node_plug_t **plug;
+	lively_node_plug_t *plug;
+
+	pthread_mutex_lock (&scene->lock);
 
 	plug = scene_find_plug (scene, source, source_ch, target, target_ch);
 
 	if (!plug) {
+		pthread_mutex_unlock (&scene->lock);
 		lively_app_log (
 			scene->app,
 			LIVELY_WARN,
@@ -402,9 +1432,8 @@ lively_scene_disconnect(
 		return;
 	}
 
-	lively_node_plug_t *next = (*plug)->next;
-	free (*plug);
-	*plug = next;
+	scene_plug_destroy (scene, plug);
 
-	target->inputs_total--;
+	scene_commit (scene);
+	pthread_mutex_unlock (&scene->lock);
 }
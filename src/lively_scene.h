@@ -1,19 +1,129 @@
 #ifndef LIVELY_SCENE_H
 #define LIVELY_SCENE_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 
+#include <pthread.h>
+
 struct lively_app;
 
+#include "lively_event.h"
+#include "lively_hash.h"
 #include "lively_node.h"
 
+#ifndef LIVELY_QUANTUM
+/**
+ * The number of frames a scene processes at a time.
+ *
+ * This is fixed at compile time (see `configure --with-quantum`) and does
+ * not depend on the period size of the audio device.
+ */
+#define LIVELY_QUANTUM 64
+#endif
+
+/**
+ * The ring of a compensation delay, with its position, so that a plug
+ * which persists across plans keeps the audio it holds.
+ */
+typedef struct lively_scene_delay {
+	struct lively_scene_plan *owner; /**< The plan which frees it; never read by the audio thread */
+	unsigned int mask;
+	unsigned int position;
+	float samples[];
+} lively_scene_delay_t;
+
+/**
+ * A plug as seen by the audio thread.
+ *
+ * The first plug to write a given target buffer in a plan copies into it,
+ * every later one accumulates, so buffers never need to be cleared.
+ *
+ * A plug on a path with less latency than others arriving at the same
+ * target is delayed to match, through a ring buffer preallocated when the
+ * plan is compiled, or taken over from the previous plan if the plug had
+ * one of the same size there. The ring is the only part of a plan the
+ * audio thread writes.
+ */
+typedef struct lively_scene_plug {
+	struct lively_node *target;
+	enum lively_node_channel source_ch;
+	enum lively_node_channel target_ch;
+	bool accumulate;
+
+	unsigned int delay;
+	struct lively_scene_delay *delay_ring;
+} lively_scene_plug_t;
+
+/**
+ * A node to process, followed by the plugs leaving it.
+ *
+ * A step may instead run a fused chain of kernel nodes, from the node that
+ * receives the input to the node whose plugs follow, which is then the
+ * step's node.
+ */
+typedef struct lively_scene_step {
+	struct lively_node *node;
+	unsigned int plugs_start;
+	unsigned int plugs_count;
+	unsigned int chain_start;
+	unsigned int chain_count; /**< Zero unless the step is a fused chain */
+} lively_scene_step_t;
+
+/**
+ * An immutable, topologically sorted snapshot of a Lively Scene.
+ *
+ * Plans are compiled by whichever thread edits the scene and published
+ * atomically; the audio thread only ever reads the current plan.
+ */
+typedef struct lively_scene_plan {
+	unsigned int steps_count;
+	struct lively_scene_step *steps;
+
+	unsigned int plugs_count;
+	struct lively_scene_plug *plugs;
+
+	unsigned int chain_count;
+	struct lively_node **chain;
+
+	unsigned int inputs_count;
+	struct lively_node_io **inputs;
+
+	/** Output nodes which have at least one plug into them */
+	unsigned int outputs_count;
+	struct lively_node_io **outputs;
+
+	/** Latency from the input nodes to the output nodes, in frames */
+	unsigned int latency;
+} lively_scene_plan_t;
+
 typedef struct lively_scene {
 	struct lively_app *app;
 	struct lively_node *head;
 
+	/** Indices over the nodes and plugs, kept under the scene lock */
+	unsigned int next_id;
+	lively_hash_t nodes_by_id;
+	lively_hash_t nodes_by_name;
+	lively_hash_t plugs;
+
+	/** Nesting of #lively_scene_begin_edit, and whether a commit is owed */
+	unsigned int edit_depth;
+	bool edit_dirty;
+
 	unsigned int buffer_length;
+	atomic_uint sample_rate;
 
 	const char *name;
+
+	pthread_mutex_t lock;
+	_Atomic(struct lively_scene_plan *) plan;
+	atomic_uint process_sequence;
+	atomic_uint latency;
+
+	lively_event_queue_t events;
+	atomic_ullong frame;
+	atomic_bool rolling;
 } lively_scene_t;
 
 void lively_scene_init(struct lively_scene *scene, struct lively_app *app);
@@ -25,14 +135,36 @@ void lively_scene_nodes_foreach(
 	void *data);
 
 unsigned int lively_scene_get_buffer_length (lively_scene_t *scene);
+unsigned int lively_scene_get_latency (lively_scene_t *scene);
+unsigned int lively_scene_get_sample_rate (lively_scene_t *scene);
+bool lively_scene_set_sample_rate (lively_scene_t *scene, unsigned int rate);
+void lively_scene_update_latency (lively_scene_t *scene);
 bool lively_scene_set_buffer_length (lively_scene_t *scene, unsigned int length);
 
+void lively_scene_begin_edit (struct lively_scene *scene);
+void lively_scene_end_edit (struct lively_scene *scene);
+
 bool lively_scene_add_node(struct lively_scene *scene, struct lively_node *node);
+struct lively_node *lively_scene_find_node (struct lively_scene *scene, const char *name);
+struct lively_node *lively_scene_find_node_by_id (struct lively_scene *scene, unsigned int id);
 void lively_scene_remove_node(struct lively_scene *scene, struct lively_node *node);
 void lively_scene_disconnect_node (struct lively_scene *scene, struct lively_node *node);
 
 void lively_scene_process (struct lively_scene *scene, unsigned int count);
 
+lively_scene_plan_t *lively_scene_plan_acquire (struct lively_scene *scene);
+void lively_scene_plan_release (struct lively_scene *scene);
+void lively_scene_synchronize (struct lively_scene *scene);
+void lively_scene_plan_process (lively_scene_plan_t *plan, unsigned int length);
+unsigned int lively_scene_plan_begin_block (
+	struct lively_scene *scene,
+	lively_scene_plan_t *plan,
+	unsigned int length);
+
+unsigned long long lively_scene_get_frame (struct lively_scene *scene);
+bool lively_scene_is_rolling (struct lively_scene *scene);
+bool lively_scene_post_event (struct lively_scene *scene, const lively_event_t *event);
+
 bool lively_scene_is_connected (
 	struct lively_scene *scene,
 	struct lively_node *source,
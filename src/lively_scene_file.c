@@ -0,0 +1,370 @@
+/**
+ * @file lively_scene_file.c
+ * Lively Scene File: A relocatable binary form of a Lively Scene
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node.h"
+#include "lively_scene_file.h"
+
+#include "platform.h"
+
+/**
+* Returns true if a table of count records of the given size lies within
+* the file and is aligned.
+*/
+static bool
+file_table_valid (
+	const lively_scene_file_t *file,
+	uint32_t offset,
+	uint32_t count,
+	size_t record_size) {
+
+	if (offset % 4 != 0 || offset > file->size) {
+		return false;
+	}
+	return count <= (file->size - offset) / record_size;
+}
+
+static bool
+file_string_valid (const lively_scene_file_t *file, uint32_t offset) {
+	return offset < file->header->strings_size;
+}
+
+static bool
+file_validate (lively_scene_file_t *file) {
+	const lively_scene_file_header_t *header = file->data;
+
+	if (file->size < sizeof *header
+		|| memcmp (header->magic, LIVELY_SCENE_FILE_MAGIC, sizeof header->magic) != 0) {
+		file->error = "not a binary scene file";
+		return false;
+	}
+	if (header->byte_order != LIVELY_SCENE_FILE_BYTE_ORDER) {
+		file->error = "written on a machine with a different byte order";
+		return false;
+	}
+	if (header->version != LIVELY_SCENE_FILE_VERSION) {
+		file->error = "unsupported version";
+		return false;
+	}
+	if (header->size != file->size) {
+		file->error = "truncated";
+		return false;
+	}
+
+	file->header = header;
+	if (header->strings_offset > file->size
+		|| header->strings_size > file->size - header->strings_offset
+		|| header->strings_size == 0) {
+		file->error = "string table out of bounds";
+		return false;
+	}
+	file->strings = (const char *) file->data + header->strings_offset;
+	if (file->strings[header->strings_size - 1] != '\0') {
+		file->error = "string table is not terminated";
+		return false;
+	}
+
+	if (!file_table_valid (file, header->nodes_offset, header->nodes_count,
+			sizeof *file->nodes)
+		|| !file_table_valid (file, header->params_offset, header->params_count,
+			sizeof *file->params)
+		|| !file_table_valid (file, header->plugs_offset, header->plugs_count,
+			sizeof *file->plugs)) {
+		file->error = "table out of bounds";
+		return false;
+	}
+	file->nodes = (const void *) ((const char *) file->data + header->nodes_offset);
+	file->params = (const void *) ((const char *) file->data + header->params_offset);
+	file->plugs = (const void *) ((const char *) file->data + header->plugs_offset);
+
+	if (!file_string_valid (file, header->name)) {
+		file->error = "bad scene name";
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header->nodes_count; i++) {
+		const lively_scene_file_node_t *node = &file->nodes[i];
+		bool type_valid = node->type == LIVELY_NODE_PROCESS
+			|| node->type == LIVELY_NODE_INPUT
+			|| node->type == LIVELY_NODE_OUTPUT;
+
+		if (!file_string_valid (file, node->class_name)
+			|| !file_string_valid (file, node->name)
+			|| !file_string_valid (file, node->inner)
+			|| !type_valid
+			|| node->channels > LIVELY_CHANNELS_MAX
+			|| node->outputs > LIVELY_CHANNELS_MAX
+			|| node->params_start > header->params_count
+			|| node->params_count > header->params_count - node->params_start) {
+			file->error = "bad node record";
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < header->plugs_count; i++) {
+		const lively_scene_file_plug_t *plug = &file->plugs[i];
+		if (plug->source >= header->nodes_count
+			|| plug->target >= header->nodes_count
+			|| !LIVELY_CHANNEL_VALID (plug->source_ch)
+			|| !LIVELY_CHANNEL_VALID (plug->target_ch)) {
+			file->error = "bad plug record";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+* Maps and validates a binary scene file.
+*
+* Validation checks every offset and index once, so that the tables may be
+* used directly afterwards. On failure, the reason is left in error.
+*
+* @param file The scene file
+* @param path The path of the file
+*
+* @return A success value
+*/
+bool
+lively_scene_file_open (lively_scene_file_t *file, const char *path) {
+	memset (file, 0, sizeof *file);
+
+	file->data = platform_map_file (path, &file->size);
+	if (!file->data) {
+		file->error = "could not be mapped";
+		return false;
+	}
+
+	if (!file_validate (file)) {
+		const char *error = file->error;
+		lively_scene_file_close (file);
+		file->error = error;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+* Unmaps a scene file. Strings returned from it are no longer valid.
+*
+* @param file The scene file
+*/
+void
+lively_scene_file_close (lively_scene_file_t *file) {
+	if (file->data) {
+		platform_unmap_file (file->data, file->size);
+	}
+	memset (file, 0, sizeof *file);
+}
+
+/**
+* Returns a string of the string table.
+*
+* @param file The scene file
+* @param offset The offset of the string, as found in a record
+*/
+const char *
+lively_scene_file_string (const lively_scene_file_t *file, uint32_t offset) {
+	return file->strings + offset;
+}
+
+static bool
+writer_reserve (void **array, size_t *capacity, size_t count, size_t size) {
+	if (count <= *capacity) {
+		return true;
+	}
+
+	size_t grown = *capacity ? *capacity * 2 : 64;
+	while (grown < count) {
+		grown *= 2;
+	}
+
+	void *resized = realloc (*array, grown * size);
+	if (!resized) {
+		return false;
+	}
+	*array = resized;
+	*capacity = grown;
+	return true;
+}
+
+static bool
+writer_add_string (lively_scene_file_writer_t *writer, const char *string, uint32_t *offset) {
+	size_t length = strlen (string) + 1;
+	if (!writer_reserve ((void **) &writer->strings, &writer->strings_capacity,
+			writer->strings_size + length, 1)) {
+		return false;
+	}
+
+	*offset = (uint32_t) writer->strings_size;
+	memcpy (writer->strings + writer->strings_size, string, length);
+	writer->strings_size += length;
+	return true;
+}
+
+/**
+* Initializes an empty scene file writer.
+*
+* @param writer The writer
+*
+* @return A success value
+*/
+bool
+lively_scene_file_writer_init (lively_scene_file_writer_t *writer) {
+	memset (writer, 0, sizeof *writer);
+	return writer_add_string (writer, "", &writer->name);
+}
+
+void
+lively_scene_file_writer_destroy (lively_scene_file_writer_t *writer) {
+	free (writer->strings);
+	free (writer->nodes);
+	free (writer->params);
+	free (writer->plugs);
+	memset (writer, 0, sizeof *writer);
+}
+
+bool
+lively_scene_file_writer_set_name (lively_scene_file_writer_t *writer, const char *name) {
+	return writer_add_string (writer, name, &writer->name);
+}
+
+/**
+* Appends a node. Nodes are numbered in the order they are added.
+*/
+bool
+lively_scene_file_writer_add_node (
+	lively_scene_file_writer_t *writer,
+	const char *class_name,
+	const char *name,
+	uint32_t type,
+	uint32_t port,
+	uint32_t channels,
+	uint32_t outputs,
+	const char *inner,
+	uint32_t latency) {
+
+	if (!writer_reserve ((void **) &writer->nodes, &writer->nodes_capacity,
+			writer->nodes_count + 1, sizeof *writer->nodes)) {
+		return false;
+	}
+
+	lively_scene_file_node_t *node = &writer->nodes[writer->nodes_count];
+	if (!writer_add_string (writer, class_name, &node->class_name)
+		|| !writer_add_string (writer, name, &node->name)
+		|| !writer_add_string (writer, inner ? inner : "", &node->inner)) {
+		return false;
+	}
+	node->type = type;
+	node->port = port;
+	node->channels = channels;
+	node->outputs = outputs;
+	node->latency = latency;
+	node->params_start = (uint32_t) writer->params_count;
+	node->params_count = 0;
+
+	writer->nodes_count++;
+	return true;
+}
+
+/**
+* Appends a parameter to the node added last.
+*/
+bool
+lively_scene_file_writer_add_param (
+	lively_scene_file_writer_t *writer,
+	uint32_t index,
+	float value) {
+
+	if (writer->nodes_count == 0
+		|| !writer_reserve ((void **) &writer->params, &writer->params_capacity,
+			writer->params_count + 1, sizeof *writer->params)) {
+		return false;
+	}
+
+	lively_scene_file_param_t *param = &writer->params[writer->params_count++];
+	param->index = index;
+	param->value = value;
+	writer->nodes[writer->nodes_count - 1].params_count++;
+	return true;
+}
+
+bool
+lively_scene_file_writer_add_plug (
+	lively_scene_file_writer_t *writer,
+	uint32_t source,
+	uint32_t source_ch,
+	uint32_t target,
+	uint32_t target_ch) {
+
+	if (!writer_reserve ((void **) &writer->plugs, &writer->plugs_capacity,
+			writer->plugs_count + 1, sizeof *writer->plugs)) {
+		return false;
+	}
+
+	lively_scene_file_plug_t *plug = &writer->plugs[writer->plugs_count++];
+	plug->source = source;
+	plug->target = target;
+	plug->source_ch = source_ch;
+	plug->target_ch = target_ch;
+	return true;
+}
+
+/**
+* Writes the scene file: the header, then the node, parameter and plug
+* tables, then the string table.
+*
+* @param writer The writer
+* @param path The path of the file to create or replace
+*
+* @return A success value
+*/
+bool
+lively_scene_file_writer_save (lively_scene_file_writer_t *writer, const char *path) {
+	lively_scene_file_header_t header;
+	memset (&header, 0, sizeof header);
+
+	memcpy (header.magic, LIVELY_SCENE_FILE_MAGIC, sizeof header.magic);
+	header.version = LIVELY_SCENE_FILE_VERSION;
+	header.byte_order = LIVELY_SCENE_FILE_BYTE_ORDER;
+	header.name = writer->name;
+
+	size_t nodes_size = writer->nodes_count * sizeof *writer->nodes;
+	size_t params_size = writer->params_count * sizeof *writer->params;
+	size_t plugs_size = writer->plugs_count * sizeof *writer->plugs;
+	size_t size = sizeof header + nodes_size + params_size + plugs_size
+		+ writer->strings_size;
+	if (size > UINT32_MAX) {
+		return false;
+	}
+
+	header.nodes_offset = sizeof header;
+	header.nodes_count = (uint32_t) writer->nodes_count;
+	header.params_offset = (uint32_t) (header.nodes_offset + nodes_size);
+	header.params_count = (uint32_t) writer->params_count;
+	header.plugs_offset = (uint32_t) (header.params_offset + params_size);
+	header.plugs_count = (uint32_t) writer->plugs_count;
+	header.strings_offset = (uint32_t) (header.plugs_offset + plugs_size);
+	header.strings_size = (uint32_t) writer->strings_size;
+	header.size = (uint32_t) size;
+
+	FILE *stream = fopen (path, "wb");
+	if (!stream) {
+		return false;
+	}
+
+	bool success = fwrite (&header, sizeof header, 1, stream) == 1
+		&& fwrite (writer->nodes, 1, nodes_size, stream) == nodes_size
+		&& fwrite (writer->params, 1, params_size, stream) == params_size
+		&& fwrite (writer->plugs, 1, plugs_size, stream) == plugs_size
+		&& fwrite (writer->strings, 1, writer->strings_size, stream) == writer->strings_size;
+
+	return fclose (stream) == 0 && success;
+}
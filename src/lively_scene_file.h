@@ -0,0 +1,129 @@
+#ifndef LIVELY_SCENE_FILE_H
+#define LIVELY_SCENE_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIVELY_SCENE_FILE_MAGIC "LIVELYSC"
+#define LIVELY_SCENE_FILE_VERSION 1
+/** Written in native byte order; a mismatch means the file is foreign */
+#define LIVELY_SCENE_FILE_BYTE_ORDER 0x01020304u
+
+/**
+ * The header at the start of a binary scene file.
+ *
+ * Everything after the header is addressed by byte offsets from the start
+ * of the file, so the file is used in place once it has been mapped and
+ * validated. Tables are 4-byte aligned and strings are null-terminated in a
+ * single string table; a string is referenced by its offset in that table.
+ */
+typedef struct lively_scene_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t size; /**< Size of the whole file, in bytes */
+	uint32_t name; /**< Name of the scene */
+
+	uint32_t strings_offset;
+	uint32_t strings_size;
+	uint32_t nodes_offset;
+	uint32_t nodes_count;
+	uint32_t params_offset;
+	uint32_t params_count;
+	uint32_t plugs_offset;
+	uint32_t plugs_count;
+} lively_scene_file_header_t;
+
+/**
+ * A node record. The parameters of a node are a contiguous range of the
+ * parameter table.
+ */
+typedef struct lively_scene_file_node {
+	uint32_t class_name; /**< Registered node class, see #lively_node_class */
+	uint32_t name;
+	uint32_t type; /**< A #lively_node_type */
+	uint32_t port;
+	uint32_t channels; /**< For multichannel nodes, or 0 for the default */
+	uint32_t outputs; /**< For nodes with separate output channels, or 0 */
+	uint32_t inner; /**< Class wrapped by a container node, or an empty string */
+	uint32_t latency; /**< Latency of the node, or 0 to keep its own */
+	uint32_t params_start;
+	uint32_t params_count;
+} lively_scene_file_node_t;
+
+typedef struct lively_scene_file_param {
+	uint32_t index;
+	float value;
+} lively_scene_file_param_t;
+
+/**
+ * A plug record, referencing nodes by their index in the node table.
+ */
+typedef struct lively_scene_file_plug {
+	uint32_t source;
+	uint32_t target;
+	uint32_t source_ch; /**< A #lively_node_channel */
+	uint32_t target_ch;
+} lively_scene_file_plug_t;
+
+/**
+ * A mapped and validated binary scene file.
+ */
+typedef struct lively_scene_file {
+	void *data;
+	size_t size;
+	const char *error; /**< Why the last open failed */
+
+	const lively_scene_file_header_t *header;
+	const char *strings;
+	const lively_scene_file_node_t *nodes;
+	const lively_scene_file_param_t *params;
+	const lively_scene_file_plug_t *plugs;
+} lively_scene_file_t;
+
+bool lively_scene_file_open (lively_scene_file_t *, const char *path);
+void lively_scene_file_close (lively_scene_file_t *);
+const char *lively_scene_file_string (const lively_scene_file_t *, uint32_t offset);
+
+/**
+ * Builds a binary scene file in memory, in the order it will be loaded.
+ */
+typedef struct lively_scene_file_writer {
+	char *strings;
+	size_t strings_size, strings_capacity;
+	lively_scene_file_node_t *nodes;
+	size_t nodes_count, nodes_capacity;
+	lively_scene_file_param_t *params;
+	size_t params_count, params_capacity;
+	lively_scene_file_plug_t *plugs;
+	size_t plugs_count, plugs_capacity;
+	uint32_t name;
+} lively_scene_file_writer_t;
+
+bool lively_scene_file_writer_init (lively_scene_file_writer_t *);
+void lively_scene_file_writer_destroy (lively_scene_file_writer_t *);
+bool lively_scene_file_writer_set_name (lively_scene_file_writer_t *, const char *name);
+bool lively_scene_file_writer_add_node (
+	lively_scene_file_writer_t *,
+	const char *class_name,
+	const char *name,
+	uint32_t type,
+	uint32_t port,
+	uint32_t channels,
+	uint32_t outputs,
+	const char *inner,
+	uint32_t latency);
+bool lively_scene_file_writer_add_param (
+	lively_scene_file_writer_t *,
+	uint32_t index,
+	float value);
+bool lively_scene_file_writer_add_plug (
+	lively_scene_file_writer_t *,
+	uint32_t source,
+	uint32_t source_ch,
+	uint32_t target,
+	uint32_t target_ch);
+bool lively_scene_file_writer_save (lively_scene_file_writer_t *, const char *path);
+
+#endif
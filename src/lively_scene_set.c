@@ -0,0 +1,290 @@
+/**
+ * @file lively_scene_set.c
+ * Lively Scene Set: Preloaded scenes with switching at period boundaries
+ */
+
+#include <math.h>
+
+#include "lively_scene_set.h"
+
+#define SET_REQUEST_PENDING (1u << 31)
+#define SET_REQUEST_INDEX_SHIFT 24
+#define SET_REQUEST_FADE_MASK ((1u << SET_REQUEST_INDEX_SHIFT) - 1)
+#define SET_HALF_PI 1.57079632679489661923f
+
+_Static_assert (LIVELY_SCENE_SET_SIZE < (1 << 7),
+	"Scene indices must fit in a switch request");
+
+/**
+* Initializes an empty scene set.
+*
+* @param set The scene set
+*/
+void
+lively_scene_set_init (lively_scene_set_t *set) {
+	pthread_mutex_init (&set->lock, NULL);
+	for (unsigned int i = 0; i < LIVELY_SCENE_SET_SIZE; i++) {
+		atomic_init (&set->scenes[i], NULL);
+	}
+
+	atomic_init (&set->request, 0);
+	atomic_init (&set->active, 0);
+	atomic_init (&set->fading, LIVELY_SCENE_NONE);
+	set->fade_position = 0;
+	set->fade_length = 0;
+	set->sample_rate = 0;
+}
+
+/**
+* Destroys a scene set. The scenes belong to the caller.
+*
+* @param set The scene set
+*/
+void
+lively_scene_set_destroy (lively_scene_set_t *set) {
+	pthread_mutex_destroy (&set->lock);
+}
+
+/**
+* Adds a scene to the first free slot of the set.
+*
+* The scene should be fully built before it is switched to. Its buffers are
+* sized for #LIVELY_QUANTUM here, so that the switch costs nothing.
+*
+* @param set The scene set
+* @param scene The Lively Scene
+* @param index Receives the index of the slot, if not NULL
+*
+* @return A success value; false if the set is full, or buffers could not be
+* allocated for its size or for the sample rate of the set
+*/
+bool
+lively_scene_set_add (lively_scene_set_t *set, lively_scene_t *scene, unsigned int *index) {
+	if (lively_scene_get_buffer_length (scene) < LIVELY_QUANTUM
+		&& !lively_scene_set_buffer_length (scene, LIVELY_QUANTUM)) {
+		return false;
+	}
+
+	pthread_mutex_lock (&set->lock);
+	for (unsigned int i = 0; i < LIVELY_SCENE_SET_SIZE; i++) {
+		if (!atomic_load (&set->scenes[i])) {
+			if (set->sample_rate && !lively_scene_set_sample_rate (scene, set->sample_rate)) {
+				break;
+			}
+			atomic_store (&set->scenes[i], scene);
+			pthread_mutex_unlock (&set->lock);
+			if (index) {
+				*index = i;
+			}
+			return true;
+		}
+	}
+	pthread_mutex_unlock (&set->lock);
+
+	return false;
+}
+
+/**
+* Removes a scene from the set.
+*
+* A scene which is heard, fading out or about to be switched to cannot be
+* removed. Once this returns true, the audio thread no longer references
+* the scene and it may be destroyed.
+*
+* @param set The scene set
+* @param index The index of the slot
+*
+* @return A success value
+*/
+bool
+lively_scene_set_remove (lively_scene_set_t *set, unsigned int index) {
+	bool success = false;
+
+	if (index >= LIVELY_SCENE_SET_SIZE) {
+		return false;
+	}
+
+	pthread_mutex_lock (&set->lock);
+
+	unsigned int request = atomic_load (&set->request);
+	bool requested = (request & SET_REQUEST_PENDING)
+		&& (request & ~SET_REQUEST_PENDING) >> SET_REQUEST_INDEX_SHIFT == index;
+
+	// The audio thread marks a scene as fading before it stops being active.
+	if (!requested
+		&& atomic_load (&set->active) != index
+		&& atomic_load (&set->fading) != index) {
+		atomic_store (&set->scenes[index], NULL);
+		success = true;
+	}
+
+	pthread_mutex_unlock (&set->lock);
+	return success;
+}
+
+/**
+* Requests a switch to another scene of the set, which takes effect at the
+* start of the next device period.
+*
+* A later request replaces one which has not taken effect yet. Switching
+* while a crossfade is in progress cuts the scene that was fading out.
+*
+* @param set The scene set
+* @param index The index of the slot to switch to
+* @param fade The length of the equal-power crossfade, in frames, or 0 to
+* cut over
+*
+* @return A success value; false if the slot is empty
+*/
+bool
+lively_scene_set_switch (lively_scene_set_t *set, unsigned int index, unsigned int fade) {
+	if (index >= LIVELY_SCENE_SET_SIZE) {
+		return false;
+	}
+	if (fade > SET_REQUEST_FADE_MASK) {
+		fade = SET_REQUEST_FADE_MASK;
+	}
+
+	pthread_mutex_lock (&set->lock);
+
+	bool success = atomic_load (&set->scenes[index]) != NULL;
+	if (success) {
+		atomic_store (&set->request,
+			SET_REQUEST_PENDING | index << SET_REQUEST_INDEX_SHIFT | fade);
+	}
+
+	pthread_mutex_unlock (&set->lock);
+	return success;
+}
+
+/**
+* Returns the scene which is heard, or faded in, or NULL if the set is
+* empty.
+*
+* @param set The scene set
+*/
+lively_scene_t *
+lively_scene_set_get_active (lively_scene_set_t *set) {
+	return atomic_load (&set->scenes[atomic_load (&set->active)]);
+}
+
+/**
+* Sets the sample rate of every scene in the set, and of every scene added
+* later.
+*
+* @param set The scene set
+* @param rate The sample rate, in frames per second
+*
+* @return A success value; false if a scene could not change its rate, in
+* which case it keeps the previous one
+*/
+bool
+lively_scene_set_use_sample_rate (lively_scene_set_t *set, unsigned int rate) {
+	bool success = true;
+
+	pthread_mutex_lock (&set->lock);
+	set->sample_rate = rate;
+	for (unsigned int i = 0; i < LIVELY_SCENE_SET_SIZE; i++) {
+		lively_scene_t *scene = atomic_load (&set->scenes[i]);
+		if (scene && !lively_scene_set_sample_rate (scene, rate)) {
+			success = false;
+		}
+	}
+	pthread_mutex_unlock (&set->lock);
+
+	return success;
+}
+
+/**
+* Picks up a pending switch. Called by the audio thread at the start of
+* every device period.
+*
+* @param set The scene set
+*/
+void
+lively_scene_set_begin_period (lively_scene_set_t *set) {
+	unsigned int request = atomic_load (&set->request);
+	if (!(request & SET_REQUEST_PENDING)) {
+		return;
+	}
+
+	unsigned int index = (request & ~SET_REQUEST_PENDING) >> SET_REQUEST_INDEX_SHIFT;
+	unsigned int fade = request & SET_REQUEST_FADE_MASK;
+	unsigned int active = atomic_load (&set->active);
+
+	if (index != active) {
+		if (fade && atomic_load (&set->scenes[active])) {
+			atomic_store (&set->fading, active);
+		} else {
+			atomic_store (&set->fading, LIVELY_SCENE_NONE);
+		}
+		atomic_store (&set->active, index);
+
+		set->fade_position = 0;
+		set->fade_length = fade;
+	}
+
+	// Only retire the request now that the switch is visible, so that
+	// #lively_scene_set_remove always sees one or the other. A newer request
+	// is left for the next period.
+	atomic_compare_exchange_strong (&set->request, &request, 0);
+}
+
+/**
+* Returns the scene which is fading out, or NULL. Audio thread only.
+*
+* @param set The scene set
+*/
+lively_scene_t *
+lively_scene_set_get_fading (lively_scene_set_t *set) {
+	unsigned int fading = atomic_load_explicit (&set->fading, memory_order_relaxed);
+	if (fading == LIVELY_SCENE_NONE) {
+		return NULL;
+	}
+	return atomic_load (&set->scenes[fading]);
+}
+
+/**
+* Computes the gains of the next frames of a crossfade. Audio thread only.
+*
+* @param set The scene set
+* @param gain_in Receives the gains of the active scene
+* @param gain_out Receives the gains of the scene fading out
+* @param length The number of frames
+*/
+void
+lively_scene_set_fade_gains (
+	lively_scene_set_t *set,
+	float *gain_in,
+	float *gain_out,
+	unsigned int length) {
+
+	float step = 1.0f / set->fade_length;
+
+	for (unsigned int i = 0; i < length; i++) {
+		unsigned int position = set->fade_position + i;
+		float x = position < set->fade_length ? position * step : 1.0f;
+
+		gain_in[i] = sinf (x * SET_HALF_PI);
+		gain_out[i] = cosf (x * SET_HALF_PI);
+	}
+}
+
+/**
+* Advances a crossfade, ending it once the scene fading out is silent.
+* Audio thread only.
+*
+* @param set The scene set
+* @param length The number of frames processed
+*/
+void
+lively_scene_set_advance (lively_scene_set_t *set, unsigned int length) {
+	if (atomic_load_explicit (&set->fading, memory_order_relaxed) == LIVELY_SCENE_NONE) {
+		return;
+	}
+
+	set->fade_position += length;
+	if (set->fade_position >= set->fade_length) {
+		atomic_store (&set->fading, LIVELY_SCENE_NONE);
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef LIVELY_SCENE_SET_H
+#define LIVELY_SCENE_SET_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "lively_scene.h"
+
+/** Maximum number of scenes held ready in a scene set */
+#define LIVELY_SCENE_SET_SIZE 16
+
+/** Marks the absence of a scene index */
+#define LIVELY_SCENE_NONE LIVELY_SCENE_SET_SIZE
+
+/**
+ * A set of fully prepared Lively Scenes, one of which is heard at a time.
+ *
+ * Scenes are built, loaded and allocated ahead of time by any thread. The
+ * audio thread only picks up a switch at the start of a device period and
+ * then either cuts over or crossfades from the previous scene, without
+ * allocating or preparing anything. While a scene is not heard, its clock
+ * stands still and its events wait.
+ *
+ * Slots, and requests to switch, are changed under the set lock. The audio
+ * thread reads them through atomics only.
+ */
+typedef struct lively_scene_set {
+	pthread_mutex_t lock;
+	_Atomic(lively_scene_t *) scenes[LIVELY_SCENE_SET_SIZE];
+
+	/** Pending switch, packing the scene index and the fade length */
+	atomic_uint request;
+
+	atomic_uint active;
+	atomic_uint fading; /**< Scene fading out, or #LIVELY_SCENE_NONE */
+
+	/** Sample rate of the device, given to every scene added, or 0 */
+	unsigned int sample_rate;
+
+	/** Owned by the audio thread */
+	unsigned int fade_position;
+	unsigned int fade_length;
+} lively_scene_set_t;
+
+void lively_scene_set_init (lively_scene_set_t *);
+void lively_scene_set_destroy (lively_scene_set_t *);
+
+bool lively_scene_set_add (lively_scene_set_t *, lively_scene_t *, unsigned int *index);
+bool lively_scene_set_remove (lively_scene_set_t *, unsigned int index);
+bool lively_scene_set_switch (lively_scene_set_t *, unsigned int index, unsigned int fade);
+lively_scene_t *lively_scene_set_get_active (lively_scene_set_t *);
+bool lively_scene_set_use_sample_rate (lively_scene_set_t *, unsigned int rate);
+
+void lively_scene_set_begin_period (lively_scene_set_t *);
+lively_scene_t *lively_scene_set_get_fading (lively_scene_set_t *);
+void lively_scene_set_fade_gains (
+	lively_scene_set_t *,
+	float *gain_in,
+	float *gain_out,
+	unsigned int length);
+void lively_scene_set_advance (lively_scene_set_t *, unsigned int length);
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * @file lively_session.c
+ * Lively Session: Loads binary scene files into a Lively Scene
+ */
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_app.h"
+#include "lively_event.h"
+#include "lively_node_class.h"
+#include "lively_param.h"
+#include "lively_session.h"
+
+static size_t
+session_align (size_t size) {
+	size_t alignment = alignof (max_align_t);
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+* Creates every node of the file in a single allocation and applies its
+* parameters. Nothing is added to the scene yet.
+*/
+static bool
+session_instantiate (lively_session_t *session) {
+	lively_scene_t *scene = session->scene;
+	lively_scene_file_t *file = &session->file;
+	unsigned int count = file->header->nodes_count;
+
+	size_t tables_size = session_align (count * (sizeof *session->nodes
+		+ sizeof *session->classes));
+	size_t size = tables_size;
+
+	const lively_node_class_t **classes = malloc ((count + 1) * sizeof *classes);
+	if (!classes) {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		const char *class_name = lively_scene_file_string (file, file->nodes[i].class_name);
+		classes[i] = lively_node_class_find (class_name);
+		if (!classes[i]) {
+			lively_app_log (scene->app, LIVELY_ERROR, "session",
+				"Unknown node class '%s'", class_name);
+			free (classes);
+			return false;
+		}
+		size += session_align (classes[i]->size);
+	}
+
+	session->arena = calloc (1, size);
+	if (!session->arena) {
+		free (classes);
+		return false;
+	}
+	session->nodes = (lively_node_t **) session->arena;
+	session->classes = (const lively_node_class_t **) (session->nodes + count);
+	memcpy (session->classes, classes, count * sizeof *classes);
+	free (classes);
+
+	char *next = session->arena + tables_size;
+	for (unsigned int i = 0; i < count; i++) {
+		const lively_scene_file_node_t *record = &file->nodes[i];
+		const lively_node_class_t *class = session->classes[i];
+		lively_node_t *node = (lively_node_t *) next;
+		next += session_align (class->size);
+
+		lively_node_options_t options = {
+			.type = record->type,
+			.port = record->port,
+			.channels = record->channels,
+			.outputs = record->outputs,
+			.inner = *lively_scene_file_string (file, record->inner)
+				? lively_scene_file_string (file, record->inner) : NULL
+		};
+		if (!class->init (node, &options)) {
+			lively_app_log (scene->app, LIVELY_ERROR, "session",
+				"Could not create node '%s'",
+				lively_scene_file_string (file, record->name));
+			return false;
+		}
+		session->nodes_count++;
+
+		node->name = (char *) lively_scene_file_string (file, record->name);
+		if (record->latency) {
+			node->latency = record->latency;
+		}
+		session->nodes[i] = node;
+
+		lively_event_t event;
+		memset (&event, 0, sizeof event);
+		event.type = LIVELY_EVENT_PARAM;
+		event.node = node;
+
+		for (uint32_t p = 0; p < record->params_count; p++) {
+			const lively_scene_file_param_t *param = &file->params[record->params_start + p];
+			lively_node_set_param (node, param->index, param->value);
+			if (node->handle_event) {
+				event.param.index = param->index;
+				event.param.value = param->value;
+				node->handle_event (node, &event);
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+* Checks that every plug of the file joins channels its nodes have. The
+* file alone cannot tell, since the channels of a node depend on its class.
+*/
+static bool
+session_check_plugs (lively_session_t *session) {
+	lively_scene_file_t *file = &session->file;
+
+	for (uint32_t i = 0; i < file->header->plugs_count; i++) {
+		const lively_scene_file_plug_t *plug = &file->plugs[i];
+		lively_node_t *source = session->nodes[plug->source];
+		lively_node_t *target = session->nodes[plug->target];
+		lively_node_t *missing = !lively_node_can_read (source, plug->source_ch) ? source
+			: !lively_node_can_write (target, plug->target_ch) ? target : NULL;
+
+		if (missing) {
+			lively_app_log (session->scene->app, LIVELY_ERROR, "session",
+				"Plug %u uses a channel that node '%s' does not have",
+				i, missing->name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+session_destroy_nodes (lively_session_t *session) {
+	for (unsigned int i = 0; i < session->nodes_count; i++) {
+		if (session->classes[i]->destroy) {
+			session->classes[i]->destroy (session->nodes[i]);
+		}
+	}
+	free (session->arena);
+	session->arena = NULL;
+	session->nodes = NULL;
+	session->classes = NULL;
+	session->nodes_count = 0;
+}
+
+/**
+* Loads a binary scene file into a Lively Scene, alongside any nodes it
+* already has.
+*
+* The file is mapped rather than parsed, the nodes are created in a single
+* allocation and the whole scene is added in one batch of edits, so the
+* plan is compiled once regardless of its size.
+*
+* The plugs are not built from the table in place, though: each one is
+* made by #lively_scene_connect with an allocation of its own, since the
+* scene indexes them and frees them one by one as they are disconnected.
+* Loading therefore costs one allocation per plug, and the plan is
+* compiled from the scene rather than read from the file.
+*
+* This function will produce #LIVELY_ERROR if the file is invalid,
+* references an unknown node class or plugs into a channel a node does not
+* have.
+*
+* @param session The session
+* @param scene The Lively Scene to load into
+* @param path The path of the binary scene file
+*
+* @return A success value
+*/
+bool
+lively_session_load (lively_session_t *session, lively_scene_t *scene, const char *path) {
+	memset (session, 0, sizeof *session);
+	session->scene = scene;
+
+	if (!lively_scene_file_open (&session->file, path)) {
+		lively_app_log (scene->app, LIVELY_ERROR, "session",
+			"Could not load scene '%s': %s", path, session->file.error);
+		return false;
+	}
+
+	if (!session_instantiate (session)) {
+		lively_app_log (scene->app, LIVELY_ERROR, "session",
+			"Could not create the nodes of scene '%s'", path);
+		session_destroy_nodes (session);
+		lively_scene_file_close (&session->file);
+		return false;
+	}
+
+	if (!session_check_plugs (session)) {
+		lively_app_log (scene->app, LIVELY_ERROR, "session",
+			"Could not load scene '%s': bad plug", path);
+		session_destroy_nodes (session);
+		lively_scene_file_close (&session->file);
+		return false;
+	}
+
+	lively_scene_file_t *file = &session->file;
+	bool success = true;
+
+	lively_scene_begin_edit (scene);
+
+	session->scene_name = scene->name;
+	scene->name = lively_scene_file_string (file, file->header->name);
+
+	for (unsigned int i = 0; i < session->nodes_count; i++) {
+		success = lively_scene_add_node (scene, session->nodes[i]) && success;
+	}
+	for (uint32_t i = 0; i < file->header->plugs_count; i++) {
+		const lively_scene_file_plug_t *plug = &file->plugs[i];
+		lively_scene_connect (scene,
+			session->nodes[plug->source], plug->source_ch,
+			session->nodes[plug->target], plug->target_ch);
+	}
+
+	lively_scene_end_edit (scene);
+
+	if (!success) {
+		lively_app_log (scene->app, LIVELY_ERROR, "session",
+			"Could not allocate buffers for scene '%s'", path);
+		lively_session_unload (session);
+		return false;
+	}
+
+	lively_app_log (scene->app, LIVELY_INFO, "session",
+		"Loaded scene '%s' with %u nodes and %u plugs",
+		scene->name, session->nodes_count, file->header->plugs_count);
+	return true;
+}
+
+/**
+* Removes the nodes of a session from its scene, frees them and unmaps the
+* file.
+*
+* @param session The session
+*/
+void
+lively_session_unload (lively_session_t *session) {
+	lively_scene_t *scene = session->scene;
+
+	lively_scene_begin_edit (scene);
+	for (unsigned int i = 0; i < session->nodes_count; i++) {
+		if (session->nodes[i]->scene == scene) {
+			lively_scene_remove_node (scene, session->nodes[i]);
+		}
+	}
+	scene->name = session->scene_name;
+	lively_scene_end_edit (scene);
+
+	session_destroy_nodes (session);
+	lively_scene_file_close (&session->file);
+}
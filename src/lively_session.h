@@ -0,0 +1,30 @@
+#ifndef LIVELY_SESSION_H
+#define LIVELY_SESSION_H
+
+#include <stdbool.h>
+
+#include "lively_node.h"
+#include "lively_scene.h"
+#include "lively_scene_file.h"
+
+/**
+ * The nodes of a binary scene file, instantiated into a Lively Scene.
+ *
+ * All nodes live in one allocation, and their names point into the mapped
+ * file, so the file stays mapped for as long as the session is loaded.
+ */
+typedef struct lively_session {
+	lively_scene_file_t file;
+	lively_scene_t *scene;
+	const char *scene_name; /**< Name of the scene before loading */
+
+	char *arena;
+	lively_node_t **nodes;
+	const struct lively_node_class **classes;
+	unsigned int nodes_count;
+} lively_session_t;
+
+bool lively_session_load (lively_session_t *, lively_scene_t *, const char *path);
+void lively_session_unload (lively_session_t *);
+
+#endif
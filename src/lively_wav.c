@@ -0,0 +1,393 @@
+/**
+ * @file lively_wav.c
+ * Lively WAV: Reads and writes the layout and samples of RIFF WAVE files
+ *
+ * Only the chunks needed to play a file are read: fmt, for the layout, and
+ * data, for the samples, with ds64 for the sizes of RF64 files. Everything
+ * else, such as LIST or JUNK, is skipped. Headers are parsed and built a
+ * byte at a time, so they read the same on any host.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lively_wav.h"
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xfffe
+/** Most chunks skipped before the data chunk, so a corrupt file cannot loop */
+#define WAV_CHUNKS_MAX 64
+/** Where the chunks of a written header start */
+#define WAV_DS64_OFFSET 12
+#define WAV_FORMAT_OFFSET 48
+#define WAV_PAD_OFFSET 72
+#define WAV_DATA_OFFSET (LIVELY_WAV_HEADER_BYTES - 8)
+/** Size of a RIFF or data chunk which is given by the ds64 chunk instead */
+#define WAV_SIZE_RF64 UINT32_MAX
+
+static const unsigned int wav_sample_bytes[] = {
+	[LIVELY_WAV_PCM_16] = 2,
+	[LIVELY_WAV_PCM_24] = 3,
+	[LIVELY_WAV_PCM_32] = 4,
+	[LIVELY_WAV_FLOAT_32] = 4
+};
+
+static uint32_t
+wav_u32 (const unsigned char *bytes) {
+	return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8
+		| (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static uint64_t
+wav_u64 (const unsigned char *bytes) {
+	return (uint64_t) wav_u32 (bytes) | (uint64_t) wav_u32 (bytes + 4) << 32;
+}
+
+static uint16_t
+wav_u16 (const unsigned char *bytes) {
+	return (uint16_t) (bytes[0] | bytes[1] << 8);
+}
+
+static void
+wav_put_u16 (unsigned char *bytes, unsigned int value) {
+	bytes[0] = (unsigned char) value;
+	bytes[1] = (unsigned char) (value >> 8);
+}
+
+static void
+wav_put_u32 (unsigned char *bytes, uint32_t value) {
+	for (unsigned int i = 0; i < 4; i++) {
+		bytes[i] = (unsigned char) (value >> 8 * i);
+	}
+}
+
+static void
+wav_put_u64 (unsigned char *bytes, uint64_t value) {
+	wav_put_u32 (bytes, (uint32_t) value);
+	wav_put_u32 (bytes + 4, (uint32_t) (value >> 32));
+}
+
+static bool
+wav_read (int fd, void *buffer, size_t size, uint64_t offset) {
+	return pread (fd, buffer, size, (off_t) offset) == (ssize_t) size;
+}
+
+/**
+* Sets up the layout of a file to be written, with no frames yet.
+*
+* @param wav The layout
+* @param encoding How the samples are to be stored
+* @param channels The number of channels
+* @param rate The sample rate
+*/
+void
+lively_wav_init (
+	lively_wav_t *wav,
+	lively_wav_encoding_t encoding,
+	unsigned int channels,
+	unsigned int rate) {
+
+	wav->encoding = encoding;
+	wav->channels = channels;
+	wav->rate = rate;
+	wav->frame_bytes = channels * wav_sample_bytes[encoding];
+	wav->data_offset = LIVELY_WAV_HEADER_BYTES;
+	wav->frames = 0;
+	wav->error = NULL;
+}
+
+/**
+* Reads the fmt chunk, whose format tag, channels, rate and bits must
+* describe one of the #lively_wav_encoding.
+*/
+static bool
+wav_read_format (lively_wav_t *wav, const unsigned char *chunk, uint32_t size) {
+	if (size < 16) {
+		wav->error = "format chunk too short";
+		return false;
+	}
+
+	unsigned int format = wav_u16 (chunk);
+	unsigned int bits = wav_u16 (chunk + 14);
+	if (format == WAV_FORMAT_EXTENSIBLE && size >= 26) {
+		// The sub-format GUID starts with the format tag it stands for.
+		format = wav_u16 (chunk + 24);
+	}
+
+	wav->channels = wav_u16 (chunk + 2);
+	wav->rate = wav_u32 (chunk + 4);
+
+	if (format == WAV_FORMAT_PCM && bits == 16) {
+		wav->encoding = LIVELY_WAV_PCM_16;
+	} else if (format == WAV_FORMAT_PCM && bits == 24) {
+		wav->encoding = LIVELY_WAV_PCM_24;
+	} else if (format == WAV_FORMAT_PCM && bits == 32) {
+		wav->encoding = LIVELY_WAV_PCM_32;
+	} else if (format == WAV_FORMAT_FLOAT && bits == 32) {
+		wav->encoding = LIVELY_WAV_FLOAT_32;
+	} else {
+		wav->error = "unsupported sample format";
+		return false;
+	}
+
+	if (wav->channels == 0 || wav->rate == 0) {
+		wav->error = "no channels or no rate";
+		return false;
+	}
+	wav->frame_bytes = wav->channels * (bits / 8);
+	return true;
+}
+
+/**
+* Reads the layout of a WAV file, and finds its samples.
+*
+* A data chunk which claims more bytes than the file holds, as left by a
+* recording which was cut short, is taken to end with the file. RF64 files
+* are read the same, with the sizes of their ds64 chunk.
+*
+* @param wav Receives the layout, or the reason in #lively_wav::error
+* @param fd The file, open for reading
+*
+* @return A success value
+*/
+bool
+lively_wav_read_header (lively_wav_t *wav, int fd) {
+	unsigned char header[12];
+	struct stat st;
+	bool format = false;
+	uint64_t data_size = 0;
+
+	wav->error = NULL;
+	if (fstat (fd, &st) != 0 || !wav_read (fd, header, sizeof header, 0)
+		|| (memcmp (header, "RIFF", 4) != 0 && memcmp (header, "RF64", 4) != 0)
+		|| memcmp (header + 8, "WAVE", 4) != 0) {
+		wav->error = "not a WAV file";
+		return false;
+	}
+
+	uint64_t offset = sizeof header;
+	for (unsigned int i = 0; i < WAV_CHUNKS_MAX; i++) {
+		unsigned char chunk[8 + 40];
+		if (!wav_read (fd, chunk, 8, offset)) {
+			break;
+		}
+		uint32_t size = wav_u32 (chunk + 4);
+
+		if (memcmp (chunk, "fmt ", 4) == 0) {
+			uint32_t length = size < 40 ? size : 40;
+			if (!wav_read (fd, chunk + 8, length, offset + 8)
+				|| !wav_read_format (wav, chunk + 8, size)) {
+				if (!wav->error) {
+					wav->error = "format chunk cut short";
+				}
+				return false;
+			}
+			format = true;
+		} else if (memcmp (chunk, "ds64", 4) == 0) {
+			// The sizes of the RIFF and data chunks, 64 bits each.
+			if (size < 16 || !wav_read (fd, chunk + 8, 16, offset + 8)) {
+				wav->error = "ds64 chunk cut short";
+				return false;
+			}
+			data_size = wav_u64 (chunk + 16);
+		} else if (memcmp (chunk, "data", 4) == 0) {
+			if (!format) {
+				wav->error = "data before format";
+				return false;
+			}
+			uint64_t available = (uint64_t) st.st_size > offset + 8
+				? (uint64_t) st.st_size - (offset + 8) : 0;
+			if (size != WAV_SIZE_RF64 || data_size == 0) {
+				data_size = size;
+			}
+			wav->data_offset = offset + 8;
+			wav->frames = (data_size < available ? data_size : available) / wav->frame_bytes;
+			return true;
+		}
+
+		// Chunks are padded to an even size.
+		offset += 8 + (uint64_t) size + (size & 1);
+	}
+
+	wav->error = format ? "no data chunk" : "no format chunk";
+	return false;
+}
+
+/**
+* Converts interleaved samples as stored in a WAV file to planar floats in
+* [-1, 1).
+*
+* @param wav The layout of the samples
+* @param data The samples, starting at a frame
+* @param output Receives the samples of each channel
+* @param frames The number of frames
+*/
+void
+lively_wav_decode (
+	const lively_wav_t *wav,
+	const unsigned char *data,
+	float *const *output,
+	unsigned int frames) {
+
+	unsigned int channels = wav->channels;
+
+	for (unsigned int c = 0; c < channels; c++) {
+		float *out = output[c];
+
+		switch (wav->encoding) {
+		case LIVELY_WAV_PCM_16: {
+			const unsigned char *in = data + 2 * c;
+			for (unsigned int i = 0; i < frames; i++, in += wav->frame_bytes) {
+				out[i] = (float) (int16_t) wav_u16 (in) * (1.0f / 32768.0f);
+			}
+			break;
+		}
+		case LIVELY_WAV_PCM_24: {
+			const unsigned char *in = data + 3 * c;
+			for (unsigned int i = 0; i < frames; i++, in += wav->frame_bytes) {
+				// Placed in the top of 32 bits, so the sign comes along.
+				int32_t sample = (int32_t) ((uint32_t) in[0] << 8
+					| (uint32_t) in[1] << 16 | (uint32_t) in[2] << 24);
+				out[i] = (float) sample * (1.0f / 2147483648.0f);
+			}
+			break;
+		}
+		case LIVELY_WAV_PCM_32: {
+			const unsigned char *in = data + 4 * c;
+			for (unsigned int i = 0; i < frames; i++, in += wav->frame_bytes) {
+				out[i] = (float) (int32_t) wav_u32 (in) * (1.0f / 2147483648.0f);
+			}
+			break;
+		}
+		case LIVELY_WAV_FLOAT_32: {
+			const unsigned char *in = data + 4 * c;
+			for (unsigned int i = 0; i < frames; i++, in += wav->frame_bytes) {
+				uint32_t bits = wav_u32 (in);
+				memcpy (&out[i], &bits, sizeof bits);
+			}
+			break;
+		}
+		}
+	}
+}
+
+/**
+* Builds the header of a file written with #lively_wav_init, for the
+* frames written so far. Its size is #LIVELY_WAV_HEADER_BYTES whatever the
+* number of frames, so it can be rewritten in place as the file grows:
+* a JUNK chunk holds the place of the ds64 chunk, which takes it over once
+* the sizes no longer fit in 32 bits, and another pads the samples to the
+* end of the header.
+*
+* @param wav The layout
+* @param header Receives #LIVELY_WAV_HEADER_BYTES bytes
+*/
+void
+lively_wav_write_header (const lively_wav_t *wav, unsigned char *header) {
+	uint64_t data_size = wav->frames * wav->frame_bytes;
+	// Chunks are padded to an even size.
+	uint64_t riff_size = LIVELY_WAV_HEADER_BYTES - 8 + data_size + (data_size & 1);
+	bool rf64 = riff_size >= WAV_SIZE_RF64;
+	unsigned int bits = 8 * wav_sample_bytes[wav->encoding];
+
+	memset (header, 0, LIVELY_WAV_HEADER_BYTES);
+
+	memcpy (header, rf64 ? "RF64" : "RIFF", 4);
+	wav_put_u32 (header + 4, rf64 ? WAV_SIZE_RF64 : (uint32_t) riff_size);
+	memcpy (header + 8, "WAVE", 4);
+
+	unsigned char *ds64 = header + WAV_DS64_OFFSET;
+	memcpy (ds64, rf64 ? "ds64" : "JUNK", 4);
+	wav_put_u32 (ds64 + 4, WAV_FORMAT_OFFSET - WAV_DS64_OFFSET - 8);
+	if (rf64) {
+		wav_put_u64 (ds64 + 8, riff_size);
+		wav_put_u64 (ds64 + 16, data_size);
+		wav_put_u64 (ds64 + 24, wav->frames);
+	}
+
+	unsigned char *format = header + WAV_FORMAT_OFFSET;
+	memcpy (format, "fmt ", 4);
+	wav_put_u32 (format + 4, 16);
+	wav_put_u16 (format + 8, wav->encoding == LIVELY_WAV_FLOAT_32 ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM);
+	wav_put_u16 (format + 10, wav->channels);
+	wav_put_u32 (format + 12, wav->rate);
+	wav_put_u32 (format + 16, wav->rate * wav->frame_bytes);
+	wav_put_u16 (format + 20, wav->frame_bytes);
+	wav_put_u16 (format + 22, bits);
+
+	unsigned char *pad = header + WAV_PAD_OFFSET;
+	memcpy (pad, "JUNK", 4);
+	wav_put_u32 (pad + 4, WAV_DATA_OFFSET - WAV_PAD_OFFSET - 8);
+
+	unsigned char *data = header + WAV_DATA_OFFSET;
+	memcpy (data, "data", 4);
+	wav_put_u32 (data + 4, rf64 ? WAV_SIZE_RF64 : (uint32_t) data_size);
+}
+
+/**
+* Converts planar floats to interleaved samples as stored in a WAV file.
+* Samples beyond [-1, 1) are clipped.
+*
+* @param wav The layout of the samples
+* @param input The samples of each channel
+* @param data Receives the samples
+* @param frames The number of frames
+*/
+void
+lively_wav_encode (
+	const lively_wav_t *wav,
+	const float *const *input,
+	unsigned char *data,
+	unsigned int frames) {
+
+	unsigned int channels = wav->channels;
+
+	for (unsigned int c = 0; c < channels; c++) {
+		const float *in = input[c];
+
+		switch (wav->encoding) {
+		case LIVELY_WAV_PCM_16: {
+			unsigned char *out = data + 2 * c;
+			for (unsigned int i = 0; i < frames; i++, out += wav->frame_bytes) {
+				float x = fminf (fmaxf (in[i] * 32768.0f, -32768.0f), 32767.0f);
+				wav_put_u16 (out, (unsigned int) lrintf (x));
+			}
+			break;
+		}
+		case LIVELY_WAV_PCM_24: {
+			unsigned char *out = data + 3 * c;
+			for (unsigned int i = 0; i < frames; i++, out += wav->frame_bytes) {
+				float x = fminf (fmaxf (in[i] * 8388608.0f, -8388608.0f), 8388607.0f);
+				uint32_t sample = (uint32_t) lrintf (x);
+				out[0] = (unsigned char) sample;
+				out[1] = (unsigned char) (sample >> 8);
+				out[2] = (unsigned char) (sample >> 16);
+			}
+			break;
+		}
+		case LIVELY_WAV_PCM_32: {
+			unsigned char *out = data + 4 * c;
+			for (unsigned int i = 0; i < frames; i++, out += wav->frame_bytes) {
+				// The largest float below 2^31, as 2^31 - 1 is not one.
+				float x = fminf (fmaxf (in[i] * 2147483648.0f, -2147483648.0f), 2147483520.0f);
+				wav_put_u32 (out, (uint32_t) lrintf (x));
+			}
+			break;
+		}
+		case LIVELY_WAV_FLOAT_32: {
+			unsigned char *out = data + 4 * c;
+			for (unsigned int i = 0; i < frames; i++, out += wav->frame_bytes) {
+				uint32_t bits;
+				memcpy (&bits, &in[i], sizeof bits);
+				wav_put_u32 (out, bits);
+			}
+			break;
+		}
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef LIVELY_WAV_H
+#define LIVELY_WAV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Bytes of the header of files written by Lively, so that their samples
+ * start on a block of the disk. The header has room to become RF64 in place
+ * once the file outgrows 4 GiB.
+ */
+#define LIVELY_WAV_HEADER_BYTES 4096
+
+/**
+ * Specifies how the samples of a WAV file are stored. All of them are
+ * little-endian and interleaved.
+ */
+typedef enum lively_wav_encoding {
+	LIVELY_WAV_PCM_16,
+	LIVELY_WAV_PCM_24,
+	LIVELY_WAV_PCM_32,
+	LIVELY_WAV_FLOAT_32
+} lively_wav_encoding_t;
+
+/**
+ * The layout of the audio in a WAV file, as found in its header.
+ */
+typedef struct lively_wav {
+	enum lively_wav_encoding encoding;
+	unsigned int channels;
+	unsigned int rate;
+	unsigned int frame_bytes; /**< Bytes of one sample of every channel */
+
+	uint64_t data_offset; /**< Of the first frame, in bytes */
+	uint64_t frames;
+
+	const char *error; /**< Why the header was not read */
+} lively_wav_t;
+
+void lively_wav_init (
+	lively_wav_t *,
+	lively_wav_encoding_t encoding,
+	unsigned int channels,
+	unsigned int rate);
+
+bool lively_wav_read_header (lively_wav_t *, int fd);
+void lively_wav_decode (
+	const lively_wav_t *,
+	const unsigned char *data,
+	float *const *output,
+	unsigned int frames);
+
+void lively_wav_write_header (const lively_wav_t *, unsigned char *header);
+void lively_wav_encode (
+	const lively_wav_t *,
+	const float *const *input,
+	unsigned char *data,
+	unsigned int frames);
+
+#endif
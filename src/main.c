@@ -7,8 +7,10 @@
 
 #include "platform.h"
 #include "lively_app.h"
+#include "lively_session.h"
 
 static lively_app_t lively;
+static lively_session_t session;
 
 static void shutdown (void) {
 	lively_app_shutdown (&lively);
@@ -21,13 +23,30 @@ static void shutdown (void) {
 * variable with file scope. This way, upon receiving the
 * signal to quit by the user, we can clean up.
 *
+* An optional argument names a binary scene file to load, see
+* lively_scene_convert.
+*
 * @return Success value 
 */
-int main(void) {
+int main(int argc, char **argv) {
 	platform_register_exit (&shutdown);
 
 	lively_app_init (&lively);
+
+	bool loaded = false;
+	if (argc > 1) {
+		loaded = lively_session_load (&session, &lively.scene, argv[1]);
+		if (!loaded) {
+			lively_app_destroy (&lively);
+			return 1;
+		}
+	}
+
 	lively_app_run (&lively);
+
+	if (loaded) {
+		lively_session_unload (&session);
+	}
 	lively_app_destroy (&lively);
 
 	return 0;
@@ -0,0 +1,475 @@
+/**
+ * @file lively_node_analyzer.c
+ * Lively Analyzer: Spectra of a signal, made off the audio thread
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_analyzer.h"
+#include "../lively_app.h"
+#include "../lively_hash.h"
+
+#define ANALYZER_PI 3.14159265358979323846
+#define ANALYZER_MASK (LIVELY_ANALYZER_RING - 1)
+/**
+* Frames the audio thread may write while the latest frames are copied
+* out of the ring, before they could be overwritten. Longer blocks are
+* written in pieces of this size.
+*/
+#define ANALYZER_GUARD ((LIVELY_ANALYZER_RING - LIVELY_ANALYZER_SIZE_MAX) / 2)
+/** Set in #lively_node_analyzer::middle when the spectrum there was not taken */
+#define ANALYZER_FRESH 4u
+
+_Static_assert ((LIVELY_ANALYZER_RING & ANALYZER_MASK) == 0,
+	"Rings are indexed by masking");
+
+static const lively_param_info_t analyzer_params[LIVELY_ANALYZER_PARAMS] = {
+	[LIVELY_ANALYZER_SIZE] = {
+		.name = "size",
+		.type = LIVELY_PARAM_INT,
+		.min = (float) LIVELY_ANALYZER_SIZE_MIN,
+		.max = (float) LIVELY_ANALYZER_SIZE_MAX,
+		.initial = 4096.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_ANALYZER_RATE] = {
+		.name = "rate",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 1.0f,
+		.max = 120.0f,
+		.initial = 30.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_ANALYZER_AVERAGING] = {
+		.name = "averaging",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 10000.0f,
+		.initial = 300.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_ANALYZER_BINS] = {
+		.name = "bins",
+		.type = LIVELY_PARAM_INT,
+		.min = 8.0f,
+		.max = (float) LIVELY_ANALYZER_BINS_MAX,
+		.initial = 128.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	}
+};
+
+/**
+* Returns the size of transform a parameter value asks for: the power of
+* two at or below it.
+*/
+static unsigned int
+analyzer_size (float value) {
+	unsigned int size = LIVELY_ANALYZER_SIZE_MIN;
+	while (size * 2 <= (unsigned int) value && size < LIVELY_ANALYZER_SIZE_MAX) {
+		size *= 2;
+	}
+	return size;
+}
+
+static bool
+analyzer_process (lively_node_t *node, unsigned int length) {
+	lively_node_analyzer_t *analyzer = (lively_node_analyzer_t *) node;
+	uint64_t written = atomic_load_explicit (&analyzer->written, memory_order_relaxed);
+
+	for (unsigned int offset = 0; offset < length; ) {
+		unsigned int count = length - offset < ANALYZER_GUARD ? length - offset : ANALYZER_GUARD;
+		unsigned int index = (unsigned int) (written & ANALYZER_MASK);
+		unsigned int first = LIVELY_ANALYZER_RING - index < count
+			? LIVELY_ANALYZER_RING - index : count;
+
+		for (unsigned int c = 0; c < analyzer->channels; c++) {
+			const float *x = analyzer->io.buffer + (size_t) c * analyzer->stride + offset;
+			float *ring = analyzer->ring + (size_t) c * LIVELY_ANALYZER_RING;
+			memcpy (ring + index, x, first * sizeof *x);
+			memcpy (ring, x + first, (count - first) * sizeof *x);
+		}
+
+		written += count;
+		offset += count;
+		atomic_store_explicit (&analyzer->written, written, memory_order_release);
+	}
+
+	return true;
+}
+
+/**
+* Frees the transform and everything sized after it.
+*/
+static void
+analyzer_free_transform (lively_node_analyzer_t *analyzer) {
+	if (analyzer->fft) {
+		lively_fft_release (analyzer->fft);
+	}
+	free (analyzer->window);
+	free (analyzer->samples);
+	free (analyzer->re);
+	free (analyzer->im);
+	free (analyzer->work);
+	free (analyzer->power);
+	free (analyzer->average);
+	analyzer->fft = NULL;
+	analyzer->window = NULL;
+	analyzer->samples = NULL;
+	analyzer->re = NULL;
+	analyzer->im = NULL;
+	analyzer->work = NULL;
+	analyzer->power = NULL;
+	analyzer->average = NULL;
+	analyzer->size = 0;
+}
+
+/**
+* Sets up a transform of another size, with its window and buffers, and
+* starts the average over. On failure the analyzer has no transform.
+*/
+static bool
+analyzer_set_size (lively_node_analyzer_t *analyzer, unsigned int size) {
+	unsigned int half = size / 2 + 1;
+
+	analyzer_free_transform (analyzer);
+
+	analyzer->fft = lively_fft_acquire (size, LIVELY_FFT_REAL);
+	analyzer->window = malloc (size * sizeof *analyzer->window);
+	analyzer->samples = malloc (size * sizeof *analyzer->samples);
+	analyzer->re = malloc (half * sizeof *analyzer->re);
+	analyzer->im = malloc (half * sizeof *analyzer->im);
+	analyzer->work = analyzer->fft
+		? malloc (lively_fft_work_size (analyzer->fft) * sizeof *analyzer->work) : NULL;
+	analyzer->power = malloc (half * sizeof *analyzer->power);
+	analyzer->average = calloc (half, sizeof *analyzer->average);
+
+	if (!analyzer->fft || !analyzer->window || !analyzer->samples
+		|| !analyzer->re || !analyzer->im || !analyzer->work
+		|| !analyzer->power || !analyzer->average) {
+		analyzer_free_transform (analyzer);
+		return false;
+	}
+
+	// A periodic Hann window. Summed over both halves of the spectrum, the
+	// power of a sine of amplitude A is size * A^2 / 2 times the sum of the
+	// squares of the window.
+	double squares = 0.0;
+	for (unsigned int n = 0; n < size; n++) {
+		double w = 0.5 - 0.5 * cos (2.0 * ANALYZER_PI * n / size);
+		analyzer->window[n] = (float) w;
+		squares += w * w;
+	}
+	analyzer->scale = (float) (4.0 / (size * squares));
+	analyzer->size = size;
+	analyzer->analyzed = 0;
+	return true;
+}
+
+/**
+* Lays the bins out in log frequency, for a sample rate and the size of
+* the transform.
+*/
+static void
+analyzer_set_bins (lively_node_analyzer_t *analyzer, unsigned int bins, unsigned int sample_rate) {
+	unsigned int half = analyzer->size / 2;
+	double spacing = (double) sample_rate / analyzer->size;
+	double high = sample_rate / 2.0 < LIVELY_ANALYZER_HIGH ? sample_rate / 2.0 : LIVELY_ANALYZER_HIGH;
+	double ratio = pow (high / LIVELY_ANALYZER_LOW, 1.0 / bins);
+
+	for (unsigned int b = 0; b < bins; b++) {
+		double low = LIVELY_ANALYZER_LOW * pow (ratio, b);
+		double first = ceil (low / spacing);
+		double last = ceil (low * ratio / spacing);
+		double position = low * sqrt (ratio) / spacing;
+
+		analyzer->first[b] = first < half + 1 ? (unsigned int) first : half + 1;
+		analyzer->last[b] = last < half + 1 ? (unsigned int) last : half + 1;
+		analyzer->position[b] = position < half ? (float) position : (float) half;
+	}
+
+	analyzer->bins = bins;
+	analyzer->bins_rate = sample_rate;
+	analyzer->bins_size = analyzer->size;
+}
+
+/**
+* Copies the latest frames of a channel out of its ring, windowed.
+*/
+static void
+analyzer_copy (lively_node_analyzer_t *analyzer, unsigned int channel, uint64_t written) {
+	const float *ring = analyzer->ring + (size_t) channel * LIVELY_ANALYZER_RING;
+	unsigned int size = analyzer->size;
+	unsigned int index = (unsigned int) ((written - size) & ANALYZER_MASK);
+	unsigned int first = LIVELY_ANALYZER_RING - index < size ? LIVELY_ANALYZER_RING - index : size;
+
+	memcpy (analyzer->samples, ring + index, first * sizeof *ring);
+	memcpy (analyzer->samples + first, ring, (size - first) * sizeof *ring);
+	for (unsigned int n = 0; n < size; n++) {
+		analyzer->samples[n] *= analyzer->window[n];
+	}
+}
+
+/**
+* Sums the averaged power into the bins of the back spectrum, and swaps it
+* into the middle.
+*/
+static void
+analyzer_publish (lively_node_analyzer_t *analyzer, uint64_t written) {
+	lively_analyzer_spectrum_t *spectrum = &analyzer->spectra[analyzer->back];
+	double spacing = (double) analyzer->bins_rate / analyzer->size;
+	unsigned int half = analyzer->size / 2;
+
+	spectrum->frames = written;
+	spectrum->bins = analyzer->bins;
+	for (unsigned int b = 0; b < analyzer->bins; b++) {
+		float power = 0.0f;
+
+		if (analyzer->first[b] < analyzer->last[b]) {
+			for (unsigned int k = analyzer->first[b]; k < analyzer->last[b]; k++) {
+				power += analyzer->average[k];
+			}
+		} else {
+			float position = analyzer->position[b];
+			unsigned int k = (unsigned int) position;
+			float fraction = position - (float) k;
+			power = k < half
+				? analyzer->average[k] + (analyzer->average[k + 1] - analyzer->average[k]) * fraction
+				: analyzer->average[half];
+		}
+
+		spectrum->frequency[b] = (float) (analyzer->position[b] * spacing);
+		spectrum->level[b] = fmaxf (10.0f * log10f (power * analyzer->scale + 1e-15f),
+			LIVELY_ANALYZER_FLOOR);
+	}
+
+	unsigned int old = atomic_exchange_explicit (&analyzer->middle,
+		analyzer->back | ANALYZER_FRESH, memory_order_acq_rel);
+	analyzer->back = old & ~ANALYZER_FRESH;
+}
+
+/**
+* Makes a spectrum from the latest frames, if the node took any since the
+* last one. Runs on the analysis thread.
+*
+* @return The seconds until the next spectrum
+*/
+static double
+analyzer_run (lively_analysis_task_t *task) {
+	lively_node_analyzer_t *analyzer = LIVELY_CONTAINER_OF (task, lively_node_analyzer_t, task);
+	lively_node_t *node = (lively_node_t *) analyzer;
+	double period = 1.0 / lively_node_get_param (node, LIVELY_ANALYZER_RATE);
+	unsigned int size = analyzer_size (lively_node_get_param (node, LIVELY_ANALYZER_SIZE));
+	unsigned int bins = (unsigned int) lively_node_get_param (node, LIVELY_ANALYZER_BINS);
+	float averaging = lively_node_get_param (node, LIVELY_ANALYZER_AVERAGING);
+	unsigned int sample_rate = atomic_load_explicit (&analyzer->sample_rate, memory_order_relaxed);
+	uint64_t written = atomic_load_explicit (&analyzer->written, memory_order_acquire);
+
+	if (sample_rate == 0 || written < size || written == analyzer->analyzed) {
+		return period;
+	}
+	if (size != analyzer->size && !analyzer_set_size (analyzer, size)) {
+		lively_app_log (analyzer->analysis->app, LIVELY_ERROR, "analyzer",
+			"Could not set up a transform of %u frames", size);
+		return period;
+	}
+	if (bins != analyzer->bins || sample_rate != analyzer->bins_rate
+		|| size != analyzer->bins_size) {
+		analyzer_set_bins (analyzer, bins, sample_rate);
+	}
+
+	unsigned int half = size / 2 + 1;
+	memset (analyzer->power, 0, half * sizeof *analyzer->power);
+	for (unsigned int c = 0; c < analyzer->channels; c++) {
+		analyzer_copy (analyzer, c, written);
+		lively_fft_real (analyzer->fft, analyzer->samples, analyzer->re, analyzer->im, analyzer->work);
+		for (unsigned int k = 0; k < half; k++) {
+			analyzer->power[k] += analyzer->re[k] * analyzer->re[k] + analyzer->im[k] * analyzer->im[k];
+		}
+	}
+
+	// Frames overwritten while they were copied make a wrong spectrum;
+	// the next one will do.
+	atomic_thread_fence (memory_order_acquire);
+	if (atomic_load_explicit (&analyzer->written, memory_order_relaxed) - written > ANALYZER_GUARD) {
+		return period;
+	}
+
+	float seconds = (float) (written - analyzer->analyzed) / (float) sample_rate;
+	float keep = analyzer->analyzed && averaging > 0.0f ? expf (-1000.0f * seconds / averaging) : 0.0f;
+	float scale = (1.0f - keep) / (float) analyzer->channels;
+	for (unsigned int k = 0; k < half; k++) {
+		analyzer->average[k] = keep * analyzer->average[k] + scale * analyzer->power[k];
+	}
+	analyzer->analyzed = written;
+
+	analyzer_publish (analyzer, written);
+	return period;
+}
+
+/**
+* Allocates room for length samples of every channel, and tells the
+* analysis thread the sample rate of the node, which the scene sets before
+* calling this. Like #lively_node_io_set_buffer_length, nothing changes on
+* failure.
+*/
+static bool
+analyzer_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_analyzer_t *analyzer = (lively_node_analyzer_t *) node;
+
+	if (length > analyzer->stride) {
+		float *buffer = calloc ((size_t) length * analyzer->channels, sizeof *buffer);
+		if (!buffer) {
+			return false;
+		}
+		free (analyzer->io.buffer);
+		analyzer->io.buffer = buffer;
+		analyzer->stride = length;
+	}
+	atomic_store_explicit (&analyzer->sample_rate, node->sample_rate, memory_order_relaxed);
+
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+analyzer_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_analyzer_t *analyzer = (lively_node_analyzer_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!analyzer->io.buffer || index >= analyzer->channels) {
+		return NULL;
+	}
+	return analyzer->io.buffer + (size_t) index * analyzer->stride;
+}
+
+/**
+* Initializes an analyzer node, which only passes its input on until it is
+* started.
+*
+* @param analyzer The analyzer node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_ANALYZER_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_analyzer_init (lively_node_analyzer_t *analyzer, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) analyzer;
+
+	if (channels == 0) {
+		channels = LIVELY_ANALYZER_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	analyzer->ring = calloc ((size_t) channels * LIVELY_ANALYZER_RING, sizeof *analyzer->ring);
+	if (!analyzer->ring) {
+		return false;
+	}
+
+	lively_node_io_init (&analyzer->io, LIVELY_NODE_PROCESS);
+	node->process = analyzer_process;
+	node->set_buffer_length = analyzer_set_buffer_length;
+	node->get_read_buffer = analyzer_get_buffer;
+	node->get_write_buffer = analyzer_get_buffer;
+
+	analyzer->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	analyzer->stride = 0;
+	atomic_init (&analyzer->written, 0);
+	atomic_init (&analyzer->sample_rate, 0);
+
+	analyzer->task.run = analyzer_run;
+	analyzer->analysis = NULL;
+	analyzer->fft = NULL;
+	analyzer->window = NULL;
+	analyzer->samples = NULL;
+	analyzer->re = NULL;
+	analyzer->im = NULL;
+	analyzer->work = NULL;
+	analyzer->power = NULL;
+	analyzer->average = NULL;
+	analyzer->size = 0;
+	analyzer->analyzed = 0;
+	analyzer->bins = 0;
+	analyzer->bins_rate = 0;
+	analyzer->bins_size = 0;
+
+	memset (analyzer->spectra, 0, sizeof analyzer->spectra);
+	analyzer->back = 0;
+	atomic_init (&analyzer->middle, 1);
+	analyzer->front = 2;
+
+	lively_node_params_init (node, analyzer->params, analyzer_params, LIVELY_ANALYZER_PARAMS);
+	return true;
+}
+
+/**
+* Stops an analyzer node, and frees its rings and transform.
+*
+* @param node The analyzer node, which must not be in a scene
+*/
+void
+lively_node_analyzer_destroy (lively_node_t *node) {
+	lively_node_analyzer_t *analyzer = (lively_node_analyzer_t *) node;
+
+	lively_node_analyzer_stop (analyzer);
+	analyzer_free_transform (analyzer);
+	free (analyzer->ring);
+	analyzer->ring = NULL;
+	analyzer->stride = 0;
+	lively_node_io_destroy (node);
+}
+
+/**
+* Starts making spectra on an analysis service, at the rate of the node.
+*
+* @param analyzer The analyzer node
+* @param analysis The analysis service, usually that of the application
+*/
+void
+lively_node_analyzer_start (lively_node_analyzer_t *analyzer, lively_analysis_t *analysis) {
+	lively_node_analyzer_stop (analyzer);
+	analyzer->analysis = analysis;
+	lively_analysis_add (analysis, &analyzer->task);
+}
+
+/**
+* Stops making spectra. Once this returns, no spectrum is being made.
+*
+* @param analyzer The analyzer node
+*/
+void
+lively_node_analyzer_stop (lively_node_analyzer_t *analyzer) {
+	if (analyzer->analysis) {
+		lively_analysis_remove (analyzer->analysis, &analyzer->task);
+		analyzer->analysis = NULL;
+	}
+}
+
+/**
+* Takes the newest spectrum. Only one thread may read an analyzer node; it
+* never waits, nor makes the analysis thread wait.
+*
+* @param analyzer The analyzer node
+*
+* @return The spectrum, which stays valid and unchanged until the next
+* call; the same one again if nothing was published since. It has no bins
+* before the first.
+*/
+const lively_analyzer_spectrum_t *
+lively_node_analyzer_read (lively_node_analyzer_t *analyzer) {
+	if (atomic_load_explicit (&analyzer->middle, memory_order_relaxed) & ANALYZER_FRESH) {
+		unsigned int old = atomic_exchange_explicit (&analyzer->middle, analyzer->front,
+			memory_order_acq_rel);
+		analyzer->front = old & ~ANALYZER_FRESH;
+	}
+	return &analyzer->spectra[analyzer->front];
+}
@@ -0,0 +1,113 @@
+#ifndef LIVELY_NODE_ANALYZER_H
+#define LIVELY_NODE_ANALYZER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../lively_analysis.h"
+#include "../lively_node.h"
+#include "../lively_param.h"
+#include "../dsp/lively_fft.h"
+
+/** Channels of an analyzer node when none are asked for */
+#define LIVELY_ANALYZER_DEFAULT_CHANNELS 2
+/** Smallest and largest transforms, in frames; powers of two */
+#define LIVELY_ANALYZER_SIZE_MIN 256
+#define LIVELY_ANALYZER_SIZE_MAX 16384
+/** Frames of the ring of each channel; a power of two */
+#define LIVELY_ANALYZER_RING (2 * LIVELY_ANALYZER_SIZE_MAX)
+/** Most bins of a spectrum */
+#define LIVELY_ANALYZER_BINS_MAX 256
+/** Lowest and highest frequencies of the bins, in Hz */
+#define LIVELY_ANALYZER_LOW 20.0
+#define LIVELY_ANALYZER_HIGH 20000.0
+/** Level reported for silence, in dB */
+#define LIVELY_ANALYZER_FLOOR -150.0f
+
+/** Parameters of an analyzer node, read by the analysis thread */
+enum lively_node_analyzer_param {
+	LIVELY_ANALYZER_SIZE, /**< Frames of each transform, rounded down to a power of two */
+	LIVELY_ANALYZER_RATE, /**< Spectra per second */
+	LIVELY_ANALYZER_AVERAGING, /**< Time constant of the average, in milliseconds */
+	LIVELY_ANALYZER_BINS, /**< Bins between #LIVELY_ANALYZER_LOW and #LIVELY_ANALYZER_HIGH */
+	LIVELY_ANALYZER_PARAMS
+};
+
+/**
+ * A spectrum of an analyzer node, as published to its reader.
+ */
+typedef struct lively_analyzer_spectrum {
+	uint64_t frames; /**< Frames the node had taken when the spectrum was made */
+	unsigned int bins;
+	float frequency[LIVELY_ANALYZER_BINS_MAX]; /**< Center of each bin, in Hz */
+	/** Power in each bin, in dB relative to a full-scale sine */
+	float level[LIVELY_ANALYZER_BINS_MAX];
+} lively_analyzer_spectrum_t;
+
+/**
+ * Shows the spectrum of its input, and passes it on unchanged.
+ *
+ * All the audio thread does is copy each channel into a ring and publish
+ * how many frames it wrote. The spectra are made by a task on the
+ * #lively_analysis thread, at the rate the node asks for: it copies the
+ * latest frames of each channel from the rings, checks that the audio
+ * thread did not overwrite them meanwhile, applies a Hann window and takes
+ * a real FFT. The power of the channels is averaged together, then over
+ * time, and summed into bins spaced evenly in log frequency. A bin too
+ * narrow to hold the center of any frequency of the transform takes the
+ * power at its center, interpolated.
+ *
+ * Each spectrum is published through a triple buffer, and a single reader
+ * thread takes the newest one with #lively_node_analyzer_read, without
+ * either ever waiting for the other.
+ */
+typedef struct lively_node_analyzer {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	/** Written by the audio thread */
+	float *ring; /**< #LIVELY_ANALYZER_RING frames per channel */
+	atomic_ullong written; /**< Frames ever written */
+	/** Of the frames in the ring; set along with the buffer length */
+	atomic_uint sample_rate;
+
+	/** Owned by the analysis thread */
+	lively_analysis_task_t task;
+	lively_analysis_t *analysis; /**< While the task is added */
+	lively_fft_t *fft;
+	unsigned int size;
+	float *window;
+	float scale; /**< Turns summed power into the level of a sine */
+	float *samples;
+	float *re, *im;
+	float *work;
+	float *power; /**< Of each frequency of the transform */
+	float *average;
+	uint64_t analyzed; /**< Frames written when the last spectrum was made */
+
+	/** The bins, for the size, sample rate and count they were laid out for */
+	unsigned int bins;
+	unsigned int bins_rate;
+	unsigned int bins_size;
+	unsigned int first[LIVELY_ANALYZER_BINS_MAX]; /**< First frequency summed */
+	unsigned int last[LIVELY_ANALYZER_BINS_MAX]; /**< Past the last one; first if none */
+	float position[LIVELY_ANALYZER_BINS_MAX]; /**< Of the center, in frequencies */
+
+	/** The triple buffer: the analysis thread writes back, the reader reads front */
+	lively_analyzer_spectrum_t spectra[3];
+	unsigned int back;
+	unsigned int front;
+	atomic_uint middle; /**< Index of the third spectrum, and whether it is new */
+
+	lively_param_t params[LIVELY_ANALYZER_PARAMS];
+} lively_node_analyzer_t;
+
+bool lively_node_analyzer_init (lively_node_analyzer_t *, unsigned int channels);
+void lively_node_analyzer_destroy (lively_node_t *);
+
+void lively_node_analyzer_start (lively_node_analyzer_t *, lively_analysis_t *);
+void lively_node_analyzer_stop (lively_node_analyzer_t *);
+const lively_analyzer_spectrum_t *lively_node_analyzer_read (lively_node_analyzer_t *);
+
+#endif
@@ -0,0 +1,467 @@
+/**
+ * @file lively_node_biquad.c
+ * Lively Biquad: Cascaded biquad filters over many channels at once
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_biquad.h"
+#include "../lively_scene.h"
+
+#define BIQUAD_PI 3.14159265358979323846
+#define BIQUAD_LANES LIVELY_BIQUAD_LANES
+#define BIQUAD_TILE LIVELY_KERNEL_TILE
+
+_Static_assert (BIQUAD_LANES == 4 || BIQUAD_LANES == 8 || BIQUAD_LANES == 16,
+	"LIVELY_BIQUAD_LANES must be 4, 8 or 16");
+
+#define BIQUAD_SECTION_INFO(n) \
+	{ \
+		.name = "type" #n, \
+		.type = LIVELY_PARAM_INT, \
+		.min = LIVELY_BIQUAD_OFF, \
+		.max = LIVELY_BIQUAD_HIGHSHELF, \
+		.initial = LIVELY_BIQUAD_OFF, \
+		.smoothing = LIVELY_SMOOTH_NONE \
+	}, { \
+		.name = "frequency" #n, \
+		.type = LIVELY_PARAM_FLOAT, \
+		.min = 10.0f, \
+		.max = 24000.0f, \
+		.initial = 1000.0f, \
+		.smoothing = LIVELY_SMOOTH_ONE_POLE, \
+		.smoothing_time = 0.01f \
+	}, { \
+		.name = "q" #n, \
+		.type = LIVELY_PARAM_FLOAT, \
+		.min = 0.1f, \
+		.max = 24.0f, \
+		.initial = 0.70710678f, \
+		.smoothing = LIVELY_SMOOTH_ONE_POLE, \
+		.smoothing_time = 0.01f \
+	}, { \
+		.name = "gain" #n, \
+		.type = LIVELY_PARAM_FLOAT, \
+		.min = -30.0f, \
+		.max = 30.0f, \
+		.initial = 0.0f, \
+		.smoothing = LIVELY_SMOOTH_ONE_POLE, \
+		.smoothing_time = 0.01f \
+	}
+
+_Static_assert (LIVELY_BIQUAD_SECTIONS == 4, "One row of parameters per section");
+
+static const lively_param_info_t biquad_params[LIVELY_BIQUAD_PARAMS] = {
+	BIQUAD_SECTION_INFO (1),
+	BIQUAD_SECTION_INFO (2),
+	BIQUAD_SECTION_INFO (3),
+	BIQUAD_SECTION_INFO (4)
+};
+
+static const lively_biquad_coefficients_t biquad_identity = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+/**
+* Computes the coefficients of a section from the Audio EQ Cookbook
+* formulas. An off section, or one at or above Nyquist, passes its input
+* through.
+*
+* @param coefficients Receives the coefficients
+* @param type A #lively_biquad_type
+* @param frequency The cutoff or center frequency, in Hz
+* @param q The quality factor
+* @param gain The gain of peak and shelf sections, in dB
+* @param sample_rate The sample rate, in Hz
+*/
+void
+lively_biquad_design (
+	lively_biquad_coefficients_t *coefficients,
+	unsigned int type,
+	float frequency,
+	float q,
+	float gain,
+	float sample_rate) {
+
+	if (type == LIVELY_BIQUAD_OFF || frequency >= 0.5f * sample_rate) {
+		*coefficients = biquad_identity;
+		return;
+	}
+
+	// Designed in double precision, since low cutoffs leave the poles
+	// very close to the unit circle.
+	double w0 = 2.0 * BIQUAD_PI * frequency / sample_rate;
+	double cosine = cos (w0);
+	double alpha = sin (w0) / (2.0 * q);
+	double a = pow (10.0, gain / 40.0);
+	double shelf = 2.0 * sqrt (a) * alpha;
+	double b0, b1, b2, a0, a1, a2;
+
+	switch (type) {
+	case LIVELY_BIQUAD_LOWPASS:
+		b0 = (1.0 - cosine) / 2.0;
+		b1 = 1.0 - cosine;
+		b2 = b0;
+		a0 = 1.0 + alpha;
+		a1 = -2.0 * cosine;
+		a2 = 1.0 - alpha;
+		break;
+	case LIVELY_BIQUAD_HIGHPASS:
+		b0 = (1.0 + cosine) / 2.0;
+		b1 = -(1.0 + cosine);
+		b2 = b0;
+		a0 = 1.0 + alpha;
+		a1 = -2.0 * cosine;
+		a2 = 1.0 - alpha;
+		break;
+	case LIVELY_BIQUAD_BANDPASS:
+		b0 = alpha;
+		b1 = 0.0;
+		b2 = -alpha;
+		a0 = 1.0 + alpha;
+		a1 = -2.0 * cosine;
+		a2 = 1.0 - alpha;
+		break;
+	case LIVELY_BIQUAD_NOTCH:
+		b0 = 1.0;
+		b1 = -2.0 * cosine;
+		b2 = 1.0;
+		a0 = 1.0 + alpha;
+		a1 = -2.0 * cosine;
+		a2 = 1.0 - alpha;
+		break;
+	case LIVELY_BIQUAD_PEAK:
+		b0 = 1.0 + alpha * a;
+		b1 = -2.0 * cosine;
+		b2 = 1.0 - alpha * a;
+		a0 = 1.0 + alpha / a;
+		a1 = -2.0 * cosine;
+		a2 = 1.0 - alpha / a;
+		break;
+	case LIVELY_BIQUAD_LOWSHELF:
+		b0 = a * ((a + 1.0) - (a - 1.0) * cosine + shelf);
+		b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cosine);
+		b2 = a * ((a + 1.0) - (a - 1.0) * cosine - shelf);
+		a0 = (a + 1.0) + (a - 1.0) * cosine + shelf;
+		a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cosine);
+		a2 = (a + 1.0) + (a - 1.0) * cosine - shelf;
+		break;
+	case LIVELY_BIQUAD_HIGHSHELF:
+		b0 = a * ((a + 1.0) + (a - 1.0) * cosine + shelf);
+		b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cosine);
+		b2 = a * ((a + 1.0) + (a - 1.0) * cosine - shelf);
+		a0 = (a + 1.0) - (a - 1.0) * cosine + shelf;
+		a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cosine);
+		a2 = (a + 1.0) - (a - 1.0) * cosine - shelf;
+		break;
+	default:
+		*coefficients = biquad_identity;
+		return;
+	}
+
+	coefficients->b0 = (float) (b0 / a0);
+	coefficients->b1 = (float) (b1 / a0);
+	coefficients->b2 = (float) (b2 / a0);
+	coefficients->a1 = (float) (a1 / a0);
+	coefficients->a2 = (float) (a2 / a0);
+}
+
+static float *
+biquad_section_state (lively_node_biquad_t *biquad, unsigned int group, unsigned int section) {
+	return biquad->state + (group * LIVELY_BIQUAD_SECTIONS + section) * 2 * BIQUAD_LANES;
+}
+
+/**
+* Advances the parameters by a block, and works out how the coefficients of
+* each section move across it.
+*
+* @return The number of sections which do anything, listed in active
+*/
+static unsigned int
+biquad_update (
+	lively_node_biquad_t *biquad,
+	unsigned int length,
+	lively_biquad_coefficients_t *start,
+	lively_biquad_coefficients_t *step,
+	bool *moving,
+	unsigned int *active) {
+
+	lively_node_t *node = (lively_node_t *) biquad;
+	float sample_rate = (float) node->sample_rate;
+	bool rate_changed = sample_rate != biquad->sample_rate;
+	unsigned int count = 0;
+
+	biquad->sample_rate = sample_rate;
+
+	for (unsigned int s = 0; s < LIVELY_BIQUAD_SECTIONS; s++) {
+		float *settings = biquad->settings[s];
+		float values[LIVELY_BIQUAD_SECTION_PARAMS];
+
+		for (unsigned int p = 0; p < LIVELY_BIQUAD_SECTION_PARAMS; p++) {
+			values[p] = lively_param_advance (
+				&biquad->params[s * LIVELY_BIQUAD_SECTION_PARAMS + p], length);
+		}
+
+		start[s] = biquad->coefficients[s];
+		moving[s] = false;
+
+		if (rate_changed || memcmp (values, settings, sizeof values) != 0) {
+			lively_biquad_coefficients_t target;
+			lively_biquad_design (&target, (unsigned int) values[LIVELY_BIQUAD_TYPE],
+				values[LIVELY_BIQUAD_FREQUENCY], values[LIVELY_BIQUAD_Q],
+				values[LIVELY_BIQUAD_GAIN], sample_rate);
+			if (rate_changed) {
+				// Coefficients for another rate are meaningless here, so
+				// jump rather than ramp from them.
+				start[s] = target;
+			}
+			moving[s] = memcmp (&target, &start[s], sizeof target) != 0;
+
+			if (settings[LIVELY_BIQUAD_TYPE] == LIVELY_BIQUAD_OFF) {
+				// The state of a section which was off is stale.
+				unsigned int groups = (biquad->channels + BIQUAD_LANES - 1) / BIQUAD_LANES;
+				for (unsigned int g = 0; g < groups; g++) {
+					memset (biquad_section_state (biquad, g, s), 0,
+						2 * BIQUAD_LANES * sizeof (float));
+				}
+			}
+
+			float scale = 1.0f / (float) length;
+			step[s].b0 = (target.b0 - start[s].b0) * scale;
+			step[s].b1 = (target.b1 - start[s].b1) * scale;
+			step[s].b2 = (target.b2 - start[s].b2) * scale;
+			step[s].a1 = (target.a1 - start[s].a1) * scale;
+			step[s].a2 = (target.a2 - start[s].a2) * scale;
+
+			biquad->coefficients[s] = target;
+			memcpy (settings, values, sizeof values);
+		}
+
+		if (moving[s] || settings[LIVELY_BIQUAD_TYPE] != LIVELY_BIQUAD_OFF) {
+			active[count++] = s;
+		}
+	}
+
+	return count;
+}
+
+/**
+* Runs one section over an interleaved tile, in transposed direct form II.
+* The inner loops run across lanes, so that they vectorize.
+*
+* @param tile Samples of each lane, interleaved
+* @param count The number of frames in the tile
+* @param state The two state variables of each lane
+* @param start The coefficients at the start of the block
+* @param step The change of the coefficients per sample, if moving
+* @param position The position of the tile in the block
+*/
+static void
+biquad_section (
+	float (*tile)[BIQUAD_LANES],
+	unsigned int count,
+	float *state,
+	const lively_biquad_coefficients_t *start,
+	const lively_biquad_coefficients_t *step,
+	bool moving,
+	unsigned int position) {
+
+	float z1[BIQUAD_LANES], z2[BIQUAD_LANES];
+	memcpy (z1, state, sizeof z1);
+	memcpy (z2, state + BIQUAD_LANES, sizeof z2);
+
+	if (!moving) {
+		float b0 = start->b0, b1 = start->b1, b2 = start->b2;
+		float a1 = start->a1, a2 = start->a2;
+
+		for (unsigned int n = 0; n < count; n++) {
+			for (unsigned int l = 0; l < BIQUAD_LANES; l++) {
+				float x = tile[n][l];
+				float y = b0 * x + z1[l];
+				z1[l] = b1 * x - a1 * y + z2[l];
+				z2[l] = b2 * x - a2 * y;
+				tile[n][l] = y;
+			}
+		}
+	} else {
+		for (unsigned int n = 0; n < count; n++) {
+			float t = (float) (position + n + 1);
+			float b0 = start->b0 + step->b0 * t;
+			float b1 = start->b1 + step->b1 * t;
+			float b2 = start->b2 + step->b2 * t;
+			float a1 = start->a1 + step->a1 * t;
+			float a2 = start->a2 + step->a2 * t;
+
+			for (unsigned int l = 0; l < BIQUAD_LANES; l++) {
+				float x = tile[n][l];
+				float y = b0 * x + z1[l];
+				z1[l] = b1 * x - a1 * y + z2[l];
+				z2[l] = b2 * x - a2 * y;
+				tile[n][l] = y;
+			}
+		}
+	}
+
+	memcpy (state, z1, sizeof z1);
+	memcpy (state + BIQUAD_LANES, z2, sizeof z2);
+}
+
+static bool
+biquad_process (lively_node_t *node, unsigned int length) {
+	lively_node_biquad_t *biquad = (lively_node_biquad_t *) node;
+	lively_biquad_coefficients_t start[LIVELY_BIQUAD_SECTIONS];
+	lively_biquad_coefficients_t step[LIVELY_BIQUAD_SECTIONS];
+	bool moving[LIVELY_BIQUAD_SECTIONS];
+	unsigned int active[LIVELY_BIQUAD_SECTIONS];
+
+	unsigned int active_count = biquad_update (biquad, length, start, step, moving, active);
+	if (active_count == 0) {
+		return true;
+	}
+
+	float tile[BIQUAD_TILE][BIQUAD_LANES];
+	unsigned int channels = biquad->channels;
+	unsigned int groups = (channels + BIQUAD_LANES - 1) / BIQUAD_LANES;
+
+	for (unsigned int offset = 0; offset < length; offset += BIQUAD_TILE) {
+		unsigned int count = length - offset < BIQUAD_TILE ? length - offset : BIQUAD_TILE;
+
+		for (unsigned int g = 0; g < groups; g++) {
+			unsigned int first = g * BIQUAD_LANES;
+			unsigned int lanes = channels - first < BIQUAD_LANES
+				? channels - first : BIQUAD_LANES;
+			float *samples = biquad->io.buffer + (size_t) first * biquad->stride + offset;
+
+			for (unsigned int l = 0; l < lanes; l++) {
+				const float *channel = samples + (size_t) l * biquad->stride;
+				for (unsigned int n = 0; n < count; n++) {
+					tile[n][l] = channel[n];
+				}
+			}
+			for (unsigned int l = lanes; l < BIQUAD_LANES; l++) {
+				for (unsigned int n = 0; n < count; n++) {
+					tile[n][l] = 0.0f;
+				}
+			}
+
+			for (unsigned int i = 0; i < active_count; i++) {
+				unsigned int s = active[i];
+				biquad_section (tile, count, biquad_section_state (biquad, g, s),
+					&start[s], &step[s], moving[s], offset);
+			}
+
+			for (unsigned int l = 0; l < lanes; l++) {
+				float *channel = samples + (size_t) l * biquad->stride;
+				for (unsigned int n = 0; n < count; n++) {
+					channel[n] = tile[n][l];
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+* Allocates room for length samples of every channel. Like
+* #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+biquad_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_biquad_t *biquad = (lively_node_biquad_t *) node;
+
+	if (length <= biquad->stride) {
+		node->buffer_length = length;
+		return true;
+	}
+
+	float *buffer = malloc ((size_t) length * biquad->channels * sizeof *buffer);
+	if (!buffer) {
+		return false;
+	}
+
+	free (biquad->io.buffer);
+	biquad->io.buffer = buffer;
+	biquad->stride = length;
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+biquad_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_biquad_t *biquad = (lively_node_biquad_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!biquad->io.buffer || index >= biquad->channels) {
+		return NULL;
+	}
+	return biquad->io.buffer + (size_t) index * biquad->stride;
+}
+
+/**
+* Initializes a biquad node with every section off.
+*
+* @param biquad The biquad node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_BIQUAD_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_biquad_init (lively_node_biquad_t *biquad, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) biquad;
+
+	if (channels == 0) {
+		channels = LIVELY_BIQUAD_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	lively_node_io_init (&biquad->io, LIVELY_NODE_PROCESS);
+	node->process = biquad_process;
+	node->set_buffer_length = biquad_set_buffer_length;
+	node->get_read_buffer = biquad_get_buffer;
+	node->get_write_buffer = biquad_get_buffer;
+
+	unsigned int groups = (channels + BIQUAD_LANES - 1) / BIQUAD_LANES;
+	biquad->state = calloc ((size_t) groups * LIVELY_BIQUAD_SECTIONS * 2 * BIQUAD_LANES,
+		sizeof *biquad->state);
+	if (!biquad->state) {
+		return false;
+	}
+
+	biquad->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	biquad->stride = 0;
+	biquad->sample_rate = 0.0f;
+	lively_node_params_init (node, biquad->params, biquad_params, LIVELY_BIQUAD_PARAMS);
+
+	for (unsigned int s = 0; s < LIVELY_BIQUAD_SECTIONS; s++) {
+		biquad->coefficients[s] = biquad_identity;
+		for (unsigned int p = 0; p < LIVELY_BIQUAD_SECTION_PARAMS; p++) {
+			biquad->settings[s][p] = biquad->params[s * LIVELY_BIQUAD_SECTION_PARAMS + p].current;
+		}
+	}
+
+	return true;
+}
+
+/**
+* Frees the buffers and filter state of a biquad node.
+*
+* @param node The biquad node, which must not be in a scene
+*/
+void
+lively_node_biquad_destroy (lively_node_t *node) {
+	lively_node_biquad_t *biquad = (lively_node_biquad_t *) node;
+
+	free (biquad->state);
+	biquad->state = NULL;
+	biquad->stride = 0;
+	lively_node_io_destroy (node);
+}
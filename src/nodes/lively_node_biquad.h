@@ -0,0 +1,91 @@
+#ifndef LIVELY_NODE_BIQUAD_H
+#define LIVELY_NODE_BIQUAD_H
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/**
+ * Number of channels filtered side by side. Must be 4, 8 or 16; 8 fills an
+ * AVX register, and 16 an AVX-512 register.
+ */
+#ifndef LIVELY_BIQUAD_LANES
+#define LIVELY_BIQUAD_LANES 8
+#endif
+
+/** Number of cascaded sections */
+#define LIVELY_BIQUAD_SECTIONS 4
+
+/** Channels of a biquad node when none are asked for */
+#define LIVELY_BIQUAD_DEFAULT_CHANNELS 2
+
+/** Shapes of a section */
+enum lively_biquad_type {
+	LIVELY_BIQUAD_OFF, /**< Passes the signal through, at no cost */
+	LIVELY_BIQUAD_LOWPASS,
+	LIVELY_BIQUAD_HIGHPASS,
+	LIVELY_BIQUAD_BANDPASS,
+	LIVELY_BIQUAD_NOTCH,
+	LIVELY_BIQUAD_PEAK,
+	LIVELY_BIQUAD_LOWSHELF,
+	LIVELY_BIQUAD_HIGHSHELF
+};
+
+/**
+ * Parameters of a section. Section s has parameters starting at
+ * s * #LIVELY_BIQUAD_SECTION_PARAMS, named type1, frequency1, q1, gain1,
+ * type2 and so on.
+ */
+enum lively_biquad_section_param {
+	LIVELY_BIQUAD_TYPE, /**< A #lively_biquad_type, off by default */
+	LIVELY_BIQUAD_FREQUENCY, /**< In Hz */
+	LIVELY_BIQUAD_Q,
+	LIVELY_BIQUAD_GAIN, /**< In dB, for peak and shelf sections */
+	LIVELY_BIQUAD_SECTION_PARAMS
+};
+
+#define LIVELY_BIQUAD_PARAMS (LIVELY_BIQUAD_SECTIONS * LIVELY_BIQUAD_SECTION_PARAMS)
+
+/**
+ * Normalized coefficients of a section, with a0 divided out.
+ */
+typedef struct lively_biquad_coefficients {
+	float b0, b1, b2;
+	float a1, a2;
+} lively_biquad_coefficients_t;
+
+/**
+ * A cascade of biquad filters, applied alike to every channel.
+ *
+ * The channels are stored one after another in a single buffer, and are
+ * filtered #LIVELY_BIQUAD_LANES at a time: each group of channels is
+ * interleaved into a tile, so that the sections run in transposed direct
+ * form II across all lanes at once, and deinterleaved again. When a
+ * parameter moves, the coefficients are interpolated sample by sample from
+ * their values at the start of the block to their values at the end.
+ */
+typedef struct lively_node_biquad {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	/** Two state variables per section and lane, for every group of lanes */
+	float *state;
+	lively_biquad_coefficients_t coefficients[LIVELY_BIQUAD_SECTIONS];
+	/** The parameter values the coefficients were computed from */
+	float settings[LIVELY_BIQUAD_SECTIONS][LIVELY_BIQUAD_SECTION_PARAMS];
+	float sample_rate;
+
+	lively_param_t params[LIVELY_BIQUAD_PARAMS];
+} lively_node_biquad_t;
+
+bool lively_node_biquad_init (lively_node_biquad_t *, unsigned int channels);
+void lively_node_biquad_destroy (lively_node_t *);
+void lively_biquad_design (
+	lively_biquad_coefficients_t *,
+	unsigned int type,
+	float frequency,
+	float q,
+	float gain,
+	float sample_rate);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file lively_node_clip.c
+ * Lively Clip: Limits a signal to a threshold by hard clipping
+ */
+
+#include <math.h>
+
+#include "lively_node_clip.h"
+
+static const lively_param_info_t clip_params[LIVELY_CLIP_PARAMS] = {
+	[LIVELY_CLIP_THRESHOLD] = {
+		.name = "threshold",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 16.0f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	}
+};
+
+static void
+clip_kernel (lively_node_t *node, float *samples, unsigned int count) {
+	lively_param_t *threshold = &((lively_node_clip_t *) node)->params[LIVELY_CLIP_THRESHOLD];
+	float thresholds[LIVELY_KERNEL_TILE];
+
+	if (lively_param_ramp (threshold, thresholds, count)) {
+		for (unsigned int i = 0; i < count; i++) {
+			samples[i] = fminf (fmaxf (samples[i], -thresholds[i]), thresholds[i]);
+		}
+	} else {
+		float t = threshold->current;
+		for (unsigned int i = 0; i < count; i++) {
+			samples[i] = fminf (fmaxf (samples[i], -t), t);
+		}
+	}
+}
+
+/**
+* Initializes a clip node with a threshold of full scale.
+*
+* @param clip The clip node
+*/
+void
+lively_node_clip_init (lively_node_clip_t *clip) {
+	lively_node_t *node = (lively_node_t *) clip;
+
+	lively_node_io_init (&clip->io, LIVELY_NODE_PROCESS);
+	node->process = lively_node_kernel_process;
+	node->kernel = clip_kernel;
+
+	lively_node_params_init (node, clip->params, clip_params, LIVELY_CLIP_PARAMS);
+}
@@ -0,0 +1,23 @@
+#ifndef LIVELY_NODE_CLIP_H
+#define LIVELY_NODE_CLIP_H
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Parameters of a clip node */
+enum lively_node_clip_param {
+	LIVELY_CLIP_THRESHOLD, /**< Largest magnitude let through, 1 by default */
+	LIVELY_CLIP_PARAMS
+};
+
+/**
+ * Hard-clips its input to a threshold. A kernel node.
+ */
+typedef struct lively_node_clip {
+	lively_node_io_t io;
+	lively_param_t params[LIVELY_CLIP_PARAMS];
+} lively_node_clip_t;
+
+void lively_node_clip_init (lively_node_clip_t *);
+
+#endif
@@ -0,0 +1,587 @@
+/**
+ * @file lively_node_convolution.c
+ * Lively Convolution: Zero-latency partitioned convolution with long
+ * impulse responses
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_convolution.h"
+#include "../lively_hash.h"
+#include "../lively_scene.h"
+#include "../lively_thread.h"
+#include "../dsp/lively_fft.h"
+
+#define CONVOLUTION_HEAD LIVELY_CONVOLUTION_HEAD
+#define CONVOLUTION_TAIL LIVELY_CONVOLUTION_TAIL
+/** Blocks in flight between the audio thread and the worker */
+#define CONVOLUTION_SLOTS 4
+
+_Static_assert ((CONVOLUTION_HEAD & (CONVOLUTION_HEAD - 1)) == 0
+	&& (CONVOLUTION_TAIL & (CONVOLUTION_TAIL - 1)) == 0
+	&& CONVOLUTION_TAIL > CONVOLUTION_HEAD,
+	"Partition sizes must be powers of two, with the tail larger");
+
+static const lively_param_info_t convolution_params[LIVELY_CONVOLUTION_PARAMS] = {
+	[LIVELY_CONVOLUTION_DRY] = {
+		.name = "dry",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 4.0f,
+		.initial = 0.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	},
+	[LIVELY_CONVOLUTION_WET] = {
+		.name = "wet",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 4.0f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	}
+};
+
+/**
+ * Uniformly partitioned convolution with one part of an impulse response,
+ * by overlap-save: every block is transformed once together with the block
+ * before it, and multiplied with the spectrum of each partition.
+ */
+typedef struct convolution_stage {
+	lively_fft_t *fft; /**< Real transform of twice the size */
+	float *work;
+	unsigned int size; /**< Partition and block size */
+	unsigned int bins;
+	unsigned int count; /**< Number of partitions */
+	float *response_re, *response_im; /**< Spectra of the partitions */
+	float *history_re, *history_im; /**< Spectra of the last count blocks */
+	unsigned int position; /**< Slot in the history of the next block */
+	float *window; /**< The previous and the current block */
+	float *sum_re, *sum_im;
+	float *result;
+} convolution_stage_t;
+
+enum convolution_slot_state {
+	SLOT_FREE,
+	SLOT_SUBMITTED, /**< Holds input for the worker */
+	SLOT_DONE /**< Holds output for the audio thread */
+};
+
+typedef struct convolution_slot {
+	atomic_int state;
+	unsigned long block; /**< Number of the tail block held */
+	float input[CONVOLUTION_TAIL];
+	float output[CONVOLUTION_TAIL];
+} convolution_slot_t;
+
+/**
+ * Everything derived from one impulse response.
+ */
+typedef struct lively_convolution {
+	float direct[CONVOLUTION_HEAD]; /**< The first samples of the response, reversed */
+	float input[2 * CONVOLUTION_HEAD]; /**< The previous and the current head block */
+	float head_output[CONVOLUTION_HEAD];
+	unsigned int head_fill;
+	convolution_stage_t head;
+
+	convolution_stage_t tail; /**< Owned by the worker */
+	float tail_input[CONVOLUTION_TAIL];
+	unsigned int tail_fill;
+	unsigned long tail_block;
+	int reading; /**< Slot whose output is being played, or -1 */
+	unsigned long worker_block; /**< Next block the worker expects */
+	convolution_slot_t slots[CONVOLUTION_SLOTS];
+	atomic_uint late; /**< Tail blocks the worker did not deliver in time */
+
+	bool worker_running;
+	sem_t wake;
+	lively_thread_t worker;
+} lively_convolution_t;
+
+static void
+convolution_stage_destroy (convolution_stage_t *stage) {
+	if (stage->count == 0) {
+		return;
+	}
+	lively_fft_release (stage->fft);
+	free (stage->work);
+	free (stage->response_re);
+	free (stage->response_im);
+	free (stage->history_re);
+	free (stage->history_im);
+	free (stage->window);
+	free (stage->sum_re);
+	free (stage->sum_im);
+	free (stage->result);
+	memset (stage, 0, sizeof *stage);
+}
+
+/**
+* Prepares a stage for count partitions of size samples of a response.
+* Samples past the end of the response are taken as zeros.
+*/
+static bool
+convolution_stage_init (
+	convolution_stage_t *stage,
+	unsigned int size,
+	unsigned int count,
+	const float *response,
+	size_t length) {
+
+	memset (stage, 0, sizeof *stage);
+	if (count == 0) {
+		return true;
+	}
+
+	size_t spectra = (size_t) count * (size + 1);
+	stage->size = size;
+	stage->bins = size + 1;
+	stage->count = count;
+	stage->response_re = malloc (spectra * sizeof (float));
+	stage->response_im = malloc (spectra * sizeof (float));
+	stage->history_re = calloc (spectra, sizeof (float));
+	stage->history_im = calloc (spectra, sizeof (float));
+	stage->window = calloc (2 * size, sizeof (float));
+	stage->sum_re = malloc (stage->bins * sizeof (float));
+	stage->sum_im = malloc (stage->bins * sizeof (float));
+	stage->result = malloc (2 * size * sizeof (float));
+	stage->fft = lively_fft_acquire (2 * size, LIVELY_FFT_REAL);
+	stage->work = stage->fft ? malloc (lively_fft_work_size (stage->fft) * sizeof (float)) : NULL;
+
+	if (!stage->fft || !stage->work
+		|| !stage->response_re || !stage->response_im
+		|| !stage->history_re || !stage->history_im
+		|| !stage->window || !stage->sum_re || !stage->sum_im || !stage->result) {
+		convolution_stage_destroy (stage);
+		return false;
+	}
+
+	// The inverse transform is scaled by its size, so the responses are
+	// scaled down in advance.
+	float scale = 1.0f / (float) (2 * size);
+	for (unsigned int j = 0; j < count; j++) {
+		size_t start = (size_t) j * size;
+		size_t available = start < length ? length - start : 0;
+		size_t used = available < size ? available : size;
+		float *re = stage->response_re + (size_t) j * stage->bins;
+		float *im = stage->response_im + (size_t) j * stage->bins;
+
+		memset (stage->result, 0, 2 * size * sizeof (float));
+		for (size_t i = 0; i < used; i++) {
+			stage->result[i] = response[start + i] * scale;
+		}
+		lively_fft_real (stage->fft, stage->result, re, im, stage->work);
+	}
+
+	return true;
+}
+
+/**
+* Adds a block of size samples, and computes the output of the stage for
+* the block which follows it, as if its first partition were applied to the
+* block just added.
+*/
+static void
+convolution_stage_push (convolution_stage_t *stage, const float *block, float *output) {
+	unsigned int size = stage->size;
+	unsigned int bins = stage->bins;
+	size_t slot = (size_t) stage->position * bins;
+
+	memcpy (stage->window + size, block, size * sizeof *block);
+	lively_fft_real (stage->fft, stage->window,
+		stage->history_re + slot, stage->history_im + slot, stage->work);
+	memcpy (stage->window, block, size * sizeof *block);
+
+	float *sum_re = stage->sum_re;
+	float *sum_im = stage->sum_im;
+	memset (sum_re, 0, bins * sizeof *sum_re);
+	memset (sum_im, 0, bins * sizeof *sum_im);
+
+	unsigned int history = stage->position;
+	for (unsigned int j = 0; j < stage->count; j++) {
+		const float *xr = stage->history_re + (size_t) history * bins;
+		const float *xi = stage->history_im + (size_t) history * bins;
+		const float *hr = stage->response_re + (size_t) j * bins;
+		const float *hi = stage->response_im + (size_t) j * bins;
+
+		for (unsigned int k = 0; k < bins; k++) {
+			sum_re[k] += xr[k] * hr[k] - xi[k] * hi[k];
+			sum_im[k] += xr[k] * hi[k] + xi[k] * hr[k];
+		}
+		history = history ? history - 1 : stage->count - 1;
+	}
+
+	lively_fft_real_inverse (stage->fft, sum_re, sum_im, stage->result, stage->work);
+	memcpy (output, stage->result + size, size * sizeof *output);
+
+	stage->position = stage->position + 1 < stage->count ? stage->position + 1 : 0;
+}
+
+/**
+* Accounts for blocks which never reached the stage, as silence.
+*/
+static void
+convolution_stage_skip (convolution_stage_t *stage, unsigned long blocks) {
+	unsigned int bins = stage->bins;
+
+	memset (stage->window, 0, 2 * stage->size * sizeof *stage->window);
+	if (blocks >= stage->count) {
+		blocks = stage->count;
+	}
+	for (unsigned long i = 0; i < blocks; i++) {
+		size_t slot = (size_t) stage->position * bins;
+		memset (stage->history_re + slot, 0, bins * sizeof (float));
+		memset (stage->history_im + slot, 0, bins * sizeof (float));
+		stage->position = stage->position + 1 < stage->count ? stage->position + 1 : 0;
+	}
+}
+
+/**
+* Returns the submitted slot with the lowest block number, or -1.
+*/
+static int
+convolution_next_slot (lively_convolution_t *convolution) {
+	int next = -1;
+	for (int i = 0; i < CONVOLUTION_SLOTS; i++) {
+		convolution_slot_t *slot = &convolution->slots[i];
+		if (atomic_load_explicit (&slot->state, memory_order_acquire) == SLOT_SUBMITTED
+			&& (next < 0 || slot->block < convolution->slots[next].block)) {
+			next = i;
+		}
+	}
+	return next;
+}
+
+/**
+* Computes tail blocks as the audio thread submits them.
+*/
+static void
+convolution_worker_main (lively_thread_t *thread) {
+	lively_convolution_t *convolution = LIVELY_CONTAINER_OF (thread, lively_convolution_t, worker);
+
+	while (lively_thread_get_state (thread) != THREAD_STOP) {
+		if (sem_wait (&convolution->wake) != 0 && errno != EINTR) {
+			break;
+		}
+
+		int next;
+		while ((next = convolution_next_slot (convolution)) >= 0) {
+			convolution_slot_t *slot = &convolution->slots[next];
+
+			if (slot->block != convolution->worker_block) {
+				convolution_stage_skip (&convolution->tail,
+					slot->block - convolution->worker_block);
+			}
+			convolution_stage_push (&convolution->tail, slot->input, slot->output);
+			convolution->worker_block = slot->block + 1;
+
+			atomic_store_explicit (&slot->state, SLOT_DONE, memory_order_release);
+		}
+	}
+}
+
+static void
+convolution_free (lively_convolution_t *convolution) {
+	if (!convolution) {
+		return;
+	}
+
+	if (convolution->worker_running) {
+		lively_thread_set_state (&convolution->worker, THREAD_STOP);
+		sem_post (&convolution->wake);
+		lively_thread_join (&convolution->worker);
+		sem_destroy (&convolution->wake);
+	}
+
+	convolution_stage_destroy (&convolution->head);
+	convolution_stage_destroy (&convolution->tail);
+	free (convolution);
+}
+
+/**
+* Splits a response into its direct part, head and tail, transforms them
+* and starts a worker for the tail if there is one.
+*/
+static lively_convolution_t *
+convolution_create (const float *response, size_t length) {
+	lively_convolution_t *convolution = calloc (1, sizeof *convolution);
+	if (!convolution) {
+		return NULL;
+	}
+
+	// The worker has a whole tail block of time for each block, so the tail
+	// can only start after two of them.
+	size_t tail_start = 2 * CONVOLUTION_TAIL;
+	size_t head_end = length < tail_start ? length : tail_start;
+	unsigned int head_count = head_end > CONVOLUTION_HEAD
+		? (unsigned int) ((head_end - CONVOLUTION_HEAD + CONVOLUTION_HEAD - 1) / CONVOLUTION_HEAD)
+		: 0;
+	size_t tail_blocks = length > tail_start
+		? (length - tail_start + CONVOLUTION_TAIL - 1) / CONVOLUTION_TAIL
+		: 0;
+
+	if (tail_blocks > UINT32_MAX) {
+		free (convolution);
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < CONVOLUTION_HEAD && i < length; i++) {
+		convolution->direct[CONVOLUTION_HEAD - 1 - i] = response[i];
+	}
+	convolution->reading = -1;
+	atomic_init (&convolution->late, 0);
+	for (int i = 0; i < CONVOLUTION_SLOTS; i++) {
+		atomic_init (&convolution->slots[i].state, SLOT_FREE);
+	}
+
+	if (!convolution_stage_init (&convolution->head, CONVOLUTION_HEAD, head_count,
+			response + CONVOLUTION_HEAD, head_end > CONVOLUTION_HEAD ? head_end - CONVOLUTION_HEAD : 0)
+		|| !convolution_stage_init (&convolution->tail, CONVOLUTION_TAIL,
+			(unsigned int) tail_blocks,
+			response + (tail_blocks ? tail_start : 0), tail_blocks ? length - tail_start : 0)) {
+		convolution_free (convolution);
+		return NULL;
+	}
+
+	if (tail_blocks) {
+		if (sem_init (&convolution->wake, 0, 0) != 0) {
+			convolution_free (convolution);
+			return NULL;
+		}
+		if (!lively_thread_init (&convolution->worker, NULL, convolution_worker_main)) {
+			sem_destroy (&convolution->wake);
+			convolution_free (convolution);
+			return NULL;
+		}
+		convolution->worker_running = true;
+	}
+
+	return convolution;
+}
+
+/**
+* Hands a complete tail block to the worker, and starts playing the output
+* of the block before it.
+*/
+static void
+convolution_tail_boundary (lively_convolution_t *convolution) {
+	unsigned long block = convolution->tail_block++;
+
+	if (convolution->reading >= 0) {
+		atomic_store_explicit (&convolution->slots[convolution->reading].state,
+			SLOT_FREE, memory_order_relaxed);
+		convolution->reading = -1;
+	}
+
+	convolution_slot_t *slot = &convolution->slots[block % CONVOLUTION_SLOTS];
+	if (atomic_load_explicit (&slot->state, memory_order_acquire) == SLOT_SUBMITTED) {
+		// The worker is so far behind that it still has not started on
+		// this slot; the block is dropped, and played as silence.
+		atomic_fetch_add_explicit (&convolution->late, 1, memory_order_relaxed);
+	} else {
+		memcpy (slot->input, convolution->tail_input, sizeof slot->input);
+		slot->block = block;
+		atomic_store_explicit (&slot->state, SLOT_SUBMITTED, memory_order_release);
+		sem_post (&convolution->wake);
+	}
+
+	if (block == 0) {
+		return;
+	}
+	int previous = (int) ((block - 1) % CONVOLUTION_SLOTS);
+	convolution_slot_t *ready = &convolution->slots[previous];
+	if (atomic_load_explicit (&ready->state, memory_order_acquire) == SLOT_DONE
+		&& ready->block == block - 1) {
+		convolution->reading = previous;
+	} else {
+		atomic_fetch_add_explicit (&convolution->late, 1, memory_order_relaxed);
+	}
+}
+
+/**
+* Convolves up to the end of the current head block, in place.
+*/
+static void
+convolution_run (lively_convolution_t *convolution, float *samples, unsigned int count) {
+	unsigned int fill = convolution->head_fill;
+	float *input = convolution->input;
+
+	memcpy (input + CONVOLUTION_HEAD + fill, samples, count * sizeof *samples);
+	if (convolution->tail.count) {
+		memcpy (convolution->tail_input + convolution->tail_fill, samples,
+			count * sizeof *samples);
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		const float *window = input + fill + i + 1;
+		float sum = 0.0f;
+		for (unsigned int j = 0; j < CONVOLUTION_HEAD; j++) {
+			sum += convolution->direct[j] * window[j];
+		}
+		samples[i] = sum + convolution->head_output[fill + i];
+	}
+
+	if (convolution->reading >= 0) {
+		const float *tail = convolution->slots[convolution->reading].output
+			+ convolution->tail_fill;
+		for (unsigned int i = 0; i < count; i++) {
+			samples[i] += tail[i];
+		}
+	}
+
+	convolution->head_fill += count;
+	if (convolution->head_fill == CONVOLUTION_HEAD) {
+		if (convolution->head.count) {
+			convolution_stage_push (&convolution->head, input + CONVOLUTION_HEAD,
+				convolution->head_output);
+		}
+		memcpy (input, input + CONVOLUTION_HEAD, CONVOLUTION_HEAD * sizeof *input);
+		convolution->head_fill = 0;
+	}
+
+	if (convolution->tail.count) {
+		convolution->tail_fill += count;
+		if (convolution->tail_fill == CONVOLUTION_TAIL) {
+			convolution_tail_boundary (convolution);
+			convolution->tail_fill = 0;
+		}
+	}
+}
+
+static bool
+convolution_process (lively_node_t *node, unsigned int length) {
+	lively_node_convolution_t *node_convolution = (lively_node_convolution_t *) node;
+	lively_convolution_t *convolution = atomic_load (&node_convolution->convolution);
+	lively_param_t *dry = &node_convolution->params[LIVELY_CONVOLUTION_DRY];
+	lively_param_t *wet = &node_convolution->params[LIVELY_CONVOLUTION_WET];
+	float *samples = node_convolution->io.buffer;
+
+	float input[CONVOLUTION_HEAD];
+	float dry_values[CONVOLUTION_HEAD];
+	float wet_values[CONVOLUTION_HEAD];
+
+	for (unsigned int offset = 0; offset < length; ) {
+		unsigned int count = CONVOLUTION_HEAD
+			- (convolution ? convolution->head_fill : 0);
+		if (count > length - offset) {
+			count = length - offset;
+		}
+		float *block = samples + offset;
+
+		memcpy (input, block, count * sizeof *block);
+		if (convolution) {
+			convolution_run (convolution, block, count);
+		} else {
+			memset (block, 0, count * sizeof *block);
+		}
+
+		bool dry_moving = lively_param_ramp (dry, dry_values, count);
+		bool wet_moving = lively_param_ramp (wet, wet_values, count);
+		if (!dry_moving && !wet_moving) {
+			for (unsigned int i = 0; i < count; i++) {
+				block[i] = dry->current * input[i] + wet->current * block[i];
+			}
+		} else {
+			for (unsigned int i = 0; i < count; i++) {
+				float d = dry_moving ? dry_values[i] : dry->current;
+				float w = wet_moving ? wet_values[i] : wet->current;
+				block[i] = d * input[i] + w * block[i];
+			}
+		}
+
+		offset += count;
+	}
+
+	return true;
+}
+
+/**
+* Initializes a convolution node without an impulse response, which is
+* silent until one is set.
+*
+* @param node_convolution The convolution node
+*/
+void
+lively_node_convolution_init (lively_node_convolution_t *node_convolution) {
+	lively_node_t *node = (lively_node_t *) node_convolution;
+
+	lively_node_io_init (&node_convolution->io, LIVELY_NODE_PROCESS);
+	node->process = convolution_process;
+	atomic_init (&node_convolution->convolution, NULL);
+
+	lively_node_params_init (node, node_convolution->params, convolution_params,
+		LIVELY_CONVOLUTION_PARAMS);
+}
+
+/**
+* Replaces the impulse response of a convolution node.
+*
+* The response is partitioned and transformed on the calling thread, which
+* must not be the audio thread, and then swapped in. The previous response
+* is freed once the audio thread is done with it. The convolution restarts
+* from silence, so a ringing reverb tail is cut off.
+*
+* Not safe to call concurrently with itself, or with moving the node
+* between scenes.
+*
+* @param node_convolution The convolution node
+* @param response The impulse response, which is copied
+* @param length The number of samples of the response, or 0 to remove it
+*
+* @return A success value; on failure the previous response is kept
+*/
+bool
+lively_node_convolution_set_response (
+	lively_node_convolution_t *node_convolution,
+	const float *response,
+	size_t length) {
+
+	lively_node_t *node = (lively_node_t *) node_convolution;
+	lively_convolution_t *convolution = NULL;
+
+	if (length) {
+		convolution = convolution_create (response, length);
+		if (!convolution) {
+			return false;
+		}
+	}
+
+	lively_convolution_t *previous = atomic_exchange (&node_convolution->convolution, convolution);
+	if (node->scene) {
+		lively_scene_synchronize (node->scene);
+	}
+	convolution_free (previous);
+	return true;
+}
+
+/**
+* Returns how many tail blocks the worker delivered too late to be played
+* since the impulse response was set. Each was replaced by silence.
+*
+* @param node_convolution The convolution node
+*/
+unsigned int
+lively_node_convolution_get_late (lively_node_convolution_t *node_convolution) {
+	lively_convolution_t *convolution = atomic_load (&node_convolution->convolution);
+	return convolution ? atomic_load (&convolution->late) : 0;
+}
+
+/**
+* Stops the worker and frees the impulse response and buffer of a
+* convolution node.
+*
+* @param node The convolution node, which must not be in a scene
+*/
+void
+lively_node_convolution_destroy (lively_node_t *node) {
+	lively_node_convolution_t *node_convolution = (lively_node_convolution_t *) node;
+
+	convolution_free (atomic_exchange (&node_convolution->convolution, NULL));
+	lively_node_io_destroy (node);
+}
@@ -0,0 +1,56 @@
+#ifndef LIVELY_NODE_CONVOLUTION_H
+#define LIVELY_NODE_CONVOLUTION_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Size of the partitions computed on the audio thread; a power of two */
+#define LIVELY_CONVOLUTION_HEAD 64
+/** Size of the partitions computed in the background; a power of two */
+#define LIVELY_CONVOLUTION_TAIL 1024
+
+/** Parameters of a convolution node */
+enum lively_node_convolution_param {
+	LIVELY_CONVOLUTION_DRY, /**< Linear gain of the input, 0 by default */
+	LIVELY_CONVOLUTION_WET, /**< Linear gain of the convolved signal, 1 by default */
+	LIVELY_CONVOLUTION_PARAMS
+};
+
+struct lively_convolution;
+
+/**
+ * Convolves its input with an impulse response, such as a reverb or a
+ * speaker cabinet, without adding latency.
+ *
+ * The impulse response is split in three. Its first
+ * #LIVELY_CONVOLUTION_HEAD samples are applied directly, sample by sample.
+ * The rest, up to twice #LIVELY_CONVOLUTION_TAIL samples, is applied on the
+ * audio thread in uniform partitions of #LIVELY_CONVOLUTION_HEAD samples
+ * through the frequency domain. The tail beyond that is applied in
+ * partitions of #LIVELY_CONVOLUTION_TAIL samples by a worker thread, which
+ * gets a whole partition of time to deliver each block; blocks are handed
+ * back and forth through slots with atomic states, so the audio thread
+ * never waits for it.
+ *
+ * Everything derived from an impulse response lives in a
+ * #lively_convolution, which is prepared on the thread that sets the
+ * impulse response and swapped in atomically.
+ */
+typedef struct lively_node_convolution {
+	lively_node_io_t io;
+	_Atomic(struct lively_convolution *) convolution;
+	lively_param_t params[LIVELY_CONVOLUTION_PARAMS];
+} lively_node_convolution_t;
+
+void lively_node_convolution_init (lively_node_convolution_t *);
+void lively_node_convolution_destroy (lively_node_t *);
+bool lively_node_convolution_set_response (
+	lively_node_convolution_t *,
+	const float *response,
+	size_t length);
+unsigned int lively_node_convolution_get_late (lively_node_convolution_t *);
+
+#endif
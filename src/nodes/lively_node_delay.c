@@ -0,0 +1,597 @@
+/**
+ * @file lively_node_delay.c
+ * Lively Delay: Multi-tap, modulated delay lines on power of two rings
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_delay.h"
+
+#define DELAY_PI 3.14159265358979323846f
+#define DELAY_TAPS LIVELY_DELAY_TAPS
+#define DELAY_TILE LIVELY_KERNEL_TILE
+/**
+ * Shortest delay, in frames. Cubic interpolation reads two frames past the
+ * position of a tap, and those must be written before it reads them.
+ */
+#define DELAY_MIN 3.0f
+/** Frames a tap which is not moving reads for a tile */
+#define DELAY_SPAN (DELAY_TILE + 3)
+/** The rings are never sized for less than this rate */
+#define DELAY_RATE_MIN 48000
+
+#define DELAY_TAP_INFO(n, time, gain) \
+	{ \
+		.name = "time" #n, \
+		.type = LIVELY_PARAM_FLOAT, \
+		.min = 0.0f, \
+		.max = LIVELY_DELAY_TIME_MAX, \
+		.initial = time, \
+		.smoothing = LIVELY_SMOOTH_LINEAR, \
+		.smoothing_time = 0.05f \
+	}, { \
+		.name = "gain" #n, \
+		.type = LIVELY_PARAM_FLOAT, \
+		.min = -1.0f, \
+		.max = 1.0f, \
+		.initial = gain, \
+		.smoothing = LIVELY_SMOOTH_LINEAR, \
+		.smoothing_time = 0.02f \
+	}
+
+_Static_assert (DELAY_TAPS == 4, "One row of parameters per tap");
+
+static const lively_param_info_t delay_params[LIVELY_DELAY_PARAMS] = {
+	DELAY_TAP_INFO (1, 250.0f, 1.0f),
+	DELAY_TAP_INFO (2, 500.0f, 0.0f),
+	DELAY_TAP_INFO (3, 750.0f, 0.0f),
+	DELAY_TAP_INFO (4, 1000.0f, 0.0f),
+	[LIVELY_DELAY_SPREAD] = {
+		.name = "spread",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = LIVELY_DELAY_SPREAD_MAX,
+		.initial = 0.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_DELAY_DEPTH] = {
+		.name = "depth",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = LIVELY_DELAY_DEPTH_MAX,
+		.initial = 0.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_DELAY_RATE] = {
+		.name = "rate",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 20.0f,
+		.initial = 0.5f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_DELAY_FEEDBACK] = {
+		.name = "feedback",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = -0.99f,
+		.max = 0.99f,
+		.initial = 0.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	},
+	[LIVELY_DELAY_DRY] = {
+		.name = "dry",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 4.0f,
+		.initial = 0.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	},
+	[LIVELY_DELAY_WET] = {
+		.name = "wet",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 4.0f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	},
+	[LIVELY_DELAY_INTERPOLATION] = {
+		.name = "interpolation",
+		.type = LIVELY_PARAM_INT,
+		.min = LIVELY_DELAY_LINEAR,
+		.max = LIVELY_DELAY_ALLPASS,
+		.initial = LIVELY_DELAY_CUBIC,
+		.smoothing = LIVELY_SMOOTH_NONE
+	}
+};
+
+/**
+ * A value moving across a block: start + step * (n + 1) at frame n.
+ */
+typedef struct delay_ramp {
+	float start;
+	float step;
+} delay_ramp_t;
+
+/**
+ * The settings of a block, worked out from the parameters at its start.
+ */
+typedef struct delay_block {
+	delay_ramp_t time[DELAY_TAPS]; /**< In frames */
+	delay_ramp_t gain[DELAY_TAPS];
+	bool active[DELAY_TAPS];
+	delay_ramp_t feedback, dry, wet;
+	float spread; /**< In frames, for the last channel */
+	float depth; /**< In frames */
+	float increment; /**< Of the modulation phase per frame */
+	float rotation[2]; /**< Cosine and sine of the increment */
+	float limit; /**< Longest delay the rings hold, in frames */
+	unsigned int interpolation;
+} delay_block_t;
+
+static unsigned int
+delay_power_of_two (unsigned int count) {
+	unsigned int size = 1;
+	while (size < count) {
+		size <<= 1;
+	}
+	return size;
+}
+
+/**
+* Advances a parameter by a block. The step is taken before scaling, so that
+* a parameter at rest gives a ramp which does not move.
+*/
+static delay_ramp_t
+delay_ramp (lively_param_t *param, unsigned int length, double scale) {
+	delay_ramp_t ramp;
+	float start = param->current;
+	float end = lively_param_advance (param, length);
+
+	ramp.start = (float) (start * scale);
+	ramp.step = (float) ((end - start) * scale / length);
+	return ramp;
+}
+
+static float
+delay_at (const delay_ramp_t *ramp, unsigned int frame) {
+	return ramp->start + ramp->step * (float) (frame + 1);
+}
+
+static float
+delay_clamp (float frames, float limit) {
+	return fminf (fmaxf (frames, DELAY_MIN), limit);
+}
+
+/**
+* Rounds down without a call into the math library, so that loops over
+* every frame still vectorize.
+*/
+static int
+delay_floor (float value) {
+	int whole = (int) value;
+	return whole - (value < (float) whole);
+}
+
+static float
+delay_cubic (float xm1, float x0, float x1, float x2, float alpha) {
+	return x0 + 0.5f * alpha * (x1 - xm1
+		+ alpha * (2.0f * xm1 - 5.0f * x0 + 4.0f * x1 - x2
+		+ alpha * (3.0f * (x0 - x1) + x2 - xm1)));
+}
+
+/**
+* Reads a tile from a tap whose delay does not move, as one span of the
+* ring copied in at most two pieces.
+*
+* @param position Where the first frame of the tile goes in the ring
+* @param frames The delay, in frames
+* @param state The last output, for allpass interpolation
+*/
+static void
+delay_read_span (
+	const float *ring,
+	unsigned int mask,
+	unsigned int position,
+	float frames,
+	unsigned int count,
+	unsigned int interpolation,
+	float *state,
+	float *restrict output) {
+
+	float whole = floorf (-frames);
+	float alpha = -frames - whole;
+	unsigned int start = (position + (unsigned int) (int) whole - 1) & mask;
+	unsigned int total = count + 3;
+	unsigned int first = mask + 1 - start < total ? mask + 1 - start : total;
+	float span[DELAY_SPAN];
+
+	// span[n + 1] is the frame just before the position of the tap at
+	// frame n, so that cubic interpolation finds one frame before it.
+	memcpy (span, ring + start, first * sizeof *span);
+	memcpy (span + first, ring, (total - first) * sizeof *span);
+
+	switch (interpolation) {
+	case LIVELY_DELAY_LINEAR:
+		for (unsigned int n = 0; n < count; n++) {
+			output[n] = span[n + 1] + alpha * (span[n + 2] - span[n + 1]);
+		}
+		break;
+	case LIVELY_DELAY_CUBIC:
+		for (unsigned int n = 0; n < count; n++) {
+			output[n] = delay_cubic (span[n], span[n + 1], span[n + 2], span[n + 3], alpha);
+		}
+		break;
+	default: {
+		// Delays the later frame by the remaining fraction, 1 - alpha.
+		float eta = alpha / (2.0f - alpha);
+		float y = *state;
+		for (unsigned int n = 0; n < count; n++) {
+			y = eta * span[n + 2] + span[n + 1] - eta * y;
+			output[n] = y;
+		}
+		*state = y;
+		break;
+	}
+	}
+}
+
+/**
+* Reads a tile from a tap whose delay moves, gathering every frame from its
+* own position.
+*
+* @param frames The delay at each frame of the tile
+*/
+static void
+delay_read_moving (
+	const float *ring,
+	unsigned int mask,
+	unsigned int position,
+	const float *frames,
+	unsigned int count,
+	unsigned int interpolation,
+	float *state,
+	float *restrict output) {
+
+	switch (interpolation) {
+	case LIVELY_DELAY_LINEAR:
+		for (unsigned int n = 0; n < count; n++) {
+			float relative = (float) n - frames[n];
+			int whole = delay_floor (relative);
+			unsigned int index = position + (unsigned int) whole;
+			float x0 = ring[index & mask];
+			float x1 = ring[(index + 1) & mask];
+			output[n] = x0 + (relative - (float) whole) * (x1 - x0);
+		}
+		break;
+	case LIVELY_DELAY_CUBIC:
+		for (unsigned int n = 0; n < count; n++) {
+			float relative = (float) n - frames[n];
+			int whole = delay_floor (relative);
+			unsigned int index = position + (unsigned int) whole;
+			output[n] = delay_cubic (ring[(index - 1) & mask], ring[index & mask],
+				ring[(index + 1) & mask], ring[(index + 2) & mask], relative - (float) whole);
+		}
+		break;
+	default: {
+		float y = *state;
+		for (unsigned int n = 0; n < count; n++) {
+			float relative = (float) n - frames[n];
+			int whole = delay_floor (relative);
+			float alpha = relative - (float) whole;
+			float eta = alpha / (2.0f - alpha);
+			unsigned int index = position + (unsigned int) whole;
+			y = eta * ring[(index + 1) & mask] + ring[index & mask] - eta * y;
+			output[n] = y;
+		}
+		*state = y;
+		break;
+	}
+	}
+}
+
+/**
+* Reads a tile from a tap of a channel.
+*
+* @param modulation The modulation of the channel at each frame, in frames
+* @param offset The position of the tile in the block
+* @param extra The spread of the channel, in frames
+*/
+static void
+delay_read (
+	lively_node_delay_t *delay,
+	const delay_block_t *block,
+	unsigned int channel,
+	unsigned int tap,
+	const float *modulation,
+	unsigned int offset,
+	unsigned int count,
+	float extra,
+	float *output) {
+
+	const float *ring = delay->ring + (size_t) channel * (delay->ring_mask + 1);
+	const delay_ramp_t *time = &block->time[tap];
+	float *state = &delay->allpass[channel * DELAY_TAPS + tap];
+
+	if (time->step == 0.0f && block->depth == 0.0f) {
+		delay_read_span (ring, delay->ring_mask, delay->position,
+			delay_clamp (time->start + extra, block->limit),
+			count, block->interpolation, state, output);
+		return;
+	}
+
+	float frames[DELAY_TILE];
+	for (unsigned int n = 0; n < count; n++) {
+		frames[n] = delay_clamp (delay_at (time, offset + n) + extra + modulation[n],
+			block->limit);
+	}
+	delay_read_moving (ring, delay->ring_mask, delay->position, frames,
+		count, block->interpolation, state, output);
+}
+
+static void
+delay_write (lively_node_delay_t *delay, unsigned int channel, const float *input, unsigned int count) {
+	unsigned int size = delay->ring_mask + 1;
+	float *ring = delay->ring + (size_t) channel * size;
+	unsigned int first = size - delay->position < count ? size - delay->position : count;
+
+	memcpy (ring + delay->position, input, first * sizeof *input);
+	memcpy (ring, input + first, (count - first) * sizeof *input);
+}
+
+/**
+* Runs a tile of one channel: reads the taps, feeds the input and the
+* first tap back into the ring, and mixes the result in place.
+*/
+static void
+delay_channel (
+	lively_node_delay_t *delay,
+	const delay_block_t *block,
+	unsigned int channel,
+	unsigned int offset,
+	unsigned int count) {
+
+	float *x = delay->io.buffer + (size_t) channel * delay->stride + offset;
+	float extra = delay->channels > 1
+		? block->spread * (float) channel / (float) (delay->channels - 1) : 0.0f;
+	float modulation[DELAY_TILE];
+	float wet[DELAY_TILE];
+	float tap[DELAY_TILE];
+	unsigned int first = 0;
+
+	if (block->depth != 0.0f) {
+		// The sine is rotated from its value at the start of the tile,
+		// rather than evaluated at every frame.
+		float phase = delay->phase + (float) channel / (float) delay->channels
+			+ block->increment * (float) offset;
+		float sine = sinf (2.0f * DELAY_PI * phase);
+		float cosine = cosf (2.0f * DELAY_PI * phase);
+		float half = 0.5f * block->depth;
+		for (unsigned int n = 0; n < count; n++) {
+			float next = sine * block->rotation[0] + cosine * block->rotation[1];
+			modulation[n] = half * (1.0f + sine);
+			cosine = cosine * block->rotation[0] - sine * block->rotation[1];
+			sine = next;
+		}
+	} else {
+		memset (modulation, 0, count * sizeof *modulation);
+	}
+
+	memset (wet, 0, count * sizeof *wet);
+
+	if (block->feedback.start != 0.0f || block->feedback.step != 0.0f) {
+		// The tile is short enough that the first tap only reads frames
+		// written before it, so it can be fed back as a whole.
+		float fed[DELAY_TILE];
+		delay_read (delay, block, channel, 0, modulation, offset, count, extra, tap);
+		for (unsigned int n = 0; n < count; n++) {
+			fed[n] = x[n] + delay_at (&block->feedback, offset + n) * tap[n];
+			wet[n] += delay_at (&block->gain[0], offset + n) * tap[n];
+		}
+		delay_write (delay, channel, fed, count);
+		first = 1;
+	} else {
+		delay_write (delay, channel, x, count);
+	}
+
+	for (unsigned int t = first; t < DELAY_TAPS; t++) {
+		if (!block->active[t]) {
+			continue;
+		}
+		delay_read (delay, block, channel, t, modulation, offset, count, extra, tap);
+		for (unsigned int n = 0; n < count; n++) {
+			wet[n] += delay_at (&block->gain[t], offset + n) * tap[n];
+		}
+	}
+
+	for (unsigned int n = 0; n < count; n++) {
+		x[n] = delay_at (&block->dry, offset + n) * x[n]
+			+ delay_at (&block->wet, offset + n) * wet[n];
+	}
+}
+
+static bool
+delay_process (lively_node_t *node, unsigned int length) {
+	lively_node_delay_t *delay = (lively_node_delay_t *) node;
+	unsigned int sample_rate = node->sample_rate;
+	// In double, so that whole milliseconds stay whole frames.
+	double frames = sample_rate / 1000.0;
+	lively_param_t *params = delay->params;
+	delay_block_t block;
+
+	for (unsigned int t = 0; t < DELAY_TAPS; t++) {
+		lively_param_t *tap = &params[t * LIVELY_DELAY_TAP_PARAMS];
+		block.time[t] = delay_ramp (&tap[LIVELY_DELAY_TIME], length, frames);
+		block.gain[t] = delay_ramp (&tap[LIVELY_DELAY_GAIN], length, 1.0);
+		block.active[t] = block.gain[t].start != 0.0f || block.gain[t].step != 0.0f;
+	}
+	block.feedback = delay_ramp (&params[LIVELY_DELAY_FEEDBACK], length, 1.0);
+	block.dry = delay_ramp (&params[LIVELY_DELAY_DRY], length, 1.0);
+	block.wet = delay_ramp (&params[LIVELY_DELAY_WET], length, 1.0);
+	block.spread = (float) (lively_param_advance (&params[LIVELY_DELAY_SPREAD], length) * frames);
+	block.depth = (float) (lively_param_advance (&params[LIVELY_DELAY_DEPTH], length) * frames);
+	block.increment = lively_param_advance (&params[LIVELY_DELAY_RATE], length) / (float) sample_rate;
+	block.rotation[0] = cosf (2.0f * DELAY_PI * block.increment);
+	block.rotation[1] = sinf (2.0f * DELAY_PI * block.increment);
+	block.interpolation = (unsigned int) lively_param_advance (&params[LIVELY_DELAY_INTERPOLATION], length);
+	block.limit = (float) (delay->ring_mask + 1 - DELAY_TILE - 4);
+
+	bool feedback = block.feedback.start != 0.0f || block.feedback.step != 0.0f;
+
+	for (unsigned int offset = 0; offset < length;) {
+		unsigned int count = length - offset < DELAY_TILE ? length - offset : DELAY_TILE;
+
+		if (feedback) {
+			// The first tap of the first channel is the shortest, and moves
+			// linearly, so its least delay is at one end of the tile.
+			float lower = fminf (delay_at (&block.time[0], offset),
+				delay_at (&block.time[0], offset + count - 1));
+			unsigned int allowed = (unsigned int) delay_clamp (lower, block.limit) - 2;
+			if (count > allowed) {
+				count = allowed;
+			}
+		}
+
+		for (unsigned int c = 0; c < delay->channels; c++) {
+			delay_channel (delay, &block, c, offset, count);
+		}
+
+		delay->position = (delay->position + count) & delay->ring_mask;
+		offset += count;
+	}
+
+	delay->phase += block.increment * (float) length;
+	delay->phase -= floorf (delay->phase);
+	return true;
+}
+
+/**
+* Allocates room for length samples of every channel, and the rings, which
+* hold the longest delay at the sample rate of the node. The scene calls
+* this again whenever its rate changes, and the rings grow to match. Like
+* #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+delay_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_delay_t *delay = (lively_node_delay_t *) node;
+	unsigned int rate = node->sample_rate;
+	if (rate < DELAY_RATE_MIN) {
+		rate = DELAY_RATE_MIN;
+	}
+
+	float longest = LIVELY_DELAY_TIME_MAX + LIVELY_DELAY_SPREAD_MAX + LIVELY_DELAY_DEPTH_MAX;
+	unsigned int size = delay_power_of_two (
+		(unsigned int) ceilf (longest * rate / 1000.0f) + DELAY_TILE + 4);
+	bool grow_buffer = length > delay->stride;
+	bool grow_ring = !delay->ring || size > delay->ring_mask + 1;
+
+	if (!grow_buffer && !grow_ring) {
+		node->buffer_length = length;
+		return true;
+	}
+
+	float *buffer = grow_buffer
+		? malloc ((size_t) length * delay->channels * sizeof *buffer) : NULL;
+	float *ring = grow_ring
+		? calloc ((size_t) size * delay->channels, sizeof *ring) : NULL;
+	if ((grow_buffer && !buffer) || (grow_ring && !ring)) {
+		free (buffer);
+		free (ring);
+		return false;
+	}
+
+	if (grow_buffer) {
+		free (delay->io.buffer);
+		delay->io.buffer = buffer;
+		delay->stride = length;
+	}
+	if (grow_ring) {
+		free (delay->ring);
+		delay->ring = ring;
+		delay->ring_mask = size - 1;
+		delay->position = 0;
+	}
+
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+delay_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_delay_t *delay = (lively_node_delay_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!delay->io.buffer || index >= delay->channels) {
+		return NULL;
+	}
+	return delay->io.buffer + (size_t) index * delay->stride;
+}
+
+/**
+* Initializes a delay node with a single tap of 250 ms.
+*
+* @param delay The delay node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_DELAY_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_delay_init (lively_node_delay_t *delay, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) delay;
+
+	if (channels == 0) {
+		channels = LIVELY_DELAY_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	lively_node_io_init (&delay->io, LIVELY_NODE_PROCESS);
+	node->process = delay_process;
+	node->set_buffer_length = delay_set_buffer_length;
+	node->get_read_buffer = delay_get_buffer;
+	node->get_write_buffer = delay_get_buffer;
+
+	delay->allpass = calloc ((size_t) channels * DELAY_TAPS, sizeof *delay->allpass);
+	if (!delay->allpass) {
+		return false;
+	}
+
+	delay->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	delay->stride = 0;
+	delay->ring = NULL;
+	delay->ring_mask = 0;
+	delay->position = 0;
+	delay->phase = 0.0f;
+	lively_node_params_init (node, delay->params, delay_params, LIVELY_DELAY_PARAMS);
+
+	return true;
+}
+
+/**
+* Frees the buffers and rings of a delay node.
+*
+* @param node The delay node, which must not be in a scene
+*/
+void
+lively_node_delay_destroy (lively_node_t *node) {
+	lively_node_delay_t *delay = (lively_node_delay_t *) node;
+
+	free (delay->ring);
+	free (delay->allpass);
+	delay->ring = NULL;
+	delay->allpass = NULL;
+	delay->ring_mask = 0;
+	delay->stride = 0;
+	lively_node_io_destroy (node);
+}
@@ -0,0 +1,80 @@
+#ifndef LIVELY_NODE_DELAY_H
+#define LIVELY_NODE_DELAY_H
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Channels of a delay node when none are asked for */
+#define LIVELY_DELAY_DEFAULT_CHANNELS 2
+/** Number of read taps */
+#define LIVELY_DELAY_TAPS 4
+/** Longest tap time, in milliseconds */
+#define LIVELY_DELAY_TIME_MAX 2000.0f
+/** Deepest modulation, in milliseconds */
+#define LIVELY_DELAY_DEPTH_MAX 20.0f
+/** Widest spread between the first and the last channel, in milliseconds */
+#define LIVELY_DELAY_SPREAD_MAX 50.0f
+
+/** How taps read between samples */
+enum lively_delay_interpolation {
+	LIVELY_DELAY_LINEAR,
+	LIVELY_DELAY_CUBIC, /**< Catmull-Rom, over four samples */
+	LIVELY_DELAY_ALLPASS /**< A first order allpass, flat in magnitude */
+};
+
+/**
+ * Parameters of a tap. Tap t has parameters starting at
+ * t * #LIVELY_DELAY_TAP_PARAMS, named time1, gain1, time2 and so on.
+ */
+enum lively_delay_tap_param {
+	LIVELY_DELAY_TIME, /**< In milliseconds */
+	LIVELY_DELAY_GAIN, /**< Linear; 1 for the first tap and 0 for the others by default */
+	LIVELY_DELAY_TAP_PARAMS
+};
+
+/** Parameters of a delay node, after those of the taps */
+enum lively_node_delay_param {
+	/** In milliseconds, added to the taps of the last channel, and in proportion to the others */
+	LIVELY_DELAY_SPREAD = LIVELY_DELAY_TAPS * LIVELY_DELAY_TAP_PARAMS,
+	LIVELY_DELAY_DEPTH, /**< In milliseconds, added to the taps by a sine */
+	LIVELY_DELAY_RATE, /**< Of the sine, in Hz */
+	LIVELY_DELAY_FEEDBACK, /**< Of the first tap into the input */
+	LIVELY_DELAY_DRY, /**< Linear gain of the input, 0 by default */
+	LIVELY_DELAY_WET, /**< Linear gain of the taps, 1 by default */
+	LIVELY_DELAY_INTERPOLATION, /**< A #lively_delay_interpolation, cubic by default */
+	LIVELY_DELAY_PARAMS
+};
+
+/**
+ * A multi-tap delay line with modulation and feedback, for echoes,
+ * choruses and flangers.
+ *
+ * Every channel has a power of two ring, indexed by masking, and all of
+ * them share one allocation made when the node joins a scene, long enough
+ * for the longest time, spread and depth at the scene's sample rate. Moving
+ * the taps never allocates.
+ *
+ * A tap which is not moving reads its block as at most two contiguous
+ * spans of the ring, which are interpolated in vectorized loops; a moving
+ * tap gathers each frame at its own position. The modulation shifts the
+ * phase of each channel evenly around the cycle. With feedback, blocks are
+ * split so that the first tap only reads frames written before the split.
+ */
+typedef struct lively_node_delay {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	float *ring; /**< A ring of ring_mask + 1 samples per channel */
+	unsigned int ring_mask;
+	unsigned int position; /**< Where the next frame is written in every ring */
+	float phase; /**< Of the modulation, in cycles */
+	float *allpass; /**< The last output of each tap of each channel */
+
+	lively_param_t params[LIVELY_DELAY_PARAMS];
+} lively_node_delay_t;
+
+bool lively_node_delay_init (lively_node_delay_t *, unsigned int channels);
+void lively_node_delay_destroy (lively_node_t *);
+
+#endif
@@ -0,0 +1,350 @@
+/**
+ * @file lively_node_dynamics.c
+ * Lively Dynamics: Lookahead compression and brickwall limiting
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_dynamics.h"
+
+static const lively_param_info_t dynamics_params[LIVELY_DYNAMICS_PARAMS] = {
+	[LIVELY_DYNAMICS_THRESHOLD] = {
+		.name = "threshold",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = -60.0f,
+		.max = 0.0f,
+		.initial = 0.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_DYNAMICS_RATIO] = {
+		.name = "ratio",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 1.0f,
+		.max = LIVELY_DYNAMICS_RATIO_LIMIT,
+		.initial = LIVELY_DYNAMICS_RATIO_LIMIT,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_DYNAMICS_RELEASE] = {
+		.name = "release",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 1.0f,
+		.max = 5000.0f,
+		.initial = 100.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_DYNAMICS_MAKEUP] = {
+		.name = "makeup",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 24.0f,
+		.initial = 0.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	}
+};
+
+static unsigned int
+dynamics_power_of_two (unsigned int count) {
+	unsigned int size = 1;
+	while (size < count) {
+		size <<= 1;
+	}
+	return size;
+}
+
+/**
+* Works out the gain each frame of the block needs on its own, from the
+* loudest channel, in place of the levels.
+*/
+static void
+dynamics_detect (lively_node_dynamics_t *dynamics, unsigned int length, float threshold, float exponent) {
+	float *gain = dynamics->gain;
+
+	memset (gain, 0, length * sizeof *gain);
+	for (unsigned int c = 0; c < dynamics->channels; c++) {
+		const float *x = dynamics->io.buffer + (size_t) c * dynamics->stride;
+		for (unsigned int n = 0; n < length; n++) {
+			gain[n] = fmaxf (gain[n], fabsf (x[n]));
+		}
+	}
+
+	if (exponent == 1.0f) {
+		for (unsigned int n = 0; n < length; n++) {
+			gain[n] = threshold / fmaxf (gain[n], threshold);
+		}
+	} else {
+		// Above the threshold the output level moves by 1 / ratio of the
+		// input level: a gain of (threshold / level) ^ (1 - 1 / ratio).
+		for (unsigned int n = 0; n < length; n++) {
+			gain[n] = expf (exponent * logf (threshold / fmaxf (gain[n], threshold)));
+		}
+	}
+}
+
+/**
+* Turns the gain each frame needs into the gain applied to the frame the
+* delay line releases at the same time, lookahead frames older.
+*/
+static void
+dynamics_envelope (lively_node_dynamics_t *dynamics, unsigned int length, float release) {
+	float *gain = dynamics->gain;
+	float *deque_gain = dynamics->deque_gain;
+	unsigned int *deque_frame = dynamics->deque_frame;
+	unsigned int mask = dynamics->window_mask;
+	unsigned int head = dynamics->deque_head, tail = dynamics->deque_tail;
+	unsigned int span = dynamics->lookahead + 1;
+	float *window = dynamics->window;
+	double sum = dynamics->window_sum;
+	double scale = 1.0 / span;
+	float released = dynamics->released;
+	unsigned int frame = dynamics->frame;
+
+	for (unsigned int n = 0; n < length; n++, frame++) {
+		float needed = gain[n];
+
+		// The deque holds increasing gains of increasing frames, so its
+		// head is the minimum over the window.
+		while (tail != head && deque_gain[(tail - 1) & mask] >= needed) {
+			tail--;
+		}
+		deque_gain[tail & mask] = needed;
+		deque_frame[tail & mask] = frame;
+		tail++;
+		if (frame - deque_frame[head & mask] >= span) {
+			head++;
+		}
+		float held = deque_gain[head & mask];
+
+		released = held < released ? held : held + (released - held) * release;
+
+		sum += released - window[(frame - span) & mask];
+		window[frame & mask] = released;
+		gain[n] = (float) (sum * scale);
+	}
+
+	dynamics->deque_head = head;
+	dynamics->deque_tail = tail;
+	dynamics->window_sum = sum;
+	dynamics->released = released;
+	dynamics->frame = frame;
+}
+
+/**
+* Delays every channel by the lookahead and applies the gain, with the
+* makeup gain ramping from start by step per frame.
+*/
+static void
+dynamics_apply (lively_node_dynamics_t *dynamics, unsigned int length, float start, float step) {
+	unsigned int size = dynamics->delay_mask + 1;
+	unsigned int write = dynamics->delay_position;
+	unsigned int read = (write - dynamics->lookahead) & dynamics->delay_mask;
+	float *gain = dynamics->gain;
+
+	for (unsigned int n = 0; n < length; n++) {
+		gain[n] *= start + step * (float) (n + 1);
+	}
+
+	for (unsigned int c = 0; c < dynamics->channels; c++) {
+		float *restrict x = dynamics->io.buffer + (size_t) c * dynamics->stride;
+		float *ring = dynamics->delay + (size_t) c * size;
+
+		if (dynamics->lookahead) {
+			// The ring holds the lookahead and a block, so the block is
+			// written before the delayed one is read, each in at most two
+			// contiguous spans.
+			unsigned int first = size - write < length ? size - write : length;
+			memcpy (ring + write, x, first * sizeof *x);
+			memcpy (ring, x + first, (length - first) * sizeof *x);
+
+			first = size - read < length ? size - read : length;
+			memcpy (x, ring + read, first * sizeof *x);
+			memcpy (x + first, ring, (length - first) * sizeof *x);
+		}
+
+		for (unsigned int n = 0; n < length; n++) {
+			x[n] *= gain[n];
+		}
+	}
+
+	dynamics->delay_position = (write + length) & dynamics->delay_mask;
+}
+
+static bool
+dynamics_process (lively_node_t *node, unsigned int length) {
+	lively_node_dynamics_t *dynamics = (lively_node_dynamics_t *) node;
+	float sample_rate = (float) node->sample_rate;
+
+	float threshold = lively_param_advance (&dynamics->params[LIVELY_DYNAMICS_THRESHOLD], length);
+	float ratio = lively_param_advance (&dynamics->params[LIVELY_DYNAMICS_RATIO], length);
+	float release = lively_param_advance (&dynamics->params[LIVELY_DYNAMICS_RELEASE], length);
+	float makeup_start = dynamics->params[LIVELY_DYNAMICS_MAKEUP].current;
+	float makeup = lively_param_advance (&dynamics->params[LIVELY_DYNAMICS_MAKEUP], length);
+
+	float exponent = ratio >= LIVELY_DYNAMICS_RATIO_LIMIT ? 1.0f : 1.0f - 1.0f / ratio;
+	float start = powf (10.0f, makeup_start / 20.0f);
+	float end = powf (10.0f, makeup / 20.0f);
+
+	dynamics_detect (dynamics, length, powf (10.0f, threshold / 20.0f), exponent);
+	dynamics_envelope (dynamics, length, expf (-1000.0f / (release * sample_rate)));
+	dynamics_apply (dynamics, length, start, (end - start) / (float) length);
+
+	return true;
+}
+
+/**
+* Allocates room for length samples of every channel, and a delay line and
+* window for the lookahead, which is read from the latency of the node.
+* Like #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+dynamics_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_dynamics_t *dynamics = (lively_node_dynamics_t *) node;
+	unsigned int lookahead = node->latency < LIVELY_DYNAMICS_LOOKAHEAD_MAX
+		? node->latency : LIVELY_DYNAMICS_LOOKAHEAD_MAX;
+	unsigned int stride = length > dynamics->stride ? length : dynamics->stride;
+
+	if (stride == dynamics->stride && lookahead == dynamics->lookahead && dynamics->window) {
+		node->buffer_length = length;
+		return true;
+	}
+
+	// The deque briefly holds lookahead + 2 frames, the window looks back
+	// lookahead + 1 frames, and the delay line holds a block besides the
+	// lookahead.
+	unsigned int window_size = dynamics_power_of_two (lookahead + 2);
+	unsigned int delay_size = dynamics_power_of_two (lookahead + stride);
+
+	float *buffer = stride != dynamics->stride
+		? malloc ((size_t) stride * dynamics->channels * sizeof *buffer) : NULL;
+	float *gain = stride != dynamics->stride ? malloc (stride * sizeof *gain) : NULL;
+	float *delay = calloc ((size_t) delay_size * dynamics->channels, sizeof *delay);
+	float *deque_gain = malloc (window_size * sizeof *deque_gain);
+	unsigned int *deque_frame = malloc (window_size * sizeof *deque_frame);
+	float *window = malloc (window_size * sizeof *window);
+
+	if ((stride != dynamics->stride && (!buffer || !gain))
+		|| !delay || !deque_gain || !deque_frame || !window) {
+		free (buffer);
+		free (gain);
+		free (delay);
+		free (deque_gain);
+		free (deque_frame);
+		free (window);
+		return false;
+	}
+
+	if (stride != dynamics->stride) {
+		free (dynamics->io.buffer);
+		free (dynamics->gain);
+		dynamics->io.buffer = buffer;
+		dynamics->gain = gain;
+		dynamics->stride = stride;
+	}
+	free (dynamics->delay);
+	free (dynamics->deque_gain);
+	free (dynamics->deque_frame);
+	free (dynamics->window);
+
+	dynamics->lookahead = lookahead;
+	dynamics->delay = delay;
+	dynamics->delay_mask = delay_size - 1;
+	dynamics->delay_position = 0;
+	dynamics->deque_gain = deque_gain;
+	dynamics->deque_frame = deque_frame;
+	dynamics->deque_head = 0;
+	dynamics->deque_tail = 0;
+	dynamics->window = window;
+	dynamics->window_mask = window_size - 1;
+	for (unsigned int i = 0; i < window_size; i++) {
+		window[i] = 1.0f;
+	}
+	dynamics->window_sum = lookahead + 1;
+	dynamics->released = 1.0f;
+	dynamics->frame = 0;
+
+	node->latency = lookahead;
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+dynamics_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_dynamics_t *dynamics = (lively_node_dynamics_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!dynamics->io.buffer || index >= dynamics->channels) {
+		return NULL;
+	}
+	return dynamics->io.buffer + (size_t) index * dynamics->stride;
+}
+
+/**
+* Initializes a dynamics node as a limiter at 0 dBFS, with a lookahead of
+* #LIVELY_DYNAMICS_DEFAULT_LOOKAHEAD frames.
+*
+* @param dynamics The dynamics node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_DYNAMICS_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_dynamics_init (lively_node_dynamics_t *dynamics, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) dynamics;
+
+	if (channels == 0) {
+		channels = LIVELY_DYNAMICS_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	lively_node_io_init (&dynamics->io, LIVELY_NODE_PROCESS);
+	node->process = dynamics_process;
+	node->set_buffer_length = dynamics_set_buffer_length;
+	node->get_read_buffer = dynamics_get_buffer;
+	node->get_write_buffer = dynamics_get_buffer;
+	node->latency = LIVELY_DYNAMICS_DEFAULT_LOOKAHEAD;
+
+	dynamics->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	dynamics->stride = 0;
+	dynamics->gain = NULL;
+	dynamics->lookahead = 0;
+	dynamics->delay = NULL;
+	dynamics->deque_gain = NULL;
+	dynamics->deque_frame = NULL;
+	dynamics->window = NULL;
+	lively_node_params_init (node, dynamics->params, dynamics_params, LIVELY_DYNAMICS_PARAMS);
+
+	return true;
+}
+
+/**
+* Frees the buffers and delay lines of a dynamics node.
+*
+* @param node The dynamics node, which must not be in a scene
+*/
+void
+lively_node_dynamics_destroy (lively_node_t *node) {
+	lively_node_dynamics_t *dynamics = (lively_node_dynamics_t *) node;
+
+	free (dynamics->gain);
+	free (dynamics->delay);
+	free (dynamics->deque_gain);
+	free (dynamics->deque_frame);
+	free (dynamics->window);
+	dynamics->gain = NULL;
+	dynamics->delay = NULL;
+	dynamics->deque_gain = NULL;
+	dynamics->deque_frame = NULL;
+	dynamics->window = NULL;
+	dynamics->stride = 0;
+	lively_node_io_destroy (node);
+}
@@ -0,0 +1,70 @@
+#ifndef LIVELY_NODE_DYNAMICS_H
+#define LIVELY_NODE_DYNAMICS_H
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Channels of a dynamics node when none are asked for */
+#define LIVELY_DYNAMICS_DEFAULT_CHANNELS 2
+/** Lookahead of a new dynamics node, in frames; 5 ms at 48 kHz */
+#define LIVELY_DYNAMICS_DEFAULT_LOOKAHEAD 240
+/** Longest lookahead, in frames */
+#define LIVELY_DYNAMICS_LOOKAHEAD_MAX 32768
+/** A ratio of this much or more limits rather than compresses */
+#define LIVELY_DYNAMICS_RATIO_LIMIT 100.0f
+
+/** Parameters of a dynamics node */
+enum lively_node_dynamics_param {
+	LIVELY_DYNAMICS_THRESHOLD, /**< In dBFS, 0 by default */
+	LIVELY_DYNAMICS_RATIO, /**< #LIVELY_DYNAMICS_RATIO_LIMIT by default */
+	LIVELY_DYNAMICS_RELEASE, /**< In milliseconds */
+	LIVELY_DYNAMICS_MAKEUP, /**< In dB, applied after the gain reduction */
+	LIVELY_DYNAMICS_PARAMS
+};
+
+/**
+ * A lookahead compressor and brickwall limiter, whose channels are linked:
+ * they all follow the loudest one.
+ *
+ * The lookahead is the node's #lively_node::latency, so the scene delays
+ * parallel paths to match. It is taken when the node joins a scene or its
+ * buffers are resized; to change it, set the latency, then call
+ * #lively_scene_set_buffer_length.
+ *
+ * The gain needed by each input frame is held at its minimum over the
+ * lookahead window, with a monotonic deque, so that the cost per frame does
+ * not depend on the lookahead. The held gain recovers at the release rate,
+ * and is then averaged over the window, which fades it in over the
+ * lookahead and guarantees that no peak exceeds the threshold once
+ * limiting. The input is delayed by the lookahead through a power of two
+ * ring per channel, and the gain is applied to all channels in vectorized
+ * loops.
+ */
+typedef struct lively_node_dynamics {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+	float *gain; /**< Scratch: the level, then the gain, of each frame */
+
+	unsigned int lookahead; /**< In frames */
+	float *delay; /**< A ring of delay_mask + 1 samples per channel */
+	unsigned int delay_mask;
+	unsigned int delay_position;
+
+	/** The deque of held gains, and the window of released ones */
+	float *deque_gain;
+	unsigned int *deque_frame;
+	unsigned int deque_head, deque_tail;
+	float *window;
+	unsigned int window_mask;
+	double window_sum;
+	float released;
+	unsigned int frame;
+
+	lively_param_t params[LIVELY_DYNAMICS_PARAMS];
+} lively_node_dynamics_t;
+
+bool lively_node_dynamics_init (lively_node_dynamics_t *, unsigned int channels);
+void lively_node_dynamics_destroy (lively_node_t *);
+
+#endif
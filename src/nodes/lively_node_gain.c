@@ -0,0 +1,50 @@
+/**
+ * @file lively_node_gain.c
+ * Lively Gain: Scales a signal by a linear gain
+ */
+
+#include "lively_node_gain.h"
+
+static const lively_param_info_t gain_params[LIVELY_GAIN_PARAMS] = {
+	[LIVELY_GAIN_LEVEL] = {
+		.name = "level",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.0f,
+		.max = 16.0f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.02f
+	}
+};
+
+static void
+gain_kernel (lively_node_t *node, float *samples, unsigned int count) {
+	lively_param_t *level = &((lively_node_gain_t *) node)->params[LIVELY_GAIN_LEVEL];
+	float levels[LIVELY_KERNEL_TILE];
+
+	if (lively_param_ramp (level, levels, count)) {
+		for (unsigned int i = 0; i < count; i++) {
+			samples[i] *= levels[i];
+		}
+	} else {
+		for (unsigned int i = 0; i < count; i++) {
+			samples[i] *= level->current;
+		}
+	}
+}
+
+/**
+* Initializes a gain node with unity gain.
+*
+* @param gain The gain node
+*/
+void
+lively_node_gain_init (lively_node_gain_t *gain) {
+	lively_node_t *node = (lively_node_t *) gain;
+
+	lively_node_io_init (&gain->io, LIVELY_NODE_PROCESS);
+	node->process = lively_node_kernel_process;
+	node->kernel = gain_kernel;
+
+	lively_node_params_init (node, gain->params, gain_params, LIVELY_GAIN_PARAMS);
+}
@@ -0,0 +1,23 @@
+#ifndef LIVELY_NODE_GAIN_H
+#define LIVELY_NODE_GAIN_H
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Parameters of a gain node */
+enum lively_node_gain_param {
+	LIVELY_GAIN_LEVEL, /**< Linear gain, 1 by default */
+	LIVELY_GAIN_PARAMS
+};
+
+/**
+ * Multiplies its input by a gain. A kernel node.
+ */
+typedef struct lively_node_gain {
+	lively_node_io_t io;
+	lively_param_t params[LIVELY_GAIN_PARAMS];
+} lively_node_gain_t;
+
+void lively_node_gain_init (lively_node_gain_t *);
+
+#endif
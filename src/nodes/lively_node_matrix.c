@@ -0,0 +1,331 @@
+/**
+ * @file lively_node_matrix.c
+ * Lively Matrix: Mixes many inputs into many outputs through ramped gains
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_matrix.h"
+
+#define MATRIX_TILE LIVELY_KERNEL_TILE
+/** Room for the longest parameter name, gain_63_63 */
+#define MATRIX_NAME_SIZE 12
+
+_Static_assert (LIVELY_CHANNELS_MAX <= 99, "Parameter names have room for two digits");
+
+static const lively_param_info_t matrix_gain = {
+	.name = "gain",
+	.type = LIVELY_PARAM_FLOAT,
+	.min = -4.0f,
+	.max = 4.0f,
+	.initial = 0.0f,
+	.smoothing = LIVELY_SMOOTH_LINEAR,
+	.smoothing_time = 0.02f
+};
+
+/**
+* Advances every gain by a block, and lists the cells which are not silent
+* during it, output by output. While no gain is set or moving, the list of
+* the last block still holds and nothing is polled.
+*/
+static void
+matrix_update (lively_node_matrix_t *matrix, unsigned int length) {
+	lively_node_t *node = (lively_node_t *) matrix;
+	unsigned int changes = atomic_load_explicit (&node->params_changes, memory_order_acquire);
+	unsigned int inputs = matrix->inputs;
+	float scale = 1.0f / (float) length;
+
+	if (changes == matrix->changes && !matrix->moving) {
+		return;
+	}
+	matrix->changes = changes;
+	matrix->moving = false;
+
+	for (unsigned int o = 0; o < matrix->outputs; o++) {
+		lively_param_t *params = matrix->params + (size_t) o * inputs;
+		lively_matrix_cell_t *cells = matrix->cells + (size_t) o * inputs;
+		unsigned int count = 0;
+
+		for (unsigned int i = 0; i < inputs; i++) {
+			float start = params[i].current;
+			float end = lively_param_advance (&params[i], length);
+			if (end != start || params[i].remaining) {
+				// The list must be made again once the gain comes to rest.
+				matrix->moving = true;
+			}
+			if (start == 0.0f && end == 0.0f) {
+				continue;
+			}
+			cells[count].input = i;
+			cells[count].start = start;
+			cells[count].step = (end - start) * scale;
+			count++;
+		}
+
+		matrix->cells_count[o] = count;
+	}
+}
+
+/**
+* Adds four inputs, each through its gain, to a tile of an output.
+*
+* @param position The position of the tile in the block, for ramps
+*/
+static void
+matrix_mix4 (
+	float *restrict output,
+	const float *restrict x0,
+	const float *restrict x1,
+	const float *restrict x2,
+	const float *restrict x3,
+	const lively_matrix_cell_t *cells,
+	unsigned int count,
+	unsigned int position) {
+
+	if (cells[0].step == 0.0f && cells[1].step == 0.0f
+		&& cells[2].step == 0.0f && cells[3].step == 0.0f) {
+
+		float g0 = cells[0].start, g1 = cells[1].start;
+		float g2 = cells[2].start, g3 = cells[3].start;
+		for (unsigned int n = 0; n < count; n++) {
+			output[n] += g0 * x0[n] + g1 * x1[n] + g2 * x2[n] + g3 * x3[n];
+		}
+		return;
+	}
+
+	float s0 = cells[0].start, s1 = cells[1].start;
+	float s2 = cells[2].start, s3 = cells[3].start;
+	float d0 = cells[0].step, d1 = cells[1].step;
+	float d2 = cells[2].step, d3 = cells[3].step;
+	for (unsigned int n = 0; n < count; n++) {
+		float t = (float) (position + n + 1);
+		output[n] += (s0 + d0 * t) * x0[n] + (s1 + d1 * t) * x1[n]
+			+ (s2 + d2 * t) * x2[n] + (s3 + d3 * t) * x3[n];
+	}
+}
+
+/**
+* Adds one input, through its gain, to a tile of an output.
+*/
+static void
+matrix_mix1 (
+	float *restrict output,
+	const float *restrict x,
+	const lively_matrix_cell_t *cell,
+	unsigned int count,
+	unsigned int position) {
+
+	float start = cell->start, step = cell->step;
+
+	if (step == 0.0f) {
+		for (unsigned int n = 0; n < count; n++) {
+			output[n] += start * x[n];
+		}
+		return;
+	}
+	for (unsigned int n = 0; n < count; n++) {
+		output[n] += (start + step * (float) (position + n + 1)) * x[n];
+	}
+}
+
+static bool
+matrix_process (lively_node_t *node, unsigned int length) {
+	lively_node_matrix_t *matrix = (lively_node_matrix_t *) node;
+	unsigned int stride = matrix->stride;
+	const float *input = matrix->io.buffer;
+
+	matrix_update (matrix, length);
+
+	for (unsigned int o = 0; o < matrix->outputs; o++) {
+		const lively_matrix_cell_t *cells = matrix->cells + (size_t) o * matrix->inputs;
+		unsigned int count = matrix->cells_count[o];
+		float *output = matrix->output + (size_t) o * stride;
+
+		memset (output, 0, length * sizeof *output);
+		if (count == 0) {
+			continue;
+		}
+
+		// Tiles keep the sum in cache while the cells stream past it.
+		for (unsigned int offset = 0; offset < length; offset += MATRIX_TILE) {
+			unsigned int tile = length - offset < MATRIX_TILE ? length - offset : MATRIX_TILE;
+			unsigned int c = 0;
+
+			for (; c + 4 <= count; c += 4) {
+				matrix_mix4 (output + offset,
+					input + (size_t) cells[c].input * stride + offset,
+					input + (size_t) cells[c + 1].input * stride + offset,
+					input + (size_t) cells[c + 2].input * stride + offset,
+					input + (size_t) cells[c + 3].input * stride + offset,
+					cells + c, tile, offset);
+			}
+			for (; c < count; c++) {
+				matrix_mix1 (output + offset,
+					input + (size_t) cells[c].input * stride + offset,
+					cells + c, tile, offset);
+			}
+		}
+	}
+
+	// The scene only writes inputs which have plugs; clear them all, so
+	// that one whose plug was removed does not repeat its last block.
+	for (unsigned int i = 0; i < matrix->inputs; i++) {
+		memset (matrix->io.buffer + (size_t) i * stride, 0, length * sizeof (float));
+	}
+
+	return true;
+}
+
+/**
+* Allocates room for length samples of every input and output. Like
+* #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+matrix_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_matrix_t *matrix = (lively_node_matrix_t *) node;
+
+	if (length <= matrix->stride) {
+		node->buffer_length = length;
+		return true;
+	}
+
+	float *input = calloc ((size_t) length * matrix->inputs, sizeof *input);
+	float *output = calloc ((size_t) length * matrix->outputs, sizeof *output);
+	if (!input || !output) {
+		free (input);
+		free (output);
+		return false;
+	}
+
+	free (matrix->io.buffer);
+	free (matrix->output);
+	matrix->io.buffer = input;
+	matrix->output = output;
+	matrix->stride = length;
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of an input, or NULL if the node does not have it.
+*/
+static float *
+matrix_get_write_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_matrix_t *matrix = (lively_node_matrix_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!matrix->io.buffer || index >= matrix->inputs) {
+		return NULL;
+	}
+	return matrix->io.buffer + (size_t) index * matrix->stride;
+}
+
+/**
+* Returns the buffer of an output, or NULL if the node does not have it.
+*/
+static float *
+matrix_get_read_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_matrix_t *matrix = (lively_node_matrix_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!matrix->output || index >= matrix->outputs) {
+		return NULL;
+	}
+	return matrix->output + (size_t) index * matrix->stride;
+}
+
+/**
+* Initializes a matrix node with every gain at zero.
+*
+* @param matrix The matrix node
+* @param inputs The number of inputs, up to #LIVELY_CHANNELS_MAX, or 0 for
+* #LIVELY_MATRIX_DEFAULT_CHANNELS
+* @param outputs The number of outputs, up to #LIVELY_CHANNELS_MAX, or 0 for
+* as many as inputs
+*
+* @return A success value
+*/
+bool
+lively_node_matrix_init (lively_node_matrix_t *matrix, unsigned int inputs, unsigned int outputs) {
+	lively_node_t *node = (lively_node_t *) matrix;
+
+	if (inputs == 0) {
+		inputs = LIVELY_MATRIX_DEFAULT_CHANNELS;
+	}
+	if (outputs == 0) {
+		outputs = inputs;
+	}
+	if (inputs > LIVELY_CHANNELS_MAX || outputs > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	lively_node_io_init (&matrix->io, LIVELY_NODE_PROCESS);
+	node->process = matrix_process;
+	node->set_buffer_length = matrix_set_buffer_length;
+	node->get_read_buffer = matrix_get_read_buffer;
+	node->get_write_buffer = matrix_get_write_buffer;
+
+	size_t count = (size_t) inputs * outputs;
+	matrix->inputs = inputs;
+	matrix->outputs = outputs;
+	node->read_channels = outputs;
+	node->write_channels = inputs;
+	matrix->stride = 0;
+	matrix->output = NULL;
+	matrix->moving = true;
+	matrix->changes = 0;
+	matrix->cells = malloc (count * sizeof *matrix->cells);
+	matrix->cells_count = calloc (outputs, sizeof *matrix->cells_count);
+	matrix->infos = malloc (count * sizeof *matrix->infos);
+	matrix->names = malloc (count * MATRIX_NAME_SIZE);
+	matrix->params = malloc (count * sizeof *matrix->params);
+
+	if (!matrix->cells || !matrix->cells_count
+		|| !matrix->infos || !matrix->names || !matrix->params) {
+		lively_node_matrix_destroy (node);
+		return false;
+	}
+
+	for (unsigned int o = 0; o < outputs; o++) {
+		for (unsigned int i = 0; i < inputs; i++) {
+			size_t index = (size_t) o * inputs + i;
+			char *name = matrix->names + index * MATRIX_NAME_SIZE;
+
+			snprintf (name, MATRIX_NAME_SIZE, "gain_%u_%u", i, o);
+			matrix->infos[index] = matrix_gain;
+			matrix->infos[index].name = name;
+		}
+	}
+	lively_node_params_init (node, matrix->params, matrix->infos, (unsigned int) count);
+
+	return true;
+}
+
+/**
+* Frees the buffers and gains of a matrix node.
+*
+* @param node The matrix node, which must not be in a scene
+*/
+void
+lively_node_matrix_destroy (lively_node_t *node) {
+	lively_node_matrix_t *matrix = (lively_node_matrix_t *) node;
+
+	free (matrix->output);
+	free (matrix->cells);
+	free (matrix->cells_count);
+	free (matrix->infos);
+	free (matrix->names);
+	free (matrix->params);
+	matrix->output = NULL;
+	matrix->cells = NULL;
+	matrix->cells_count = NULL;
+	matrix->infos = NULL;
+	matrix->names = NULL;
+	matrix->params = NULL;
+	matrix->stride = 0;
+	node->params = NULL;
+	node->params_count = 0;
+	lively_node_io_destroy (node);
+}
@@ -0,0 +1,55 @@
+#ifndef LIVELY_NODE_MATRIX_H
+#define LIVELY_NODE_MATRIX_H
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Inputs and outputs of a matrix node when none are asked for */
+#define LIVELY_MATRIX_DEFAULT_CHANNELS 2
+
+/**
+ * A gain of the matrix which is not zero during a block.
+ */
+typedef struct lively_matrix_cell {
+	unsigned int input;
+	float start; /**< The gain at the start of the block */
+	float step; /**< The change of the gain per sample */
+} lively_matrix_cell_t;
+
+/**
+ * Mixes any number of inputs into any number of outputs through a matrix of
+ * smoothed gains, such as a set of monitor mixes.
+ *
+ * Plugs into the node feed its input channels, and plugs out of it read its
+ * output channels. The gain from input i to output o is parameter
+ * o * inputs + i, named gain_<i>_<o>, and is 0 by default.
+ *
+ * The gains which are not zero are gathered into a sparse list, output by
+ * output, whenever a gain is set or moving, so silent cells cost nothing. Each
+ * output is then computed in tiles of #LIVELY_KERNEL_TILE samples, taking
+ * its cells four at a time, so that the sum stays in cache and the loops
+ * over samples vectorize. Inputs are cleared after use, so that an input
+ * whose plug was removed is silent rather than stale.
+ */
+typedef struct lively_node_matrix {
+	lively_node_io_t io; /**< Holds the inputs */
+	unsigned int inputs;
+	unsigned int outputs;
+	unsigned int stride; /**< Samples between the starts of two channels */
+	float *output;
+
+	/** The cells of output o start at o * inputs; cells_count[o] are in use */
+	lively_matrix_cell_t *cells;
+	unsigned int *cells_count;
+	unsigned int changes; /**< #lively_node::params_changes when they were listed */
+	bool moving; /**< Whether a gain moved during the last block */
+
+	lively_param_info_t *infos;
+	char *names;
+	lively_param_t *params;
+} lively_node_matrix_t;
+
+bool lively_node_matrix_init (lively_node_matrix_t *, unsigned int inputs, unsigned int outputs);
+void lively_node_matrix_destroy (lively_node_t *);
+
+#endif
@@ -0,0 +1,554 @@
+/**
+ * @file lively_node_meter.c
+ * Lively Meter: Peak, RMS and loudness metering
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_meter.h"
+
+#define METER_PI 3.14159265358979323846
+#define METER_LANES LIVELY_BIQUAD_LANES
+#define METER_TILE LIVELY_KERNEL_TILE
+/** Set in #lively_node_meter::middle when the reading there was not taken */
+#define METER_FRESH 4u
+
+static const lively_param_info_t meter_params[LIVELY_METER_PARAMS] = {
+	[LIVELY_METER_TRUE_PEAK] = {
+		.name = "truepeak",
+		.type = LIVELY_PARAM_INT,
+		.min = 0.0f,
+		.max = 1.0f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	}
+};
+
+/**
+* Returns the loudness of a mean square of weighted samples, in LUFS.
+*/
+static float
+meter_loudness (double energy) {
+	if (energy <= 0.0) {
+		return LIVELY_METER_FLOOR;
+	}
+	return fmaxf ((float) (-0.691 + 10.0 * log10 (energy)), LIVELY_METER_FLOOR);
+}
+
+static float *
+meter_state (lively_node_meter_t *meter, unsigned int group, unsigned int section) {
+	return meter->state + (group * 2 + section) * 2 * METER_LANES;
+}
+
+/**
+* Designs the K-weighting for a sample rate, and starts a step over. The
+* shelf and the high-pass are those of BS.1770 at 48 kHz, found again at
+* other rates through the bilinear transform of their analog prototypes.
+*/
+static void
+meter_set_sample_rate (lively_node_meter_t *meter, unsigned int sample_rate) {
+	unsigned int groups = (meter->channels + METER_LANES - 1) / METER_LANES;
+	lively_biquad_coefficients_t *shelf = &meter->weighting[0];
+	lively_biquad_coefficients_t *highpass = &meter->weighting[1];
+
+	double k = tan (METER_PI * 1681.974450955533 / sample_rate);
+	double q = 0.7071752369554196;
+	double high = pow (10.0, 3.999843853973347 / 20.0);
+	double band = pow (high, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+	shelf->b0 = (float) ((high + band * k / q + k * k) / a0);
+	shelf->b1 = (float) (2.0 * (k * k - high) / a0);
+	shelf->b2 = (float) ((high - band * k / q + k * k) / a0);
+	shelf->a1 = (float) (2.0 * (k * k - 1.0) / a0);
+	shelf->a2 = (float) ((1.0 - k / q + k * k) / a0);
+
+	k = tan (METER_PI * 38.13547087602444 / sample_rate);
+	q = 0.5003270373238773;
+	a0 = 1.0 + k / q + k * k;
+	highpass->b0 = 1.0f;
+	highpass->b1 = -2.0f;
+	highpass->b2 = 1.0f;
+	highpass->a1 = (float) (2.0 * (k * k - 1.0) / a0);
+	highpass->a2 = (float) ((1.0 - k / q + k * k) / a0);
+	memset (meter->state, 0, (size_t) groups * 2 * 2 * METER_LANES * sizeof *meter->state);
+
+	meter->sample_rate = sample_rate;
+	meter->step_length = (sample_rate + 5) / 10;
+	meter->step_position = 0;
+	memset (meter->energy, 0, sizeof meter->energy);
+	meter->weighted = 0.0;
+}
+
+/**
+* Forgets every gating block, so that the integrated loudness starts over.
+*/
+static void
+meter_clear_gating (lively_node_meter_t *meter) {
+	memset (meter->histogram_count, 0, sizeof meter->histogram_count);
+	memset (meter->histogram_energy, 0, sizeof meter->histogram_energy);
+	meter->gated_count = 0;
+	meter->gated_energy = 0.0;
+	meter->gated_from = meter->steps;
+	meter->integrated = LIVELY_METER_FLOOR;
+}
+
+/**
+* Raises a span of a channel to the oversampled rate and keeps its highest
+* level.
+*/
+static void
+meter_true_peak (lively_node_meter_t *meter, unsigned int channel, const float *x, unsigned int count) {
+	float peak = meter->true_peak[channel];
+
+	for (unsigned int offset = 0; offset < count; offset += LIVELY_HALFBAND_BLOCK) {
+		unsigned int frames = count - offset < LIVELY_HALFBAND_BLOCK
+			? count - offset : LIVELY_HALFBAND_BLOCK;
+		unsigned int samples = frames * LIVELY_METER_TRUE_PEAK_FACTOR;
+
+		lively_halfband_up (&meter->halfbands[channel], x + offset, meter->scratch, frames);
+		for (unsigned int n = 0; n < samples; n++) {
+			peak = fmaxf (peak, fabsf (meter->scratch[n]));
+		}
+	}
+
+	meter->true_peak[channel] = peak;
+}
+
+/**
+* Runs one section of the K-weighting over an interleaved tile, in
+* transposed direct form II, across lanes.
+*/
+static void
+meter_section (
+	float (*tile)[METER_LANES],
+	unsigned int count,
+	float *state,
+	const lively_biquad_coefficients_t *k) {
+
+	float b0 = k->b0, b1 = k->b1, b2 = k->b2;
+	float a1 = k->a1, a2 = k->a2;
+	float z1[METER_LANES], z2[METER_LANES];
+	memcpy (z1, state, sizeof z1);
+	memcpy (z2, state + METER_LANES, sizeof z2);
+
+	for (unsigned int n = 0; n < count; n++) {
+		for (unsigned int l = 0; l < METER_LANES; l++) {
+			float x = tile[n][l];
+			float y = b0 * x + z1[l];
+			z1[l] = b1 * x - a1 * y + z2[l];
+			z2[l] = b2 * x - a2 * y;
+			tile[n][l] = y;
+		}
+	}
+
+	memcpy (state, z1, sizeof z1);
+	memcpy (state + METER_LANES, z2, sizeof z2);
+}
+
+/**
+* Weights a span of every channel and adds up its squares. The lanes past
+* the last channel hold silence, which adds nothing.
+*/
+static void
+meter_weight (lively_node_meter_t *meter, unsigned int offset, unsigned int count) {
+	float tile[METER_TILE][METER_LANES];
+	float sums[METER_LANES] = { 0.0f };
+	unsigned int channels = meter->channels;
+	unsigned int groups = (channels + METER_LANES - 1) / METER_LANES;
+
+	for (unsigned int position = 0; position < count; position += METER_TILE) {
+		unsigned int frames = count - position < METER_TILE ? count - position : METER_TILE;
+
+		for (unsigned int g = 0; g < groups; g++) {
+			unsigned int first = g * METER_LANES;
+			unsigned int lanes = channels - first < METER_LANES ? channels - first : METER_LANES;
+			const float *samples = meter->io.buffer + (size_t) first * meter->stride
+				+ offset + position;
+
+			for (unsigned int l = 0; l < lanes; l++) {
+				const float *channel = samples + (size_t) l * meter->stride;
+				for (unsigned int n = 0; n < frames; n++) {
+					tile[n][l] = channel[n];
+				}
+			}
+			for (unsigned int l = lanes; l < METER_LANES; l++) {
+				for (unsigned int n = 0; n < frames; n++) {
+					tile[n][l] = 0.0f;
+				}
+			}
+
+			meter_section (tile, frames, meter_state (meter, g, 0), &meter->weighting[0]);
+			meter_section (tile, frames, meter_state (meter, g, 1), &meter->weighting[1]);
+
+			for (unsigned int n = 0; n < frames; n++) {
+				for (unsigned int l = 0; l < METER_LANES; l++) {
+					sums[l] += tile[n][l] * tile[n][l];
+				}
+			}
+		}
+	}
+
+	double sum = 0.0;
+	for (unsigned int l = 0; l < METER_LANES; l++) {
+		sum += sums[l];
+	}
+	meter->weighted += sum;
+}
+
+/**
+* Measures a span of the block which does not cross the end of a step.
+*/
+static void
+meter_measure (lively_node_meter_t *meter, unsigned int offset, unsigned int count, bool oversampling) {
+	for (unsigned int c = 0; c < meter->channels; c++) {
+		const float *x = meter->io.buffer + (size_t) c * meter->stride + offset;
+		float peak = meter->peak[c];
+		float sum = 0.0f;
+
+		for (unsigned int n = 0; n < count; n++) {
+			peak = fmaxf (peak, fabsf (x[n]));
+			sum += x[n] * x[n];
+		}
+		meter->peak[c] = peak;
+		meter->energy[c] += sum;
+
+		if (oversampling) {
+			meter_true_peak (meter, c, x, count);
+		}
+	}
+
+	meter_weight (meter, offset, count);
+}
+
+/**
+* Adds a gating block to the histogram, if it is above the absolute gate,
+* and works out the integrated loudness again. The relative gate is 10 LU
+* below the loudness of every block above the absolute one.
+*/
+static void
+meter_gate (lively_node_meter_t *meter, double energy) {
+	double loudness = meter_loudness (energy);
+
+	if (loudness < LIVELY_METER_HISTOGRAM_MIN) {
+		return;
+	}
+
+	unsigned int bin = (unsigned int) ((loudness - LIVELY_METER_HISTOGRAM_MIN) * 10.0);
+	if (bin >= LIVELY_METER_HISTOGRAM_BINS) {
+		bin = LIVELY_METER_HISTOGRAM_BINS - 1;
+	}
+	meter->histogram_count[bin]++;
+	meter->histogram_energy[bin] += energy;
+	meter->gated_count++;
+	meter->gated_energy += energy;
+
+	double gate = meter_loudness (meter->gated_energy / (double) meter->gated_count) - 10.0;
+	unsigned int first = gate > LIVELY_METER_HISTOGRAM_MIN
+		? (unsigned int) ((gate - LIVELY_METER_HISTOGRAM_MIN) * 10.0) : 0;
+	unsigned long long count = 0;
+	double sum = 0.0;
+
+	for (unsigned int b = first; b < LIVELY_METER_HISTOGRAM_BINS; b++) {
+		count += meter->histogram_count[b];
+		sum += meter->histogram_energy[b];
+	}
+	meter->integrated = count ? meter_loudness (sum / (double) count) : LIVELY_METER_FLOOR;
+}
+
+/**
+* Ends a step: keeps its mean squares, and works out the levels over the
+* windows which end with it.
+*/
+static void
+meter_step (lively_node_meter_t *meter) {
+	double scale = 1.0 / (double) meter->step_length;
+	double *energy = meter->step_energy[meter->steps % LIVELY_METER_MOMENTARY_STEPS];
+
+	for (unsigned int c = 0; c < meter->channels; c++) {
+		energy[c] = meter->energy[c] * scale;
+		meter->energy[c] = 0.0;
+	}
+	meter->step_weighted[meter->steps % LIVELY_METER_SHORT_TERM_STEPS] = meter->weighted * scale;
+	meter->weighted = 0.0;
+	meter->steps++;
+
+	for (unsigned int c = 0; c < meter->channels; c++) {
+		double sum = 0.0;
+		for (unsigned int s = 0; s < LIVELY_METER_MOMENTARY_STEPS; s++) {
+			sum += meter->step_energy[s][c];
+		}
+		meter->rms[c] = (float) sqrt (sum / LIVELY_METER_MOMENTARY_STEPS);
+	}
+
+	double momentary = 0.0, short_term = 0.0;
+	for (unsigned int s = 0; s < LIVELY_METER_SHORT_TERM_STEPS; s++) {
+		double weighted = meter->step_weighted[(meter->steps - 1 - s) % LIVELY_METER_SHORT_TERM_STEPS];
+		if (s < LIVELY_METER_MOMENTARY_STEPS) {
+			momentary += weighted;
+		}
+		short_term += weighted;
+	}
+	momentary /= LIVELY_METER_MOMENTARY_STEPS;
+	short_term /= LIVELY_METER_SHORT_TERM_STEPS;
+
+	meter->momentary = meter_loudness (momentary);
+	meter->short_term = meter_loudness (short_term);
+	if (meter->steps - meter->gated_from >= LIVELY_METER_MOMENTARY_STEPS) {
+		meter_gate (meter, momentary);
+	}
+}
+
+/**
+* Publishes the levels into the back reading and swaps it into the middle.
+* While the reading in the middle has not been taken, its peaks are
+* carried into the one which replaces it. Should the reader take it in
+* between, a peak is shown twice, but never missed.
+*/
+static void
+meter_publish (lively_node_meter_t *meter) {
+	lively_meter_reading_t *reading = &meter->readings[meter->back];
+	unsigned int channels = meter->channels;
+	bool missed = atomic_load_explicit (&meter->middle, memory_order_relaxed) & METER_FRESH;
+
+	reading->frames = meter->frames;
+	reading->channels = channels;
+	for (unsigned int c = 0; c < channels; c++) {
+		reading->peak[c] = missed ? fmaxf (meter->peak[c], meter->carry_peak[c]) : meter->peak[c];
+		reading->true_peak[c] = missed
+			? fmaxf (meter->true_peak[c], meter->carry_true_peak[c]) : meter->true_peak[c];
+		meter->peak[c] = 0.0f;
+		meter->true_peak[c] = 0.0f;
+	}
+	memcpy (meter->carry_peak, reading->peak, channels * sizeof *reading->peak);
+	memcpy (meter->carry_true_peak, reading->true_peak, channels * sizeof *reading->true_peak);
+	memcpy (reading->rms, meter->rms, channels * sizeof *meter->rms);
+	reading->momentary = meter->momentary;
+	reading->short_term = meter->short_term;
+	reading->integrated = meter->integrated;
+
+	unsigned int old = atomic_exchange_explicit (&meter->middle, meter->back | METER_FRESH,
+		memory_order_acq_rel);
+	meter->back = old & ~METER_FRESH;
+}
+
+static bool
+meter_process (lively_node_t *node, unsigned int length) {
+	lively_node_meter_t *meter = (lively_node_meter_t *) node;
+	bool oversampling = lively_param_advance (&meter->params[LIVELY_METER_TRUE_PEAK], length) != 0.0f;
+
+	if (atomic_exchange_explicit (&meter->reset, false, memory_order_acquire)) {
+		meter_clear_gating (meter);
+	}
+	if (oversampling && !meter->oversampling) {
+		// The history of the filters is stale.
+		for (unsigned int c = 0; c < meter->channels; c++) {
+			lively_halfband_reset (&meter->halfbands[c]);
+		}
+	}
+	meter->oversampling = oversampling;
+
+	for (unsigned int offset = 0; offset < length; ) {
+		unsigned int count = meter->step_length - meter->step_position;
+		if (count > length - offset) {
+			count = length - offset;
+		}
+
+		meter_measure (meter, offset, count, oversampling);
+		meter->step_position += count;
+		if (meter->step_position == meter->step_length) {
+			meter_step (meter);
+			meter->step_position = 0;
+		}
+		offset += count;
+	}
+
+	meter->frames += length;
+	meter_publish (meter);
+	return true;
+}
+
+/**
+* Allocates room for length samples of every channel, and designs the
+* K-weighting for the sample rate of the node, which the scene sets before
+* calling this. Like #lively_node_io_set_buffer_length, nothing changes on
+* failure.
+*/
+static bool
+meter_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_meter_t *meter = (lively_node_meter_t *) node;
+
+	if (length > meter->stride) {
+		float *buffer = calloc ((size_t) length * meter->channels, sizeof *buffer);
+		if (!buffer) {
+			return false;
+		}
+		free (meter->io.buffer);
+		meter->io.buffer = buffer;
+		meter->stride = length;
+	}
+	if (node->sample_rate && node->sample_rate != meter->sample_rate) {
+		meter_set_sample_rate (meter, node->sample_rate);
+	}
+
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+meter_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_meter_t *meter = (lively_node_meter_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!meter->io.buffer || index >= meter->channels) {
+		return NULL;
+	}
+	return meter->io.buffer + (size_t) index * meter->stride;
+}
+
+static void
+meter_free_halfbands (lively_halfband_t *halfbands, unsigned int count) {
+	for (unsigned int c = 0; c < count; c++) {
+		lively_halfband_destroy (&halfbands[c]);
+	}
+	free (halfbands);
+}
+
+/**
+* Initializes a meter node, which measures the true peak.
+*
+* @param meter The meter node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_METER_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_meter_init (lively_node_meter_t *meter, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) meter;
+
+	if (channels == 0) {
+		channels = LIVELY_METER_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	unsigned int groups = (channels + METER_LANES - 1) / METER_LANES;
+	float *state = calloc ((size_t) groups * 2 * 2 * METER_LANES, sizeof *state);
+	lively_halfband_t *halfbands = malloc (channels * sizeof *halfbands);
+	unsigned int c = 0;
+
+	while (halfbands && c < channels
+		&& lively_halfband_init (&halfbands[c], LIVELY_METER_TRUE_PEAK_FACTOR)) {
+		c++;
+	}
+	if (!state || !halfbands || c < channels) {
+		if (halfbands) {
+			meter_free_halfbands (halfbands, c);
+		}
+		free (state);
+		return false;
+	}
+
+	lively_node_io_init (&meter->io, LIVELY_NODE_PROCESS);
+	node->process = meter_process;
+	node->set_buffer_length = meter_set_buffer_length;
+	node->get_read_buffer = meter_get_buffer;
+	node->get_write_buffer = meter_get_buffer;
+
+	meter->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	meter->stride = 0;
+	meter->halfbands = halfbands;
+	meter->oversampling = false;
+	meter->state = state;
+	meter->sample_rate = 0;
+	meter->step_length = 0;
+	meter->step_position = 0;
+
+	memset (meter->peak, 0, sizeof meter->peak);
+	memset (meter->true_peak, 0, sizeof meter->true_peak);
+	memset (meter->carry_peak, 0, sizeof meter->carry_peak);
+	memset (meter->carry_true_peak, 0, sizeof meter->carry_true_peak);
+	memset (meter->energy, 0, sizeof meter->energy);
+	meter->weighted = 0.0;
+	meter->steps = 0;
+	memset (meter->step_energy, 0, sizeof meter->step_energy);
+	memset (meter->step_weighted, 0, sizeof meter->step_weighted);
+	meter_clear_gating (meter);
+
+	memset (meter->rms, 0, sizeof meter->rms);
+	meter->momentary = LIVELY_METER_FLOOR;
+	meter->short_term = LIVELY_METER_FLOOR;
+	meter->frames = 0;
+	atomic_init (&meter->reset, false);
+
+	memset (meter->readings, 0, sizeof meter->readings);
+	for (unsigned int i = 0; i < 3; i++) {
+		meter->readings[i].channels = channels;
+		meter->readings[i].momentary = LIVELY_METER_FLOOR;
+		meter->readings[i].short_term = LIVELY_METER_FLOOR;
+		meter->readings[i].integrated = LIVELY_METER_FLOOR;
+	}
+	meter->back = 0;
+	atomic_init (&meter->middle, 1);
+	meter->front = 2;
+
+	lively_node_params_init (node, meter->params, meter_params, LIVELY_METER_PARAMS);
+	return true;
+}
+
+/**
+* Frees the buffers and filters of a meter node.
+*
+* @param node The meter node, which must not be in a scene
+*/
+void
+lively_node_meter_destroy (lively_node_t *node) {
+	lively_node_meter_t *meter = (lively_node_meter_t *) node;
+
+	if (meter->halfbands) {
+		meter_free_halfbands (meter->halfbands, meter->channels);
+		meter->halfbands = NULL;
+	}
+	free (meter->state);
+	meter->state = NULL;
+	meter->stride = 0;
+	lively_node_io_destroy (node);
+}
+
+/**
+* Takes the newest reading the audio thread published. Only one thread may
+* read a meter node; it never waits, nor makes the audio thread wait.
+*
+* @param meter The meter node
+*
+* @return The reading, which stays valid and unchanged until the next call;
+* the same one again if nothing was published since
+*/
+const lively_meter_reading_t *
+lively_node_meter_read (lively_node_meter_t *meter) {
+	if (atomic_load_explicit (&meter->middle, memory_order_relaxed) & METER_FRESH) {
+		unsigned int old = atomic_exchange_explicit (&meter->middle, meter->front,
+			memory_order_acq_rel);
+		meter->front = old & ~METER_FRESH;
+	}
+	return &meter->readings[meter->front];
+}
+
+/**
+* Starts the integrated loudness over, from the next block. May be called
+* from any thread.
+*
+* @param meter The meter node
+*/
+void
+lively_node_meter_reset (lively_node_meter_t *meter) {
+	atomic_store_explicit (&meter->reset, true, memory_order_release);
+}
@@ -0,0 +1,139 @@
+#ifndef LIVELY_NODE_METER_H
+#define LIVELY_NODE_METER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+#include "../dsp/lively_halfband.h"
+#include "lively_node_biquad.h"
+
+/** Channels of a meter node when none are asked for */
+#define LIVELY_METER_DEFAULT_CHANNELS 2
+/** Oversampling of the true peak, as ITU-R BS.1770 asks at 48 kHz */
+#define LIVELY_METER_TRUE_PEAK_FACTOR 4
+/** Steps of 100 ms in the momentary window of 400 ms */
+#define LIVELY_METER_MOMENTARY_STEPS 4
+/** Steps of 100 ms in the short-term window of 3 s */
+#define LIVELY_METER_SHORT_TERM_STEPS 30
+/** Loudness at the bottom of the histogram, which is also the absolute gate */
+#define LIVELY_METER_HISTOGRAM_MIN -70.0
+/** Bins of 0.1 LU in the histogram, up to +10 LUFS */
+#define LIVELY_METER_HISTOGRAM_BINS 800
+/** Loudness reported for silence, or before there is any, in LUFS */
+#define LIVELY_METER_FLOOR -120.0f
+
+/** Parameters of a meter node */
+enum lively_node_meter_param {
+	LIVELY_METER_TRUE_PEAK, /**< 1 to measure the true peak, 0 to skip it; 1 by default */
+	LIVELY_METER_PARAMS
+};
+
+/**
+ * The levels of a meter node, as published to its reader. Levels are
+ * linear, and loudness is in LUFS.
+ */
+typedef struct lively_meter_reading {
+	uint64_t frames; /**< Frames metered when the reading was published */
+	unsigned int channels;
+
+	/** Highest sample of each channel since the reading before this one was taken */
+	float peak[LIVELY_CHANNELS_MAX];
+	/** Highest level between samples likewise, or 0 if not measured */
+	float true_peak[LIVELY_CHANNELS_MAX];
+	/** Of each channel over the momentary window, without weighting */
+	float rms[LIVELY_CHANNELS_MAX];
+
+	float momentary;
+	float short_term;
+	float integrated; /**< Gated, since the node began or was reset */
+} lively_meter_reading_t;
+
+/**
+ * Measures every channel of its input and passes it on unchanged: the
+ * sample peak, the true peak and the RMS level of each channel, and the
+ * loudness of all of them together after ITU-R BS.1770 and EBU R128.
+ *
+ * The peaks and the sums of squares are reductions over the contiguous
+ * samples of each channel, which vectorize. The K-weighting filters are
+ * run on #LIVELY_BIQUAD_LANES channels side by side, as the biquad node
+ * does. The true peak is the highest sample once oversampled by
+ * #LIVELY_METER_TRUE_PEAK_FACTOR through a #lively_halfband cascade, which
+ * costs more than the rest together; it can be switched off.
+ *
+ * Loudness is measured in steps of 100 ms. Every channel has a weight of
+ * 1, since the node does not know which are surrounds. Blocks of 400 ms,
+ * one per step, are gated into a histogram of
+ * #LIVELY_METER_HISTOGRAM_BINS bins, which keeps the integrated loudness
+ * in constant memory however long the program; the relative gate is
+ * applied at the resolution of a bin.
+ *
+ * Each block, the audio thread publishes a #lively_meter_reading through
+ * a triple buffer, and a single reader thread takes the newest one with
+ * #lively_node_meter_read. Neither ever waits for the other. Peaks which
+ * the reader did not take are carried into the next reading, so that none
+ * is missed however seldom it reads.
+ */
+typedef struct lively_node_meter {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	lively_halfband_t *halfbands; /**< One per channel, for the true peak */
+	bool oversampling; /**< Whether the true peak was measured last block */
+	/** A block at the oversampled rate */
+	float scratch[LIVELY_HALFBAND_BLOCK * LIVELY_METER_TRUE_PEAK_FACTOR];
+
+	/** The K-weighting: a high shelf, then a high-pass */
+	lively_biquad_coefficients_t weighting[2];
+	/** Two state variables per section and lane, for every group of lanes */
+	float *state;
+	unsigned int sample_rate;
+
+	/** Peaks since the last reading */
+	float peak[LIVELY_CHANNELS_MAX];
+	float true_peak[LIVELY_CHANNELS_MAX];
+	/** Peaks of the last reading published, which may not have been taken */
+	float carry_peak[LIVELY_CHANNELS_MAX];
+	float carry_true_peak[LIVELY_CHANNELS_MAX];
+
+	/** The step being measured */
+	unsigned int step_length; /**< In frames */
+	unsigned int step_position;
+	double energy[LIVELY_CHANNELS_MAX]; /**< Sums of squares of each channel */
+	double weighted; /**< Sum of squares of every weighted channel */
+
+	/** Mean squares of the last steps, in rings indexed by step */
+	unsigned long long steps;
+	double step_energy[LIVELY_METER_MOMENTARY_STEPS][LIVELY_CHANNELS_MAX];
+	double step_weighted[LIVELY_METER_SHORT_TERM_STEPS];
+
+	/** Gating blocks above the absolute gate, from the step they start at */
+	unsigned long long gated_from;
+	unsigned int histogram_count[LIVELY_METER_HISTOGRAM_BINS];
+	double histogram_energy[LIVELY_METER_HISTOGRAM_BINS];
+	unsigned long long gated_count;
+	double gated_energy;
+
+	float rms[LIVELY_CHANNELS_MAX];
+	float momentary, short_term, integrated;
+	uint64_t frames;
+	atomic_bool reset;
+
+	/** The triple buffer: the audio thread writes back, the reader reads front */
+	lively_meter_reading_t readings[3];
+	unsigned int back;
+	unsigned int front;
+	atomic_uint middle; /**< Index of the third reading, and whether it is new */
+
+	lively_param_t params[LIVELY_METER_PARAMS];
+} lively_node_meter_t;
+
+bool lively_node_meter_init (lively_node_meter_t *, unsigned int channels);
+void lively_node_meter_destroy (lively_node_t *);
+
+const lively_meter_reading_t *lively_node_meter_read (lively_node_meter_t *);
+void lively_node_meter_reset (lively_node_meter_t *);
+
+#endif
@@ -0,0 +1,301 @@
+/**
+ * @file lively_node_oversample.c
+ * Lively Oversample: Runs a kernel node at a multiple of the scene rate
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_oversample.h"
+
+static const lively_param_info_t oversample_factor_info = {
+	.name = "factor",
+	.type = LIVELY_PARAM_INT,
+	.min = 1.0f,
+	.max = (float) LIVELY_OVERSAMPLE_FACTOR_MAX,
+	.initial = 4.0f,
+	.smoothing = LIVELY_SMOOTH_NONE
+};
+
+/**
+* Returns the factor a parameter value asks for: the power of two at or
+* below it.
+*/
+static unsigned int
+oversample_factor (float value) {
+	unsigned int factor = 1;
+	while (factor * 2 <= (unsigned int) value && factor < LIVELY_OVERSAMPLE_FACTOR_MAX) {
+		factor *= 2;
+	}
+	return factor;
+}
+
+/**
+* Passes the parameters of the inner class on to every instance, if any
+* were set since the last block. Each instance smooths towards them itself.
+*/
+static void
+oversample_update (lively_node_oversample_t *oversample) {
+	lively_node_t *node = (lively_node_t *) oversample;
+	unsigned int changes = atomic_load_explicit (&node->params_changes, memory_order_acquire);
+
+	if (changes == oversample->changes) {
+		return;
+	}
+	oversample->changes = changes;
+
+	for (unsigned int c = 0; c < oversample->channels; c++) {
+		lively_node_t *inner = lively_node_oversample_get_inner (oversample, c);
+		for (unsigned int i = 0; i < inner->params_count; i++) {
+			lively_node_set_param (inner, i,
+				lively_node_get_param (node, LIVELY_OVERSAMPLE_PARAMS + i));
+		}
+	}
+}
+
+static bool
+oversample_process (lively_node_t *node, unsigned int length) {
+	lively_node_oversample_t *oversample = (lively_node_oversample_t *) node;
+	unsigned int factor = oversample->factor;
+
+	lively_param_advance (&oversample->params[LIVELY_OVERSAMPLE_FACTOR], length);
+	if (!factor) {
+		return true;
+	}
+	oversample_update (oversample);
+
+	for (unsigned int c = 0; c < oversample->channels; c++) {
+		lively_node_t *inner = lively_node_oversample_get_inner (oversample, c);
+		lively_halfband_t *halfband = &oversample->halfbands[c];
+		float *buffer = oversample->io.buffer + (size_t) c * oversample->stride;
+
+		for (unsigned int offset = 0; offset < length; offset += LIVELY_HALFBAND_BLOCK) {
+			unsigned int frames = length - offset < LIVELY_HALFBAND_BLOCK
+				? length - offset : LIVELY_HALFBAND_BLOCK;
+			unsigned int count = frames * factor;
+
+			lively_halfband_up (halfband, buffer + offset, oversample->scratch, frames);
+			for (unsigned int tile = 0; tile < count; tile += LIVELY_KERNEL_TILE) {
+				inner->kernel (inner, oversample->scratch + tile,
+					count - tile < LIVELY_KERNEL_TILE ? count - tile : LIVELY_KERNEL_TILE);
+			}
+			lively_halfband_down (halfband, oversample->scratch, buffer + offset, frames);
+		}
+	}
+
+	return true;
+}
+
+static void
+oversample_free_halfbands (lively_halfband_t *halfbands, unsigned int count) {
+	for (unsigned int c = 0; c < count; c++) {
+		lively_halfband_destroy (&halfbands[c]);
+	}
+	free (halfbands);
+}
+
+/**
+* Allocates room for length samples of every channel, and the cascades for
+* the factor parameter, whose latency becomes the node's. Like
+* #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+oversample_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_oversample_t *oversample = (lively_node_oversample_t *) node;
+	unsigned int factor = oversample_factor (lively_node_get_param (node, LIVELY_OVERSAMPLE_FACTOR));
+	bool grow = length > oversample->stride;
+	bool rebuild = factor != oversample->factor;
+	lively_halfband_t *halfbands = NULL;
+
+	float *buffer = grow
+		? calloc ((size_t) length * oversample->channels, sizeof *buffer) : NULL;
+	if (grow && !buffer) {
+		return false;
+	}
+	if (rebuild) {
+		halfbands = malloc (oversample->channels * sizeof *halfbands);
+		unsigned int c = 0;
+		while (halfbands && c < oversample->channels && lively_halfband_init (&halfbands[c], factor)) {
+			c++;
+		}
+		if (!halfbands || c < oversample->channels) {
+			if (halfbands) {
+				oversample_free_halfbands (halfbands, c);
+			}
+			free (buffer);
+			return false;
+		}
+	}
+
+	if (grow) {
+		free (oversample->io.buffer);
+		oversample->io.buffer = buffer;
+		oversample->stride = length;
+	}
+	if (rebuild) {
+		if (oversample->halfbands) {
+			oversample_free_halfbands (oversample->halfbands, oversample->channels);
+		}
+		oversample->halfbands = halfbands;
+		oversample->factor = factor;
+	}
+
+	// The instances run at the oversampled rate, and take anything timed,
+	// such as the smoothing of their parameters, from it.
+	for (unsigned int c = 0; c < oversample->channels; c++) {
+		lively_node_t *inner = lively_node_oversample_get_inner (oversample, c);
+		inner->scene = node->scene;
+		inner->sample_rate = node->sample_rate * factor;
+	}
+
+	node->latency = lively_halfband_latency (factor);
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+oversample_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_oversample_t *oversample = (lively_node_oversample_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!oversample->io.buffer || index >= oversample->channels) {
+		return NULL;
+	}
+	return oversample->io.buffer + (size_t) index * oversample->stride;
+}
+
+/**
+* Destroys the first count instances of the inner class.
+*/
+static void
+oversample_destroy_inner (lively_node_oversample_t *oversample, unsigned int count) {
+	for (unsigned int c = 0; c < count; c++) {
+		lively_node_t *inner = lively_node_oversample_get_inner (oversample, c);
+		inner->scene = NULL;
+		oversample->inner_class->destroy (inner);
+	}
+	free (oversample->inner);
+	oversample->inner = NULL;
+}
+
+/**
+* Initializes an oversample node around a kernel node class, with a factor
+* of 4 and the parameters of the class at their initial values.
+*
+* @param oversample The oversample node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_OVERSAMPLE_DEFAULT_CHANNELS
+* @param inner The class of the node to oversample, whose nodes must have a
+* kernel
+*
+* @return A success value
+*/
+bool
+lively_node_oversample_init (
+	lively_node_oversample_t *oversample,
+	unsigned int channels,
+	const lively_node_class_t *inner) {
+
+	lively_node_t *node = (lively_node_t *) oversample;
+	lively_node_options_t options = {.type = LIVELY_NODE_PROCESS};
+	unsigned int c = 0;
+
+	if (channels == 0) {
+		channels = LIVELY_OVERSAMPLE_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX || !inner) {
+		return false;
+	}
+
+	lively_node_io_init (&oversample->io, LIVELY_NODE_PROCESS);
+	node->process = oversample_process;
+	node->set_buffer_length = oversample_set_buffer_length;
+	node->get_read_buffer = oversample_get_buffer;
+	node->get_write_buffer = oversample_get_buffer;
+
+	oversample->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	oversample->stride = 0;
+	oversample->inner_class = inner;
+	oversample->factor = 0;
+	oversample->halfbands = NULL;
+	oversample->infos = NULL;
+	oversample->params = NULL;
+
+	oversample->inner = calloc (channels, inner->size);
+	if (!oversample->inner) {
+		return false;
+	}
+	while (c < channels && inner->init (lively_node_oversample_get_inner (oversample, c), &options)) {
+		c++;
+	}
+	if (c < channels || !lively_node_oversample_get_inner (oversample, 0)->kernel) {
+		oversample_destroy_inner (oversample, c);
+		return false;
+	}
+
+	// The parameters of the first instance stand for those of all of them.
+	lively_node_t *first = lively_node_oversample_get_inner (oversample, 0);
+	unsigned int count = LIVELY_OVERSAMPLE_PARAMS + first->params_count;
+	oversample->infos = malloc (count * sizeof *oversample->infos);
+	oversample->params = malloc (count * sizeof *oversample->params);
+	if (!oversample->infos || !oversample->params) {
+		free (oversample->infos);
+		free (oversample->params);
+		oversample_destroy_inner (oversample, channels);
+		return false;
+	}
+
+	oversample->infos[LIVELY_OVERSAMPLE_FACTOR] = oversample_factor_info;
+	for (unsigned int i = 0; i < first->params_count; i++) {
+		oversample->infos[LIVELY_OVERSAMPLE_PARAMS + i] = *first->params[i].info;
+	}
+	lively_node_params_init (node, oversample->params, oversample->infos, count);
+	for (unsigned int i = 0; i < first->params_count; i++) {
+		lively_node_set_param (node, LIVELY_OVERSAMPLE_PARAMS + i, lively_node_get_param (first, i));
+	}
+	oversample->changes = atomic_load_explicit (&node->params_changes, memory_order_relaxed);
+
+	return true;
+}
+
+/**
+* Frees the cascades and inner nodes of an oversample node.
+*
+* @param node The oversample node, which must not be in a scene
+*/
+void
+lively_node_oversample_destroy (lively_node_t *node) {
+	lively_node_oversample_t *oversample = (lively_node_oversample_t *) node;
+
+	if (oversample->halfbands) {
+		oversample_free_halfbands (oversample->halfbands, oversample->channels);
+		oversample->halfbands = NULL;
+	}
+	oversample->factor = 0;
+	oversample_destroy_inner (oversample, oversample->channels);
+	free (oversample->params);
+	free (oversample->infos);
+	oversample->params = NULL;
+	oversample->infos = NULL;
+	node->params = NULL;
+	node->params_count = 0;
+	oversample->stride = 0;
+	lively_node_io_destroy (node);
+}
+
+/**
+* Returns the inner node of a channel, for instance to read state it
+* exposes. Its parameters are overwritten by those of the oversample node.
+*
+* @param oversample The oversample node
+* @param channel The index of the channel
+*/
+lively_node_t *
+lively_node_oversample_get_inner (lively_node_oversample_t *oversample, unsigned int channel) {
+	return (lively_node_t *) (oversample->inner + (size_t) channel * oversample->inner_class->size);
+}
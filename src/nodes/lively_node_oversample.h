@@ -0,0 +1,68 @@
+#ifndef LIVELY_NODE_OVERSAMPLE_H
+#define LIVELY_NODE_OVERSAMPLE_H
+
+#include "../lively_node.h"
+#include "../lively_node_class.h"
+#include "../lively_param.h"
+#include "../dsp/lively_halfband.h"
+
+/** Channels of an oversample node when none are asked for */
+#define LIVELY_OVERSAMPLE_DEFAULT_CHANNELS 2
+/** Largest oversampling factor */
+#define LIVELY_OVERSAMPLE_FACTOR_MAX (1 << LIVELY_HALFBAND_STAGES_MAX)
+
+/**
+ * Parameters of an oversample node. Those of the inner node follow, in
+ * their own order, from #LIVELY_OVERSAMPLE_PARAMS on.
+ */
+enum lively_node_oversample_param {
+	LIVELY_OVERSAMPLE_FACTOR, /**< 1, 2, 4 or 8; 4 by default */
+	LIVELY_OVERSAMPLE_PARAMS
+};
+
+/**
+ * Runs a kernel node at 2, 4 or 8 times the rate of the scene, so that a
+ * nonlinearity such as clipping does not alias back into the audible band.
+ *
+ * The node holds one instance of the inner node class per channel. Each
+ * block of a channel is raised to the oversampled rate by a
+ * #lively_halfband cascade, handed to the kernel of its instance a tile at
+ * a time, and brought back down. Parameters of the inner node are set on
+ * the oversample node, which passes them on to every instance. Each
+ * instance's #lively_node::sample_rate is the oversampled rate, so that
+ * its smoothing and anything else timed take as long as they would at the
+ * rate of the scene.
+ *
+ * The filters delay the signal by #lively_halfband_latency, which is the
+ * node's #lively_node::latency. The factor is taken when the node joins a
+ * scene or its buffers are resized; to change it, set the parameter, then
+ * call #lively_scene_set_buffer_length.
+ */
+typedef struct lively_node_oversample {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	const lively_node_class_t *inner_class;
+	char *inner; /**< One node of the inner class per channel */
+	unsigned int changes; /**< Of the parameters, when last passed on */
+
+	unsigned int factor; /**< In use, or 0 before the cascades are set up */
+	lively_halfband_t *halfbands; /**< One per channel */
+	/** A block at the oversampled rate */
+	float scratch[LIVELY_HALFBAND_BLOCK * LIVELY_OVERSAMPLE_FACTOR_MAX];
+
+	/** The factor, then those of the inner class */
+	lively_param_info_t *infos;
+	lively_param_t *params;
+} lively_node_oversample_t;
+
+bool lively_node_oversample_init (
+	lively_node_oversample_t *,
+	unsigned int channels,
+	const lively_node_class_t *inner);
+void lively_node_oversample_destroy (lively_node_t *);
+
+lively_node_t *lively_node_oversample_get_inner (lively_node_oversample_t *, unsigned int channel);
+
+#endif
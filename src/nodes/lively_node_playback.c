@@ -0,0 +1,277 @@
+/**
+ * @file lively_node_playback.c
+ * Lively Playback: Plays a file streamed from disk
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_playback.h"
+#include "../lively_scene.h"
+
+static const lively_param_info_t playback_params[LIVELY_PLAYBACK_PARAMS] = {
+	[LIVELY_PLAYBACK_PLAYING] = {
+		.name = "playing",
+		.type = LIVELY_PARAM_INT,
+		.min = 0.0f,
+		.max = 1.0f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	}
+};
+
+static bool
+playback_process (lively_node_t *node, unsigned int length) {
+	lively_node_playback_t *playback = (lively_node_playback_t *) node;
+	lively_disk_stream_t *stream = atomic_load_explicit (&playback->stream, memory_order_acquire);
+	float playing = lively_param_advance (&playback->params[LIVELY_PLAYBACK_PLAYING], length);
+	float *output[LIVELY_CHANNELS_MAX];
+	unsigned int channels = 0, produced = 0;
+
+	if (stream && playing != 0.0f) {
+		// Channels of the file beyond those of the node are dropped.
+		channels = stream->channels < playback->channels ? stream->channels : playback->channels;
+		for (unsigned int c = 0; c < stream->channels; c++) {
+			output[c] = c < channels
+				? playback->io.buffer + (size_t) c * playback->stride : NULL;
+		}
+		produced = lively_disk_stream_read (stream, output, length);
+	}
+
+	for (unsigned int c = 0; c < playback->channels; c++) {
+		float *buffer = playback->io.buffer + (size_t) c * playback->stride;
+		if (c >= channels) {
+			if (channels == 1) {
+				memcpy (buffer, playback->io.buffer, produced * sizeof *buffer);
+			} else {
+				memset (buffer, 0, produced * sizeof *buffer);
+			}
+		}
+		memset (buffer + produced, 0, (length - produced) * sizeof *buffer);
+	}
+
+	return true;
+}
+
+/**
+* Allocates room for length samples of every channel, and converts the
+* stream to the sample rate of the node, which the scene sets before
+* calling this, from where it had played to. Like
+* #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+playback_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_playback_t *playback = (lively_node_playback_t *) node;
+	lively_disk_stream_t *stream = atomic_load (&playback->stream);
+	float *buffer = NULL;
+
+	if (length > playback->stride) {
+		buffer = calloc ((size_t) length * playback->channels, sizeof *buffer);
+		if (!buffer) {
+			return false;
+		}
+	}
+	if (stream && node->sample_rate && !lively_disk_stream_set_rate (stream, node->sample_rate)) {
+		free (buffer);
+		return false;
+	}
+
+	if (buffer) {
+		free (playback->io.buffer);
+		playback->io.buffer = buffer;
+		playback->stride = length;
+	}
+
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+playback_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_playback_t *playback = (lively_node_playback_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!playback->io.buffer || index >= playback->channels) {
+		return NULL;
+	}
+	return playback->io.buffer + (size_t) index * playback->stride;
+}
+
+/**
+* Initializes a playback node with no file, which plays silence.
+*
+* @param playback The playback node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_PLAYBACK_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_playback_init (lively_node_playback_t *playback, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) playback;
+
+	if (channels == 0) {
+		channels = LIVELY_PLAYBACK_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	lively_node_io_init (&playback->io, LIVELY_NODE_PROCESS);
+	node->process = playback_process;
+	node->set_buffer_length = playback_set_buffer_length;
+	node->get_read_buffer = playback_get_buffer;
+	node->get_write_buffer = playback_get_buffer;
+
+	playback->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	playback->stride = 0;
+	atomic_init (&playback->stream, NULL);
+	lively_node_params_init (node, playback->params, playback_params, LIVELY_PLAYBACK_PARAMS);
+
+	return true;
+}
+
+/**
+* Closes the file and frees the buffer of a playback node.
+*
+* @param node The playback node, which must not be in a scene
+*/
+void
+lively_node_playback_destroy (lively_node_t *node) {
+	lively_node_playback_t *playback = (lively_node_playback_t *) node;
+
+	lively_node_playback_close (playback);
+	playback->stride = 0;
+	lively_node_io_destroy (node);
+}
+
+/**
+* Hands a new stream to the audio thread, then closes the one it replaces
+* once the audio thread is done with it.
+*/
+static void
+playback_replace (lively_node_playback_t *playback, lively_disk_stream_t *stream) {
+	lively_node_t *node = (lively_node_t *) playback;
+	lively_disk_stream_t *previous = atomic_exchange (&playback->stream, stream);
+
+	if (previous) {
+		lively_scene_synchronize (node->scene);
+		lively_disk_close (previous);
+	}
+}
+
+/**
+* Starts playing a WAV file from its beginning, in place of the previous
+* one. The first frames are read before this returns, so playback starts
+* at the next block.
+*
+* Must not be called from the audio thread, nor concurrently with itself,
+* with #lively_node_playback_close, with moving the node between scenes or
+* with a change of their sample rate.
+*
+* @param playback The playback node, which must be in a scene; the file is
+* converted to the rate of the scene, and again whenever it changes
+* @param disk The disk service to stream the file through
+* @param path The path of the file
+*
+* @return A success value; on failure the previous file keeps playing
+*/
+bool
+lively_node_playback_open (lively_node_playback_t *playback, lively_disk_t *disk, const char *path) {
+	lively_node_t *node = (lively_node_t *) playback;
+
+	if (!node->scene) {
+		return false;
+	}
+
+	lively_disk_stream_t *stream = lively_disk_open_reader (disk, path, node->sample_rate);
+	if (!stream) {
+		return false;
+	}
+
+	playback_replace (playback, stream);
+	return true;
+}
+
+/**
+* Starts playing a sample of the pool from its beginning, in place of what
+* was playing, as #lively_node_playback_open does a file. Any number of
+* nodes may play the same sample; its storage is shared, and only the
+* ring of each node is its own.
+*
+* The same restrictions as #lively_node_playback_open apply.
+*
+* @param playback The playback node, which must be in a scene
+* @param disk The disk service to decode the sample on
+* @param sample The sample, which the node takes a reference to
+*
+* @return A success value; on failure what was playing keeps playing
+*/
+bool
+lively_node_playback_open_sample (
+	lively_node_playback_t *playback,
+	lively_disk_t *disk,
+	lively_pool_sample_t *sample) {
+
+	lively_node_t *node = (lively_node_t *) playback;
+
+	if (!node->scene) {
+		return false;
+	}
+
+	lively_disk_stream_t *stream = lively_disk_open_sample (disk, sample, node->sample_rate);
+	if (!stream) {
+		return false;
+	}
+
+	playback_replace (playback, stream);
+	return true;
+}
+
+/**
+* Stops playing the file of a playback node, if any, and closes it.
+*
+* The same restrictions as #lively_node_playback_open apply.
+*
+* @param playback The playback node
+*/
+void
+lively_node_playback_close (lively_node_playback_t *playback) {
+	lively_node_t *node = (lively_node_t *) playback;
+	lively_disk_stream_t *previous = atomic_exchange (&playback->stream, NULL);
+
+	if (previous) {
+		if (node->scene) {
+			lively_scene_synchronize (node->scene);
+		}
+		lively_disk_close (previous);
+	}
+}
+
+/**
+* Returns whether the whole file has been played, or there is none.
+*
+* @param playback The playback node
+*/
+bool
+lively_node_playback_is_finished (lively_node_playback_t *playback) {
+	lively_disk_stream_t *stream = atomic_load (&playback->stream);
+	return !stream || lively_disk_stream_is_finished (stream);
+}
+
+/**
+* Returns the number of blocks the disk could not keep up with since the
+* file was opened.
+*
+* @param playback The playback node
+*/
+unsigned long
+lively_node_playback_get_underruns (lively_node_playback_t *playback) {
+	lively_disk_stream_t *stream = atomic_load (&playback->stream);
+	return stream ? atomic_load_explicit (&stream->underruns, memory_order_relaxed) : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef LIVELY_NODE_PLAYBACK_H
+#define LIVELY_NODE_PLAYBACK_H
+
+#include <stdatomic.h>
+
+#include "../lively_disk.h"
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Channels of a playback node when none are asked for */
+#define LIVELY_PLAYBACK_DEFAULT_CHANNELS 2
+
+/** Parameters of a playback node */
+enum lively_node_playback_param {
+	LIVELY_PLAYBACK_PLAYING, /**< 1 to play, 0 to pause; 1 by default */
+	LIVELY_PLAYBACK_PARAMS
+};
+
+/**
+ * Plays a file streamed from disk, such as a stem, or a sample of the
+ * pool, such as a cue, without the audio thread ever touching the
+ * filesystem.
+ *
+ * The file is read ahead into a #lively_disk_stream by the disk thread,
+ * converted to the rate of the scene if need be, and each block takes its
+ * frames from the ring. A mono file plays on every channel; other channels
+ * beyond those of the file are silent. When the ring runs dry before the
+ * end of the file, the rest of the block is silent and the stream counts
+ * an underrun.
+ */
+typedef struct lively_node_playback {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	_Atomic(lively_disk_stream_t *) stream;
+
+	lively_param_t params[LIVELY_PLAYBACK_PARAMS];
+} lively_node_playback_t;
+
+bool lively_node_playback_init (lively_node_playback_t *, unsigned int channels);
+void lively_node_playback_destroy (lively_node_t *);
+
+bool lively_node_playback_open (lively_node_playback_t *, lively_disk_t *, const char *path);
+bool lively_node_playback_open_sample (
+	lively_node_playback_t *,
+	lively_disk_t *,
+	lively_pool_sample_t *);
+void lively_node_playback_close (lively_node_playback_t *);
+bool lively_node_playback_is_finished (lively_node_playback_t *);
+unsigned long lively_node_playback_get_underruns (lively_node_playback_t *);
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * @file lively_node_recorder.c
+ * Lively Recorder: Records its input to a file on disk
+ */
+
+#include <stdlib.h>
+
+#include "lively_node_recorder.h"
+#include "../lively_scene.h"
+
+static const lively_param_info_t recorder_params[LIVELY_RECORDER_PARAMS] = {
+	[LIVELY_RECORDER_RECORDING] = {
+		.name = "recording",
+		.type = LIVELY_PARAM_INT,
+		.min = 0.0f,
+		.max = 1.0f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	}
+};
+
+static bool
+recorder_process (lively_node_t *node, unsigned int length) {
+	lively_node_recorder_t *recorder = (lively_node_recorder_t *) node;
+	lively_disk_stream_t *stream = atomic_load_explicit (&recorder->stream, memory_order_acquire);
+	float recording = lively_param_advance (&recorder->params[LIVELY_RECORDER_RECORDING], length);
+	const float *input[LIVELY_CHANNELS_MAX];
+
+	if (stream && recording != 0.0f) {
+		for (unsigned int c = 0; c < recorder->channels; c++) {
+			input[c] = recorder->io.buffer + (size_t) c * recorder->stride;
+		}
+		lively_disk_stream_write (stream, input, length);
+	}
+
+	return true;
+}
+
+/**
+* Allocates room for length samples of every channel. Like
+* #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+recorder_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_recorder_t *recorder = (lively_node_recorder_t *) node;
+
+	if (length > recorder->stride) {
+		float *buffer = calloc ((size_t) length * recorder->channels, sizeof *buffer);
+		if (!buffer) {
+			return false;
+		}
+		free (recorder->io.buffer);
+		recorder->io.buffer = buffer;
+		recorder->stride = length;
+	}
+
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+recorder_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_recorder_t *recorder = (lively_node_recorder_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!recorder->io.buffer || index >= recorder->channels) {
+		return NULL;
+	}
+	return recorder->io.buffer + (size_t) index * recorder->stride;
+}
+
+/**
+* Initializes a recorder node with no file, which only passes its input on.
+*
+* @param recorder The recorder node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_RECORDER_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_recorder_init (lively_node_recorder_t *recorder, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) recorder;
+
+	if (channels == 0) {
+		channels = LIVELY_RECORDER_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	lively_node_io_init (&recorder->io, LIVELY_NODE_PROCESS);
+	node->process = recorder_process;
+	node->set_buffer_length = recorder_set_buffer_length;
+	node->get_read_buffer = recorder_get_buffer;
+	node->get_write_buffer = recorder_get_buffer;
+
+	recorder->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	recorder->stride = 0;
+	atomic_init (&recorder->stream, NULL);
+	lively_node_params_init (node, recorder->params, recorder_params, LIVELY_RECORDER_PARAMS);
+
+	return true;
+}
+
+/**
+* Completes the file and frees the buffer of a recorder node.
+*
+* @param node The recorder node, which must not be in a scene
+*/
+void
+lively_node_recorder_destroy (lively_node_t *node) {
+	lively_node_recorder_t *recorder = (lively_node_recorder_t *) node;
+
+	lively_node_recorder_close (recorder);
+	recorder->stride = 0;
+	lively_node_io_destroy (node);
+}
+
+/**
+* Starts recording into a new file, in place of the previous one,
+* which is completed. Recording starts at the next block.
+*
+* Must not be called from the audio thread, nor concurrently with itself,
+* with #lively_node_recorder_close, or with moving the node between scenes.
+*
+* @param recorder The recorder node, which must be in a scene; the file has
+* the rate of the scene
+* @param disk The disk service to stream the file through
+* @param path The path of the file, which is replaced if it exists
+* @param encoding How the samples are to be stored
+* @param lossless Whether to compress the file, as #lively_disk_open_writer
+* does
+*
+* @return A success value; on failure the previous file keeps recording
+*/
+bool
+lively_node_recorder_open (
+	lively_node_recorder_t *recorder,
+	lively_disk_t *disk,
+	const char *path,
+	lively_wav_encoding_t encoding,
+	bool lossless) {
+
+	lively_node_t *node = (lively_node_t *) recorder;
+
+	if (!node->scene) {
+		return false;
+	}
+
+	lively_disk_stream_t *stream = lively_disk_open_writer (disk, path, encoding,
+		recorder->channels, lively_scene_get_sample_rate (node->scene), lossless);
+	if (!stream) {
+		return false;
+	}
+
+	lively_disk_stream_t *previous = atomic_exchange (&recorder->stream, stream);
+	if (previous) {
+		lively_scene_synchronize (node->scene);
+		lively_disk_close (previous);
+	}
+	return true;
+}
+
+/**
+* Stops recording, if the node was, and completes the file.
+*
+* The same restrictions as #lively_node_recorder_open apply.
+*
+* @param recorder The recorder node
+*
+* @return Whether the file was left complete, or there was none; a failure
+* is logged, and the file keeps what was last synced
+*/
+bool
+lively_node_recorder_close (lively_node_recorder_t *recorder) {
+	lively_node_t *node = (lively_node_t *) recorder;
+	lively_disk_stream_t *previous = atomic_exchange (&recorder->stream, NULL);
+
+	if (!previous) {
+		return true;
+	}
+	if (node->scene) {
+		lively_scene_synchronize (node->scene);
+	}
+	return lively_disk_close (previous);
+}
+
+/**
+* Returns the number of blocks which did not fit, whole or in part, since
+* the file was opened.
+*
+* @param recorder The recorder node
+*/
+unsigned long
+lively_node_recorder_get_overflows (lively_node_recorder_t *recorder) {
+	lively_disk_stream_t *stream = atomic_load (&recorder->stream);
+	return stream ? atomic_load_explicit (&stream->overflows, memory_order_relaxed) : 0;
+}
@@ -0,0 +1,50 @@
+#ifndef LIVELY_NODE_RECORDER_H
+#define LIVELY_NODE_RECORDER_H
+
+#include <stdatomic.h>
+
+#include "../lively_disk.h"
+#include "../lively_node.h"
+#include "../lively_param.h"
+
+/** Channels of a recorder node when none are asked for */
+#define LIVELY_RECORDER_DEFAULT_CHANNELS 2
+
+/** Parameters of a recorder node */
+enum lively_node_recorder_param {
+	LIVELY_RECORDER_RECORDING, /**< 1 to record, 0 to pause; 1 by default */
+	LIVELY_RECORDER_PARAMS
+};
+
+/**
+ * Records every channel of its input into one WAV file, or a lossless
+ * one, and passes the input on unchanged.
+ *
+ * Each block is copied into the ring of a #lively_disk_stream, which the
+ * disk thread drains into the file, so the audio thread never waits for
+ * the disk. When the disk falls so far behind that the ring is full, the
+ * frames which do not fit are dropped and the stream counts an overflow.
+ */
+typedef struct lively_node_recorder {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	_Atomic(lively_disk_stream_t *) stream;
+
+	lively_param_t params[LIVELY_RECORDER_PARAMS];
+} lively_node_recorder_t;
+
+bool lively_node_recorder_init (lively_node_recorder_t *, unsigned int channels);
+void lively_node_recorder_destroy (lively_node_t *);
+
+bool lively_node_recorder_open (
+	lively_node_recorder_t *,
+	lively_disk_t *,
+	const char *path,
+	lively_wav_encoding_t encoding,
+	bool lossless);
+bool lively_node_recorder_close (lively_node_recorder_t *);
+unsigned long lively_node_recorder_get_overflows (lively_node_recorder_t *);
+
+#endif
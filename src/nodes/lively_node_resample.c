@@ -0,0 +1,256 @@
+/**
+ * @file lively_node_resample.c
+ * Lively Resample: Brings frames queued at another rate into the scene
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lively_node_resample.h"
+
+#define RESAMPLE_MASK (LIVELY_RESAMPLE_QUEUE - 1)
+
+_Static_assert ((LIVELY_RESAMPLE_QUEUE & RESAMPLE_MASK) == 0,
+	"The queue is indexed by masking");
+
+static const lively_param_info_t resample_params[LIVELY_RESAMPLE_PARAMS] = {
+	[LIVELY_RESAMPLE_RATE] = {
+		.name = "rate",
+		.type = LIVELY_PARAM_INT,
+		.min = 8000.0f,
+		.max = 192000.0f,
+		.initial = 44100.0f,
+		.smoothing = LIVELY_SMOOTH_NONE
+	},
+	[LIVELY_RESAMPLE_RATIO] = {
+		.name = "ratio",
+		.type = LIVELY_PARAM_FLOAT,
+		.min = 0.98f,
+		.max = 1.02f,
+		.initial = 1.0f,
+		.smoothing = LIVELY_SMOOTH_LINEAR,
+		.smoothing_time = 0.1f
+	}
+};
+
+static bool
+resample_process (lively_node_t *node, unsigned int length) {
+	lively_node_resample_t *resample = (lively_node_resample_t *) node;
+	float ratio = lively_param_advance (&resample->params[LIVELY_RESAMPLE_RATIO], length);
+	const float *input[LIVELY_CHANNELS_MAX];
+	float *output[LIVELY_CHANNELS_MAX];
+	unsigned int produced = 0;
+
+	lively_param_advance (&resample->params[LIVELY_RESAMPLE_RATE], length);
+
+	if (resample->ready) {
+		unsigned int read = atomic_load_explicit (&resample->queue_read, memory_order_relaxed);
+		unsigned int available = atomic_load_explicit (&resample->queue_written,
+			memory_order_acquire) - read;
+
+		lively_resampler_set_ratio (&resample->resampler, ratio);
+
+		// The queued frames are at most two spans, before and after the
+		// end of the queue.
+		while (produced < length && available > 0) {
+			unsigned int index = read & RESAMPLE_MASK;
+			unsigned int span = LIVELY_RESAMPLE_QUEUE - index;
+			unsigned int frames = span < available ? span : available;
+			unsigned int taken = frames;
+
+			for (unsigned int c = 0; c < resample->channels; c++) {
+				input[c] = resample->queue + (size_t) c * LIVELY_RESAMPLE_QUEUE + index;
+				output[c] = resample->io.buffer + (size_t) c * resample->stride + produced;
+			}
+			produced += lively_resampler_process (&resample->resampler,
+				input, &taken, output, length - produced);
+			read += taken;
+			available -= taken;
+			if (taken < frames) {
+				break;
+			}
+		}
+
+		atomic_store_explicit (&resample->queue_read, read, memory_order_release);
+		if (produced < length) {
+			atomic_fetch_add_explicit (&resample->underruns, 1, memory_order_relaxed);
+		}
+	}
+
+	for (unsigned int c = 0; c < resample->channels; c++) {
+		float *buffer = resample->io.buffer + (size_t) c * resample->stride;
+		memset (buffer + produced, 0, (length - produced) * sizeof *buffer);
+	}
+
+	return true;
+}
+
+/**
+* Allocates room for length samples of every channel, and sets up the
+* resampler for the rate parameter and the sample rate of the node. The
+* scene calls this again whenever its rate changes, so the resampler is
+* rebuilt for the rate the device actually runs at. Like
+* #lively_node_io_set_buffer_length, nothing changes on failure.
+*/
+static bool
+resample_set_buffer_length (lively_node_t *node, unsigned int length) {
+	lively_node_resample_t *resample = (lively_node_resample_t *) node;
+	unsigned int rate_out = node->sample_rate;
+	unsigned int rate_in = (unsigned int) lively_node_get_param (node, LIVELY_RESAMPLE_RATE);
+	bool grow = length > resample->stride;
+	bool rebuild = rate_out && (!resample->ready
+		|| resample->resampler.rate_in != rate_in
+		|| resample->resampler.rate_out != rate_out);
+	lively_resampler_t resampler;
+
+	float *buffer = grow
+		? calloc ((size_t) length * resample->channels, sizeof *buffer) : NULL;
+	if (grow && !buffer) {
+		return false;
+	}
+	if (rebuild && !lively_resampler_init (&resampler, resample->channels, rate_in, rate_out, true)) {
+		free (buffer);
+		return false;
+	}
+
+	if (grow) {
+		free (resample->io.buffer);
+		resample->io.buffer = buffer;
+		resample->stride = length;
+	}
+	if (rebuild) {
+		if (resample->ready) {
+			lively_resampler_destroy (&resample->resampler);
+		}
+		resample->resampler = resampler;
+		resample->ready = true;
+	}
+
+	node->buffer_length = length;
+	return true;
+}
+
+/**
+* Returns the buffer of a channel, or NULL if the node does not have it.
+*/
+static float *
+resample_get_buffer (lively_node_t *node, lively_node_channel_t channel) {
+	lively_node_resample_t *resample = (lively_node_resample_t *) node;
+	unsigned int index = lively_node_channel_index (channel);
+
+	if (!resample->io.buffer || index >= resample->channels) {
+		return NULL;
+	}
+	return resample->io.buffer + (size_t) index * resample->stride;
+}
+
+/**
+* Initializes a resample node with an empty queue.
+*
+* @param resample The resample node
+* @param channels The number of channels, up to #LIVELY_CHANNELS_MAX, or 0
+* for #LIVELY_RESAMPLE_DEFAULT_CHANNELS
+*
+* @return A success value
+*/
+bool
+lively_node_resample_init (lively_node_resample_t *resample, unsigned int channels) {
+	lively_node_t *node = (lively_node_t *) resample;
+
+	if (channels == 0) {
+		channels = LIVELY_RESAMPLE_DEFAULT_CHANNELS;
+	}
+	if (channels > LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+
+	lively_node_io_init (&resample->io, LIVELY_NODE_PROCESS);
+	node->process = resample_process;
+	node->set_buffer_length = resample_set_buffer_length;
+	node->get_read_buffer = resample_get_buffer;
+	node->get_write_buffer = resample_get_buffer;
+
+	resample->queue = calloc ((size_t) LIVELY_RESAMPLE_QUEUE * channels, sizeof *resample->queue);
+	if (!resample->queue) {
+		return false;
+	}
+
+	resample->channels = channels;
+	node->read_channels = channels;
+	node->write_channels = channels;
+	resample->stride = 0;
+	resample->ready = false;
+	atomic_init (&resample->queue_written, 0);
+	atomic_init (&resample->queue_read, 0);
+	atomic_init (&resample->underruns, 0);
+	lively_node_params_init (node, resample->params, resample_params, LIVELY_RESAMPLE_PARAMS);
+
+	return true;
+}
+
+/**
+* Frees the queue and resampler of a resample node.
+*
+* @param node The resample node, which must not be in a scene
+*/
+void
+lively_node_resample_destroy (lively_node_t *node) {
+	lively_node_resample_t *resample = (lively_node_resample_t *) node;
+
+	if (resample->ready) {
+		lively_resampler_destroy (&resample->resampler);
+		resample->ready = false;
+	}
+	free (resample->queue);
+	resample->queue = NULL;
+	resample->stride = 0;
+	lively_node_io_destroy (node);
+}
+
+/**
+* Queues frames of every channel, at the rate of the node. Only one thread
+* may write to a node, but it need not be the audio thread, and never
+* blocks it.
+*
+* @param resample The resample node
+* @param input The frames of every channel of the node
+* @param frames The number of frames
+*
+* @return The number of frames queued, fewer if the queue is full
+*/
+unsigned int
+lively_node_resample_write (
+	lively_node_resample_t *resample,
+	const float *const *input,
+	unsigned int frames) {
+
+	unsigned int written = atomic_load_explicit (&resample->queue_written, memory_order_relaxed);
+	unsigned int read = atomic_load_explicit (&resample->queue_read, memory_order_acquire);
+	unsigned int room = LIVELY_RESAMPLE_QUEUE - (written - read);
+	unsigned int index = written & RESAMPLE_MASK;
+
+	if (frames > room) {
+		frames = room;
+	}
+
+	unsigned int first = LIVELY_RESAMPLE_QUEUE - index < frames
+		? LIVELY_RESAMPLE_QUEUE - index : frames;
+	for (unsigned int c = 0; c < resample->channels; c++) {
+		float *queue = resample->queue + (size_t) c * LIVELY_RESAMPLE_QUEUE;
+		memcpy (queue + index, input[c], first * sizeof *queue);
+		memcpy (queue, input[c] + first, (frames - first) * sizeof *queue);
+	}
+
+	atomic_store_explicit (&resample->queue_written, written + frames, memory_order_release);
+	return frames;
+}
+
+/**
+* Returns the number of blocks which the queue could not fill.
+*
+* @param resample The resample node
+*/
+unsigned long
+lively_node_resample_get_underruns (lively_node_resample_t *resample) {
+	return atomic_load_explicit (&resample->underruns, memory_order_relaxed);
+}
@@ -0,0 +1,60 @@
+#ifndef LIVELY_NODE_RESAMPLE_H
+#define LIVELY_NODE_RESAMPLE_H
+
+#include "../lively_node.h"
+#include "../lively_param.h"
+#include "../dsp/lively_resampler.h"
+
+/** Channels of a resample node when none are asked for */
+#define LIVELY_RESAMPLE_DEFAULT_CHANNELS 2
+/** Frames of the queue of each channel; a power of two */
+#define LIVELY_RESAMPLE_QUEUE 16384
+
+/** Parameters of a resample node */
+enum lively_node_resample_param {
+	LIVELY_RESAMPLE_RATE, /**< Of the queued frames, in Hz; 44100 by default */
+	LIVELY_RESAMPLE_RATIO, /**< Multiplies the frames taken per output frame */
+	LIVELY_RESAMPLE_PARAMS
+};
+
+/**
+ * A source of frames at another sample rate, such as a stream or a device
+ * with its own clock, for the scene.
+ *
+ * Any one thread queues frames with #lively_node_resample_write, and each
+ * block the node takes as many as its resampler needs to fill the block at
+ * the rate of the scene. When the queue runs dry, the rest of the block is
+ * silent and an underrun is counted.
+ *
+ * The rate is taken when the node joins a scene or its buffers are resized;
+ * to change it, set the parameter, then call #lively_scene_set_buffer_length.
+ * The ratio applies at once, so a producer may nudge it to keep the queue
+ * from slowly filling or draining.
+ */
+typedef struct lively_node_resample {
+	lively_node_io_t io;
+	unsigned int channels;
+	unsigned int stride; /**< Samples between the starts of two channels */
+
+	lively_resampler_t resampler;
+	bool ready; /**< Whether the resampler is set up */
+
+	/** #LIVELY_RESAMPLE_QUEUE frames per channel */
+	float *queue;
+	atomic_uint queue_written; /**< Frames ever written, by the producer */
+	atomic_uint queue_read; /**< Frames ever read, by the audio thread */
+	atomic_ulong underruns;
+
+	lively_param_t params[LIVELY_RESAMPLE_PARAMS];
+} lively_node_resample_t;
+
+bool lively_node_resample_init (lively_node_resample_t *, unsigned int channels);
+void lively_node_resample_destroy (lively_node_t *);
+
+unsigned int lively_node_resample_write (
+	lively_node_resample_t *,
+	const float *const *input,
+	unsigned int frames);
+unsigned long lively_node_resample_get_underruns (lively_node_resample_t *);
+
+#endif
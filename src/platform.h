@@ -1,9 +1,17 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include <stddef.h>
+
 void platform_register_exit(void (*callback)(void));
 
 void platform_pause(void);
 void platform_sleep(unsigned int seconds);
 
+double platform_time(void);
+void platform_sleep_until(double time);
+
+void *platform_map_file(const char *path, size_t *size);
+void platform_unmap_file(void *data, size_t size);
+
 #endif
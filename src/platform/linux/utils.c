@@ -1,5 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "../../platform.h"
 
 void platform_pause (void) {
@@ -9,3 +17,68 @@ void platform_pause (void) {
 void platform_sleep(unsigned int seconds) {
 	sleep (seconds);
 }
+
+/**
+* Returns the time of a monotonic clock, in seconds.
+*
+* The clock has no defined epoch and is only useful for measuring intervals.
+*/
+double platform_time (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+* Sleeps until the monotonic clock reaches the given time.
+*
+* @param time The absolute wake-up time, as returned by #platform_time
+*/
+void platform_sleep_until (double time) {
+	struct timespec ts;
+	ts.tv_sec = (time_t) time;
+	ts.tv_nsec = (long) ((time - ts.tv_sec) * 1e9);
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/**
+* Maps a whole file into memory, read-only.
+*
+* @param path The path of the file
+* @param size Receives the size of the file, in bytes
+*
+* @return The mapping, or NULL if the file could not be mapped
+*/
+void *platform_map_file (const char *path, size_t *size) {
+	int fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat (fd, &st) != 0 || st.st_size <= 0) {
+		close (fd);
+		return NULL;
+	}
+
+	void *data = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+
+	*size = (size_t) st.st_size;
+	return data;
+}
+
+/**
+* Unmaps a file mapped with #platform_map_file.
+*/
+void platform_unmap_file (void *data, size_t size) {
+	munmap (data, size);
+}
@@ -9,3 +9,50 @@ void platform_pause (void) {
 void platform_sleep(unsigned int seconds) {
 	Sleep (1000 * seconds);
 }
+
+double platform_time (void) {
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency (&frequency);
+	QueryPerformanceCounter (&counter);
+	return (double) counter.QuadPart / frequency.QuadPart;
+}
+
+void platform_sleep_until (double time) {
+	double remaining = time - platform_time ();
+	if (remaining > 0.0) {
+		Sleep ((DWORD) (remaining * 1000.0));
+	}
+}
+
+void *platform_map_file (const char *path, size_t *size) {
+	HANDLE file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx (file, &file_size) || file_size.QuadPart <= 0) {
+		CloseHandle (file);
+		return NULL;
+	}
+
+	HANDLE mapping = CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle (file);
+	if (!mapping) {
+		return NULL;
+	}
+
+	void *data = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle (mapping);
+	if (!data) {
+		return NULL;
+	}
+
+	*size = (size_t) file_size.QuadPart;
+	return data;
+}
+
+void platform_unmap_file (void *data, size_t size) {
+	UnmapViewOfFile (data);
+}
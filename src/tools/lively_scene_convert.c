@@ -0,0 +1,378 @@
+/**
+ * @file lively_scene_convert.c
+ * Converts scene files between the binary form loaded by lively and a
+ * human-readable text form.
+ *
+ * The text form has one statement per line, and # starts a comment:
+ *
+ *     lively-scene 1
+ *     name <scene>
+ *     node <name> <class> <input|output|process> [port=<n>] [channels=<n>] [outputs=<n>] [inner=<class>] [latency=<n>]
+ *     param <index> <value>
+ *     plug <source>:<channel> <target>:<channel>
+ *
+ * A param line belongs to the node before it, channels are mono, left or
+ * right, and names may not contain whitespace. Values are written with
+ * enough digits to convert back to the exact same float, so converting in
+ * either direction and back is lossless.
+ *
+ * A channel of a multichannel node may also be given by its number.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lively_hash.h"
+#include "../lively_node.h"
+#include "../lively_scene_file.h"
+
+typedef struct convert_name {
+	lively_hash_entry_t entry;
+	uint32_t index;
+	char name[];
+} convert_name_t;
+
+static const char *channel_names[] = { "mono", "left", "right" };
+
+static const char *
+convert_type_name (uint32_t type) {
+	switch (type) {
+	case LIVELY_NODE_INPUT: return "input";
+	case LIVELY_NODE_OUTPUT: return "output";
+	default: return "process";
+	}
+}
+
+static bool
+convert_parse_type (const char *name, uint32_t *type) {
+	if (strcmp (name, "input") == 0) {
+		*type = LIVELY_NODE_INPUT;
+	} else if (strcmp (name, "output") == 0) {
+		*type = LIVELY_NODE_OUTPUT;
+	} else if (strcmp (name, "process") == 0) {
+		*type = LIVELY_NODE_PROCESS;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool
+convert_parse_uint (const char *text, uint32_t *value) {
+	char *end;
+	unsigned long parsed = strtoul (text, &end, 10);
+	if (*text == '\0' || *end != '\0' || parsed > UINT32_MAX) {
+		return false;
+	}
+	*value = (uint32_t) parsed;
+	return true;
+}
+
+static bool
+convert_parse_channel (const char *name, uint32_t *channel) {
+	for (uint32_t i = 0; i < sizeof channel_names / sizeof *channel_names; i++) {
+		if (strcmp (name, channel_names[i]) == 0) {
+			*channel = i;
+			return true;
+		}
+	}
+
+	uint32_t number;
+	if (!convert_parse_uint (name, &number) || number >= LIVELY_CHANNELS_MAX) {
+		return false;
+	}
+	*channel = LIVELY_CHANNEL (number);
+	return true;
+}
+
+static void
+convert_print_channel (FILE *output, uint32_t channel) {
+	if (channel < sizeof channel_names / sizeof *channel_names) {
+		fputs (channel_names[channel], output);
+	} else {
+		fprintf (output, "%u", channel - LIVELY_CHANNEL (0));
+	}
+}
+
+static bool
+convert_find_node (lively_hash_t *names, const char *name, uint32_t *index) {
+	lively_hash_entry_t *entry = lively_hash_first (names, lively_hash_string (name));
+	for (; entry; entry = lively_hash_next (entry)) {
+		convert_name_t *node = LIVELY_CONTAINER_OF (entry, convert_name_t, entry);
+		if (strcmp (node->name, name) == 0) {
+			*index = node->index;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+* Parses a <node>:<channel> reference, modifying the text in place.
+*/
+static bool
+convert_parse_endpoint (lively_hash_t *names, char *text, uint32_t *index, uint32_t *channel) {
+	char *colon = strrchr (text, ':');
+	if (!colon) {
+		return false;
+	}
+	*colon = '\0';
+	return convert_find_node (names, text, index)
+		&& convert_parse_channel (colon + 1, channel);
+}
+
+static int
+convert_text_to_binary (FILE *input, const char *output_path) {
+	lively_scene_file_writer_t writer;
+	lively_hash_t names;
+	char line[4096];
+	char expected[32];
+	unsigned int line_number = 0;
+	uint32_t nodes_count = 0;
+	bool header = false;
+	const char *error = NULL;
+
+	lively_hash_init (&names);
+	if (!lively_scene_file_writer_init (&writer)) {
+		fprintf (stderr, "Could not allocate memory\n");
+		return 1;
+	}
+
+	while (!error && fgets (line, sizeof line, input)) {
+		line_number++;
+
+		char *comment = strchr (line, '#');
+		if (comment) {
+			*comment = '\0';
+		}
+
+		char *save;
+		char *words[12];
+		unsigned int count = 0;
+		for (char *word = strtok_r (line, " \t\r\n", &save);
+				word && count < 12;
+				word = strtok_r (NULL, " \t\r\n", &save)) {
+			words[count++] = word;
+		}
+		if (count == 0) {
+			continue;
+		}
+
+		if (!header) {
+			uint32_t version;
+			if (count != 2 || strcmp (words[0], "lively-scene") != 0
+				|| !convert_parse_uint (words[1], &version)
+				|| version != LIVELY_SCENE_FILE_VERSION) {
+				snprintf (expected, sizeof expected, "expected 'lively-scene %u'",
+					LIVELY_SCENE_FILE_VERSION);
+				error = expected;
+			}
+			header = true;
+		} else if (strcmp (words[0], "name") == 0 && count == 2) {
+			if (!lively_scene_file_writer_set_name (&writer, words[1])) {
+				error = "out of memory";
+			}
+		} else if (strcmp (words[0], "node") == 0 && count >= 4) {
+			uint32_t type, index;
+			uint32_t port = 0, channels = 0, outputs = 0, latency = 0;
+			const char *inner = NULL;
+
+			if (!convert_parse_type (words[3], &type)) {
+				error = "unknown node type";
+				break;
+			}
+			for (unsigned int i = 4; i < count; i++) {
+				if (strncmp (words[i], "port=", 5) == 0) {
+					if (!convert_parse_uint (words[i] + 5, &port)) error = "bad port";
+				} else if (strncmp (words[i], "channels=", 9) == 0) {
+					if (!convert_parse_uint (words[i] + 9, &channels)
+						|| channels > LIVELY_CHANNELS_MAX) error = "bad channels";
+				} else if (strncmp (words[i], "outputs=", 8) == 0) {
+					if (!convert_parse_uint (words[i] + 8, &outputs)
+						|| outputs > LIVELY_CHANNELS_MAX) error = "bad outputs";
+				} else if (strncmp (words[i], "inner=", 6) == 0) {
+					inner = words[i] + 6;
+					if (!*inner) error = "bad inner";
+				} else if (strncmp (words[i], "latency=", 8) == 0) {
+					if (!convert_parse_uint (words[i] + 8, &latency)) error = "bad latency";
+				} else {
+					error = "unknown node attribute";
+				}
+			}
+			if (error) {
+				break;
+			}
+			if (convert_find_node (&names, words[1], &index)) {
+				error = "duplicate node name";
+				break;
+			}
+
+			size_t length = strlen (words[1]) + 1;
+			convert_name_t *name = malloc (sizeof *name + length);
+			if (!name || !lively_hash_insert (&names, &name->entry,
+					lively_hash_string (words[1]))
+				|| !lively_scene_file_writer_add_node (&writer, words[2], words[1],
+					type, port, channels, outputs, inner, latency)) {
+				free (name);
+				error = "out of memory";
+				break;
+			}
+			name->index = nodes_count++;
+			memcpy (name->name, words[1], length);
+		} else if (strcmp (words[0], "param") == 0 && count == 3) {
+			uint32_t index;
+			char *end;
+			float value = strtof (words[2], &end);
+
+			if (!convert_parse_uint (words[1], &index) || *end != '\0') {
+				error = "bad parameter";
+			} else if (!lively_scene_file_writer_add_param (&writer, index, value)) {
+				error = "parameter before any node";
+			}
+		} else if (strcmp (words[0], "plug") == 0 && count == 3) {
+			uint32_t source, source_ch, target, target_ch;
+
+			if (!convert_parse_endpoint (&names, words[1], &source, &source_ch)
+				|| !convert_parse_endpoint (&names, words[2], &target, &target_ch)) {
+				error = "bad plug endpoint";
+			} else if (!lively_scene_file_writer_add_plug (&writer,
+					source, source_ch, target, target_ch)) {
+				error = "out of memory";
+			}
+		} else {
+			error = "unknown statement";
+		}
+	}
+
+	int status = 0;
+	if (error) {
+		fprintf (stderr, "line %u: %s\n", line_number, error);
+		status = 1;
+	} else if (!header) {
+		fprintf (stderr, "empty scene\n");
+		status = 1;
+	} else if (!lively_scene_file_writer_save (&writer, output_path)) {
+		fprintf (stderr, "Could not write '%s'\n", output_path);
+		status = 1;
+	}
+
+	for (size_t i = 0; names.buckets && i <= names.mask; i++) {
+		lively_hash_entry_t *entry = names.buckets[i];
+		while (entry) {
+			lively_hash_entry_t *next = entry->next;
+			free (LIVELY_CONTAINER_OF (entry, convert_name_t, entry));
+			entry = next;
+		}
+	}
+	lively_hash_destroy (&names);
+	lively_scene_file_writer_destroy (&writer);
+
+	return status;
+}
+
+static int
+convert_binary_to_text (lively_scene_file_t *file, FILE *output) {
+	const lively_scene_file_header_t *header = file->header;
+
+	fprintf (output, "lively-scene %u\n", LIVELY_SCENE_FILE_VERSION);
+	if (*lively_scene_file_string (file, header->name)) {
+		fprintf (output, "name %s\n", lively_scene_file_string (file, header->name));
+	}
+
+	for (uint32_t i = 0; i < header->nodes_count; i++) {
+		const lively_scene_file_node_t *node = &file->nodes[i];
+
+		fprintf (output, "node %s %s %s",
+			lively_scene_file_string (file, node->name),
+			lively_scene_file_string (file, node->class_name),
+			convert_type_name (node->type));
+		if (node->port) {
+			fprintf (output, " port=%u", node->port);
+		}
+		if (node->channels) {
+			fprintf (output, " channels=%u", node->channels);
+		}
+		if (node->outputs) {
+			fprintf (output, " outputs=%u", node->outputs);
+		}
+		if (*lively_scene_file_string (file, node->inner)) {
+			fprintf (output, " inner=%s", lively_scene_file_string (file, node->inner));
+		}
+		if (node->latency) {
+			fprintf (output, " latency=%u", node->latency);
+		}
+		fputc ('\n', output);
+
+		for (uint32_t p = 0; p < node->params_count; p++) {
+			const lively_scene_file_param_t *param = &file->params[node->params_start + p];
+			// Nine significant digits always convert back to the same float.
+			fprintf (output, "param %u %.9g\n", param->index, param->value);
+		}
+	}
+
+	for (uint32_t i = 0; i < header->plugs_count; i++) {
+		const lively_scene_file_plug_t *plug = &file->plugs[i];
+		fprintf (output, "plug %s:",
+			lively_scene_file_string (file, file->nodes[plug->source].name));
+		convert_print_channel (output, plug->source_ch);
+		fprintf (output, " %s:",
+			lively_scene_file_string (file, file->nodes[plug->target].name));
+		convert_print_channel (output, plug->target_ch);
+		fputc ('\n', output);
+	}
+
+	return ferror (output) ? 1 : 0;
+}
+
+int
+main (int argc, char **argv) {
+	if (argc != 3) {
+		fprintf (stderr,
+			"Usage: %s <input> <output>\n"
+			"\n"
+			"Converts a text scene to a binary scene, or a binary scene to text,\n"
+			"depending on the form of the input.\n",
+			argv[0]);
+		return 2;
+	}
+
+	FILE *input = fopen (argv[1], "rb");
+	if (!input) {
+		fprintf (stderr, "Could not open '%s'\n", argv[1]);
+		return 1;
+	}
+
+	char magic[8];
+	bool binary = fread (magic, 1, sizeof magic, input) == sizeof magic
+		&& memcmp (magic, LIVELY_SCENE_FILE_MAGIC, sizeof magic) == 0;
+
+	int status;
+	if (binary) {
+		fclose (input);
+
+		lively_scene_file_t file;
+		if (!lively_scene_file_open (&file, argv[1])) {
+			fprintf (stderr, "'%s': %s\n", argv[1], file.error);
+			return 1;
+		}
+
+		FILE *output = fopen (argv[2], "w");
+		if (!output) {
+			fprintf (stderr, "Could not write '%s'\n", argv[2]);
+			lively_scene_file_close (&file);
+			return 1;
+		}
+		status = convert_binary_to_text (&file, output);
+		status = fclose (output) == 0 ? status : 1;
+		lively_scene_file_close (&file);
+	} else {
+		rewind (input);
+		status = convert_text_to_binary (input, argv[2]);
+		fclose (input);
+	}
+
+	return status;
+}